@@ -0,0 +1,393 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Replays a workload file, as written by WorkloadRecorder (see
+ * dbabstract/workload.h), against a database and reports the latency
+ * and throughput it got.
+ *
+ * Every recorded connection is replayed on a Connection of its own,
+ * in its recorded order. The connections are spread over --threads
+ * threads (default: one per recorded connection).
+ *
+ * With --mode open (the default) every call is due at its recorded
+ * time, divided by --speed. A thread still runs its calls one at a
+ * time, so a call starts late when the one before it on the thread
+ * overran; its latency is counted from when it was due, and how late
+ * it started is reported as lag. A database falling behind thus shows
+ * up as latency, as it would for the users of the recorded
+ * application, instead of quietly slowing the replay down. With
+ * --mode closed the calls of a thread run back to back, and the
+ * latency is their own.
+ *
+ * The driver is either built in (--driver) or loaded from a shared
+ * library through Connection::factory (--library):
+ *
+ *   dba_loadgen --workload app.workload --database replay.db
+ *   dba_loadgen --workload app.workload --speed 4 --threads 8 \
+ *       --library /usr/local/lib/libpq_dba.so --database "host=127.0.0.1 dbname=test"
+ *
+ * The results go to stdout as JSON.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/sqlscan.h"
+#include "dbabstract/statement.h"
+#include "dbabstract/workload.h"
+
+using namespace dbabstract;
+
+extern "C" {
+#ifdef ENABLE_SQLITE3
+extern Connection * create_sqlite3_connection(void);
+#endif
+#ifdef ENABLE_PQ
+extern Connection * create_pq_connection(void);
+#endif
+#ifdef ENABLE_MYSQL
+extern Connection * create_mysql_connection(void);
+#endif
+#ifdef ENABLE_ODBC
+extern Connection * create_odbc_connection(void);
+#endif
+}
+
+enum KIND { READ, WRITE, TRANSACTION, KINDS };
+static const char *kindNames[KINDS] = { "read", "write", "transaction" };
+
+struct Options
+{
+    Options()
+        : driver("sqlite3")
+        , database("dba_loadgen.db")
+        , host(NULL)
+        , port(0)
+        , user(NULL)
+        , pass(NULL)
+        , workload(NULL)
+        , threads(0)
+        , open(true)
+        , speed(1.0) {}
+
+    std::string driver;
+    std::string library;
+    const char *database;
+    const char *host;
+    int port;
+    const char *user;
+    const char *pass;
+    const char *workload;
+    unsigned int threads;
+    bool open;
+    double speed;
+};
+
+static Connection *(*createConnection)(void) = NULL;
+
+static bool
+selectDriver(const std::string &name)
+{
+#ifdef ENABLE_SQLITE3
+    if (name == "sqlite3") createConnection = create_sqlite3_connection;
+#endif
+#ifdef ENABLE_PQ
+    if (name == "pq") createConnection = create_pq_connection;
+#endif
+#ifdef ENABLE_MYSQL
+    if (name == "mysql") createConnection = create_mysql_connection;
+#endif
+#ifdef ENABLE_ODBC
+    if (name == "odbc") createConnection = create_odbc_connection;
+#endif
+    return (createConnection != NULL);
+}
+
+static Connection *
+connect(const Options &opts)
+{
+    Connection *conn = NULL;
+    if (!opts.library.empty()) {
+        try {
+            conn = Connection::factory(opts.library.c_str());
+        } catch (std::exception *ex) {
+            delete ex;
+        }
+    } else {
+        conn = createConnection();
+    }
+    if (!conn) {
+        fprintf(stderr, "unable to create a connection\n");
+        return (NULL);
+    }
+    if (!conn->open(opts.database, opts.host, opts.port, opts.user, opts.pass)) {
+        fprintf(stderr, "unable to connect: %s\n", conn->errormsg());
+        conn->release();
+        return (NULL);
+    }
+    return (conn);
+}
+
+/**
+ * The recorded connections a thread replays, and their events in
+ * the order they are due.
+ */
+struct Lane
+{
+    Lane() : errors(0) {}
+
+    std::map<unsigned long, Connection *> conns;
+    std::vector<const WorkloadEvent *> events;
+    std::vector<unsigned long> ns[KINDS];
+    std::vector<unsigned long> lag;
+    unsigned long errors;
+};
+
+/**
+ * Replays one event, returning false if the database failed it.
+ */
+static bool
+replay(Connection *conn, const WorkloadEvent &ev, enum KIND &kind)
+{
+    switch (ev.kind) {
+    case WorkloadEvent::BEGIN:
+        kind = TRANSACTION;
+        return (conn->beginTrans());
+    case WorkloadEvent::COMMIT:
+        kind = TRANSACTION;
+        return (conn->commitTrans());
+    case WorkloadEvent::ROLLBACK:
+        kind = TRANSACTION;
+        return (conn->rollbackTrans());
+    default:
+        break;
+    }
+
+    std::string sql;
+    if (ev.kind == WorkloadEvent::PREPARED) {
+        Statement stmt(ev.sql);
+        if (!ev.bind(stmt) || !stmt.toSql(*conn, sql)) return (false);
+    } else {
+        sql = ev.sql;
+    }
+
+    if (!sqlscan::isReadOnly(sql)) {
+        kind = WRITE;
+        return (conn->execute(sql.c_str()));
+    }
+    kind = READ;
+    ResultSet *rs = conn->executeQuery(sql.c_str());
+    if (!rs) return (false);
+    unsigned int columns = rs->columnCount();
+    while (rs->next()) {
+        for (unsigned int i=0; i<columns; i++) rs->getString(i);
+    }
+    rs->close();
+    return (true);
+}
+
+static void
+worker(const Options &opts, std::chrono::steady_clock::time_point start, Lane &lane)
+{
+    for (size_t i=0; i<lane.events.size(); i++) {
+        const WorkloadEvent &ev = *lane.events[i];
+        std::chrono::steady_clock::time_point due = start +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>(ev.offsetUs / opts.speed));
+        if (opts.open) std::this_thread::sleep_until(due);
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        enum KIND kind = WRITE;
+        if (!replay(lane.conns[ev.connection], ev, kind)) lane.errors++;
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        if (opts.open) {
+            lane.lag.push_back((unsigned long) std::chrono::duration_cast<std::chrono::nanoseconds>(begin - due).count());
+            begin = due;
+        }
+        lane.ns[kind].push_back((unsigned long) std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    }
+}
+
+static double
+percentile(const std::vector<unsigned long> &sorted, double p)
+{
+    if (sorted.empty()) return (0);
+    size_t idx = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return (sorted[idx] / 1000.0);
+}
+
+static void
+printLatencies(std::vector<unsigned long> &ns, double elapsed)
+{
+    std::sort(ns.begin(), ns.end());
+    printf("\"ops\": %lu, \"ops_per_sec\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f",
+           (unsigned long) ns.size(), ns.size() / elapsed, percentile(ns, 0.50), percentile(ns, 0.99),
+           percentile(ns, 0.999), percentile(ns, 1.0));
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s --workload FILE [options]\n"
+            "  --workload FILE    workload file to replay\n"
+            "  --driver NAME      built in driver: sqlite3 (default), pq, mysql or odbc\n"
+            "  --library PATH     driver loaded with Connection::factory instead\n"
+            "  --database DB      database, DSN or connection string\n"
+            "  --host HOST        server host\n"
+            "  --port PORT        server port\n"
+            "  --user USER        user name\n"
+            "  --pass PASS        password\n"
+            "  --threads N        replay threads (default: one per recorded connection)\n"
+            "  --mode open|closed time calls from their recorded time, or run them back to back\n"
+            "  --speed X          replay X times faster than recorded (default 1)\n", name);
+}
+
+int
+main(int argc, const char * const argv[])
+{
+    Options opts;
+
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            usage(argv[0]);
+            return (arg == "--help" || arg == "-h" ? 0 : 1);
+        }
+        const char *val = argv[++i];
+        if (arg == "--workload") opts.workload = val;
+        else if (arg == "--driver") opts.driver = val;
+        else if (arg == "--library") opts.library = val;
+        else if (arg == "--database") opts.database = val;
+        else if (arg == "--host") opts.host = val;
+        else if (arg == "--port") opts.port = atoi(val);
+        else if (arg == "--user") opts.user = val;
+        else if (arg == "--pass") opts.pass = val;
+        else if (arg == "--threads") opts.threads = (unsigned int) atoi(val);
+        else if (arg == "--mode" && strcmp(val, "open") == 0) opts.open = true;
+        else if (arg == "--mode" && strcmp(val, "closed") == 0) opts.open = false;
+        else if (arg == "--speed") opts.speed = atof(val);
+        else {
+            usage(argv[0]);
+            return (1);
+        }
+    }
+
+    if (!opts.workload || opts.speed <= 0) {
+        usage(argv[0]);
+        return (1);
+    }
+    if (opts.library.empty() && !selectDriver(opts.driver)) {
+        fprintf(stderr, "driver %s is not built in\n", opts.driver.c_str());
+        return (1);
+    }
+
+    std::vector<WorkloadEvent> events;
+    unsigned long bad = 0;
+    if (!loadWorkload(opts.workload, events, &bad)) {
+        if (bad) fprintf(stderr, "%s:%lu: malformed event\n", opts.workload, bad);
+        else fprintf(stderr, "unable to read %s\n", opts.workload);
+        return (1);
+    }
+
+    // the recorded connections, in the order they first appear
+    std::vector<unsigned long> recorded;
+    std::map<unsigned long, size_t> laneOf;
+    for (size_t i=0; i<events.size(); i++) {
+        if (laneOf.find(events[i].connection) == laneOf.end()) {
+            laneOf[events[i].connection] = recorded.size();
+            recorded.push_back(events[i].connection);
+        }
+    }
+    unsigned int threads = (opts.threads ? opts.threads : (unsigned int) std::max((size_t) 1, recorded.size()));
+    std::vector<Lane> lanes(threads);
+    for (size_t i=0; i<recorded.size(); i++) {
+        laneOf[recorded[i]] %= threads;
+    }
+    for (size_t i=0; i<events.size(); i++) {
+        lanes[laneOf[events[i].connection]].events.push_back(&events[i]);
+    }
+
+    // connect up front, so the replay does not time it
+    bool ok = true;
+    for (size_t i=0; ok && i<recorded.size(); i++) {
+        Connection *conn = connect(opts);
+        if (!conn) ok = false;
+        else lanes[laneOf[recorded[i]]].conns[recorded[i]] = conn;
+    }
+
+    if (ok) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (size_t i=0; i<lanes.size(); i++) {
+            workers.push_back(std::thread(worker, std::cref(opts), start, std::ref(lanes[i])));
+        }
+        for (size_t i=0; i<workers.size(); i++) workers[i].join();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double recordedSeconds = (events.empty() ? 0 : events.back().offsetUs / 1e6);
+
+        std::vector<unsigned long> all;
+        std::vector<unsigned long> byKind[KINDS];
+        std::vector<unsigned long> lag;
+        unsigned long errors = 0;
+        for (size_t i=0; i<lanes.size(); i++) {
+            for (int k=0; k<KINDS; k++) {
+                byKind[k].insert(byKind[k].end(), lanes[i].ns[k].begin(), lanes[i].ns[k].end());
+            }
+            lag.insert(lag.end(), lanes[i].lag.begin(), lanes[i].lag.end());
+            errors += lanes[i].errors;
+        }
+        for (int k=0; k<KINDS; k++) {
+            all.insert(all.end(), byKind[k].begin(), byKind[k].end());
+        }
+
+        printf("{\n  \"workload\": \"%s\", \"mode\": \"%s\", \"speed\": %.2f, \"threads\": %u, \"connections\": %lu,\n",
+               opts.workload, opts.open ? "open" : "closed", opts.speed, threads, (unsigned long) recorded.size());
+        printf("  \"recorded_seconds\": %.3f, \"seconds\": %.3f, \"errors\": %lu,\n", recordedSeconds, elapsed, errors);
+        printf("  \"all\": { ");
+        printLatencies(all, elapsed);
+        printf(" },\n");
+        for (int k=0; k<KINDS; k++) {
+            printf("  \"%s\": { ", kindNames[k]);
+            printLatencies(byKind[k], elapsed);
+            printf(" },\n");
+        }
+        std::sort(lag.begin(), lag.end());
+        printf("  \"start_lag\": { \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f }\n}\n",
+               percentile(lag, 0.50), percentile(lag, 0.99), percentile(lag, 1.0));
+    }
+
+    for (size_t i=0; i<lanes.size(); i++) {
+        for (std::map<unsigned long, Connection *>::iterator it = lanes[i].conns.begin(); it != lanes[i].conns.end(); ++it) {
+            it->second->release();
+        }
+    }
+    return (ok ? 0 : 1);
+}
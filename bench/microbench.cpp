@@ -0,0 +1,343 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Microbenchmarks of the per-call cost of the abstraction layer.
+ *
+ * Every operation runs against an in-memory Sqlite3 database and
+ * against a synthetic driver which keeps its rows in memory, so the
+ * cost of the layer itself can be told apart from the cost of the
+ * database. For each operation the time, the number of C++ heap
+ * allocations (operator new) and, where the kernel allows it, the
+ * number of retired instructions are reported per call.
+ *
+ * Usage: dba_microbench [name-filter]
+ */
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "dbabstract/db.h"
+#include "dbabstract/fingerprint.h"
+#include "dbabstract/materialized.h"
+
+using namespace dbabstract;
+
+extern "C" {
+extern Connection * create_sqlite3_connection(void);
+}
+
+/*
+ * Allocation counting. Driver objects are created through their own
+ * operator new, which allocates with new[]; memory the database
+ * client libraries take with malloc() is not seen.
+ */
+static std::atomic<unsigned long> allocations(0);
+
+// the replacements pair new with free(), which GCC cannot see through
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t bytes)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(bytes ? bytes : 1);
+    if (!p) throw std::bad_alloc();
+    return (p);
+}
+
+void *operator new[](size_t bytes)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(bytes ? bytes : 1);
+    if (!p) throw std::bad_alloc();
+    return (p);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+/*
+ * Counts instructions retired by this thread in user space, when
+ * perf events are available.
+ */
+class InstructionCounter
+{
+public:
+    InstructionCounter() : fd_(-1)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~InstructionCounter()
+    {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool available(void) const { return (fd_ >= 0); }
+
+    void start(void)
+    {
+#ifdef __linux__
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    unsigned long long stop(void)
+    {
+        unsigned long long count = 0;
+#ifdef __linux__
+        if (fd_ < 0) return (0);
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd_, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+        return (count);
+    }
+
+private:
+    int fd_;
+};
+
+/*
+ * A driver answering every query from rows held in memory, in the
+ * same text form the real drivers return.
+ */
+class SyntheticConnection : public Connection
+{
+public:
+    SyntheticConnection(const MaterializedResult &rows) : rows_(rows) {}
+
+    std::vector<std::string> tables(void) const { return (std::vector<std::string>(1, "bench")); }
+    void *handle(void) { return (NULL); }
+    bool open(const char *, const char *, const int, const char *, const char *) { return (true); }
+    bool close(void) { return (true); }
+    bool isConnected(void) { return (true); }
+    bool execute(const char *) { return (true); }
+    ResultSet *executeQuery(const char *) { return (rows_.cursor()); }
+
+    char *escape(const char *str)
+    {
+        size_t len = strlen(str);
+        char *ret = new char[len * 2 + 3];
+        char *p = ret;
+        *p++ = '\'';
+        for (; *str; str++) {
+            if (*str == '\'') *p++ = '\'';
+            *p++ = *str;
+        }
+        *p++ = '\'';
+        *p = '\0';
+        return (ret);
+    }
+
+    const char *unixtimeToSql(const time_t val)
+    {
+        char *buf = new char[22];
+        struct tm tmp;
+        buf[0] = '\'';
+        strftime(buf+1, 20, "%Y-%m-%d %H:%M:%S", gmtime_r(&val, &tmp));
+        buf[20] = '\'';
+        buf[21] = 0;
+        return (buf);
+    }
+
+    unsigned long insertId(void) { return (0); }
+    bool beginTrans(void) { return (true); }
+    bool commitTrans(void) { return (true); }
+    bool rollbackTrans(void) { return (true); }
+    bool setTransactionMode(const enum TRANS_MODE) { return (true); }
+    unsigned int errorno(void) const { return (0); }
+    const char *errormsg(void) const { return (""); }
+    const char *version(void) const { return ("Synthetic Driver v0.1"); }
+
+private:
+    MaterializedResult rows_;
+};
+
+struct Result
+{
+    double ns;
+    double allocs;
+    double instructions;
+};
+
+/*
+ * Runs op in a loop long enough to be timed, then measures it. op
+ * performs `batch` operations per call, so that loops over rows can
+ * be reported per row.
+ */
+static Result
+measure(const std::function<void ()> &op, unsigned long batch, InstructionCounter &counter)
+{
+    unsigned long iterations = 1;
+    for (;;) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned long i=0; i<iterations; i++) op();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed > 0.05 || iterations >= (1UL << 26)) break;
+        iterations *= 2;
+    }
+
+    Result r;
+    unsigned long before = allocations.load();
+    counter.start();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long i=0; i<iterations; i++) op();
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    unsigned long long instructions = counter.stop();
+    unsigned long allocs = allocations.load() - before;
+
+    double ops = (double) iterations * batch;
+    r.ns = elapsed / ops;
+    r.allocs = allocs / ops;
+    r.instructions = instructions / ops;
+    return (r);
+}
+
+static const int ROWS = 1000;
+
+static void
+fill(Connection *conn)
+{
+    conn->execute("CREATE TABLE bench (id INTEGER PRIMARY KEY, text VARCHAR(64), num INTEGER, fl FLOAT, flag INTEGER, createdOn TIMESTAMP)");
+    conn->beginTrans();
+    for (int i=1; i<=ROWS; i++) {
+        std::ostringstream q;
+        q << "INSERT INTO bench VALUES (" << i << ", 'row number " << i << "', " << i * 7 << ", " << i / 3.0 << ", " << (i & 1)
+          << ", '2014-10-11 11:53:00')";
+        conn->execute(q.str().c_str());
+    }
+    conn->commitTrans();
+}
+
+static void
+run(const char *driver, Connection *conn, const char *filter, InstructionCounter &counter)
+{
+    struct Bench
+    {
+        const char *name;
+        unsigned long batch;
+        std::function<void ()> op;
+    };
+
+    const char *point = "SELECT id, text, num, fl, flag, createdOn FROM bench WHERE id = 500";
+    const char *scan = "SELECT id, text, num, fl, flag, createdOn FROM bench";
+
+    // a ResultSet positioned on a row, for the getters
+    ResultSet *row = conn->executeQuery(point);
+    row->next();
+    volatile long sink = 0;
+    time_t now = time(NULL);
+
+    std::vector<Bench> benches = {
+        { "executeQuery+close", 1, [&]() { conn->executeQuery(point)->close(); } },
+        { "next", ROWS, [&]() {
+            ResultSet *rs = conn->executeQuery(scan);
+            while (rs->next()) {}
+            rs->close();
+        } },
+        { "getString", 1, [&]() { sink += (long) row->getString(1); } },
+        { "getInteger", 1, [&]() { sink += row->getInteger(2); } },
+        { "getBool", 1, [&]() { sink += row->getBool(4); } },
+        { "getUnixTime", 1, [&]() { sink += (long) row->getUnixTime(5); } },
+        { "getDouble", 1, [&]() { sink += (long) row->getDouble(3); } },
+        { "getFloat", 1, [&]() { sink += (long) row->getFloat(3); } },
+        { "getLong", 1, [&]() { sink += row->getLong(2); } },
+        { "getShort", 1, [&]() { sink += row->getShort(2); } },
+        { "findColumn", 1, [&]() { sink += row->findColumn("createdOn"); } },
+        { "escape", 1, [&]() { delete [] conn->escape("it's a test string"); } },
+        { "qstr", 1, [&]() {
+            std::ostringstream q;
+            q << qstr(*conn, "it's a test string");
+            sink += q.str().size();
+        } },
+        { "unixtimeToSql", 1, [&]() { delete [] conn->unixtimeToSql(now); } },
+        { "fingerprint", 1, [&]() { sink += (long) sqlscan::fingerprint(point); } },
+    };
+
+    for (size_t i=0; i<benches.size(); i++) {
+        if (filter && !strstr(benches[i].name, filter)) continue;
+        Result r = measure(benches[i].op, benches[i].batch, counter);
+        if (counter.available()) {
+            printf("%-10s %-20s %12.1f %12.2f %14.0f\n", driver, benches[i].name, r.ns, r.allocs, r.instructions);
+        } else {
+            printf("%-10s %-20s %12.1f %12.2f %14s\n", driver, benches[i].name, r.ns, r.allocs, "n/a");
+        }
+        fflush(stdout);
+    }
+    row->close();
+}
+
+int
+main(int argc, const char * const argv[])
+{
+    const char *filter = (argc > 1 ? argv[1] : NULL);
+    InstructionCounter counter;
+
+    printf("%-10s %-20s %12s %12s %14s\n", "driver", "operation", "ns/op", "allocs/op", "insns/op");
+
+    Connection *sqlite = create_sqlite3_connection();
+    if (!sqlite->open(":memory:", NULL, 0, NULL, NULL)) {
+        fprintf(stderr, "unable to open an in-memory Sqlite3 database\n");
+        return (1);
+    }
+    fill(sqlite);
+    run("sqlite3", sqlite, filter, counter);
+
+    ResultSet *rs = sqlite->executeQuery("SELECT id, text, num, fl, flag, createdOn FROM bench");
+    MaterializedResult rows = MaterializedResult::fromResultSet(rs);
+    rs->close();
+    sqlite->release();
+
+    SyntheticConnection *synthetic = new SyntheticConnection(rows);
+    run("synthetic", synthetic, filter, counter);
+    synthetic->release();
+
+    return (0);
+}
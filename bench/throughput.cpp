@@ -0,0 +1,424 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Throughput of a mix of point reads, range scans and small writes
+ * as the number of threads grows.
+ *
+ * For every thread count from 1 up to --threads (doubling), each
+ * thread runs the mix for --seconds, either on a Connection of its
+ * own (--mode conn) or taking one from a shared ConnectionPool for
+ * every operation (--mode pool). The results go to stdout as JSON:
+ * operations per second and the p50/p99/p999 latency, overall and
+ * per kind of operation, for each thread count.
+ *
+ * Sqlite3 runs out of the box on a file in the current directory.
+ * The other drivers need a server, e.g.:
+ *
+ *   dba_throughput --driver pq --database "host=127.0.0.1 dbname=postgres"
+ *   dba_throughput --driver mysql --database test --host 127.0.0.1 --port 3306 --user root
+ *   dba_throughput --driver odbc --database "DSN=test_db" --user root
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/pool.h"
+
+using namespace dbabstract;
+
+extern "C" {
+#ifdef ENABLE_SQLITE3
+extern Connection * create_sqlite3_connection(void);
+#endif
+#ifdef ENABLE_PQ
+extern Connection * create_pq_connection(void);
+#endif
+#ifdef ENABLE_MYSQL
+extern Connection * create_mysql_connection(void);
+#endif
+#ifdef ENABLE_ODBC
+extern Connection * create_odbc_connection(void);
+#endif
+}
+
+enum KIND { POINT, SCAN, WRITE, KINDS };
+static const char *kindNames[KINDS] = { "point", "scan", "write" };
+
+struct Options
+{
+    Options()
+        : driver("sqlite3")
+        , database("dba_throughput.db")
+        , host(NULL)
+        , port(0)
+        , user(NULL)
+        , pass(NULL)
+        , threads(0)
+        , pooled(false)
+        , poolSize(0)
+        , seconds(2.0)
+        , rows(10000)
+        , scanLength(100)
+    {
+        weights[POINT] = 80;
+        weights[SCAN] = 10;
+        weights[WRITE] = 10;
+    }
+
+    std::string driver;
+    const char *database;
+    const char *host;
+    int port;
+    const char *user;
+    const char *pass;
+    unsigned int threads;
+    bool pooled;
+    unsigned int poolSize;
+    double seconds;
+    int rows;
+    int scanLength;
+    unsigned int weights[KINDS];
+};
+
+static Connection *(*createConnection)(void) = NULL;
+
+static bool
+selectDriver(const std::string &name)
+{
+#ifdef ENABLE_SQLITE3
+    if (name == "sqlite3") createConnection = create_sqlite3_connection;
+#endif
+#ifdef ENABLE_PQ
+    if (name == "pq") createConnection = create_pq_connection;
+#endif
+#ifdef ENABLE_MYSQL
+    if (name == "mysql") createConnection = create_mysql_connection;
+#endif
+#ifdef ENABLE_ODBC
+    if (name == "odbc") createConnection = create_odbc_connection;
+#endif
+    return (createConnection != NULL);
+}
+
+static Connection *
+connect(const Options &opts)
+{
+    Connection *conn = createConnection();
+    if (!conn->open(opts.database, opts.host, opts.port, opts.user, opts.pass)) {
+        fprintf(stderr, "unable to connect: %s\n", conn->errormsg());
+        conn->release();
+        return (NULL);
+    }
+    if (opts.driver == "sqlite3") {
+        // let readers run beside the writer
+        ResultSet *rs = conn->executeQuery("PRAGMA journal_mode=WAL");
+        if (rs) rs->close();
+    }
+    return (conn);
+}
+
+static bool
+prepare(const Options &opts)
+{
+    Connection *conn = connect(opts);
+    if (!conn) return (false);
+
+    conn->execute("DROP TABLE dba_bench");
+    if (!conn->execute("CREATE TABLE dba_bench (id INTEGER PRIMARY KEY, name VARCHAR(64), num INTEGER)")) {
+        fprintf(stderr, "unable to create dba_bench: %s\n", conn->errormsg());
+        conn->release();
+        return (false);
+    }
+
+    bool ok = conn->beginTrans();
+    for (int i=1; ok && i<=opts.rows; i++) {
+        std::ostringstream q;
+        q << "INSERT INTO dba_bench (id, name, num) VALUES (" << i << ", 'row " << i << "', " << i << ")";
+        ok = conn->execute(q.str().c_str());
+    }
+    if (ok) ok = conn->commitTrans();
+    if (!ok) fprintf(stderr, "unable to fill dba_bench: %s\n", conn->errormsg());
+    conn->release();
+    return (ok);
+}
+
+/**
+ * Runs one operation, returning false if the database failed it.
+ */
+static bool
+runOne(Connection *conn, enum KIND kind, int id, const Options &opts)
+{
+    std::ostringstream q;
+    switch (kind) {
+    case POINT:
+        q << "SELECT id, name, num FROM dba_bench WHERE id = " << id;
+        break;
+    case SCAN:
+        q << "SELECT id, name, num FROM dba_bench WHERE id BETWEEN " << id << " AND " << id + opts.scanLength - 1;
+        break;
+    default:
+        q << "UPDATE dba_bench SET num = num + 1 WHERE id = " << id;
+        return (conn->execute(q.str().c_str()));
+    }
+
+    ResultSet *rs = conn->executeQuery(q.str().c_str());
+    if (!rs) return (false);
+    long sum = 0;
+    while (rs->next()) {
+        sum += rs->getLong(2);
+        sum += strlen(rs->getString(1));
+    }
+    rs->close();
+    return (sum >= 0);
+}
+
+struct Samples
+{
+    Samples() : errors(0) {}
+
+    std::vector<unsigned long> ns[KINDS];
+    unsigned long errors;
+};
+
+static void
+worker(const Options &opts, Connection *own, ConnectionPool *pool, unsigned int seed,
+       const std::atomic<bool> &start, const std::atomic<bool> &stop, Samples &out)
+{
+    std::mt19937 rng(seed);
+    unsigned int total = opts.weights[POINT] + opts.weights[SCAN] + opts.weights[WRITE];
+    std::uniform_int_distribution<unsigned int> pickKind(0, total - 1);
+    std::uniform_int_distribution<int> pickId(1, std::max(1, opts.rows - opts.scanLength + 1));
+
+    while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        unsigned int r = pickKind(rng);
+        enum KIND kind = (r < opts.weights[POINT] ? POINT : r < opts.weights[POINT] + opts.weights[SCAN] ? SCAN : WRITE);
+        int id = pickId(rng);
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        Connection *conn = (pool ? pool->acquire() : own);
+        bool ok = (conn != NULL && runOne(conn, kind, id, opts));
+        if (pool && conn) pool->release(conn);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        if (!ok) out.errors++;
+        out.ns[kind].push_back((unsigned long) std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    }
+}
+
+static double
+percentile(const std::vector<unsigned long> &sorted, double p)
+{
+    if (sorted.empty()) return (0);
+    size_t idx = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return (sorted[idx] / 1000.0);
+}
+
+static void
+printLatencies(std::vector<unsigned long> &ns, double elapsed)
+{
+    std::sort(ns.begin(), ns.end());
+    printf("\"ops\": %lu, \"ops_per_sec\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f",
+           (unsigned long) ns.size(), ns.size() / elapsed,
+           percentile(ns, 0.50), percentile(ns, 0.99), percentile(ns, 0.999));
+}
+
+/**
+ * Measures the mix with the given number of threads and prints one
+ * JSON object.
+ */
+static bool
+runThreads(const Options &opts, unsigned int threads, bool first)
+{
+    std::vector<Connection *> conns;
+    ConnectionPool *pool = NULL;
+    unsigned int poolSize = (opts.pooled ? (opts.poolSize ? opts.poolSize : threads) : 0);
+
+    if (opts.pooled) {
+        pool = new ConnectionPool([&opts]() { return (connect(opts)); }, poolSize);
+    } else {
+        for (unsigned int i=0; i<threads; i++) {
+            Connection *conn = connect(opts);
+            if (!conn) {
+                for (size_t j=0; j<conns.size(); j++) conns[j]->release();
+                return (false);
+            }
+            conns.push_back(conn);
+        }
+    }
+
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::vector<Samples> samples(threads);
+    std::vector<std::thread> workers;
+    for (unsigned int i=0; i<threads; i++) {
+        workers.push_back(std::thread(worker, std::cref(opts), pool ? NULL : conns[i], pool,
+                                      1234 + i, std::cref(start), std::cref(stop), std::ref(samples[i])));
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.seconds));
+    stop.store(true);
+    for (size_t i=0; i<workers.size(); i++) workers[i].join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (size_t i=0; i<conns.size(); i++) conns[i]->release();
+    delete pool;
+
+    std::vector<unsigned long> all;
+    std::vector<unsigned long> byKind[KINDS];
+    unsigned long errors = 0;
+    for (size_t i=0; i<samples.size(); i++) {
+        for (int k=0; k<KINDS; k++) {
+            byKind[k].insert(byKind[k].end(), samples[i].ns[k].begin(), samples[i].ns[k].end());
+        }
+        errors += samples[i].errors;
+    }
+    for (int k=0; k<KINDS; k++) {
+        all.insert(all.end(), byKind[k].begin(), byKind[k].end());
+    }
+
+    printf("%s    { \"threads\": %u, \"pool_size\": %u, \"seconds\": %.3f, \"errors\": %lu, ",
+           first ? "" : ",\n", threads, poolSize, elapsed, errors);
+    printLatencies(all, elapsed);
+    for (int k=0; k<KINDS; k++) {
+        printf(", \"%s\": { ", kindNames[k]);
+        printLatencies(byKind[k], elapsed);
+        printf(" }");
+    }
+    printf(" }");
+    fflush(stdout);
+    return (true);
+}
+
+static void
+removeSqlite(const std::string &db)
+{
+    unlink(db.c_str());
+    unlink((db + "-wal").c_str());
+    unlink((db + "-shm").c_str());
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --driver NAME      sqlite3 (default), pq, mysql or odbc\n"
+            "  --database DB      database, DSN or connection string\n"
+            "  --host HOST        server host\n"
+            "  --port PORT        server port\n"
+            "  --user USER        user name\n"
+            "  --pass PASS        password\n"
+            "  --threads N        largest thread count (default: hardware threads)\n"
+            "  --mode conn|pool   a Connection per thread, or a shared pool\n"
+            "  --pool-size N      Connection objects in the pool (default: threads)\n"
+            "  --mix P:S:W        weights of point reads, scans and writes (default 80:10:10)\n"
+            "  --seconds S        run time per thread count (default 2)\n"
+            "  --rows N           rows in the table (default 10000)\n"
+            "  --scan N           rows per range scan (default 100)\n", name);
+}
+
+int
+main(int argc, const char * const argv[])
+{
+    Options opts;
+    bool databaseGiven = false;
+
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            usage(argv[0]);
+            return (arg == "--help" || arg == "-h" ? 0 : 1);
+        }
+        const char *val = argv[++i];
+        if (arg == "--driver") opts.driver = val;
+        else if (arg == "--database") { opts.database = val; databaseGiven = true; }
+        else if (arg == "--host") opts.host = val;
+        else if (arg == "--port") opts.port = atoi(val);
+        else if (arg == "--user") opts.user = val;
+        else if (arg == "--pass") opts.pass = val;
+        else if (arg == "--threads") opts.threads = (unsigned int) atoi(val);
+        else if (arg == "--mode" && strcmp(val, "pool") == 0) opts.pooled = true;
+        else if (arg == "--mode" && strcmp(val, "conn") == 0) opts.pooled = false;
+        else if (arg == "--pool-size") opts.poolSize = (unsigned int) atoi(val);
+        else if (arg == "--seconds") opts.seconds = atof(val);
+        else if (arg == "--rows") opts.rows = atoi(val);
+        else if (arg == "--scan") opts.scanLength = atoi(val);
+        else if (arg == "--mix" && sscanf(val, "%u:%u:%u", &opts.weights[POINT], &opts.weights[SCAN], &opts.weights[WRITE]) == 3) {}
+        else {
+            usage(argv[0]);
+            return (1);
+        }
+    }
+
+    if (!selectDriver(opts.driver)) {
+        fprintf(stderr, "driver %s is not built in\n", opts.driver.c_str());
+        return (1);
+    }
+    if (opts.driver != "sqlite3" && !databaseGiven) {
+        fprintf(stderr, "--database is needed for driver %s\n", opts.driver.c_str());
+        return (1);
+    }
+    if (opts.weights[POINT] + opts.weights[SCAN] + opts.weights[WRITE] == 0 || opts.rows < 1 || opts.scanLength < 1) {
+        usage(argv[0]);
+        return (1);
+    }
+    if (opts.threads == 0) {
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // only the scratch file is ours to delete, never a --database
+    bool scratch = (opts.driver == "sqlite3" && !databaseGiven);
+    if (scratch) removeSqlite(opts.database);
+    if (!prepare(opts)) return (1);
+
+    printf("{\n  \"driver\": \"%s\", \"mode\": \"%s\",\n", opts.driver.c_str(), opts.pooled ? "pool" : "conn");
+    printf("  \"mix\": { \"point\": %u, \"scan\": %u, \"write\": %u }, \"rows\": %d, \"scan_length\": %d,\n",
+           opts.weights[POINT], opts.weights[SCAN], opts.weights[WRITE], opts.rows, opts.scanLength);
+    printf("  \"results\": [\n");
+
+    bool first = true;
+    for (unsigned int n=1; ; n = std::min(n * 2, opts.threads)) {
+        if (!runThreads(opts, n, first)) return (1);
+        first = false;
+        if (n == opts.threads) break;
+    }
+    printf("\n  ]\n}\n");
+
+    if (scratch) removeSqlite(opts.database);
+
+    return (0);
+}
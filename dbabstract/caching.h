@@ -0,0 +1,695 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _CACHING_H
+#define _CACHING_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/materialized.h"
+#include "dbabstract/sqlscan.h"
+#include "dbabstract/statement.h"
+
+namespace dbabstract
+{
+    /**
+     * Results of read-only statements, kept in memory for a while and
+     * shared by any number of CachingConnections on any threads.
+     *
+     * Entries are spread over shards by the hash of their key, each
+     * shard with a lock, a least recently used list and an equal part
+     * of the memory budget. Every entry lists the tables its
+     * statement reads, and is dropped when one of them is
+     * invalidated or its time to live is over.
+     *
+     * A result read while a table it uses was being invalidated may
+     * be older than the invalidation; put() refuses it when given the
+     * clock() read before the statement was sent.
+     */
+    class QueryCache
+    {
+    private:
+        QueryCache(const QueryCache &old);
+        const QueryCache &operator=(const QueryCache &old);
+
+    public:
+        struct Stats
+        {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t fills; /** results stored */
+            uint64_t rejected; /** results too large or invalidated meanwhile */
+            uint64_t evictions; /** entries dropped for room */
+            uint64_t expirations; /** entries found past their time to live */
+            uint64_t invalidations; /** entries dropped by invalidate() */
+            size_t entries;
+            size_t bytes;
+        };
+
+        /**
+         * @param maxBytes Memory budget of the results.
+         * @param ttl Default time to live of an entry.
+         * @param shards Number of independently locked parts.
+         */
+        QueryCache(size_t maxBytes = 64 * 1024 * 1024, std::chrono::milliseconds ttl = std::chrono::milliseconds(60000), unsigned int shards = 16)
+            : ttl_(ttl)
+            , clock_(0)
+            , allInvalidated_(0)
+            , hits_(0)
+            , misses_(0)
+            , fills_(0)
+            , rejected_(0)
+            , evictions_(0)
+            , expirations_(0)
+            , invalidations_(0)
+        {
+            if (!shards) shards = 1;
+            shardBytes_ = maxBytes / shards;
+            for (unsigned int i=0; i<shards; i++) {
+                shards_.push_back(std::unique_ptr<Shard>(new Shard));
+            }
+        }
+
+        std::chrono::milliseconds ttl(void) const { return (ttl_); }
+
+        /**
+         * Returns the size of the largest result which may be stored.
+         */
+        size_t maxEntryBytes(void) const { return (shardBytes_); }
+
+        /**
+         * Returns the key of a statement: its normalized text.
+         */
+        static std::string key(const std::string &sql)
+        {
+            return (sqlscan::normalize(sql));
+        }
+
+        static std::string key(const char *sql) { return (key(std::string(sql))); }
+        /**
+         * Returns the key of a Statement and its bound values; it is
+         * the key of the SQL text when none are bound.
+         */
+        static std::string key(const Statement &stmt)
+        {
+            std::string k(stmt.key());
+            return (key(stmt.sql()) + k.substr(stmt.sql().size()));
+        }
+
+        /**
+         * Looks up a result, counting a hit or a miss.
+         *
+         * @return bool False if there is none, or it has expired.
+         */
+        bool get(const std::string &key, MaterializedResult &result)
+        {
+            Shard &shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = shard.index.find(key);
+            if (it == shard.index.end()) {
+                misses_++;
+                return (false);
+            }
+            if (it->second->expires <= std::chrono::steady_clock::now()) {
+                erase(shard, it->second);
+                expirations_++;
+                misses_++;
+                return (false);
+            }
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            result = it->second->result;
+            hits_++;
+            return (true);
+        }
+
+        /**
+         * Returns the count of invalidations so far, to pass to put().
+         */
+        uint64_t clock(void) const
+        {
+            std::lock_guard<std::mutex> lock(clockMutex_);
+            return (clock_);
+        }
+
+        /**
+         * Stores a result, making room by dropping the least recently
+         * used entries of its shard.
+         *
+         * @param tables The tables the statement reads.
+         * @param since clock() read before the statement was sent; the
+         *              result is refused if one of tables has been
+         *              invalidated since.
+         * @param ttl How long it may be used; the default ttl() when 0.
+         *
+         * @return bool False if it was refused.
+         */
+        bool put(const std::string &key, const std::vector<std::string> &tables, const MaterializedResult &result,
+                 uint64_t since, std::chrono::milliseconds ttl = std::chrono::milliseconds(0))
+        {
+            size_t bytes = sizeof(Entry) + 2 * key.size() + result.bytes();
+            for (size_t i=0; i<tables.size(); i++) bytes += tables[i].size();
+            if (bytes > shardBytes_) {
+                rejected_++;
+                return (false);
+            }
+
+            Shard &shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            {
+                // invalidate() bumps the clock before it takes the
+                // shard locks, so an entry checked here is either
+                // refused or dropped by it
+                std::lock_guard<std::mutex> clockLock(clockMutex_);
+                bool stale = (allInvalidated_ > since);
+                for (size_t i=0; !stale && i<tables.size(); i++) {
+                    std::unordered_map<std::string, uint64_t>::const_iterator it = invalidated_.find(tables[i]);
+                    stale = (it != invalidated_.end() && it->second > since);
+                }
+                if (stale) {
+                    rejected_++;
+                    return (false);
+                }
+            }
+
+            std::unordered_map<std::string, std::list<Entry>::iterator>::iterator old = shard.index.find(key);
+            if (old != shard.index.end()) erase(shard, old->second);
+
+            shard.lru.push_front(Entry());
+            Entry &e = shard.lru.front();
+            e.key = key;
+            e.result = result;
+            e.tables = tables;
+            e.expires = std::chrono::steady_clock::now() + (ttl.count() ? ttl : ttl_);
+            e.bytes = bytes;
+            shard.index[key] = shard.lru.begin();
+            for (size_t i=0; i<tables.size(); i++) shard.byTable[tables[i]].insert(&e);
+            shard.bytes += bytes;
+            fills_++;
+
+            while (shard.bytes > shardBytes_) {
+                erase(shard, --shard.lru.end());
+                evictions_++;
+            }
+            return (true);
+        }
+
+        /**
+         * Drops the results which read table, e.g. on a notification
+         * that another application changed it. Its name is matched
+         * without case and schema.
+         */
+        void invalidate(const std::string &table)
+        {
+            invalidate(std::vector<std::string>(1, table));
+        }
+
+        void invalidate(const std::vector<std::string> &tables)
+        {
+            std::vector<std::string> names;
+            for (size_t i=0; i<tables.size(); i++) {
+                std::string name(tables[i].substr(tables[i].rfind('.') == std::string::npos ? 0 : tables[i].rfind('.') + 1));
+                for (size_t j=0; j<name.size(); j++) name[j] = (char) tolower((unsigned char) name[j]);
+                names.push_back(name);
+            }
+            {
+                std::lock_guard<std::mutex> lock(clockMutex_);
+                clock_++;
+                for (size_t i=0; i<names.size(); i++) invalidated_[names[i]] = clock_;
+            }
+            for (size_t s=0; s<shards_.size(); s++) {
+                Shard &shard = *shards_[s];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (size_t i=0; i<names.size(); i++) {
+                    std::unordered_map<std::string, std::unordered_set<Entry *> >::iterator t = shard.byTable.find(names[i]);
+                    if (t == shard.byTable.end()) continue;
+                    std::vector<Entry *> entries(t->second.begin(), t->second.end());
+                    for (size_t j=0; j<entries.size(); j++) {
+                        erase(shard, shard.index[entries[j]->key]);
+                        invalidations_++;
+                    }
+                }
+            }
+        }
+
+        /**
+         * Drops every result.
+         */
+        void invalidateAll(void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(clockMutex_);
+                allInvalidated_ = ++clock_;
+            }
+            for (size_t s=0; s<shards_.size(); s++) {
+                Shard &shard = *shards_[s];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                invalidations_ += shard.lru.size();
+                shard.lru.clear();
+                shard.index.clear();
+                shard.byTable.clear();
+                shard.bytes = 0;
+            }
+        }
+
+        Stats stats(void) const
+        {
+            Stats s;
+            s.hits = hits_;
+            s.misses = misses_;
+            s.fills = fills_;
+            s.rejected = rejected_;
+            s.evictions = evictions_;
+            s.expirations = expirations_;
+            s.invalidations = invalidations_;
+            s.entries = 0;
+            s.bytes = 0;
+            for (size_t i=0; i<shards_.size(); i++) {
+                std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+                s.entries += shards_[i]->index.size();
+                s.bytes += shards_[i]->bytes;
+            }
+            return (s);
+        }
+
+    private:
+        struct Entry
+        {
+            std::string key;
+            MaterializedResult result;
+            std::vector<std::string> tables;
+            std::chrono::steady_clock::time_point expires;
+            size_t bytes;
+        };
+
+        struct Shard
+        {
+            Shard() : bytes(0) {}
+
+            mutable std::mutex mutex;
+            std::list<Entry> lru; /** most recently used first */
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+            std::unordered_map<std::string, std::unordered_set<Entry *> > byTable;
+            size_t bytes;
+        };
+
+        Shard &shardOf(const std::string &key)
+        {
+            return (*shards_[std::hash<std::string>()(key) % shards_.size()]);
+        }
+
+        static void erase(Shard &shard, std::list<Entry>::iterator it)
+        {
+            for (size_t i=0; i<it->tables.size(); i++) {
+                std::unordered_map<std::string, std::unordered_set<Entry *> >::iterator t = shard.byTable.find(it->tables[i]);
+                if (t == shard.byTable.end()) continue;
+                t->second.erase(&*it);
+                if (t->second.empty()) shard.byTable.erase(t);
+            }
+            shard.index.erase(it->key);
+            shard.bytes -= it->bytes;
+            shard.lru.erase(it);
+        }
+
+        std::vector<std::unique_ptr<Shard> > shards_;
+        size_t shardBytes_;
+        std::chrono::milliseconds ttl_;
+
+        mutable std::mutex clockMutex_;
+        uint64_t clock_;
+        uint64_t allInvalidated_;
+        std::unordered_map<std::string, uint64_t> invalidated_;
+
+        std::atomic<uint64_t> hits_;
+        std::atomic<uint64_t> misses_;
+        std::atomic<uint64_t> fills_;
+        std::atomic<uint64_t> rejected_;
+        std::atomic<uint64_t> evictions_;
+        std::atomic<uint64_t> expirations_;
+        std::atomic<uint64_t> invalidations_;
+    };
+
+    /**
+     * Passes every call through to the ResultSet of a cache miss,
+     * copying the rows as they are read. When the last row has been
+     * read, they are stored in the QueryCache; a result closed early
+     * or growing past QueryCache::maxEntryBytes() is not.
+     */
+    class CachingResultSet : public ResultSet
+    {
+    public:
+        CachingResultSet(ResultSet *rs, QueryCache *cache, const std::string &key, const std::vector<std::string> &tables,
+                         uint64_t since, std::chrono::milliseconds ttl)
+            : rs_(rs)
+            , cache_(cache)
+            , key_(key)
+            , tables_(tables)
+            , since_(since)
+            , ttl_(ttl)
+            , recording_(true)
+            , bytes_(0) {}
+
+        ~CachingResultSet()
+        {
+            rs_->close();
+        }
+
+        void *handle(void) { return (rs_->handle()); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void)
+        {
+            bool ok = rs_->next();
+            if (!recording_) return (ok);
+
+            unsigned int columns = rs_->columnCount();
+            if (!builder_) {
+                std::vector<std::string> names;
+                for (unsigned int i=0; i<columns; i++) {
+                    const char *name = rs_->columnName(i);
+                    names.push_back(name ? name : "");
+                }
+                builder_.reset(new MaterializedResult::Builder(names));
+            }
+            if (ok) {
+                values_.resize(columns);
+                for (unsigned int i=0; i<columns; i++) {
+                    values_[i] = rs_->getString(i);
+                    bytes_ += sizeof(std::string) + (values_[i] ? strlen(values_[i]) : 0);
+                }
+                if (bytes_ > cache_->maxEntryBytes()) {
+                    recording_ = false;
+                    builder_.reset();
+                } else {
+                    builder_->addRow(values_.empty() ? NULL : &values_[0]);
+                }
+            } else {
+                cache_->put(key_, tables_, builder_->build(), since_, ttl_);
+                recording_ = false;
+                builder_.reset();
+            }
+            return (ok);
+        }
+
+        unsigned int findColumn(const char *field) const { return (rs_->findColumn(field)); }
+        unsigned long recordCount(void) const { return (rs_->recordCount()); }
+        unsigned int columnCount(void) const { return (rs_->columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (rs_->columnName(idx)); }
+        const char *getString(const int idx) const { return (rs_->getString(idx)); }
+        int getInteger(const int idx) const { return (rs_->getInteger(idx)); }
+        bool getBool(const int idx) const { return (rs_->getBool(idx)); }
+        time_t getUnixTime(const int idx) const { return (rs_->getUnixTime(idx)); }
+        double getDouble(const int idx) const { return (rs_->getDouble(idx)); }
+        float getFloat(const int idx) const { return (rs_->getFloat(idx)); }
+        long getLong(const int idx) const { return (rs_->getLong(idx)); }
+        short getShort(const int idx) const { return (rs_->getShort(idx)); }
+
+    private:
+        ResultSet *rs_;
+        QueryCache *cache_;
+        std::string key_;
+        std::vector<std::string> tables_;
+        uint64_t since_;
+        std::chrono::milliseconds ttl_;
+        bool recording_;
+        size_t bytes_;
+        std::unique_ptr<MaterializedResult::Builder> builder_;
+        std::vector<const char *> values_;
+    };
+
+    /**
+     * A Connection which answers read-only statements from a
+     * QueryCache when it can, and otherwise passes every call through
+     * to another Connection.
+     *
+     * Results are keyed by the normalized SQL text, or by a Statement
+     * and its bound values. A hit returns a ResultSet over the copy
+     * kept in the cache; the driver, and any observer attached to it,
+     * never see the statement. A statement writing through execute()
+     * or executeQuery() invalidates the tables it names, or the whole
+     * cache when they cannot be told from its text (e.g. CALL).
+     *
+     * Inside beginTrans() ... commitTrans() the cache is neither read
+     * nor filled, so a transaction sees its own writes; the tables it
+     * wrote are invalidated again when it ends, dropping results other
+     * Connections read before it committed. Transactions must use
+     * those calls rather than BEGIN and COMMIT statements for this to
+     * work. Asynchronous queries are not cached.
+     *
+     * Writes by other applications are only noticed through
+     * QueryCache::invalidate() or the time to live, and statements
+     * whose results depend on more than their tables (NOW(),
+     * RANDOM(), ...) are cached like any other; wrap only the
+     * Connections used for data which suits this, e.g. configuration
+     * and reference data.
+     *
+     * It owns the wrapped Connection and release()s it when it is
+     * deleted. The QueryCache is not owned. Like the drivers, it is
+     * used from one thread at a time.
+     */
+    class CachingConnection : public Connection
+    {
+    private:
+        CachingConnection(const CachingConnection &old);
+        const CachingConnection &operator=(const CachingConnection &old);
+
+    public:
+        /**
+         * @param conn The Connection to wrap; it may be opened later
+         *             through this object.
+         * @param cache The cache to use, shared with other
+         *              Connections of the same database.
+         */
+        CachingConnection(Connection *conn, QueryCache *cache)
+            : conn_(conn)
+            , cache_(cache)
+            , ttl_(0)
+            , inTrans_(false) {}
+
+        ~CachingConnection()
+        {
+            conn_->release();
+        }
+
+        QueryCache *cache(void) const { return (cache_); }
+        Connection *connection(void) const { return (conn_); }
+
+        /**
+         * Sets the time to live of the results this Connection
+         * stores; 0 uses the default of the cache.
+         */
+        void setTtl(std::chrono::milliseconds ttl) { ttl_ = ttl; }
+
+        std::vector<std::string> tables(void) const { return (conn_->tables()); }
+        void *handle(void) { return (conn_->handle()); }
+
+        bool open(const char *database, const char *host, const int port, const char *user, const char *pass)
+        {
+            return (conn_->open(database, host, port, user, pass));
+        }
+
+        bool open(const ConnectionOptions &options) { return (conn_->open(options)); }
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const { return (conn_->unknownOptions(options)); }
+        bool close(void) { return (conn_->close()); }
+        bool isConnected(void) { return (conn_->isConnected()); }
+
+        bool execute(const char *sql)
+        {
+            bool ok = conn_->execute(sql);
+            // a failed statement may still have written in part
+            wrote(sql);
+            return (ok);
+        }
+
+        ResultSet *executeQuery(const char *sql)
+        {
+            if (inTrans_ || !sqlscan::isReadOnly(sql)) {
+                ResultSet *rs = conn_->executeQuery(sql);
+                wrote(sql);
+                return (rs);
+            }
+            return (query(QueryCache::key(sql), sql));
+        }
+
+        ResultSet *executeBatch(const char *sql)
+        {
+            ResultSet *rs = conn_->executeBatch(sql);
+            std::vector<std::string> parts = sqlscan::splitTopLevel(sql, ';');
+            for (size_t i=0; i<parts.size(); i++) {
+                if (!parts[i].empty()) wrote(parts[i].c_str());
+            }
+            return (rs);
+        }
+
+        /**
+         * Runs a Statement, keyed in the cache by its text and bound
+         * values.
+         *
+         * @return ResultSet* NULL if it failed, or fewer values than
+         *                    placeholders were bound.
+         */
+        ResultSet *executeQuery(const Statement &stmt)
+        {
+            std::string sql;
+            if (!stmt.toSql(*conn_, sql)) return (NULL);
+            if (inTrans_ || !sqlscan::isReadOnly(sql)) {
+                ResultSet *rs = conn_->executeQuery(sql.c_str());
+                wrote(sql.c_str());
+                return (rs);
+            }
+            return (query(QueryCache::key(stmt), sql.c_str()));
+        }
+
+        char *escape(const char *str) { return (conn_->escape(str)); }
+        const char *unixtimeToSql(const time_t t) { return (conn_->unixtimeToSql(t)); }
+        unsigned long insertId(void) { return (conn_->insertId()); }
+
+        bool beginTrans(void)
+        {
+            bool ok = conn_->beginTrans();
+            if (ok) inTrans_ = true;
+            return (ok);
+        }
+
+        bool commitTrans(void)
+        {
+            bool ok = conn_->commitTrans();
+            endTrans();
+            return (ok);
+        }
+
+        bool rollbackTrans(void)
+        {
+            bool ok = conn_->rollbackTrans();
+            endTrans();
+            return (ok);
+        }
+
+        bool setTransactionMode(const enum TRANS_MODE mode) { return (conn_->setTransactionMode(mode)); }
+        unsigned int errorno(void) const { return (conn_->errorno()); }
+        const char *errormsg(void) const { return (conn_->errormsg()); }
+        const char *version(void) const { return (conn_->version()); }
+
+        int socket(void) { return (conn_->socket()); }
+
+        enum ASYNC_STATUS startQuery(const char *sql)
+        {
+            asyncSql_ = sql;
+            return (conn_->startQuery(sql));
+        }
+
+        enum ASYNC_STATUS continueQuery(void) { return (conn_->continueQuery()); }
+
+        ResultSet *finishQuery(void)
+        {
+            ResultSet *rs = conn_->finishQuery();
+            wrote(asyncSql_.c_str());
+            return (rs);
+        }
+
+        bool cancelQuery(void)
+        {
+            bool ok = conn_->cancelQuery();
+            wrote(asyncSql_.c_str());
+            return (ok);
+        }
+
+        void setObserver(ConnectionObserver *observer)
+        {
+            observer_ = observer;
+            conn_->setObserver(observer);
+        }
+
+    private:
+        ResultSet *query(const std::string &key, const char *sql)
+        {
+            MaterializedResult cached;
+            if (cache_->get(key, cached)) return (cached.cursor());
+
+            uint64_t since = cache_->clock();
+            ResultSet *rs = conn_->executeQuery(sql);
+            if (!rs) return (NULL);
+            return (new CachingResultSet(rs, cache_, key, sqlscan::tableNames(sql), since, ttl_));
+        }
+
+        /**
+         * Invalidates what a statement may have written.
+         */
+        void wrote(const char *sql)
+        {
+            static const char *none[] = {
+                "BEGIN", "START", "COMMIT", "ROLLBACK", "END", "SAVEPOINT", "RELEASE", "SET", "USE",
+                "SHOW", "EXPLAIN", "DESCRIBE", "DESC", "PRAGMA", "ANALYZE", "VACUUM", "LOCK", "UNLOCK",
+                "GRANT", "REVOKE", "LISTEN", "UNLISTEN", "NOTIFY"
+            };
+            static const char *named[] = {
+                "INSERT", "UPDATE", "DELETE", "REPLACE", "MERGE", "UPSERT", "TRUNCATE", "CREATE", "DROP", "ALTER", "WITH"
+            };
+
+            if (sqlscan::isReadOnly(sql)) return;
+            std::string kw = sqlscan::firstKeyword(sql);
+            for (size_t i=0; i<sizeof(none) / sizeof(none[0]); i++) {
+                if (kw == none[i]) return;
+            }
+            std::vector<std::string> tables;
+            for (size_t i=0; i<sizeof(named) / sizeof(named[0]); i++) {
+                if (kw == named[i]) tables = sqlscan::tableNames(sql);
+            }
+            if (tables.empty()) {
+                cache_->invalidateAll();
+                return;
+            }
+            cache_->invalidate(tables);
+            if (inTrans_) written_.insert(written_.end(), tables.begin(), tables.end());
+        }
+
+        void endTrans(void)
+        {
+            inTrans_ = false;
+            if (!written_.empty()) cache_->invalidate(written_);
+            written_.clear();
+        }
+
+        Connection *conn_;
+        QueryCache *cache_;
+        std::chrono::milliseconds ttl_;
+        bool inTrans_;
+        std::vector<std::string> written_;
+        std::string asyncSql_;
+    };
+}; /* namespace */
+
+#endif
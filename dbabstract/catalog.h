@@ -0,0 +1,514 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _CATALOG_H
+#define _CATALOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/sqlscan.h"
+#include "dbabstract/statement.h"
+
+namespace dbabstract
+{
+    struct CatalogColumn
+    {
+        enum TYPE {
+            INTEGER, /** INT, BIGINT, SERIAL, ... */
+            REAL, /** REAL, FLOAT, DOUBLE */
+            NUMERIC, /** NUMERIC, DECIMAL and other exact numbers */
+            TEXT, /** CHAR, VARCHAR, TEXT, CLOB, ... */
+            BLOB, /** BLOB, BYTEA, BINARY, ... */
+            BOOLEAN,
+            DATETIME, /** DATE, TIME, DATETIME, TIMESTAMP */
+            OTHER /** anything else, e.g. intervals, arrays, JSON */
+        };
+
+        CatalogColumn() : type(OTHER), nullable(true), primaryKey(0) {}
+
+        std::string name;
+        std::string declared; /** the type as the database names it */
+        enum TYPE type;
+        bool nullable;
+        unsigned int primaryKey; /** position in the primary key from 1, 0 if not in it */
+
+        /**
+         * Classifies a declared type, much like SQLite's type affinity
+         * rules, so the names used by the other databases fit as well.
+         */
+        static enum TYPE typeOf(const std::string &declared)
+        {
+            std::string t;
+            for (size_t i=0; i<declared.size(); i++) t += (char) toupper((unsigned char) declared[i]);
+            auto has = [&t](const char *s) { return (t.find(s) != std::string::npos); };
+
+            if (has("BOOL") || t == "BIT" || t == "TINYINT(1)") return (BOOLEAN);
+            if (has("INTERVAL") || has("POINT") || has("[]") || has("JSON")) return (OTHER);
+            if (has("DATE") || has("TIME")) return (DATETIME);
+            if (has("INT") || has("SERIAL")) return (INTEGER);
+            if (has("CHAR") || has("CLOB") || has("TEXT") || has("STRING")) return (TEXT);
+            if (has("BLOB") || has("BYTEA") || has("BINARY")) return (BLOB);
+            if (has("REAL") || has("FLOA") || has("DOUB")) return (REAL);
+            if (has("NUMERIC") || has("DECIMAL") || has("NUMBER") || has("MONEY")) return (NUMERIC);
+            return (OTHER);
+        }
+    };
+
+    struct CatalogIndex
+    {
+        CatalogIndex() : unique(false), primary(false) {}
+
+        std::string name;
+        bool unique;
+        bool primary;
+        std::vector<std::string> columns; /** in index order */
+    };
+
+    struct CatalogTable
+    {
+        std::string name;
+        std::vector<CatalogColumn> columns; /** in table order */
+        std::vector<std::string> primaryKey; /** in key order */
+        std::vector<CatalogIndex> indexes;
+
+        /**
+         * Returns the column called name, ignoring case, or NULL.
+         */
+        const CatalogColumn *column(const std::string &name) const
+        {
+            for (size_t i=0; i<columns.size(); i++) {
+                if (strcasecmp(columns[i].name.c_str(), name.c_str()) == 0) return (&columns[i]);
+            }
+            return (NULL);
+        }
+    };
+
+    /**
+     * The tables of a database with their columns, types, primary
+     * keys and indexes, read from its catalog on first use and kept
+     * until invalidated. One Catalog may serve every Connection to
+     * the same database, e.g. those of a pool, from any thread; the
+     * Connection passed in is used to load what is missing.
+     *
+     * The catalog is read with SQL chosen by the driver's version():
+     * sqlite_master and PRAGMAs for SQLite, information_schema and
+     * pg_index for PostgreSQL, information_schema for MySQL. For ODBC
+     * the standard INFORMATION_SCHEMA views are tried, which give
+     * columns and primary keys but no other indexes.
+     *
+     * Attached as the observer of a Connection, it forgets what a
+     * successful CREATE, ALTER, DROP or RENAME statement may have
+     * changed. An application with an observer of its own may call
+     * onQueryEnd() from it instead.
+     */
+    class Catalog : public ConnectionObserver
+    {
+    private:
+        Catalog(const Catalog &old);
+        const Catalog &operator=(const Catalog &old);
+
+    public:
+        Catalog() : complete_(false), generation_(0), queries_(0) {}
+
+        /**
+         * Returns the names of all tables and views, loading the whole
+         * catalog unless it already has.
+         */
+        std::vector<std::string> tables(Connection &conn)
+        {
+            std::vector<std::string> names;
+            if (!load(conn, false)) return (names);
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::map<std::string, std::shared_ptr<const CatalogTable> >::const_iterator it = tables_.begin(); it != tables_.end(); ++it) {
+                if (it->second) names.push_back(it->second->name);
+            }
+            return (names);
+        }
+
+        /**
+         * Returns a table, ignoring the case of its name, loading it
+         * unless it is known.
+         *
+         * @return std::shared_ptr<const CatalogTable> Empty if there
+         *         is no such table, or it could not be read.
+         */
+        std::shared_ptr<const CatalogTable> table(Connection &conn, const std::string &name)
+        {
+            std::string key(lower(name));
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::map<std::string, std::shared_ptr<const CatalogTable> >::const_iterator it = tables_.find(key);
+                if (it != tables_.end()) return (it->second);
+                if (complete_) return (std::shared_ptr<const CatalogTable>());
+                generation = generation_;
+            }
+
+            std::map<std::string, std::shared_ptr<const CatalogTable> > found;
+            if (!fetch(conn, &key, found)) return (std::shared_ptr<const CatalogTable>());
+            std::shared_ptr<const CatalogTable> t = found[key];
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            // a table that does not exist is remembered as well
+            if (generation == generation_) tables_[key] = t;
+            return (t);
+        }
+
+        /**
+         * Reads the whole catalog, unless it already has unless force.
+         *
+         * @return bool False if it could not be read.
+         */
+        bool load(Connection &conn, bool force = true)
+        {
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (complete_ && !force) return (true);
+                generation = generation_;
+            }
+
+            std::map<std::string, std::shared_ptr<const CatalogTable> > found;
+            if (!fetch(conn, NULL, found)) return (false);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation == generation_) {
+                tables_.swap(found);
+                complete_ = true;
+            } else {
+                // changed meanwhile; still usable by the caller, not kept
+                for (std::map<std::string, std::shared_ptr<const CatalogTable> >::iterator it = found.begin(); it != found.end(); ++it) {
+                    tables_.insert(*it);
+                }
+            }
+            return (true);
+        }
+
+        /**
+         * Forgets a table, and the list of all tables.
+         */
+        void invalidate(const std::string &table)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tables_.erase(lower(table));
+            complete_ = false;
+            generation_++;
+        }
+
+        void invalidateAll(void)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tables_.clear();
+            complete_ = false;
+            generation_++;
+        }
+
+        /**
+         * Returns the number of catalog statements run so far.
+         */
+        unsigned long queries(void) const { return (queries_); }
+
+        void onQueryEnd(Connection *, const char *sql, bool ok, uint64_t)
+        {
+            if (!ok || !sql) return;
+            std::string kw = sqlscan::firstKeyword(sql);
+            if (kw != "CREATE" && kw != "ALTER" && kw != "DROP" && kw != "RENAME") return;
+
+            std::vector<std::string> names = sqlscan::tableNames(sql);
+            if (names.empty()) {
+                // CREATE INDEX ... ON and the like
+                invalidateAll();
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i=0; i<names.size(); i++) tables_.erase(names[i]);
+            // a rename or a new view may create any of the missing ones
+            for (Tables::iterator it = tables_.begin(); it != tables_.end(); ) {
+                if (it->second) ++it;
+                else tables_.erase(it++);
+            }
+            complete_ = false;
+            generation_++;
+        }
+
+    private:
+        typedef std::map<std::string, std::shared_ptr<const CatalogTable> > Tables;
+
+        static std::string lower(const std::string &s)
+        {
+            std::string out(s);
+            for (size_t i=0; i<out.size(); i++) out[i] = (char) tolower((unsigned char) out[i]);
+            return (out);
+        }
+
+        /**
+         * Runs a catalog statement, appending its rows as text, with
+         * "" for NULL.
+         */
+        bool rows(Connection &conn, const Statement &stmt, std::vector<std::vector<std::string> > &out)
+        {
+            std::string sql;
+            if (!stmt.toSql(conn, sql)) return (false);
+            queries_++;
+            ResultSet *rs = conn.executeQuery(sql.c_str());
+            if (!rs) return (false);
+            unsigned int cols = rs->columnCount();
+            while (rs->next()) {
+                std::vector<std::string> row;
+                for (unsigned int i=0; i<cols; i++) {
+                    const char *v = rs->getString(i);
+                    row.push_back(v ? v : "");
+                }
+                out.push_back(row);
+            }
+            rs->close();
+            return (true);
+        }
+
+        static bool truth(const std::string &v)
+        {
+            return (!v.empty() && (v[0] == '1' || v[0] == 't' || v[0] == 'T' || v[0] == 'Y' || v[0] == 'y'));
+        }
+
+        static std::string quoteIdentifier(const std::string &name)
+        {
+            std::string out("\"");
+            for (size_t i=0; i<name.size(); i++) {
+                if (name[i] == '"') out += '"';
+                out += name[i];
+            }
+            return (out + "\"");
+        }
+
+        /**
+         * Reads the tables, or only the one called *only (lower case),
+         * into out; a missing *only is stored as an empty pointer.
+         */
+        bool fetch(Connection &conn, const std::string *only, Tables &out)
+        {
+            const char *version = conn.version();
+            bool ok;
+            std::map<std::string, std::shared_ptr<CatalogTable> > tables;
+            if (strncmp(version, "Sqlite3", 7) == 0) ok = fetchSqlite(conn, only, tables);
+            else if (strncmp(version, "PostgreSQL", 10) == 0) ok = fetchPostgres(conn, only, tables);
+            else if (strncmp(version, "MySQL", 5) == 0) ok = fetchMysql(conn, only, tables);
+            else ok = fetchStandard(conn, only, tables);
+            if (!ok) return (false);
+
+            for (std::map<std::string, std::shared_ptr<CatalogTable> >::iterator it = tables.begin(); it != tables.end(); ++it) {
+                CatalogTable &t = *it->second;
+                for (size_t i=0; i<t.columns.size(); i++) {
+                    t.columns[i].type = CatalogColumn::typeOf(t.columns[i].declared);
+                }
+                for (size_t i=0; i<t.primaryKey.size(); i++) {
+                    for (size_t j=0; j<t.columns.size(); j++) {
+                        if (t.columns[j].name == t.primaryKey[i]) t.columns[j].primaryKey = (unsigned int) i + 1;
+                    }
+                }
+                out[it->first] = it->second;
+            }
+            if (only && out.find(*only) == out.end()) out[*only] = std::shared_ptr<const CatalogTable>();
+            return (true);
+        }
+
+        static CatalogTable &tableFor(std::map<std::string, std::shared_ptr<CatalogTable> > &tables, const std::string &name)
+        {
+            std::shared_ptr<CatalogTable> &t = tables[lower(name)];
+            if (!t) {
+                t.reset(new CatalogTable);
+                t->name = name;
+            }
+            return (*t);
+        }
+
+        /**
+         * Adds the rows of table, index, unique, primary, column to
+         * the indexes of the tables, and the primary ones to their
+         * primary keys.
+         */
+        static void addIndexes(std::map<std::string, std::shared_ptr<CatalogTable> > &tables, const std::vector<std::vector<std::string> > &rows)
+        {
+            for (size_t i=0; i<rows.size(); i++) {
+                const std::vector<std::string> &r = rows[i];
+                if (r.size() < 5) continue;
+                std::map<std::string, std::shared_ptr<CatalogTable> >::iterator t = tables.find(lower(r[0]));
+                if (t == tables.end()) continue;
+                std::vector<CatalogIndex> &indexes = t->second->indexes;
+                if (indexes.empty() || indexes.back().name != r[1]) {
+                    indexes.push_back(CatalogIndex());
+                    indexes.back().name = r[1];
+                    indexes.back().unique = truth(r[2]);
+                    indexes.back().primary = truth(r[3]);
+                }
+                indexes.back().columns.push_back(r[4]);
+                if (indexes.back().primary) t->second->primaryKey.push_back(r[4]);
+            }
+        }
+
+        bool fetchSqlite(Connection &conn, const std::string *only, std::map<std::string, std::shared_ptr<CatalogTable> > &tables)
+        {
+            std::vector<std::vector<std::string> > names;
+            Statement list(std::string("SELECT name FROM sqlite_master WHERE type IN ('table', 'view') AND name NOT LIKE 'sqlite\\_%' ESCAPE '\\'") +
+                           (only ? " AND lower(name) = ?" : ""));
+            if (only) list.bind(*only);
+            if (!rows(conn, list, names)) return (false);
+
+            for (size_t n=0; n<names.size(); n++) {
+                CatalogTable &t = tableFor(tables, names[n][0]);
+                std::vector<std::vector<std::string> > cols;
+                // cid, name, type, notnull, dflt_value, pk
+                if (!rows(conn, Statement("PRAGMA table_info(" + quoteIdentifier(t.name) + ")"), cols)) return (false);
+                std::vector<std::pair<int, std::string> > pk;
+                for (size_t i=0; i<cols.size(); i++) {
+                    if (cols[i].size() < 6) continue;
+                    CatalogColumn c;
+                    c.name = cols[i][1];
+                    c.declared = cols[i][2];
+                    c.nullable = !truth(cols[i][3]);
+                    t.columns.push_back(c);
+                    if (atoi(cols[i][5].c_str()) > 0) pk.push_back(std::make_pair(atoi(cols[i][5].c_str()), c.name));
+                }
+                std::sort(pk.begin(), pk.end());
+                for (size_t i=0; i<pk.size(); i++) t.primaryKey.push_back(pk[i].second);
+
+                std::vector<std::vector<std::string> > idx;
+                // seq, name, unique[, origin, partial]
+                if (!rows(conn, Statement("PRAGMA index_list(" + quoteIdentifier(t.name) + ")"), idx)) return (false);
+                for (size_t i=0; i<idx.size(); i++) {
+                    if (idx[i].size() < 3) continue;
+                    CatalogIndex index;
+                    index.name = idx[i][1];
+                    index.unique = truth(idx[i][2]);
+                    index.primary = (idx[i].size() > 3 && idx[i][3] == "pk");
+                    std::vector<std::vector<std::string> > info;
+                    // seqno, cid, name
+                    if (!rows(conn, Statement("PRAGMA index_info(" + quoteIdentifier(index.name) + ")"), info)) return (false);
+                    for (size_t j=0; j<info.size(); j++) {
+                        if (info[j].size() >= 3) index.columns.push_back(info[j][2]);
+                    }
+                    t.indexes.push_back(index);
+                }
+            }
+            return (true);
+        }
+
+        bool fetchPostgres(Connection &conn, const std::string *only, std::map<std::string, std::shared_ptr<CatalogTable> > &tables)
+        {
+            std::vector<std::vector<std::string> > cols;
+            Statement columns(std::string("SELECT table_name, column_name, data_type, is_nullable FROM information_schema.columns "
+                                          "WHERE table_schema = current_schema()") +
+                              (only ? " AND lower(table_name) = ?" : "") + " ORDER BY table_name, ordinal_position");
+            if (only) columns.bind(*only);
+            if (!rows(conn, columns, cols)) return (false);
+            addColumns(tables, cols);
+
+            std::vector<std::vector<std::string> > idx;
+            Statement indexes(std::string("SELECT t.relname, i.relname, ix.indisunique, ix.indisprimary, a.attname "
+                                          "FROM pg_index ix JOIN pg_class t ON t.oid = ix.indrelid JOIN pg_class i ON i.oid = ix.indexrelid "
+                                          "JOIN pg_attribute a ON a.attrelid = t.oid AND a.attnum = ANY(ix.indkey) "
+                                          "WHERE t.relnamespace = (SELECT oid FROM pg_namespace WHERE nspname = current_schema())") +
+                              (only ? " AND lower(t.relname) = ?" : "") +
+                              " ORDER BY t.relname, i.relname, array_position(ix.indkey::int2[], a.attnum)");
+            if (only) indexes.bind(*only);
+            if (!rows(conn, indexes, idx)) return (false);
+            addIndexes(tables, idx);
+            return (true);
+        }
+
+        bool fetchMysql(Connection &conn, const std::string *only, std::map<std::string, std::shared_ptr<CatalogTable> > &tables)
+        {
+            std::vector<std::vector<std::string> > cols;
+            Statement columns(std::string("SELECT table_name, column_name, column_type, is_nullable FROM information_schema.columns "
+                                          "WHERE table_schema = DATABASE()") +
+                              (only ? " AND LOWER(table_name) = ?" : "") + " ORDER BY table_name, ordinal_position");
+            if (only) columns.bind(*only);
+            if (!rows(conn, columns, cols)) return (false);
+            addColumns(tables, cols);
+
+            std::vector<std::vector<std::string> > idx;
+            Statement indexes(std::string("SELECT table_name, index_name, non_unique = 0, index_name = 'PRIMARY', column_name "
+                                          "FROM information_schema.statistics WHERE table_schema = DATABASE()") +
+                              (only ? " AND LOWER(table_name) = ?" : "") + " ORDER BY table_name, index_name, seq_in_index");
+            if (only) indexes.bind(*only);
+            if (!rows(conn, indexes, idx)) return (false);
+            addIndexes(tables, idx);
+            return (true);
+        }
+
+        bool fetchStandard(Connection &conn, const std::string *only, std::map<std::string, std::shared_ptr<CatalogTable> > &tables)
+        {
+            static const char *system = "('INFORMATION_SCHEMA', 'information_schema', 'pg_catalog', 'sys', 'SYS', 'mysql', 'performance_schema')";
+            std::vector<std::vector<std::string> > cols;
+            Statement columns(std::string("SELECT TABLE_NAME, COLUMN_NAME, DATA_TYPE, IS_NULLABLE FROM INFORMATION_SCHEMA.COLUMNS "
+                                          "WHERE TABLE_SCHEMA NOT IN ") + system +
+                              (only ? " AND LOWER(TABLE_NAME) = ?" : "") + " ORDER BY TABLE_NAME, ORDINAL_POSITION");
+            if (only) columns.bind(*only);
+            if (!rows(conn, columns, cols)) return (false);
+            addColumns(tables, cols);
+
+            // no standard view lists the other indexes
+            std::vector<std::vector<std::string> > keys;
+            Statement primary(std::string("SELECT k.TABLE_NAME, k.CONSTRAINT_NAME, 1, 1, k.COLUMN_NAME "
+                                          "FROM INFORMATION_SCHEMA.TABLE_CONSTRAINTS c JOIN INFORMATION_SCHEMA.KEY_COLUMN_USAGE k "
+                                          "ON k.CONSTRAINT_NAME = c.CONSTRAINT_NAME AND k.TABLE_NAME = c.TABLE_NAME AND k.TABLE_SCHEMA = c.TABLE_SCHEMA "
+                                          "WHERE c.CONSTRAINT_TYPE = 'PRIMARY KEY' AND c.TABLE_SCHEMA NOT IN ") + system +
+                              (only ? " AND LOWER(k.TABLE_NAME) = ?" : "") + " ORDER BY k.TABLE_NAME, k.CONSTRAINT_NAME, k.ORDINAL_POSITION");
+            if (only) primary.bind(*only);
+            if (rows(conn, primary, keys)) addIndexes(tables, keys);
+            return (true);
+        }
+
+        /**
+         * Adds the rows of table, column, type, nullable.
+         */
+        static void addColumns(std::map<std::string, std::shared_ptr<CatalogTable> > &tables, const std::vector<std::vector<std::string> > &rows)
+        {
+            for (size_t i=0; i<rows.size(); i++) {
+                const std::vector<std::string> &r = rows[i];
+                if (r.size() < 4) continue;
+                CatalogColumn c;
+                c.name = r[1];
+                c.declared = r[2];
+                c.nullable = (strcasecmp(r[3].c_str(), "NO") != 0);
+                tableFor(tables, r[0]).columns.push_back(c);
+            }
+        }
+
+        mutable std::mutex mutex_;
+        bool complete_; /** tables_ has every table */
+        uint64_t generation_; /** count of invalidations */
+        Tables tables_; /** by lower case name; empty for known missing tables */
+        std::atomic<unsigned long> queries_;
+    };
+}; /* namespace */
+
+#endif
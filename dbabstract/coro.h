@@ -0,0 +1,473 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _CORO_H
+#define _CORO_H
+
+#if !defined(__cpp_impl_coroutine)
+# error "dbabstract/coro.h requires a C++20 compiler with coroutine support"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <utility>
+
+#include "dbabstract/db.h"
+#include "dbabstract/pool.h"
+#include "dbabstract/reactor.h"
+
+namespace dbabstract
+{
+    template <typename T> class Task;
+
+    namespace detail
+    {
+        struct TaskPromiseBase
+        {
+            struct FinalAwaiter
+            {
+                bool await_ready(void) noexcept { return (false); }
+
+                template <typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+                {
+                    std::coroutine_handle<> next = h.promise().continuation;
+                    return (next ? next : std::noop_coroutine());
+                }
+
+                void await_resume(void) noexcept {}
+            };
+
+            std::suspend_always initial_suspend(void) noexcept { return {}; }
+            FinalAwaiter final_suspend(void) noexcept { return {}; }
+            void unhandled_exception(void) { error = std::current_exception(); }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+        };
+
+        template <typename T>
+        struct TaskPromise : TaskPromiseBase
+        {
+            Task<T> get_return_object(void);
+            void return_value(T v) { value = std::move(v); }
+
+            T result(void)
+            {
+                if (error) std::rethrow_exception(error);
+                return (std::move(value));
+            }
+
+            T value;
+        };
+
+        template <>
+        struct TaskPromise<void> : TaskPromiseBase
+        {
+            Task<void> get_return_object(void);
+            void return_void(void) {}
+
+            void result(void)
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        };
+
+        /* fire-and-forget coroutine owning a Task until it finishes */
+        struct Detached
+        {
+            struct promise_type
+            {
+                Detached get_return_object(void) { return {}; }
+                std::suspend_never initial_suspend(void) noexcept { return {}; }
+                std::suspend_never final_suspend(void) noexcept { return {}; }
+                void return_void(void) {}
+                void unhandled_exception(void) { std::terminate(); }
+            };
+        };
+    }
+
+    /**
+     * A lazily started coroutine producing a T. It runs when it is
+     * co_await'ed, or when handed to Executor::spawn() or
+     * Executor::syncWait().
+     */
+    template <typename T = void>
+    class Task
+    {
+    public:
+        typedef detail::TaskPromise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> handle_type;
+
+        explicit Task(handle_type h) : h_(h) {}
+        Task(Task &&other) noexcept : h_(other.h_) { other.h_ = nullptr; }
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        ~Task() { if (h_) h_.destroy(); }
+
+        bool await_ready(void) const noexcept { return (!h_ || h_.done()); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+        {
+            h_.promise().continuation = caller;
+            return (h_);
+        }
+
+        T await_resume(void) { return (h_.promise().result()); }
+
+    private:
+        handle_type h_;
+    };
+
+    namespace detail
+    {
+        template <typename T>
+        Task<T> TaskPromise<T>::get_return_object(void)
+        {
+            return (Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this)));
+        }
+
+        inline Task<void> TaskPromise<void>::get_return_object(void)
+        {
+            return (Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this)));
+        }
+
+        inline Detached runDetached(Task<void> task)
+        {
+            co_await task;
+        }
+    }
+
+    /**
+     * Runs coroutines on top of a Reactor: statements on drivers with
+     * a non-blocking path wait on their socket, and the blocking ones
+     * (Sqlite3, ODBC) are run on the Reactor's worker threads. Every
+     * coroutine resumes on the thread running the Executor.
+     */
+    class Executor
+    {
+    private:
+        Executor(const Executor &old);
+        const Executor &operator=(const Executor &old);
+
+    public:
+        explicit Executor(unsigned int offloadThreads = 2) : reactor_(offloadThreads) {}
+
+        Reactor &reactor(void) { return (reactor_); }
+
+        void run(void) { reactor_.run(); }
+        int runOnce(long timeoutMs = -1) { return (reactor_.runOnce(timeoutMs)); }
+        void stop(void) { reactor_.stop(); }
+
+        /**
+         * Starts task; it runs until its first suspension right away.
+         */
+        void spawn(Task<void> task)
+        {
+            detail::runDetached(std::move(task));
+        }
+
+        /**
+         * Drives the event loop until task completes, and returns its
+         * result. For use from plain (non-coroutine) code.
+         */
+        template <typename T>
+        T syncWait(Task<T> task)
+        {
+            bool done = false;
+            std::exception_ptr error;
+            T value;
+            spawn(store(std::move(task), value, error, done));
+            while (!done) runOnce(-1);
+            if (error) std::rethrow_exception(error);
+            return (value);
+        }
+
+        void syncWait(Task<void> task)
+        {
+            bool done = false;
+            std::exception_ptr error;
+            spawn(store(std::move(task), error, done));
+            while (!done) runOnce(-1);
+            if (error) std::rethrow_exception(error);
+        }
+
+        /**
+         * Awaitable which resumes after delayMs milliseconds.
+         */
+        struct SleepAwaiter
+        {
+            Executor &ex;
+            long delayMs;
+
+            bool await_ready(void) const noexcept { return (false); }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                ex.reactor_.schedule(delayMs, [h]() { h.resume(); });
+            }
+            void await_resume(void) const noexcept {}
+        };
+
+        SleepAwaiter sleep(long delayMs) { return SleepAwaiter{*this, delayMs}; }
+
+    private:
+        template <typename T>
+        static Task<void> store(Task<T> task, T &value, std::exception_ptr &error, bool &done)
+        {
+            try {
+                value = co_await task;
+            } catch (...) {
+                error = std::current_exception();
+            }
+            done = true;
+        }
+
+        static Task<void> store(Task<void> task, std::exception_ptr &error, bool &done)
+        {
+            try {
+                co_await task;
+            } catch (...) {
+                error = std::current_exception();
+            }
+            done = true;
+        }
+
+        Reactor reactor_;
+    };
+
+    /**
+     * A ResultSet whose next() is awaitable. Rows of drivers which
+     * buffer the whole result (PostgreSQL, MariaDB) are stepped in
+     * place; for the blocking drivers each step runs on a worker.
+     *
+     * Like the ResultSet it wraps, it MUST be closed when done.
+     */
+    class AsyncResultSet
+    {
+    public:
+        AsyncResultSet() : ex_(NULL), rs_(NULL), offload_(false) {}
+        AsyncResultSet(Executor &ex, ResultSet *rs, bool offload) : ex_(&ex), rs_(rs), offload_(offload) {}
+
+        explicit operator bool(void) const { return (rs_ != NULL); }
+        ResultSet *resultSet(void) { return (rs_); }
+
+        struct NextAwaiter
+        {
+            AsyncResultSet &self;
+            bool row;
+
+            bool await_ready(void)
+            {
+                if (!self.rs_) {
+                    row = false;
+                    return (true);
+                }
+                if (!self.offload_) {
+                    row = self.rs_->next();
+                    return (true);
+                }
+                return (false);
+            }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                Reactor &reactor = self.ex_->reactor();
+                ResultSet *rs = self.rs_;
+                bool *out = &row;
+                reactor.offload([&reactor, rs, out, h]() {
+                    bool r = rs->next();
+                    reactor.post([out, r, h]() {
+                        *out = r;
+                        h.resume();
+                    });
+                });
+            }
+
+            bool await_resume(void) const noexcept { return (row); }
+        };
+
+        NextAwaiter next(void) { return NextAwaiter{*this, false}; }
+
+        bool close(void)
+        {
+            if (!rs_) return (false);
+            ResultSet *rs = rs_;
+            rs_ = NULL;
+            return (rs->close());
+        }
+
+        unsigned int findColumn(const char *field) const { return (rs_->findColumn(field)); }
+        const char *getString(const int idx) const { return (rs_->getString(idx)); }
+        int getInteger(const int idx) const { return (rs_->getInteger(idx)); }
+        bool getBool(const int idx) const { return (rs_->getBool(idx)); }
+        time_t getUnixTime(const int idx) const { return (rs_->getUnixTime(idx)); }
+        double getDouble(const int idx) const { return (rs_->getDouble(idx)); }
+        float getFloat(const int idx) const { return (rs_->getFloat(idx)); }
+        long getLong(const int idx) const { return (rs_->getLong(idx)); }
+        short getShort(const int idx) const { return (rs_->getShort(idx)); }
+
+    private:
+        Executor *ex_;
+        ResultSet *rs_;
+        bool offload_;
+    };
+
+    /**
+     * Awaitable statements on a Connection. The Connection is not
+     * owned and must outlive every statement issued through it.
+     */
+    class AsyncConnection
+    {
+    public:
+        AsyncConnection(Executor &ex, Connection *conn) : ex_(ex), conn_(conn) {}
+
+        Connection *connection(void) { return (conn_); }
+
+        struct QueryAwaiter
+        {
+            AsyncConnection &self;
+            std::string sql;
+            long timeoutMs;
+            ResultSet *rs;
+            bool offloaded;
+
+            bool await_ready(void) const noexcept { return (false); }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                ResultSet **out = &rs;
+                bool *blocking = &offloaded;
+                Reactor &reactor = self.ex_.reactor();
+                Connection *conn = self.conn_;
+                if (!reactor.query(conn, sql, [out, blocking, &reactor, conn, h](ResultSet *r, bool) {
+                        *out = r;
+                        *blocking = reactor.offloads(conn);
+                        h.resume();
+                    }, timeoutMs)) {
+                    self.ex_.reactor().post([h]() { h.resume(); });
+                }
+            }
+
+            AsyncResultSet await_resume(void)
+            {
+                if (!rs) return (AsyncResultSet());
+                // a driver the Reactor offloaded (e.g. MySQL without the
+                // MariaDB client, which still has a socket) streams rows
+                // synchronously, and would block the loop
+                return (AsyncResultSet(self.ex_, rs, offloaded));
+            }
+        };
+
+        struct ExecuteAwaiter
+        {
+            AsyncConnection &self;
+            std::string sql;
+            long timeoutMs;
+            bool ok;
+
+            bool await_ready(void) const noexcept { return (false); }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                bool *out = &ok;
+                if (!self.ex_.reactor().execute(self.conn_, sql, [out, h](ResultSet *, bool r) {
+                        *out = r;
+                        h.resume();
+                    }, timeoutMs)) {
+                    self.ex_.reactor().post([h]() { h.resume(); });
+                }
+            }
+
+            bool await_resume(void) const noexcept { return (ok); }
+        };
+
+        /**
+         * co_await conn.query(sql) yields an AsyncResultSet, which is
+         * empty (false) on failure.
+         */
+        QueryAwaiter query(const std::string &sql, long timeoutMs = 0)
+        {
+            return QueryAwaiter{*this, sql, timeoutMs, NULL, false};
+        }
+
+        /**
+         * co_await conn.execute(sql) yields true on success.
+         */
+        ExecuteAwaiter execute(const std::string &sql, long timeoutMs = 0)
+        {
+            return ExecuteAwaiter{*this, sql, timeoutMs, false};
+        }
+
+    private:
+        Executor &ex_;
+        Connection *conn_;
+    };
+
+    /**
+     * Awaitable access to a ConnectionPool. Waiting for a Connection
+     * suspends the coroutine rather than blocking the thread.
+     */
+    class AsyncPool
+    {
+    public:
+        AsyncPool(Executor &ex, ConnectionPool &pool) : ex_(ex), pool_(pool) {}
+
+        struct AcquireAwaiter
+        {
+            AsyncPool &self;
+            Connection *conn;
+
+            bool await_ready(void)
+            {
+                conn = self.pool_.tryAcquire();
+                return (conn != NULL);
+            }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                Connection **out = &conn;
+                Reactor &reactor = self.ex_.reactor();
+                // may run on whichever thread releases a Connection
+                self.pool_.acquireAsync([out, h, &reactor](Connection *c) {
+                    reactor.post([out, c, h]() {
+                        *out = c;
+                        h.resume();
+                    });
+                });
+            }
+
+            Connection *await_resume(void) const noexcept { return (conn); }
+        };
+
+        /**
+         * co_await pool.acquire() yields a Connection, or NULL if a
+         * new one could not be opened.
+         */
+        AcquireAwaiter acquire(void) { return AcquireAwaiter{*this, NULL}; }
+
+        void release(Connection *conn) { pool_.release(conn); }
+
+    private:
+        Executor &ex_;
+        ConnectionPool &pool_;
+    };
+}; /* namespace */
+
+#endif
@@ -28,6 +28,9 @@
 #include <vector>
 #include <dlfcn.h>
 
+#include "dbabstract/observer.h"
+#include "dbabstract/options.h"
+
 #if defined(_WIN32)
 # define LIBRARY_API __declspec(dllexport)
 #else
@@ -36,6 +39,8 @@
 
 namespace dbabstract
 {
+    class MaterializedResultSet;
+
     /**
      * A ResultSet object is not updatable and has a cursor that
      * moves forward only. Thus, you can iterate through it only
@@ -70,6 +75,29 @@ namespace dbabstract
         virtual unsigned int findColumn(const char *field) const = 0;
         virtual unsigned long recordCount(void) const = 0;
 
+        /**
+         * Returns the number of columns in each row, or zero if the
+         * driver cannot tell.
+         */
+        virtual unsigned int columnCount(void) const { return (0); }
+
+        /**
+         * Returns the name of column idx. The value returned should
+         * NOT be freed, and is only valid until the ResultSet is
+         * closed.
+         */
+        virtual const char *columnName(const unsigned int) const { return (NULL); }
+
+        /**
+         * Moves on to the next result of a batch (see
+         * Connection::executeBatch()) or of a stored procedure which
+         * returns several. Unread rows of the current result are
+         * discarded. A statement without rows gives a result with no
+         * columns. Returns false when there are no more results, or
+         * the next statement failed.
+         */
+        virtual bool nextResult(void) { return (false); }
+
         virtual const char *getString(const int idx) const = 0;
         virtual int getInteger(const int idx) const = 0;
         virtual bool getBool(const int idx) const = 0;
@@ -78,6 +106,17 @@ namespace dbabstract
         virtual float getFloat(const int idx) const = 0;
         virtual long getLong(const int idx) const = 0;
         virtual short getShort(const int idx) const = 0;
+
+        /**
+         * Reads the remaining rows into memory, returning a ResultSet
+         * over them which can rewind() and seek(), and be shared
+         * between threads. It does not refer to this ResultSet or its
+         * Connection, so both may be closed and released right away.
+         * Both ResultSets MUST be closed when done.
+         *
+         * @return MaterializedResultSet*
+         */
+        MaterializedResultSet *materialize(void);
     };
 
     /**
@@ -97,7 +136,7 @@ namespace dbabstract
     class Connection
     {
     public:
-        Connection(void) : ref(1) {};
+        Connection(void) : ref(1), observer_(defaultObserverSlot().load(std::memory_order_acquire)) {};
         virtual ~Connection(void) {};
 
         /**
@@ -121,6 +160,24 @@ namespace dbabstract
          */
         virtual bool open(const char *database, const char *host, const int port, const char *user, const char *pass) = 0;
 
+        /**
+         * Open a connection to a database described by options, which
+         * may also carry settings of the driver. Options the driver
+         * does not know are written to std::cerr and otherwise ignored.
+         *
+         * @return bool True if successful.
+         */
+        virtual bool open(const ConnectionOptions &options)
+        {
+            reportUnknown(options);
+            return (open(options.get("database"), options.get("host"), (int) options.getLong("port", 0), options.get("user"), options.get("password")));
+        }
+
+        /**
+         * Returns the options open() would ignore.
+         */
+        virtual std::vector<std::string> unknownOptions(const ConnectionOptions &options) const { return (options.unknown(NULL)); }
+
         /**
          * Close the database connection
          *
@@ -160,6 +217,19 @@ namespace dbabstract
          */
         virtual ResultSet *executeQuery(const char *sql) = 0;
 
+        /**
+         * Sends several statements, separated by ';', in a single
+         * round trip. The ResultSet holds the result of the first
+         * statement; ResultSet::nextResult() steps through the rest
+         * in order. Zero is returned if the first statement fails, or
+         * the driver cannot batch statements.
+         *
+         * @param sql
+         *
+         * @return ResultSet*
+         */
+        virtual ResultSet *executeBatch(const char *) { return (NULL); }
+
         /**
          * Returns a database specific escaped string from the input.
          * The string returned must be freed by the caller.  This is
@@ -250,6 +320,93 @@ namespace dbabstract
          */
         virtual const char *version(void) const = 0;
 
+        enum ASYNC_STATUS {
+            ASYNC_UNSUPPORTED, /** driver has no non-blocking path */
+            ASYNC_WANT_READ, /** wait until socket() is readable */
+            ASYNC_WANT_WRITE, /** wait until socket() is writable */
+            ASYNC_DONE, /** statement completed, call finishQuery() */
+            ASYNC_FAILED /** statement failed, see errormsg() */
+        };
+
+        /**
+         * Returns the file descriptor of the underlying network
+         * connection, so it may be watched by an event loop. Drivers
+         * without one (or not yet connected) return -1.
+         *
+         * @return int
+         */
+        virtual int socket(void) { return (-1); }
+
+        /**
+         * Starts executing a statement without blocking. When
+         * ASYNC_WANT_READ or ASYNC_WANT_WRITE is returned, the caller
+         * waits on socket() and then calls continueQuery(). Drivers
+         * which can only block return ASYNC_UNSUPPORTED, and the
+         * caller must fall back to execute() or executeQuery().
+         *
+         * Only one asynchronous statement may be in flight on a
+         * Connection at a time.
+         *
+         * @param sql
+         *
+         * @return ASYNC_STATUS
+         */
+        virtual enum ASYNC_STATUS startQuery(const char *) { return (ASYNC_UNSUPPORTED); }
+
+        /**
+         * Advances the statement started by startQuery().
+         *
+         * @return ASYNC_STATUS
+         */
+        virtual enum ASYNC_STATUS continueQuery(void) { return (ASYNC_UNSUPPORTED); }
+
+        /**
+         * Returns the row data of a statement which completed with
+         * ASYNC_DONE, or NULL when it produced no rows. The ResultSet
+         * must be closed by the caller.
+         *
+         * @return ResultSet*
+         */
+        virtual ResultSet *finishQuery(void) { return (NULL); }
+
+        /**
+         * Abandons the statement started by startQuery(), asking the
+         * server to cancel it when possible. Afterwards the Connection
+         * is ready for a new statement, unless the driver can only
+         * abandon it by dropping the connection (MySQL): then
+         * isConnected() is false until it is opened again. It may
+         * block while it asks the server.
+         *
+         * @return bool True if the statement was abandoned.
+         */
+        virtual bool cancelQuery(void) { return (false); }
+
+        /**
+         * Attaches an observer receiving the work of this Connection,
+         * or detaches it with NULL. The observer is not owned, and
+         * must outlive its use. While none is attached, observing
+         * costs the drivers a test of a NULL pointer per call.
+         *
+         * Connections wrapping others pass it on to them.
+         *
+         * @param observer
+         */
+        virtual void setObserver(ConnectionObserver *observer) { observer_ = observer; }
+
+        ConnectionObserver *observer(void) const { return (observer_); }
+
+        /**
+         * Sets the observer attached to every Connection created from
+         * now on, to trace an application without changing the places
+         * which create them. Existing Connections are unaffected.
+         *
+         * @param observer
+         */
+        static void setDefaultObserver(ConnectionObserver *observer)
+        {
+            defaultObserverSlot().store(observer, std::memory_order_release);
+        }
+
 #ifndef STATIC
 
         typedef Connection* (*Connection_Creator) (void);
@@ -269,9 +426,9 @@ namespace dbabstract
         static Connection *
         factory(const char *db_dll_name)
         {
-            void *handle_ = dlopen(db_dll_name, 0);
+            void *handle_ = dlopen(db_dll_name, RTLD_NOW);
             if (!handle_) {
-                std::cerr << "Cannot load shared library." << std::endl;
+                std::cerr << "Cannot load shared library: " << dlerror() << std::endl;
                 throw new std::exception;
             }
 
@@ -308,6 +465,23 @@ namespace dbabstract
         }
 
         long ref;
+
+    protected:
+        /**
+         * Writes the options this driver ignores to std::cerr.
+         *
+         * @return bool True if there were none.
+         */
+        bool reportUnknown(const ConnectionOptions &options) const
+        {
+            std::vector<std::string> unknown = unknownOptions(options);
+            for (size_t i=0; i<unknown.size(); i++) {
+                std::cerr << "Unknown connection option for " << version() << ": " << unknown[i] << std::endl;
+            }
+            return (unknown.empty());
+        }
+
+        ConnectionObserver *observer_;
     };
 
     inline std::ostream &unixtime_impl(std::ostream &Out, Connection& conn_, const time_t ut)
@@ -362,5 +536,7 @@ namespace dbabstract
     };
 }; /* namespace */
 
+// defines ResultSet::materialize()
+#include "dbabstract/materialized.h"
 #endif
 
@@ -0,0 +1,257 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _EXECUTOR_H
+#define _EXECUTOR_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/materialized.h"
+#include "dbabstract/statement.h"
+
+namespace dbabstract
+{
+    /**
+     * Runs statements on a fixed set of worker threads, each owning
+     * its own Connection, and hands back their MaterializedResult
+     * through a std::future.
+     *
+     * Jobs with a higher priority run first; jobs of equal priority
+     * run in submission order. The queue is bounded: query() and
+     * execute() block while it is full, and tryQuery()/tryExecute()
+     * fail instead.
+     *
+     * The factory is called on each worker thread to open that
+     * worker's Connection. If it returns NULL, the job fails and the
+     * worker tries again on its next job.
+     */
+    class QueryExecutor
+    {
+    private:
+        QueryExecutor(const QueryExecutor &old);
+        const QueryExecutor &operator=(const QueryExecutor &old);
+
+    public:
+        typedef std::function<Connection *(void)> Factory;
+
+        /**
+         * @param factory Creates and opens a Connection.
+         * @param workers Number of worker threads (and Connections).
+         * @param maxQueue Jobs which may wait before submitters block.
+         */
+        QueryExecutor(const Factory &factory, unsigned int workers, size_t maxQueue = 1024)
+            : factory_(factory)
+            , maxQueue_(maxQueue ? maxQueue : 1)
+            , sequence_(0)
+            , stopping_(false)
+        {
+            if (workers == 0) workers = 1;
+            for (unsigned int i=0; i<workers; i++) {
+                threads_.push_back(std::thread(&QueryExecutor::run, this));
+            }
+        }
+
+        /**
+         * Finishes the queued jobs, then closes the Connections.
+         */
+        ~QueryExecutor()
+        {
+            shutdown();
+        }
+
+        /**
+         * Queues a statement returning row data.
+         */
+        std::future<MaterializedResult> query(const Statement &stmt, int priority = 0)
+        {
+            std::future<MaterializedResult> f;
+            enqueue(stmt, true, priority, true, f);
+            return (f);
+        }
+
+        /**
+         * Queues a statement whose row data, if any, is discarded.
+         */
+        std::future<MaterializedResult> execute(const Statement &stmt, int priority = 0)
+        {
+            std::future<MaterializedResult> f;
+            enqueue(stmt, false, priority, true, f);
+            return (f);
+        }
+
+        /**
+         * Like query(), but returns false instead of blocking when the
+         * queue is full.
+         */
+        bool tryQuery(const Statement &stmt, std::future<MaterializedResult> &result, int priority = 0)
+        {
+            return (enqueue(stmt, true, priority, false, result));
+        }
+
+        bool tryExecute(const Statement &stmt, std::future<MaterializedResult> &result, int priority = 0)
+        {
+            return (enqueue(stmt, false, priority, false, result));
+        }
+
+        /**
+         * Returns the number of jobs waiting for a worker.
+         */
+        size_t queued(void) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return (jobs_.size());
+        }
+
+        size_t workers(void) const { return (threads_.size()); }
+
+        /**
+         * Stops accepting jobs, runs the ones already queued and
+         * joins the workers. Jobs submitted afterwards fail.
+         */
+        void shutdown(void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stopping_ && threads_.empty()) return;
+                stopping_ = true;
+            }
+            ready_.notify_all();
+            space_.notify_all();
+            for (size_t i=0; i<threads_.size(); i++) {
+                threads_[i].join();
+            }
+            threads_.clear();
+        }
+
+    private:
+        struct Job
+        {
+            Job(const Statement &s) : stmt(s) {}
+
+            Statement stmt;
+            bool rows;
+            int priority;
+            unsigned long sequence;
+            std::shared_ptr<std::promise<MaterializedResult> > promise;
+        };
+
+        struct Order
+        {
+            bool operator()(const std::shared_ptr<Job> &a, const std::shared_ptr<Job> &b) const
+            {
+                if (a->priority != b->priority) return (a->priority < b->priority);
+                return (a->sequence > b->sequence);
+            }
+        };
+
+        bool enqueue(const Statement &stmt, bool rows, int priority, bool wait, std::future<MaterializedResult> &result)
+        {
+            std::shared_ptr<Job> job(new Job(stmt));
+            job->rows = rows;
+            job->priority = priority;
+            job->promise.reset(new std::promise<MaterializedResult>);
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (!wait && jobs_.size() >= maxQueue_ && !stopping_) {
+                    return (false);
+                }
+                space_.wait(lock, [this]() { return (stopping_ || jobs_.size() < maxQueue_); });
+                result = job->promise->get_future();
+                if (stopping_) {
+                    job->promise->set_value(MaterializedResult::failure(0, "QueryExecutor is shut down"));
+                    return (true);
+                }
+                job->sequence = sequence_++;
+                jobs_.push(job);
+            }
+            ready_.notify_one();
+            return (true);
+        }
+
+        void run(void)
+        {
+            Connection *conn = NULL;
+
+            for (;;) {
+                std::shared_ptr<Job> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    ready_.wait(lock, [this]() { return (stopping_ || !jobs_.empty()); });
+                    if (jobs_.empty()) break;
+                    job = jobs_.top();
+                    jobs_.pop();
+                }
+                space_.notify_one();
+
+                if (!conn) conn = factory_();
+                job->promise->set_value(perform(conn, *job));
+            }
+
+            if (conn) conn->release();
+        }
+
+        static MaterializedResult perform(Connection *conn, const Job &job)
+        {
+            if (!conn) {
+                return (MaterializedResult::failure(0, "could not open a Connection"));
+            }
+
+            std::string sql;
+            if (!job.stmt.toSql(*conn, sql)) {
+                return (MaterializedResult::failure(0, "not enough values bound to the statement"));
+            }
+
+            if (!job.rows) {
+                if (!conn->execute(sql.c_str())) {
+                    return (MaterializedResult::failure(conn->errorno(), conn->errormsg()));
+                }
+                return (MaterializedResult::success(conn->insertId()));
+            }
+
+            ResultSet *rs = conn->executeQuery(sql.c_str());
+            if (!rs) {
+                return (MaterializedResult::failure(conn->errorno(), conn->errormsg()));
+            }
+            MaterializedResult result = MaterializedResult::fromResultSet(rs);
+            rs->close();
+            return (result);
+        }
+
+        Factory factory_;
+        size_t maxQueue_;
+        unsigned long sequence_;
+        bool stopping_;
+        std::priority_queue<std::shared_ptr<Job>, std::vector<std::shared_ptr<Job> >, Order> jobs_;
+        std::vector<std::thread> threads_;
+        mutable std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+    };
+}; /* namespace */
+
+#endif
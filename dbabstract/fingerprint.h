@@ -0,0 +1,242 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _FINGERPRINT_H
+#define _FINGERPRINT_H
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "dbabstract/sqlscan.h"
+
+namespace dbabstract
+{
+    namespace sqlscan
+    {
+        enum {
+            FP_SPACE = 1,
+            FP_DIGIT = 2,
+            FP_WORD = 4, /** letters, digits, _, $ and UTF-8 bytes */
+            FP_OP = 8, /** characters of operators */
+            FP_PREFIX = 16 /** E'', N'', X'' and B'' strings */
+        };
+
+        /**
+         * Character classes for fingerprint(), looked up instead of
+         * calling the ctype functions for every character.
+         */
+        inline const unsigned char *fingerprintClasses(void)
+        {
+            static const struct Table {
+                Table()
+                {
+                    for (int c=0; c<256; c++) {
+                        cls[c] = 0;
+                        if (isspace(c)) cls[c] |= FP_SPACE;
+                        if (isdigit(c)) cls[c] |= FP_DIGIT;
+                        if (isWordChar((char) c) || c >= 128) cls[c] |= FP_WORD;
+                        if (c && strchr("<>=!|&+-*/%^~:@#", c)) cls[c] |= FP_OP;
+                        if (c && strchr("eEnNxXbB", c)) cls[c] |= FP_PREFIX;
+                    }
+                }
+                unsigned char cls[256];
+            } table;
+            return (table.cls);
+        }
+
+        /**
+         * Reduces a statement to the shape it has whatever values were
+         * interpolated into it, so that statistics can be grouped per
+         * statement, and returns a 64-bit hash (FNV-1a) of that shape.
+         *
+         * The statement is read once, and written to out as tokens
+         * separated by single spaces: comments are dropped, words
+         * outside quotes are folded to lower case, string and numeric
+         * literals (including a leading minus sign, E'', N'', X''
+         * and B'' strings) and $n / ? parameters become ?, IN lists of
+         * values become "in (...)", and repeated rows of VALUES are
+         * written once. Quoted identifiers are kept as they are.
+         *
+         *   SELECT * FROM t WHERE id IN (1, 2, 3) AND name = 'bob'
+         *   select * from t where id in (...) and name = ?
+         *
+         * @param sql The statement.
+         * @param out Receives the fingerprint; reusing one string
+         *            between calls avoids allocating.
+         *
+         * @return uint64_t The hash of out.
+         */
+        inline uint64_t fingerprint(const char *sql, std::string &out)
+        {
+            enum TOKEN { NONE, WORD, VALUE, OPEN, SEP, OP };
+            enum { MAX_DEPTH = 32 };
+            size_t opens[MAX_DEPTH]; // where each open parenthesis was written
+            bool inList[MAX_DEPTH];
+            int depth = 0;
+            enum TOKEN prev = NONE;
+            bool afterDot = false;
+            bool afterIn = false;
+
+            const unsigned char *cls = fingerprintClasses();
+            auto is = [cls](char ch, int what) { return ((cls[(unsigned char) ch] & what) != 0); };
+
+            out.clear();
+            const char *p = sql;
+
+            while (*p) {
+                unsigned char c = (unsigned char) *p;
+
+                if (is(c, FP_SPACE)) {
+                    p++;
+                    continue;
+                }
+                if (c == '-' && p[1] == '-') {
+                    while (*p && *p != '\n') p++;
+                    continue;
+                }
+                if (c == '/' && p[1] == '*') {
+                    p += 2;
+                    while (*p && !(p[0] == '*' && p[1] == '/')) p++;
+                    if (*p) p += 2;
+                    continue;
+                }
+
+                const char *tok = "?";
+                size_t len = 1;
+                enum TOKEN kind = VALUE;
+                bool prefixed = (is(c, FP_PREFIX) && p[1] == '\'' && (p == sql || !is(p[-1], FP_WORD)));
+
+                if (c == '\'' || prefixed) {
+                    if (prefixed) p++;
+                    for (p++; *p; p++) {
+                        if (*p == '\\' && p[1]) {
+                            p++;
+                        } else if (*p == '\'') {
+                            if (p[1] != '\'') break;
+                            p++;
+                        }
+                    }
+                    if (*p) p++;
+                } else if (c == '"' || c == '`') {
+                    tok = p;
+                    for (p++; *p && (unsigned char) *p != c; p++) {}
+                    if (*p) p++;
+                    len = p - tok;
+                } else if (is(c, FP_DIGIT) || (c == '.' && is(p[1], FP_DIGIT)) ||
+                           ((c == '-' || c == '+') && prev != WORD && prev != VALUE &&
+                            (is(p[1], FP_DIGIT) || (p[1] == '.' && is(p[2], FP_DIGIT))))) {
+                    // numbers, hex and exponents, with a sign where no operand precedes it
+                    for (p++; *p; p++) {
+                        if ((*p == '-' || *p == '+') && (p[-1] == 'e' || p[-1] == 'E') && is(p[1], FP_DIGIT)) continue;
+                        if ((!is(*p, FP_WORD) || *p == '_' || *p == '$') && *p != '.') break;
+                    }
+                } else if (c == '$' && is(p[1], FP_DIGIT)) {
+                    for (p++; is(*p, FP_DIGIT); p++) {}
+                } else if (c == '?') {
+                    p++;
+                } else if (is(c, FP_WORD)) {
+                    tok = p;
+                    while (is(*p, FP_WORD)) p++;
+                    len = p - tok;
+                    kind = WORD;
+                } else if (c == '(' || c == ')' || c == ',' || c == ';' || c == '.') {
+                    tok = p++;
+                    kind = (c == '(' ? OPEN : c == ')' ? VALUE : SEP);
+                } else {
+                    tok = p;
+                    for (p++; is(*p, FP_OP); p++) {
+                        if ((p[0] == '-' && p[1] == '-') || (p[0] == '/' && p[1] == '*')) break;
+                        // the sign of a number: a >= -1
+                        if ((p[0] == '-' || p[0] == '+') && (is(p[1], FP_DIGIT) || p[1] == '.')) break;
+                    }
+                    len = p - tok;
+                    kind = OP;
+                }
+
+                if (c == ')' && depth > 0 && --depth < MAX_DEPTH) {
+                    size_t start = opens[depth];
+                    bool values = (out.size() > start + 1);
+                    for (size_t i=start+1; values && i<out.size(); i++) {
+                        values = (out[i] == '?' || out[i] == ',' || out[i] == ' ');
+                    }
+                    if (values && inList[depth]) {
+                        out.resize(start + 1);
+                        out += "...)";
+                        prev = VALUE;
+                        continue;
+                    }
+                    // a row of values repeating the row before it
+                    size_t row = out.size() - start;
+                    if (values && start >= row + 3 && out[start - 3] == ')' && out.compare(start - 2, 2, ", ") == 0 &&
+                        out.compare(start - 3 - row, row, out, start, row) == 0) {
+                        out.resize(start - 2);
+                        prev = VALUE;
+                        continue;
+                    }
+                }
+
+                if (!out.empty() && prev != OPEN && !afterDot && kind != SEP && c != ')') {
+                    out += ' ';
+                }
+                if (kind == OPEN) {
+                    if (depth < MAX_DEPTH) {
+                        opens[depth] = out.size();
+                        inList[depth] = (prev == WORD && afterIn);
+                    }
+                    depth++;
+                }
+                size_t at = out.size();
+                out.append(tok, len);
+                if (kind == WORD) {
+                    for (size_t i=at; i<out.size(); i++) {
+                        if (out[i] >= 'A' && out[i] <= 'Z') out[i] += 'a' - 'A';
+                    }
+                    afterIn = (len == 2 && out[at] == 'i' && out[at + 1] == 'n');
+                }
+                afterDot = (c == '.' && kind == SEP);
+                prev = kind;
+            }
+
+            // a trailing semicolon does not change the statement
+            while (!out.empty() && out[out.size() - 1] == ';') {
+                out.resize(out.size() - 1);
+            }
+
+            uint64_t hash = 14695981039346656037ULL;
+            for (size_t i=0; i<out.size(); i++) {
+                hash ^= (unsigned char) out[i];
+                hash *= 1099511628211ULL;
+            }
+            return (hash);
+        }
+
+        /**
+         * Returns the hash of the fingerprint of sql only.
+         */
+        inline uint64_t fingerprint(const char *sql)
+        {
+            static thread_local std::string out;
+            return (fingerprint(sql, out));
+        }
+    }; /* namespace */
+}; /* namespace */
+
+#endif
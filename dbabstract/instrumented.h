@@ -0,0 +1,837 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _INSTRUMENTED_H
+#define _INSTRUMENTED_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/fingerprint.h"
+
+namespace dbabstract
+{
+    /**
+     * A histogram of durations in nanoseconds with a bounded relative
+     * error, in the manner of HdrHistogram: values below 64 have a
+     * bucket each, and every power of two above that is split into 32
+     * buckets, so a bucket is never wider than 1/32 of its values.
+     * Values of 2^40 ns (about 18 minutes) and more share the last
+     * bucket.
+     */
+    class LatencyHistogram
+    {
+    public:
+        enum {
+            SUB_BITS = 5,
+            SUB = 1 << SUB_BITS,
+            MAX_BITS = 40,
+            BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB
+        };
+
+        LatencyHistogram()
+            : counts_(BUCKETS, 0)
+            , total_(0)
+            , sum_(0)
+            , min_(0)
+            , max_(0) {}
+
+        static size_t bucketOf(uint64_t ns)
+        {
+            if (ns < 2 * SUB) return ((size_t) ns);
+            if (ns >> MAX_BITS) return (BUCKETS - 1);
+            int msb = 63 - __builtin_clzll(ns);
+            int shift = msb - SUB_BITS;
+            return ((size_t) ((shift + 1) * SUB + (int) (ns >> shift) - SUB));
+        }
+
+        /**
+         * Returns the smallest value counted in bucket idx.
+         */
+        static uint64_t lowestOf(size_t idx)
+        {
+            if (idx < 2 * SUB) return (idx);
+            int shift = (int) (idx / SUB) - 1;
+            return ((uint64_t) (idx % SUB + SUB) << shift);
+        }
+
+        /**
+         * Returns the largest value counted in bucket idx.
+         */
+        static uint64_t highestOf(size_t idx)
+        {
+            if (idx + 1 >= BUCKETS) return (UINT64_MAX);
+            return (lowestOf(idx + 1) - 1);
+        }
+
+        void record(uint64_t ns, uint64_t times = 1)
+        {
+            if (!times) return;
+            counts_[bucketOf(ns)] += times;
+            if (!total_ || ns < min_) min_ = ns;
+            if (ns > max_) max_ = ns;
+            total_ += times;
+            sum_ += ns * times;
+        }
+
+        void merge(const LatencyHistogram &other)
+        {
+            if (!other.total_) return;
+            for (size_t i=0; i<BUCKETS; i++) {
+                counts_[i] += other.counts_[i];
+            }
+            if (!total_ || other.min_ < min_) min_ = other.min_;
+            if (other.max_ > max_) max_ = other.max_;
+            total_ += other.total_;
+            sum_ += other.sum_;
+        }
+
+        /**
+         * Adds a bucket count directly; used when collecting the
+         * per-thread recorders.
+         */
+        void addBucket(size_t idx, uint64_t times) { counts_[idx] += times; }
+
+        /**
+         * Sets the totals after addBucket() calls.
+         */
+        void setTotals(uint64_t total, uint64_t sum, uint64_t min, uint64_t max)
+        {
+            total_ = total;
+            sum_ = sum;
+            min_ = min;
+            max_ = max;
+        }
+
+        uint64_t count(void) const { return (total_); }
+        uint64_t sum(void) const { return (sum_); }
+        uint64_t min(void) const { return (min_); }
+        uint64_t max(void) const { return (max_); }
+        uint64_t bucket(size_t idx) const { return (counts_[idx]); }
+
+        double mean(void) const
+        {
+            return (total_ ? (double) sum_ / total_ : 0.0);
+        }
+
+        /**
+         * Returns the value below which p (0..100) percent of the
+         * recorded values fall, rounded up to the end of its bucket.
+         */
+        uint64_t percentile(double p) const
+        {
+            if (!total_) return (0);
+            uint64_t rank = (uint64_t) (p / 100.0 * total_ + 0.5);
+            if (rank < 1) rank = 1;
+            if (rank > total_) rank = total_;
+
+            uint64_t seen = 0;
+            for (size_t i=0; i<BUCKETS; i++) {
+                seen += counts_[i];
+                if (seen >= rank) {
+                    uint64_t v = highestOf(i);
+                    if (v > max_) v = max_;
+                    if (v < min_) v = min_;
+                    return (v);
+                }
+            }
+            return (max_);
+        }
+
+    private:
+        std::vector<uint64_t> counts_;
+        uint64_t total_;
+        uint64_t sum_;
+        uint64_t min_;
+        uint64_t max_;
+    };
+
+    /**
+     * Counters and latency histograms shared by any number of
+     * InstrumentedConnection objects, e.g. all connections of one
+     * service.
+     *
+     * Each thread records into a recorder of its own, with plain
+     * atomic loads and stores and no locks, so recording never waits
+     * on another thread. snapshot() adds the recorders up, and may be
+     * called from any thread at any time. When a thread exits, its
+     * recorders are folded into the totals and dropped.
+     */
+    class InstrumentedStats
+    {
+    private:
+        InstrumentedStats(const InstrumentedStats &old);
+        const InstrumentedStats &operator=(const InstrumentedStats &old);
+
+    public:
+        enum TIMER {
+            EXECUTE, /** execute() */
+            QUERY, /** executeQuery(), up to the ResultSet */
+            FIRST_ROW, /** executeQuery() up to the first row */
+            FETCH, /** all next() calls of one ResultSet */
+            TRANSACTION, /** beginTrans() up to commit or rollback */
+            TIMERS
+        };
+
+        /**
+         * The totals of one statement fingerprint (see
+         * sqlscan::fingerprint()).
+         */
+        struct StatementTotals
+        {
+            StatementTotals() : calls(0), errors(0), rows(0), ns(0), maxNs(0) {}
+
+            std::string text; /** the fingerprint */
+            uint64_t calls;
+            uint64_t errors;
+            uint64_t rows;
+            uint64_t ns; /** in the statement, and fetching its rows */
+            uint64_t maxNs; /** the slowest statement, without fetching */
+
+            void merge(const StatementTotals &other)
+            {
+                if (text.empty()) text = other.text;
+                calls += other.calls;
+                errors += other.errors;
+                rows += other.rows;
+                ns += other.ns;
+                if (other.maxNs > maxNs) maxNs = other.maxNs;
+            }
+        };
+
+        /**
+         * The totals at one point in time. Snapshots of several
+         * InstrumentedStats, or several processes, may be merged.
+         */
+        struct Snapshot
+        {
+            Snapshot() : rows(0), bytes(0), resultSets(0), commits(0), rollbacks(0) {}
+
+            LatencyHistogram timers[TIMERS];
+            uint64_t rows;
+            uint64_t bytes;
+            uint64_t resultSets;
+            uint64_t commits;
+            uint64_t rollbacks;
+            std::map<unsigned int, uint64_t> errors; /** by errorno() */
+            std::map<uint64_t, StatementTotals> statements; /** by fingerprint hash */
+
+            uint64_t errorCount(void) const
+            {
+                uint64_t n = 0;
+                for (std::map<unsigned int, uint64_t>::const_iterator i = errors.begin(); i != errors.end(); ++i) {
+                    n += i->second;
+                }
+                return (n);
+            }
+
+            void merge(const Snapshot &other)
+            {
+                for (int t=0; t<TIMERS; t++) {
+                    timers[t].merge(other.timers[t]);
+                }
+                rows += other.rows;
+                bytes += other.bytes;
+                resultSets += other.resultSets;
+                commits += other.commits;
+                rollbacks += other.rollbacks;
+                for (std::map<unsigned int, uint64_t>::const_iterator i = other.errors.begin(); i != other.errors.end(); ++i) {
+                    errors[i->first] += i->second;
+                }
+                for (std::map<uint64_t, StatementTotals>::const_iterator i = other.statements.begin(); i != other.statements.end(); ++i) {
+                    statements[i->first].merge(i->second);
+                }
+            }
+        };
+
+        InstrumentedStats() : id_(nextId()), registry_(std::make_shared<Registry>()) {}
+
+        void record(enum TIMER timer, uint64_t ns)
+        {
+            local()->timers[timer].record(ns);
+        }
+
+        /**
+         * Counts a closed ResultSet and what was fetched from it.
+         */
+        void addResult(uint64_t rows, uint64_t bytes)
+        {
+            Recorder *r = local();
+            bump(r->resultSets, 1);
+            bump(r->rows, rows);
+            bump(r->bytes, bytes);
+        }
+
+        void addTransaction(bool committed, uint64_t ns)
+        {
+            Recorder *r = local();
+            r->timers[TRANSACTION].record(ns);
+            bump(committed ? r->commits : r->rollbacks, 1);
+        }
+
+        /**
+         * Counts an error. Errors are rare, so the table is kept
+         * behind a lock no other thread takes outside snapshot().
+         */
+        void addError(unsigned int code)
+        {
+            Recorder *r = local();
+            std::lock_guard<std::mutex> lock(r->lock);
+            r->errors[code]++;
+        }
+
+        /**
+         * Adds to the totals of a statement fingerprint. text is only
+         * copied the first time this thread sees the hash, and may be
+         * NULL when only adding the rows fetched later on.
+         */
+        void addStatement(uint64_t hash, const std::string *text, uint64_t calls, uint64_t ns, uint64_t rows, bool failed)
+        {
+            Recorder *r = local();
+            std::lock_guard<std::mutex> lock(r->lock);
+            StatementTotals &t = r->statements[hash];
+            if (text && t.text.empty()) t.text = *text;
+            t.calls += calls;
+            t.rows += rows;
+            t.ns += ns;
+            if (calls && ns > t.maxNs) t.maxNs = ns;
+            if (failed) t.errors++;
+        }
+
+        Snapshot snapshot(void) const
+        {
+            std::lock_guard<std::mutex> lock(registry_->mutex);
+            Snapshot s = registry_->retired;
+            for (size_t i=0; i<registry_->recorders.size(); i++) {
+                collect(*registry_->recorders[i], s);
+            }
+            return (s);
+        }
+
+    private:
+        /**
+         * A counter with a single writer: a relaxed load and store
+         * is enough, and cheaper than an atomic increment.
+         */
+        static void bump(std::atomic<uint64_t> &c, uint64_t n)
+        {
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        struct AtomicHistogram
+        {
+            AtomicHistogram() : counts(LatencyHistogram::BUCKETS), total(0), sum(0), min(UINT64_MAX), max(0)
+            {
+                for (size_t i=0; i<counts.size(); i++) counts[i].store(0, std::memory_order_relaxed);
+            }
+
+            void record(uint64_t ns)
+            {
+                bump(counts[LatencyHistogram::bucketOf(ns)], 1);
+                if (ns < min.load(std::memory_order_relaxed)) min.store(ns, std::memory_order_relaxed);
+                if (ns > max.load(std::memory_order_relaxed)) max.store(ns, std::memory_order_relaxed);
+                bump(sum, ns);
+                bump(total, 1);
+            }
+
+            /**
+             * Copies into h; a record() running meanwhile may be
+             * seen in part.
+             */
+            void collect(LatencyHistogram &h) const
+            {
+                uint64_t n = 0;
+                for (size_t i=0; i<counts.size(); i++) {
+                    uint64_t c = counts[i].load(std::memory_order_relaxed);
+                    if (c) h.addBucket(i, c);
+                    n += c;
+                }
+                if (n) h.setTotals(n, sum.load(std::memory_order_relaxed), min.load(std::memory_order_relaxed), max.load(std::memory_order_relaxed));
+            }
+
+            std::vector<std::atomic<uint64_t> > counts;
+            std::atomic<uint64_t> total;
+            std::atomic<uint64_t> sum;
+            std::atomic<uint64_t> min;
+            std::atomic<uint64_t> max;
+        };
+
+        struct Recorder
+        {
+            Recorder() : rows(0), bytes(0), resultSets(0), commits(0), rollbacks(0) {}
+
+            AtomicHistogram timers[TIMERS];
+            std::atomic<uint64_t> rows;
+            std::atomic<uint64_t> bytes;
+            std::atomic<uint64_t> resultSets;
+            std::atomic<uint64_t> commits;
+            std::atomic<uint64_t> rollbacks;
+            mutable std::mutex lock; // for errors and statements
+            std::map<unsigned int, uint64_t> errors;
+            std::unordered_map<uint64_t, StatementTotals> statements;
+        };
+
+        /**
+         * The recorders of one InstrumentedStats. Threads hold on to
+         * it too, so it lives until the stats and every thread which
+         * recorded into them have let go.
+         */
+        struct Registry
+        {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<Recorder> > recorders;
+            Snapshot retired; /** what the recorders of exited threads counted */
+        };
+
+        static void collect(const Recorder &r, Snapshot &s)
+        {
+            for (int t=0; t<TIMERS; t++) {
+                LatencyHistogram h;
+                r.timers[t].collect(h);
+                s.timers[t].merge(h);
+            }
+            s.rows += r.rows.load(std::memory_order_relaxed);
+            s.bytes += r.bytes.load(std::memory_order_relaxed);
+            s.resultSets += r.resultSets.load(std::memory_order_relaxed);
+            s.commits += r.commits.load(std::memory_order_relaxed);
+            s.rollbacks += r.rollbacks.load(std::memory_order_relaxed);
+            std::lock_guard<std::mutex> recorderLock(r.lock);
+            for (std::map<unsigned int, uint64_t>::const_iterator e = r.errors.begin(); e != r.errors.end(); ++e) {
+                s.errors[e->first] += e->second;
+            }
+            for (std::unordered_map<uint64_t, StatementTotals>::const_iterator st = r.statements.begin(); st != r.statements.end(); ++st) {
+                s.statements[st->first].merge(st->second);
+            }
+        }
+
+        /**
+         * Folds a recorder of an exiting thread into the retired
+         * totals, and frees it.
+         */
+        static void retire(Registry &registry, Recorder *r)
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            collect(*r, registry.retired);
+            for (size_t i=0; i<registry.recorders.size(); i++) {
+                if (registry.recorders[i].get() == r) {
+                    registry.recorders.erase(registry.recorders.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        /**
+         * The recorders of one thread, by the id of their stats.
+         */
+        struct ThreadRecorders
+        {
+            struct Entry
+            {
+                uint64_t id;
+                std::shared_ptr<Registry> registry;
+                Recorder *recorder;
+            };
+
+            ThreadRecorders() : lastId(0), last(NULL) {}
+
+            ~ThreadRecorders()
+            {
+                for (size_t i=0; i<entries.size(); i++) {
+                    retire(*entries[i].registry, entries[i].recorder);
+                }
+            }
+
+            uint64_t lastId;
+            Recorder *last;
+            std::vector<Entry> entries;
+        };
+
+        static uint64_t nextId(void)
+        {
+            static std::atomic<uint64_t> ids(0);
+            return (++ids);
+        }
+
+        /**
+         * Returns this thread's recorder, creating it on first use.
+         * Threads look recorders up by the id of the stats, never by
+         * address, so a new InstrumentedStats at a reused address gets
+         * fresh ones.
+         */
+        Recorder *local(void)
+        {
+            static thread_local ThreadRecorders mine;
+
+            if (mine.lastId == id_) return (mine.last);
+
+            Recorder *found = NULL;
+            for (std::vector<ThreadRecorders::Entry>::iterator i = mine.entries.begin(); i != mine.entries.end(); ) {
+                if (i->id == id_) {
+                    found = i->recorder;
+                    ++i;
+                } else if (i->registry.use_count() == 1) {
+                    // its InstrumentedStats is gone
+                    i = mine.entries.erase(i);
+                } else {
+                    ++i;
+                }
+            }
+            if (!found) {
+                found = new Recorder;
+                {
+                    std::lock_guard<std::mutex> lock(registry_->mutex);
+                    registry_->recorders.push_back(std::unique_ptr<Recorder>(found));
+                }
+                ThreadRecorders::Entry e = { id_, registry_, found };
+                mine.entries.push_back(e);
+            }
+            mine.lastId = id_;
+            mine.last = found;
+            return (found);
+        }
+
+        uint64_t id_;
+        std::shared_ptr<Registry> registry_;
+    };
+
+    /**
+     * Passes every call through to the ResultSet of the wrapped
+     * Connection, timing next() and counting the rows, and if asked
+     * to the bytes of their values. The totals are recorded when it
+     * is closed.
+     */
+    class InstrumentedResultSet : public ResultSet
+    {
+    public:
+        /**
+         * @param fingerprint The hash of the statement to add the
+         *                    fetch to, when non-zero.
+         * @param countBytes Whether to add up the length of every
+         *                   value fetched.
+         */
+        InstrumentedResultSet(ResultSet *rs, const std::shared_ptr<InstrumentedStats> &stats,
+                              std::chrono::steady_clock::time_point started, uint64_t fingerprint = 0,
+                              bool countBytes = false)
+            : rs_(rs)
+            , stats_(stats)
+            , started_(started)
+            , fingerprint_(fingerprint)
+            , countBytes_(countBytes)
+            , fetchNs_(0)
+            , rows_(0)
+            , bytes_(0) {}
+
+        ~InstrumentedResultSet()
+        {
+            rs_->close();
+            stats_->record(InstrumentedStats::FETCH, fetchNs_);
+            stats_->addResult(rows_, bytes_);
+            if (fingerprint_) stats_->addStatement(fingerprint_, NULL, 0, fetchNs_, rows_, false);
+        }
+
+        void *handle(void) { return (rs_->handle()); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = rs_->next();
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            fetchNs_ += std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+            if (ok) {
+                if (!rows_) {
+                    stats_->record(InstrumentedStats::FIRST_ROW, std::chrono::duration_cast<std::chrono::nanoseconds>(end - started_).count());
+                }
+                rows_++;
+                if (countBytes_) {
+                    unsigned int columns = rs_->columnCount();
+                    for (unsigned int i=0; i<columns; i++) {
+                        const char *v = rs_->getString(i);
+                        if (v) bytes_ += strlen(v);
+                    }
+                }
+            }
+            return (ok);
+        }
+
+        bool nextResult(void)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = rs_->nextResult();
+            fetchNs_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            return (ok);
+        }
+
+        unsigned int findColumn(const char *field) const { return (rs_->findColumn(field)); }
+        unsigned long recordCount(void) const { return (rs_->recordCount()); }
+        unsigned int columnCount(void) const { return (rs_->columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (rs_->columnName(idx)); }
+        const char *getString(const int idx) const { return (rs_->getString(idx)); }
+        int getInteger(const int idx) const { return (rs_->getInteger(idx)); }
+        bool getBool(const int idx) const { return (rs_->getBool(idx)); }
+        time_t getUnixTime(const int idx) const { return (rs_->getUnixTime(idx)); }
+        double getDouble(const int idx) const { return (rs_->getDouble(idx)); }
+        float getFloat(const int idx) const { return (rs_->getFloat(idx)); }
+        long getLong(const int idx) const { return (rs_->getLong(idx)); }
+        short getShort(const int idx) const { return (rs_->getShort(idx)); }
+
+    private:
+        ResultSet *rs_;
+        std::shared_ptr<InstrumentedStats> stats_;
+        std::chrono::steady_clock::time_point started_;
+        uint64_t fingerprint_;
+        bool countBytes_;
+        uint64_t fetchNs_;
+        uint64_t rows_;
+        uint64_t bytes_;
+    };
+
+    /**
+     * A Connection which passes every call through to another one and
+     * records how long statements, fetches and transactions take, how
+     * many rows and bytes come back, and which errors occur, into an
+     * InstrumentedStats that may be shared with other connections.
+     *
+     * It owns the wrapped Connection and release()s it when it is
+     * deleted. Like the drivers, it is used from one thread at a time.
+     */
+    class InstrumentedConnection : public Connection
+    {
+    private:
+        InstrumentedConnection(const InstrumentedConnection &old);
+        const InstrumentedConnection &operator=(const InstrumentedConnection &old);
+
+    public:
+        /**
+         * @param conn The Connection to wrap; it may be opened later
+         *             through this object.
+         * @param stats Where to record; a new InstrumentedStats when
+         *              not given.
+         */
+        InstrumentedConnection(Connection *conn, const std::shared_ptr<InstrumentedStats> &stats = std::shared_ptr<InstrumentedStats>())
+            : conn_(conn)
+            , stats_(stats ? stats : std::make_shared<InstrumentedStats>())
+            , fingerprinting_(false)
+            , countingBytes_(false)
+            , inTrans_(false)
+            , asyncFingerprint_(0) {}
+
+        ~InstrumentedConnection()
+        {
+            conn_->release();
+        }
+
+        const std::shared_ptr<InstrumentedStats> &stats(void) const { return (stats_); }
+        InstrumentedStats::Snapshot snapshot(void) const { return (stats_->snapshot()); }
+        Connection *connection(void) const { return (conn_); }
+
+        /**
+         * Also keeps totals per statement fingerprint, in
+         * Snapshot::statements. This costs a pass over the SQL text
+         * and an uncontended lock per statement.
+         */
+        void setFingerprinting(bool on) { fingerprinting_ = on; }
+
+        /**
+         * Also adds up the bytes of every value fetched, in
+         * Snapshot::bytes. This turns every value of every row into
+         * a string, so it is off by default.
+         */
+        void setCountingBytes(bool on) { countingBytes_ = on; }
+
+        std::vector<std::string> tables(void) const { return (conn_->tables()); }
+        void *handle(void) { return (conn_->handle()); }
+
+        bool open(const char *database, const char *host, const int port, const char *user, const char *pass)
+        {
+            bool ok = conn_->open(database, host, port, user, pass);
+            if (!ok) stats_->addError(conn_->errorno());
+            return (ok);
+        }
+
+        bool open(const ConnectionOptions &options)
+        {
+            bool ok = conn_->open(options);
+            if (!ok) stats_->addError(conn_->errorno());
+            return (ok);
+        }
+
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const { return (conn_->unknownOptions(options)); }
+        bool close(void) { return (conn_->close()); }
+        bool isConnected(void) { return (conn_->isConnected()); }
+
+        bool execute(const char *sql)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = conn_->execute(sql);
+            uint64_t ns = since(begin);
+            stats_->record(InstrumentedStats::EXECUTE, ns);
+            if (!ok) stats_->addError(conn_->errorno());
+            if (fingerprinting_) statement(sql, ns, !ok);
+            return (ok);
+        }
+
+        ResultSet *executeQuery(const char *sql)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            ResultSet *rs = conn_->executeQuery(sql);
+            uint64_t ns = since(begin);
+            stats_->record(InstrumentedStats::QUERY, ns);
+            if (!rs) stats_->addError(conn_->errorno());
+            uint64_t hash = (fingerprinting_ ? statement(sql, ns, !rs) : 0);
+            return (rs ? new InstrumentedResultSet(rs, stats_, begin, hash, countingBytes_) : NULL);
+        }
+
+        ResultSet *executeBatch(const char *sql)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            ResultSet *rs = conn_->executeBatch(sql);
+            uint64_t ns = since(begin);
+            stats_->record(InstrumentedStats::QUERY, ns);
+            if (!rs) stats_->addError(conn_->errorno());
+            uint64_t hash = (fingerprinting_ ? statement(sql, ns, !rs) : 0);
+            return (rs ? new InstrumentedResultSet(rs, stats_, begin, hash, countingBytes_) : NULL);
+        }
+
+        char *escape(const char *str) { return (conn_->escape(str)); }
+        const char *unixtimeToSql(const time_t t) { return (conn_->unixtimeToSql(t)); }
+        unsigned long insertId(void) { return (conn_->insertId()); }
+
+        bool beginTrans(void)
+        {
+            bool ok = conn_->beginTrans();
+            if (ok) {
+                inTrans_ = true;
+                transStarted_ = std::chrono::steady_clock::now();
+            } else {
+                stats_->addError(conn_->errorno());
+            }
+            return (ok);
+        }
+
+        bool commitTrans(void) { return (endTrans(true)); }
+        bool rollbackTrans(void) { return (endTrans(false)); }
+
+        bool setTransactionMode(const enum TRANS_MODE mode) { return (conn_->setTransactionMode(mode)); }
+        unsigned int errorno(void) const { return (conn_->errorno()); }
+        const char *errormsg(void) const { return (conn_->errormsg()); }
+        const char *version(void) const { return (conn_->version()); }
+
+        int socket(void) { return (conn_->socket()); }
+
+        /**
+         * An asynchronous query is timed from startQuery() to
+         * finishQuery().
+         */
+        enum ASYNC_STATUS startQuery(const char *sql)
+        {
+            asyncStarted_ = std::chrono::steady_clock::now();
+            asyncFingerprint_ = (fingerprinting_ ? sqlscan::fingerprint(sql, fingerprint_) : 0);
+            enum ASYNC_STATUS status = conn_->startQuery(sql);
+            if (status == ASYNC_FAILED) failAsync();
+            return (status);
+        }
+
+        enum ASYNC_STATUS continueQuery(void)
+        {
+            enum ASYNC_STATUS status = conn_->continueQuery();
+            if (status == ASYNC_FAILED) failAsync();
+            return (status);
+        }
+
+        ResultSet *finishQuery(void)
+        {
+            ResultSet *rs = conn_->finishQuery();
+            uint64_t ns = since(asyncStarted_);
+            stats_->record(InstrumentedStats::QUERY, ns);
+            if (!rs) stats_->addError(conn_->errorno());
+            if (asyncFingerprint_) stats_->addStatement(asyncFingerprint_, &fingerprint_, 1, ns, 0, !rs);
+            return (rs ? new InstrumentedResultSet(rs, stats_, asyncStarted_, asyncFingerprint_, countingBytes_) : NULL);
+        }
+
+        bool cancelQuery(void) { return (conn_->cancelQuery()); }
+
+        void setObserver(ConnectionObserver *observer)
+        {
+            observer_ = observer;
+            conn_->setObserver(observer);
+        }
+
+    private:
+        static uint64_t since(std::chrono::steady_clock::time_point begin)
+        {
+            return (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+        }
+
+        uint64_t statement(const char *sql, uint64_t ns, bool failed)
+        {
+            uint64_t hash = sqlscan::fingerprint(sql, fingerprint_);
+            stats_->addStatement(hash, &fingerprint_, 1, ns, 0, failed);
+            return (hash);
+        }
+
+        void failAsync(void)
+        {
+            stats_->addError(conn_->errorno());
+            if (asyncFingerprint_) stats_->addStatement(asyncFingerprint_, &fingerprint_, 1, since(asyncStarted_), 0, true);
+        }
+
+        bool endTrans(bool commit)
+        {
+            bool ok = (commit ? conn_->commitTrans() : conn_->rollbackTrans());
+            if (inTrans_) {
+                // a failed commit counts as a rollback
+                stats_->addTransaction(commit && ok, since(transStarted_));
+                inTrans_ = false;
+            }
+            if (!ok) stats_->addError(conn_->errorno());
+            return (ok);
+        }
+
+        Connection *conn_;
+        std::shared_ptr<InstrumentedStats> stats_;
+        bool fingerprinting_;
+        bool countingBytes_;
+        std::string fingerprint_;
+        bool inTrans_;
+        std::chrono::steady_clock::time_point transStarted_;
+        std::chrono::steady_clock::time_point asyncStarted_;
+        uint64_t asyncFingerprint_;
+    };
+}; /* namespace */
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _JSON_H
+#define _JSON_H
+
+#include <stdio.h>
+#include <string>
+
+namespace dbabstract
+{
+    namespace json
+    {
+        /**
+         * Appends str to out as a quoted JSON string. Bytes above 0x7f
+         * are copied as they are, so UTF-8 text stays readable.
+         */
+        inline void appendString(std::string &out, const char *str)
+        {
+            out += '"';
+            for (const unsigned char *p=(const unsigned char *) str; *p; p++) {
+                if (*p == '"' || *p == '\\') {
+                    out += '\\';
+                    out += (char) *p;
+                } else if (*p == '\n') {
+                    out += "\\n";
+                } else if (*p == '\t') {
+                    out += "\\t";
+                } else if (*p < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", *p);
+                    out += buf;
+                } else {
+                    out += (char) *p;
+                }
+            }
+            out += '"';
+        }
+    }; /* namespace */
+}; /* namespace */
+
+#endif
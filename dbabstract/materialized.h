@@ -0,0 +1,445 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _MATERIALIZED_H
+#define _MATERIALIZED_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbabstract/db.h"
+
+namespace dbabstract
+{
+    /**
+     * Converts a textual DATETIME or TIMESTAMP value into a time_t,
+     * following the same rules as the drivers' getUnixTime().
+     */
+    inline time_t sqlToUnixtime(const char *v)
+    {
+        struct tm tmp;
+
+        if (v && strlen(v)>=14) {
+            int Ypos = 0;
+            int Mpos = 4;
+            int Dpos = 6;
+            int hpos = 8;
+            int mpos = 10;
+            int spos = 12;
+            if (strchr(v, '-') != NULL) {
+                ++Mpos;
+                Dpos = 8;
+                hpos = 11;
+                mpos = 14;
+                spos = 17;
+            }
+            tmp.tm_wday = 0;
+            tmp.tm_yday = 0;
+            tmp.tm_isdst = 0;
+            tmp.tm_year = (((v[Ypos] - '0') * 1000) + ((v[Ypos+1] - '0') * 100) + ((v[Ypos+2] - '0') * 10) + (v[Ypos+3] - '0')) - 1900;
+            tmp.tm_mon = (((v[Mpos] - '0') * 10) + (v[Mpos+1] - '0')) - 1; /* 0 - 11 */
+            tmp.tm_mday = (((v[Dpos] - '0') * 10) + (v[Dpos+1] - '0')); /* 1 - 31 */
+            tmp.tm_hour = (((v[hpos] - '0') * 10) + (v[hpos+1] - '0')); /* 0 - 23 */
+            tmp.tm_min = (((v[mpos] - '0') * 10) + (v[mpos+1] - '0')); /* 0-59 */
+            tmp.tm_sec = (((v[spos] - '0') * 10) + (v[spos+1] - '0')); /* 0-59 */
+            return (mktime(&tmp));
+        }
+        return (0);
+    }
+
+    /**
+     * A ResultSet holding its rows on the client, which can go back
+     * to the start or to any row. Its getters convert the text of
+     * getString() the way the drivers do.
+     */
+    class RandomAccessResultSet : public ResultSet
+    {
+    public:
+        /**
+         * Moves before the first row, so next() starts over.
+         */
+        virtual void rewind(void) = 0;
+
+        /**
+         * Moves to row, counted from zero, as if next() had been
+         * called row + 1 times.
+         *
+         * @return bool False, leaving the position past the last row,
+         *              if there is no such row.
+         */
+        virtual bool seek(unsigned long row) = 0;
+
+        /**
+         * Returns the current row, -1 before the first one.
+         */
+        virtual long row(void) const = 0;
+
+        /**
+         * Returns a new ResultSet over the same rows, positioned
+         * before the first one, which may be used on another thread.
+         * It MUST be closed as well.
+         */
+        virtual RandomAccessResultSet *share(void) const = 0;
+
+        int getInteger(const int idx) const
+        {
+            const char *v = getString(idx);
+            return ((v ? atoi(v) : 0));
+        }
+
+        bool getBool(const int idx) const
+        {
+            const char *v = getString(idx);
+            if (v && (v[0] == '1' || v[0] == 't')) {
+                return (true);
+            }
+            return (false);
+        }
+
+        time_t getUnixTime(const int idx) const { return (sqlToUnixtime(getString(idx))); }
+
+        double getDouble(const int idx) const
+        {
+            const char *v = getString(idx);
+            return ((v ? strtod(v, NULL) : 0));
+        }
+
+        float getFloat(const int idx) const
+        {
+            const char *v = getString(idx);
+            return ((v ? (float) atof(v) : 0));
+        }
+
+        long getLong(const int idx) const
+        {
+            const char *v = getString(idx);
+            return ((v ? atol(v) : 0L));
+        }
+
+        short getShort(const int idx) const
+        {
+            const char *v = getString(idx);
+            return ((short) (v ? atoi(v) : 0));
+        }
+    };
+
+    /**
+     * The complete outcome of a statement, copied out of the driver:
+     * whether it succeeded, the error, and every row of the result.
+     * It does not refer to the Connection it came from, so it may be
+     * handed between threads; copies share the same immutable rows,
+     * which are freed with the last of them.
+     *
+     * The values of all rows are kept in one buffer, each followed by
+     * a NUL. Every row has the offset of its first value, a table of
+     * the offsets of its values within the row and a bitmap of its
+     * NULL columns, so a value is found without a search and a
+     * result takes a handful of allocations rather than one per cell.
+     */
+    class MaterializedResult
+    {
+    private:
+        struct Data;
+
+    public:
+        MaterializedResult() : ok_(false), errorno_(0), insertId_(0) {}
+
+        /**
+         * Reads all remaining rows of rs. The ResultSet is left open.
+         */
+        static MaterializedResult fromResultSet(ResultSet *rs)
+        {
+            MaterializedResult r;
+            std::shared_ptr<Data> data(new Data);
+
+            unsigned int cols = rs->columnCount();
+            for (unsigned int i=0; i<cols; i++) {
+                const char *name = rs->columnName(i);
+                data->columns.push_back(name ? name : "");
+            }
+            data->start();
+            std::vector<const char *> values(cols);
+            while (rs->next()) {
+                for (unsigned int i=0; i<cols; i++) {
+                    values[i] = rs->getString(i);
+                }
+                data->addRow(values.empty() ? NULL : &values[0]);
+            }
+            data->seal();
+            r.ok_ = true;
+            r.data_ = data;
+            return (r);
+        }
+
+        /**
+         * A successful statement without row data.
+         */
+        static MaterializedResult success(unsigned long insertId = 0)
+        {
+            MaterializedResult r;
+            r.ok_ = true;
+            r.insertId_ = insertId;
+            return (r);
+        }
+
+        static MaterializedResult failure(unsigned int errorno, const char *errormsg)
+        {
+            MaterializedResult r;
+            r.errorno_ = errorno;
+            r.errormsg_ = (errormsg ? errormsg : "");
+            return (r);
+        }
+
+        bool ok(void) const { return (ok_); }
+        unsigned int errorno(void) const { return (errorno_); }
+        const std::string &errormsg(void) const { return (errormsg_); }
+        unsigned long insertId(void) const { return (insertId_); }
+
+        unsigned int columnCount(void) const
+        {
+            return (data_ ? (unsigned int) data_->columns.size() : 0);
+        }
+
+        const char *columnName(const unsigned int idx) const
+        {
+            if (!data_ || idx >= data_->columns.size()) return (NULL);
+            return (data_->columns[idx].c_str());
+        }
+
+        unsigned int findColumn(const char *field) const
+        {
+            unsigned int i;
+            for (i=0; i<columnCount(); i++) {
+                if (data_->columns[i] == field) return (i);
+            }
+            return (i);
+        }
+
+        unsigned long rowCount(void) const { return (data_ ? data_->rows : 0); }
+
+        /**
+         * Returns how much memory the rows take, for callers keeping
+         * results within a budget.
+         */
+        size_t bytes(void) const { return (data_ ? data_->bytes() : 0); }
+
+        /**
+         * Returns the value at row, col, or NULL for SQL NULL.
+         */
+        const char *value(unsigned long row, unsigned int col) const
+        {
+            return (data_->value(row, col));
+        }
+
+        /**
+         * Returns a new ResultSet positioned before the first row.
+         * It MUST be closed when done, like any other ResultSet.
+         */
+        MaterializedResultSet *cursor(void) const;
+
+        /**
+         * Assembles a MaterializedResult row by row, for results
+         * computed on the client rather than read from a driver.
+         */
+        class Builder
+        {
+        public:
+            Builder(const std::vector<std::string> &columns) : data_(new Data)
+            {
+                data_->columns = columns;
+                data_->start();
+            }
+
+            /**
+             * Appends a row of columnCount() values; NULL pointers are
+             * stored as SQL NULL.
+             */
+            void addRow(const char * const *values)
+            {
+                data_->addRow(values);
+            }
+
+            MaterializedResult build(void)
+            {
+                MaterializedResult r;
+                data_->seal();
+                r.ok_ = true;
+                r.data_ = data_;
+                std::shared_ptr<Data> fresh(new Data);
+                fresh->columns = data_->columns;
+                fresh->start();
+                data_ = fresh;
+                return (r);
+            }
+
+        private:
+            std::shared_ptr<Data> data_;
+        };
+
+    private:
+        struct Data
+        {
+            Data() : rows(0), bitmapBytes(0) {}
+
+            void start(void)
+            {
+                bitmapBytes = (columns.size() + 7) / 8;
+            }
+
+            void addRow(const char * const *values)
+            {
+                size_t cols = columns.size();
+                size_t row = buffer.size();
+                rowStart.push_back(row);
+                nullBits.resize(nullBits.size() + bitmapBytes, 0);
+                uint8_t *bits = (bitmapBytes ? &nullBits[nullBits.size() - bitmapBytes] : NULL);
+                for (size_t i=0; i<cols; i++) {
+                    cellOffset.push_back((uint32_t) (buffer.size() - row));
+                    if (!values[i]) {
+                        bits[i / 8] |= (uint8_t) (1 << (i % 8));
+                        continue;
+                    }
+                    buffer.insert(buffer.end(), values[i], values[i] + strlen(values[i]) + 1);
+                }
+                rows++;
+            }
+
+            /**
+             * Gives back the room the vectors grew into.
+             */
+            void seal(void)
+            {
+                buffer.shrink_to_fit();
+                rowStart.shrink_to_fit();
+                cellOffset.shrink_to_fit();
+                nullBits.shrink_to_fit();
+            }
+
+            const char *value(unsigned long row, unsigned int col) const
+            {
+                if (nullBits[row * bitmapBytes + col / 8] & (1 << (col % 8))) return (NULL);
+                return (&buffer[rowStart[row] + cellOffset[row * columns.size() + col]]);
+            }
+
+            size_t bytes(void) const
+            {
+                size_t n = sizeof(Data) + buffer.capacity() + rowStart.capacity() * sizeof(size_t) +
+                    cellOffset.capacity() * sizeof(uint32_t) + nullBits.capacity();
+                for (size_t i=0; i<columns.size(); i++) n += sizeof(std::string) + columns[i].size();
+                return (n);
+            }
+
+            std::vector<std::string> columns;
+            std::vector<char> buffer; /** the values, row after row */
+            std::vector<size_t> rowStart; /** offset of each row in buffer */
+            std::vector<uint32_t> cellOffset; /** offset of each value in its row */
+            std::vector<uint8_t> nullBits; /** bitmapBytes per row */
+            unsigned long rows;
+            size_t bitmapBytes;
+        };
+
+        bool ok_;
+        unsigned int errorno_;
+        std::string errormsg_;
+        unsigned long insertId_;
+        std::shared_ptr<const Data> data_;
+    };
+
+    /**
+     * A RandomAccessResultSet over the rows of a MaterializedResult.
+     * The rows are shared with those returned by share(), and freed
+     * when the last of them is closed.
+     */
+    class MaterializedResultSet : public RandomAccessResultSet
+    {
+    public:
+        MaterializedResultSet(const MaterializedResult &result) : result_(result), row_(-1) {}
+
+        void *handle(void) { return (NULL); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void)
+        {
+            if (row_ + 1 >= (long) result_.rowCount()) {
+                row_ = (long) result_.rowCount();
+                return (false);
+            }
+            row_++;
+            return (true);
+        }
+
+        void rewind(void) { row_ = -1; }
+
+        bool seek(unsigned long row)
+        {
+            if (row >= result_.rowCount()) {
+                row_ = (long) result_.rowCount();
+                return (false);
+            }
+            row_ = (long) row;
+            return (true);
+        }
+
+        long row(void) const { return (row_); }
+
+        MaterializedResultSet *share(void) const { return (new MaterializedResultSet(result_)); }
+
+        const MaterializedResult &result(void) const { return (result_); }
+
+        unsigned int findColumn(const char *field) const { return (result_.findColumn(field)); }
+        unsigned long recordCount(void) const { return (result_.rowCount()); }
+        unsigned int columnCount(void) const { return (result_.columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (result_.columnName(idx)); }
+
+        const char *getString(const int idx) const
+        {
+            if (row_ < 0 || row_ >= (long) result_.rowCount() || idx < 0 || (unsigned int) idx >= result_.columnCount()) {
+                return (NULL);
+            }
+            return (result_.value(row_, idx));
+        }
+
+    private:
+        MaterializedResult result_;
+        long row_;
+    };
+
+    inline MaterializedResultSet *MaterializedResult::cursor(void) const
+    {
+        return (new MaterializedResultSet(*this));
+    }
+
+    inline MaterializedResultSet *ResultSet::materialize(void)
+    {
+        return (MaterializedResult::fromResultSet(this).cursor());
+    }
+}; /* namespace */
+
+#endif
@@ -23,10 +23,12 @@
 #include <iostream>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "mysql_db.h"
 
 #include "mysql/mysql.h"
+#include "mysql/errmsg.h"
 
 namespace dbabstract
 {
@@ -38,30 +40,76 @@ MySQL_ResultSet::~MySQL_ResultSet()
 bool
 MySQL_ResultSet::close(void)
 {
-    if (!res_) return (false);
-
-    // eat remaining rows, if there are some
-    while ((row_ = mysql_fetch_row(res_)) != NULL) {
+    // the connection is out of sync until every result has been read
+    while (advance()) {
         ;
     }
 
-    mysql_free_result(res_);
-    res_ = NULL;
+    fetch_.finish();
     delete this;
 
     return (true);
 }
 
+/**
+ * Frees the current result and reads the next one, if any.
+ */
+bool
+MySQL_ResultSet::advance(void)
+{
+    if (res_) {
+        // eat remaining rows, if there are some
+        while ((row_ = mysql_fetch_row(res_)) != NULL) {
+            ;
+        }
+        mysql_free_result(res_);
+        res_ = NULL;
+    }
+    row_ = NULL;
+    if (!mysql_) return (false);
+
+    int status = mysql_next_result(mysql_);
+    if (status == 0) {
+        res_ = mysql_use_result(mysql_);
+        if (res_ || mysql_field_count(mysql_) == 0) {
+            return (true);
+        }
+    }
+    if (status >= 0) {
+        std::cerr << "MySQL: " << mysql_error(mysql_) << std::endl;
+    }
+    if (batch_) batch_->endBatch();
+    mysql_ = NULL;
+    return (false);
+}
+
+bool
+MySQL_ResultSet::nextResult(void)
+{
+    return (advance());
+}
+
 bool
 MySQL_ResultSet::next(void)
 {
+    if (!res_) return (false);
+    if (!fetch_.active()) {
+        row_ = mysql_fetch_row(res_);
+        return ((row_ != NULL ? true : false));
+    }
+
+    // rows are streamed by mysql_use_result, so fetching is the wait
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     row_ = mysql_fetch_row(res_);
-    return ((row_ != NULL ? true : false));
+    return (fetch_.add(row_ != NULL, begin));
 }
 
 unsigned long
 MySQL_ResultSet::recordCount(void) const
 {
+    // a statement without rows reports the rows it changed
+    if (!res_) return (mysql_ ? (unsigned long) mysql_affected_rows(mysql_) : 0);
+
     /* NOTE: This call ALWAYS fails because mysql_use_result
        is used, UNTIL all rows have been read. This is documented
        in the MySQL manual.
@@ -79,6 +127,7 @@ MySQL_ResultSet::findColumn(const char *fld) const
     unsigned int i;
     MYSQL_FIELD *field;
 
+    if (!res_) return (0);
     num_fields = mysql_num_fields(res_);
     for (i=0; i<num_fields; i++) {
         field = mysql_fetch_field_direct(res_, i);
@@ -89,6 +138,20 @@ MySQL_ResultSet::findColumn(const char *fld) const
     return (i);
 }
 
+unsigned int
+MySQL_ResultSet::columnCount(void) const
+{
+    if (!res_) return (0);
+    return (mysql_num_fields(res_));
+}
+
+const char *
+MySQL_ResultSet::columnName(const unsigned int idx) const
+{
+    if (!res_ || idx >= mysql_num_fields(res_)) return (NULL);
+    return (mysql_fetch_field_direct(res_, idx)->name);
+}
+
 const char *
 MySQL_ResultSet::getString(const int idx) const
 {
@@ -194,33 +257,89 @@ MySQL_ResultSet::operator delete (void *ptr)
 bool
 MySQL_Connection::open(const char *database, const char *host, const int port, const char *user, const char *pass)
 {
+    return (open(ConnectionOptions(database, host, port, user, pass)));
+}
+
+/* settings taking a number of seconds */
+static const struct {
+    const char *name;
+    enum mysql_option option;
+} timeoutOptions[] = {
+    { "connect_timeout", MYSQL_OPT_CONNECT_TIMEOUT },
+    { "read_timeout", MYSQL_OPT_READ_TIMEOUT },
+    { "write_timeout", MYSQL_OPT_WRITE_TIMEOUT }
+};
+static const char *const connectionOptions[] = {
+    "connect_timeout", "read_timeout", "write_timeout", "compress", "multi_statements", "unix_socket", "ping_interval", NULL
+};
+
+bool
+MySQL_Connection::open(const ConnectionOptions &options)
+{
+    const char *database = options.get("database");
+    const char *host = options.get("host");
+    int port = (int) options.getLong("port", 0);
+    // stored procedures answer with more than one result
+    unsigned long flags = CLIENT_MULTI_RESULTS;
+
+    reportUnknown(options);
+    ConnectTrace trace(observer_, this, database, host, port);
     if ((mysql_ = mysql_init(NULL)) == NULL) {
         return (false);
     }
+#ifdef MYSQL_WAIT_READ
+    // MariaDB client library; enables the mysql_*_start/cont calls
+    mysql_options(mysql_, MYSQL_OPT_NONBLOCK, 0);
+#endif
+    for (size_t i=0; i<sizeof(timeoutOptions) / sizeof(timeoutOptions[0]); i++) {
+        if (!options.has(timeoutOptions[i].name)) continue;
+        unsigned int seconds = (unsigned int) options.getLong(timeoutOptions[i].name, 0);
+        mysql_options(mysql_, timeoutOptions[i].option, &seconds);
+    }
+    if (options.getBool("compress", false)) mysql_options(mysql_, MYSQL_OPT_COMPRESS, NULL);
+    multi_ = options.getBool("multi_statements", false);
+    if (multi_) flags |= CLIENT_MULTI_STATEMENTS;
+    if (options.has("ping_interval")) pingIdle_ = (int) options.getLong("ping_interval", pingIdle_);
+
     if (mysql_real_connect(
             mysql_,
             host,
-            user,
-            pass,
+            options.get("user"),
+            options.get("password"),
             NULL,
             (unsigned)port,
-            NULL,
-            0
+            options.get("unix_socket"),
+            flags
             ) == NULL) {
         return (false);
     }
     if (mysql_select_db(mysql_, database) != 0) {
         return (false);
     }
-    return (true);
+    lastUsed_ = time(NULL);
+    return (trace.finish(true));
+}
+
+std::vector<std::string>
+MySQL_Connection::unknownOptions(const ConnectionOptions &options) const
+{
+    return (options.unknown(connectionOptions));
 }
 
 bool
 MySQL_Connection::close(void)
 {
     if (!mysql_) return (false);
+    if (pending_) {
+        mysql_free_result(pending_);
+        pending_ = NULL;
+    }
     mysql_close(mysql_);
     mysql_ = NULL;
+    lastUsed_ = 0;
+    multi_ = false;
+    batchErrno_ = 0;
+    if (observer_) observer_->onDisconnect(this);
     return (true);
 }
 
@@ -228,17 +347,40 @@ bool
 MySQL_Connection::isConnected(void)
 {
     if (!mysql_) return (false);
-    return ((mysql_ping(mysql_) == 0 ? true : false));
+    // a busy connection proves itself with every statement
+    if (lastUsed_ && time(NULL) - lastUsed_ <= pingIdle_) return (true);
+    return (used(mysql_ping(mysql_) == 0));
+}
+
+/**
+ * Notes whether the server answered the last call.
+ */
+bool
+MySQL_Connection::used(bool ok)
+{
+    unsigned int err = mysql_errno(mysql_);
+    batchErrno_ = 0;
+    if (ok) lastUsed_ = time(NULL);
+    else if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) lastUsed_ = 0;
+    return (ok);
 }
 
 bool
 MySQL_Connection::execute(const char *sql)
 {
     if (!mysql_) return (false);
-    if (mysql_query(mysql_, sql) == 0) {
-        return (true);
+    QueryTrace trace(observer_, this, sql);
+    int status = mysql_query(mysql_, sql);
+    if (!used(status == 0)) {
+        return (false);
     }
-    return (false);
+
+    // read every result, or the next statement is out of sync
+    do {
+        MYSQL_RES *res = mysql_store_result(mysql_);
+        if (res) mysql_free_result(res);
+    } while ((status = mysql_next_result(mysql_)) == 0);
+    return (trace.finish(status < 0));
 }
 
 dbabstract::ResultSet *
@@ -246,16 +388,56 @@ MySQL_Connection::executeQuery(const char *sql)
 {
     if (!mysql_) return (NULL);
 
-    if (mysql_query(mysql_, sql)) {
+    QueryTrace trace(observer_, this, sql);
+    if (!used(mysql_query(mysql_, sql) == 0)) {
         return (0);
     }
     MYSQL_RES *res = mysql_use_result(mysql_);
     if (!res) {
         return (0);
     }
-    dbabstract::ResultSet *c = 0;
-    c = new dbabstract::MySQL_ResultSet(res);
-    return (c);
+    dbabstract::MySQL_ResultSet *c = new dbabstract::MySQL_ResultSet(res, mysql_);
+    c->fetch_.attach(observer_, this);
+    return (trace.finish(c));
+}
+
+dbabstract::ResultSet *
+MySQL_Connection::executeBatch(const char *sql)
+{
+    if (!mysql_) return (NULL);
+
+    if (!multi_ && !used(mysql_set_server_option(mysql_, MYSQL_OPTION_MULTI_STATEMENTS_ON) == 0)) {
+        return (0);
+    }
+    QueryTrace trace(observer_, this, sql);
+    if (!used(mysql_query(mysql_, sql) == 0)) {
+        endBatch();
+        return (0);
+    }
+    // a first statement without rows still starts the batch
+    MYSQL_RES *res = mysql_use_result(mysql_);
+    if (!res && mysql_field_count(mysql_) != 0) {
+        endBatch();
+        return (0);
+    }
+    dbabstract::MySQL_ResultSet *c = new dbabstract::MySQL_ResultSet(res, mysql_);
+    if (!multi_) c->batch_ = this;
+    c->fetch_.attach(observer_, this);
+    return (trace.finish(c));
+}
+
+/**
+ * Turns multiple statements off again once a batch is done, unless
+ * the connection was opened with them. Turning them off clears the
+ * error, so the batch's is kept for errorno() and errormsg().
+ */
+void
+MySQL_Connection::endBatch(void)
+{
+    if (multi_) return;
+    batchErrno_ = mysql_errno(mysql_);
+    batchError_ = mysql_error(mysql_);
+    mysql_set_server_option(mysql_, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
 }
 
 char *
@@ -290,36 +472,35 @@ MySQL_Connection::insertId(void)
 }
 
 bool
-MySQL_Connection::beginTrans(void)
+MySQL_Connection::transaction(const char *sql, enum ConnectionObserver::TRANS_EVENT event)
 {
     if (!mysql_) return (false);
-    if (mysql_query(mysql_, "SET AUTOCOMMIT = 0") != 0) {
+    TransactionTrace trace(observer_, this, event);
+    if (event == ConnectionObserver::BEGIN && !used(mysql_query(mysql_, "SET AUTOCOMMIT = 0") == 0)) {
         return (false);
     }
-    if (mysql_query(mysql_, "BEGIN") == 0) {
-        return (true);
+    if (used(mysql_query(mysql_, sql) == 0)) {
+        return (trace.finish(true));
     }
     return (false);
 }
 
+bool
+MySQL_Connection::beginTrans(void)
+{
+    return (transaction("BEGIN", ConnectionObserver::BEGIN));
+}
+
 bool
 MySQL_Connection::commitTrans(void)
 {
-    if (!mysql_) return (false);
-    if (mysql_query(mysql_, "COMMIT") == 0) {
-        return (true);
-    }
-    return (false);
+    return (transaction("COMMIT", ConnectionObserver::COMMIT));
 }
 
 bool
 MySQL_Connection::rollbackTrans(void)
 {
-    if (!mysql_) return (false);
-    if (mysql_query(mysql_, "ROLLBACK") == 0) {
-        return (true);
-    }
-    return (false);
+    return (transaction("ROLLBACK", ConnectionObserver::ROLLBACK));
 }
 
 bool
@@ -347,13 +528,13 @@ MySQL_Connection::setTransactionMode(const enum TRANS_MODE mode)
 unsigned int
 MySQL_Connection::errorno(void) const
 {
-    return (mysql_errno(mysql_));
+    return (batchErrno_ ? batchErrno_ : mysql_errno(mysql_));
 }
 
 const char *
 MySQL_Connection::errormsg(void) const
 {
-    return (mysql_error(mysql_));
+    return (batchErrno_ ? batchError_.c_str() : mysql_error(mysql_));
 }
 
 const char *
@@ -381,6 +562,176 @@ MySQL_Connection::tables(void) const
     return vTables;
 }
 
+int
+MySQL_Connection::socket(void)
+{
+    if (!mysql_) return (-1);
+#ifdef MYSQL_WAIT_READ
+    return ((int) mysql_get_socket(mysql_));
+#else
+    return (mysql_->net.fd);
+#endif
+}
+
+#ifdef MYSQL_WAIT_READ
+
+/* phase_ of an asynchronous statement */
+#define PHASE_IDLE 0
+#define PHASE_QUERY 1
+#define PHASE_STORE 2
+
+Connection::ASYNC_STATUS
+MySQL_Connection::asyncStatus(int status)
+{
+    wait_ = status;
+    if (status & MYSQL_WAIT_WRITE) return (ASYNC_WANT_WRITE);
+    // MYSQL_WAIT_TIMEOUT is covered by the caller's own deadline
+    return (ASYNC_WANT_READ);
+}
+
+Connection::ASYNC_STATUS
+MySQL_Connection::startQuery(const char *sql)
+{
+    int err = 0;
+    int status;
+
+    if (!mysql_) return (ASYNC_FAILED);
+    if (pending_) {
+        mysql_free_result(pending_);
+        pending_ = NULL;
+    }
+
+    phase_ = PHASE_QUERY;
+    async_.start(observer_, this, sql);
+    status = mysql_real_query_start(&err, mysql_, sql, strlen(sql));
+    if (status) return (asyncStatus(status));
+    if (!used(err == 0)) {
+        phase_ = PHASE_IDLE;
+        async_.finish(false);
+        return (ASYNC_FAILED);
+    }
+    return (continueQuery());
+}
+
+Connection::ASYNC_STATUS
+MySQL_Connection::continueQuery(void)
+{
+    enum ASYNC_STATUS status = poll();
+    if (status == ASYNC_DONE || status == ASYNC_FAILED) {
+        async_.finish(status == ASYNC_DONE);
+    }
+    return (status);
+}
+
+Connection::ASYNC_STATUS
+MySQL_Connection::poll(void)
+{
+    int err = 0;
+    int status;
+
+    if (!mysql_) return (ASYNC_FAILED);
+
+    if (phase_ == PHASE_QUERY) {
+        if (wait_) {
+            status = mysql_real_query_cont(&err, mysql_, wait_);
+            if (status) return (asyncStatus(status));
+            wait_ = 0;
+            if (!used(err == 0)) {
+                phase_ = PHASE_IDLE;
+                return (ASYNC_FAILED);
+            }
+        }
+        if (mysql_field_count(mysql_) == 0) {
+            // no row data, e.g. an INSERT
+            phase_ = PHASE_IDLE;
+            return (ASYNC_DONE);
+        }
+        phase_ = PHASE_STORE;
+        status = mysql_store_result_start(&pending_, mysql_);
+        if (status) return (asyncStatus(status));
+    } else if (phase_ == PHASE_STORE) {
+        status = mysql_store_result_cont(&pending_, mysql_, wait_);
+        if (status) return (asyncStatus(status));
+    } else {
+        return (ASYNC_FAILED);
+    }
+
+    wait_ = 0;
+    phase_ = PHASE_IDLE;
+    return (used(pending_ != NULL) ? ASYNC_DONE : ASYNC_FAILED);
+}
+
+dbabstract::ResultSet *
+MySQL_Connection::finishQuery(void)
+{
+    MYSQL_RES *res = pending_;
+    pending_ = NULL;
+
+    if (!res) return (NULL);
+
+    // mysql_store_result() received every row with the statement
+    if (observer_) observer_->onFetchBatch(this, (unsigned long) mysql_num_rows(res), 0);
+    dbabstract::ResultSet *c = 0;
+    c = new dbabstract::MySQL_ResultSet(res);
+    return (c);
+}
+
+bool
+MySQL_Connection::cancelQuery(void)
+{
+    if (!mysql_) return (false);
+
+    // there is no protocol level cancel; drop the connection and let
+    // the caller reconnect, which is what the server would see anyway
+    if (phase_ != PHASE_IDLE) {
+        mysql_close(mysql_);
+        mysql_ = NULL;
+        lastUsed_ = 0;
+    }
+    if (pending_) {
+        mysql_free_result(pending_);
+        pending_ = NULL;
+    }
+    phase_ = PHASE_IDLE;
+    wait_ = 0;
+    async_.finish(false);
+    return (true);
+}
+
+#else
+
+Connection::ASYNC_STATUS
+MySQL_Connection::asyncStatus(int)
+{
+    return (ASYNC_UNSUPPORTED);
+}
+
+Connection::ASYNC_STATUS
+MySQL_Connection::startQuery(const char *)
+{
+    return (ASYNC_UNSUPPORTED);
+}
+
+Connection::ASYNC_STATUS
+MySQL_Connection::continueQuery(void)
+{
+    return (ASYNC_UNSUPPORTED);
+}
+
+dbabstract::ResultSet *
+MySQL_Connection::finishQuery(void)
+{
+    return (NULL);
+}
+
+bool
+MySQL_Connection::cancelQuery(void)
+{
+    return (false);
+}
+
+#endif
+
 void *
 MySQL_Connection::operator new (size_t bytes)
 {
@@ -33,7 +33,7 @@ namespace dbabstract
     {
         friend class MySQL_Connection;
     protected:
-        MySQL_ResultSet(MYSQL_RES *res) : res_(res) {};
+        MySQL_ResultSet(MYSQL_RES *res, MYSQL *mysql = NULL) : res_(res), row_(NULL), mysql_(mysql), batch_(NULL) {};
         ~MySQL_ResultSet();
     private:
         MySQL_ResultSet() {};
@@ -45,9 +45,12 @@ namespace dbabstract
 
         bool close(void);
         bool next(void);
+        bool nextResult(void);
 
         unsigned long recordCount(void) const;
         unsigned int findColumn(const char *field) const;
+        unsigned int columnCount(void) const;
+        const char *columnName(const unsigned int idx) const;
 
         const char *getString(const int idx) const;
         int getInteger(const int idx) const;
@@ -65,26 +68,47 @@ namespace dbabstract
         void operator delete (void *ptr);
 
     private:
+        bool advance(void);
+
         MYSQL_RES *res_;
         MYSQL_ROW row_;
+        MYSQL *mysql_; /** set while more results may follow, NULL after the last */
+        MySQL_Connection *batch_; /** ends its batch after the last result, when set */
+        FetchTrace fetch_;
     };
 
     class MySQL_Connection : public Connection
     {
+        friend class MySQL_ResultSet;
     private:
         MySQL_Connection(const MySQL_Connection &old);
         const MySQL_Connection &operator=(const MySQL_Connection &old);
 
     public:
-        MySQL_Connection() : mysql_(NULL) {};
+        MySQL_Connection() : mysql_(NULL), pending_(NULL), phase_(0), wait_(0), lastUsed_(0), pingIdle_(30), multi_(false), batchErrno_(0) {};
         ~MySQL_Connection() { close(); }
 
         void * handle(void) { return mysql_; }
         bool open(const char *database, const char *host, const int port, const char *user, const char *pass);
+
+        /**
+         * Also takes "connect_timeout", "read_timeout" and
+         * "write_timeout" in seconds, "compress", "multi_statements",
+         * "unix_socket" and "ping_interval" (see setPingInterval()).
+         */
+        bool open(const ConnectionOptions &options);
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const;
         bool close(void);
         bool isConnected(void);
         bool execute(const char *sql);
         ResultSet *executeQuery(const char *sql);
+
+        /**
+         * Turns multiple statements on for the batch, and off again
+         * once its last result has been read or the ResultSet closed,
+         * unless the connection was opened with "multi_statements".
+         */
+        ResultSet *executeBatch(const char *sql);
         char *escape(const char *);
         const char *unixtimeToSql(const time_t);
         unsigned long insertId(void);
@@ -101,6 +125,18 @@ namespace dbabstract
 
         std::vector<std::string> tables(void) const;
 
+        int socket(void);
+        enum ASYNC_STATUS startQuery(const char *sql);
+        enum ASYNC_STATUS continueQuery(void);
+        ResultSet *finishQuery(void);
+        bool cancelQuery(void);
+
+        /**
+         * isConnected() pings the server only when the connection has
+         * been idle for longer than this, or has lost the server.
+         */
+        void setPingInterval(int seconds) { pingIdle_ = seconds; }
+
         // Overload the new/delete opertors so the object will be
         // created/deleted using the memory allocator associated with the
         // DLL/SO.
@@ -108,6 +144,21 @@ namespace dbabstract
         void operator delete (void *ptr);
 
     private:
+        bool used(bool ok);
+        enum ASYNC_STATUS asyncStatus(int status);
+        enum ASYNC_STATUS poll(void);
+        bool transaction(const char *sql, enum ConnectionObserver::TRANS_EVENT event);
+        void endBatch(void);
+
         MYSQL *mysql_;
+        MYSQL_RES *pending_;
+        int phase_;
+        int wait_;
+        AsyncQueryTrace async_;
+        time_t lastUsed_; /** last time the server answered, 0 if it is lost */
+        int pingIdle_;
+        bool multi_; /** opened with "multi_statements" */
+        unsigned int batchErrno_; /** the error a batch ended with, until the next call */
+        std::string batchError_;
     };
 }
@@ -0,0 +1,326 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _OBSERVER_H
+#define _OBSERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <stdint.h>
+
+namespace dbabstract
+{
+    class Connection;
+
+    /**
+     * Receives the work the drivers do, e.g. to trace it. Attach one
+     * to a Connection with Connection::setObserver(), or to every
+     * Connection created from then on with
+     * Connection::setDefaultObserver().
+     *
+     * The callbacks run on the thread calling the driver, inside the
+     * call, so they should be quick. An observer shared by several
+     * Connection objects is called from several threads. Durations
+     * are in nanoseconds.
+     */
+    class ConnectionObserver
+    {
+    public:
+        enum TRANS_EVENT {
+            BEGIN,
+            COMMIT,
+            ROLLBACK
+        };
+
+        virtual ~ConnectionObserver() {}
+
+        virtual void onConnect(Connection *, const char *, const char *, int, bool, uint64_t) {}
+
+        /**
+         * Called by close() when it closes an open connection. The
+         * Connection may be deleted right after, and its address
+         * reused by another one.
+         */
+        virtual void onDisconnect(Connection *) {}
+
+        /**
+         * Called before a statement is sent, by execute(),
+         * executeQuery() and startQuery().
+         */
+        virtual void onQueryStart(Connection *, const char *) {}
+
+        /**
+         * Called once the statement has completed or failed; for a
+         * query, before any row is fetched.
+         */
+        virtual void onQueryEnd(Connection *, const char *, bool, uint64_t) {}
+
+        /**
+         * Called for the rows a driver takes from the database. A
+         * result received whole with the statement (PostgreSQL, and
+         * asynchronous MySQL queries) is reported right after
+         * onQueryEnd(), with a time of 0 as it is part of the
+         * statement's. A result streamed row by row (Sqlite3, MySQL,
+         * ODBC) is reported when the ResultSet is closed, with the
+         * rows stepped through and the time spent stepping.
+         */
+        virtual void onFetchBatch(Connection *, unsigned long, uint64_t) {}
+
+        /**
+         * Called by beginTrans(), commitTrans() and rollbackTrans();
+         * the time is that of the call itself.
+         */
+        virtual void onTransaction(Connection *, enum TRANS_EVENT, bool, uint64_t) {}
+    };
+
+    /**
+     * The observer new Connection objects start with.
+     */
+    inline std::atomic<ConnectionObserver *> &defaultObserverSlot(void)
+    {
+        static std::atomic<ConnectionObserver *> slot(NULL);
+        return (slot);
+    }
+
+    inline uint64_t elapsedNs(std::chrono::steady_clock::time_point since)
+    {
+        return ((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
+    }
+
+    /**
+     * Reports one statement of a driver. Without an observer, every
+     * member is a single test of a NULL pointer.
+     *
+     *   QueryTrace trace(observer_, this, sql);
+     *   ...
+     *   return (trace.finish(ok));
+     *
+     * A trace going out of scope without finish() reports a failure.
+     */
+    class QueryTrace
+    {
+    private:
+        QueryTrace(const QueryTrace &old);
+        const QueryTrace &operator=(const QueryTrace &old);
+
+    public:
+        QueryTrace(ConnectionObserver *obs, Connection *conn, const char *sql)
+            : obs_(obs)
+            , conn_(conn)
+            , sql_(sql)
+        {
+            if (obs_) {
+                start_ = std::chrono::steady_clock::now();
+                obs_->onQueryStart(conn_, sql_);
+            }
+        }
+
+        ~QueryTrace()
+        {
+            if (obs_) finish(false);
+        }
+
+        bool finish(bool ok)
+        {
+            if (obs_) {
+                obs_->onQueryEnd(conn_, sql_, ok, elapsedNs(start_));
+                obs_ = NULL;
+            }
+            return (ok);
+        }
+
+        template <typename T>
+        T *finish(T *result)
+        {
+            finish(result != NULL);
+            return (result);
+        }
+
+    private:
+        ConnectionObserver *obs_;
+        Connection *conn_;
+        const char *sql_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * Reports a statement started by startQuery() and completed by
+     * a later call; it keeps a copy of the SQL while observed.
+     */
+    class AsyncQueryTrace
+    {
+    public:
+        AsyncQueryTrace() : obs_(NULL), conn_(NULL) {}
+
+        void start(ConnectionObserver *obs, Connection *conn, const char *sql)
+        {
+            obs_ = obs;
+            if (!obs_) return;
+            conn_ = conn;
+            sql_ = sql;
+            start_ = std::chrono::steady_clock::now();
+            obs_->onQueryStart(conn_, sql_.c_str());
+        }
+
+        bool finish(bool ok)
+        {
+            if (obs_) {
+                obs_->onQueryEnd(conn_, sql_.c_str(), ok, elapsedNs(start_));
+                obs_ = NULL;
+            }
+            return (ok);
+        }
+
+    private:
+        ConnectionObserver *obs_;
+        Connection *conn_;
+        std::string sql_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * Reports beginTrans(), commitTrans() or rollbackTrans().
+     */
+    class TransactionTrace
+    {
+    private:
+        TransactionTrace(const TransactionTrace &old);
+        const TransactionTrace &operator=(const TransactionTrace &old);
+
+    public:
+        TransactionTrace(ConnectionObserver *obs, Connection *conn, enum ConnectionObserver::TRANS_EVENT event)
+            : obs_(obs)
+            , conn_(conn)
+            , event_(event)
+        {
+            if (obs_) start_ = std::chrono::steady_clock::now();
+        }
+
+        ~TransactionTrace()
+        {
+            if (obs_) finish(false);
+        }
+
+        bool finish(bool ok)
+        {
+            if (obs_) {
+                obs_->onTransaction(conn_, event_, ok, elapsedNs(start_));
+                obs_ = NULL;
+            }
+            return (ok);
+        }
+
+    private:
+        ConnectionObserver *obs_;
+        Connection *conn_;
+        enum ConnectionObserver::TRANS_EVENT event_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * Reports open().
+     */
+    class ConnectTrace
+    {
+    private:
+        ConnectTrace(const ConnectTrace &old);
+        const ConnectTrace &operator=(const ConnectTrace &old);
+
+    public:
+        ConnectTrace(ConnectionObserver *obs, Connection *conn, const char *database, const char *host, int port)
+            : obs_(obs)
+            , conn_(conn)
+            , database_(database)
+            , host_(host)
+            , port_(port)
+        {
+            if (obs_) start_ = std::chrono::steady_clock::now();
+        }
+
+        ~ConnectTrace()
+        {
+            if (obs_) finish(false);
+        }
+
+        bool finish(bool ok)
+        {
+            if (obs_) {
+                obs_->onConnect(conn_, database_, host_, port_, ok, elapsedNs(start_));
+                obs_ = NULL;
+            }
+            return (ok);
+        }
+
+    private:
+        ConnectionObserver *obs_;
+        Connection *conn_;
+        const char *database_;
+        const char *host_;
+        int port_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * Adds up the rows a streaming ResultSet steps through, and the
+     * time spent doing so, for one onFetchBatch() at close().
+     *
+     *   if (!fetch_.active()) return (step());
+     *   std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+     *   bool row = step();
+     *   return (fetch_.add(row, begin));
+     */
+    class FetchTrace
+    {
+    public:
+        FetchTrace() : obs_(NULL), conn_(NULL), rows_(0), ns_(0) {}
+
+        void attach(ConnectionObserver *obs, Connection *conn)
+        {
+            obs_ = obs;
+            conn_ = conn;
+        }
+
+        bool active(void) const { return (obs_ != NULL); }
+
+        bool add(bool row, std::chrono::steady_clock::time_point begin)
+        {
+            ns_ += elapsedNs(begin);
+            if (row) rows_++;
+            return (row);
+        }
+
+        void finish(void)
+        {
+            if (obs_) {
+                obs_->onFetchBatch(conn_, rows_, ns_);
+                obs_ = NULL;
+            }
+        }
+
+    private:
+        ConnectionObserver *obs_;
+        Connection *conn_;
+        unsigned long rows_;
+        uint64_t ns_;
+    };
+}; /* namespace */
+
+#endif
@@ -21,8 +21,10 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mutex>
 
 #include "odbc_db.h"
 
@@ -66,12 +68,17 @@ ODBC_ResultSet::close(void)
         ;
     }
 
+    if (conn_) {
+        conn_->checkin(hstmt);
+    } else {
 #if (ODBCVER < 0x0300)
-    SQLFreeStmt (hstmt, SQL_CLOSE);
+        SQLFreeStmt (hstmt, SQL_CLOSE);
 #else
-    SQLCloseCursor (hstmt);
+        SQLCloseCursor (hstmt);
 #endif
+    }
 
+    fetch_.finish();
     delete this;
 
     return (true);
@@ -79,8 +86,18 @@ ODBC_ResultSet::close(void)
 
 bool
 ODBC_ResultSet::next(void)
+{
+    if (!fetch_.active()) return (step());
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    return (fetch_.add(step(), begin));
+}
+
+bool
+ODBC_ResultSet::step(void)
 {
     int sts = 0;
+    column_ = -1;
     /* execute this on the second row, not the first */
     if (record > 0) {
         sts = SQLMoreResults (hstmt);
@@ -135,33 +152,60 @@ ODBC_ResultSet::findColumn(const char *fld) const
     return (i);
 }
 
+unsigned int
+ODBC_ResultSet::columnCount(void) const
+{
+    short numCols = 0;
+
+    if (SQLNumResultCols (hstmt, &numCols) != SQL_SUCCESS) {
+        return 0;
+    }
+    return ((unsigned int) numCols);
+}
+
+const char *
+ODBC_ResultSet::columnName(const unsigned int idx) const
+{
+    SQLSMALLINT colType;
+    SQLULEN colPrecision;
+    SQLSMALLINT colScale, colNullable;
+
+    if (SQLDescribeCol (hstmt, idx + 1, (SQLTCHAR *) colName_, NUMTCHAR (colName_), NULL,
+                &colType, &colPrecision, &colScale,
+                &colNullable) != SQL_SUCCESS)
+        return (NULL);
+    return ((const char *) colName_);
+}
+
 const char *
 ODBC_ResultSet::getString(const int idx) const
 {
     int sts = 0;
     SQLLEN colIndicator;
-    static SQLTCHAR fetchBuffer[1024 * 1024];
-    static int index = 0;
 
-    if (index == idx) {
-        return (const char *)fetchBuffer;
+    // each ResultSet has its own buffer, so cursors may be nested
+    if (value_.empty()) {
+        value_.resize(1024 * 1024);
+    }
+    if (column_ == idx) {
+        return ((const char *) &value_[0]);
     }
-    index = idx;
+    column_ = idx;
 
-    memset(fetchBuffer, 0, sizeof(fetchBuffer));
+    memset(&value_[0], 0, value_.size() * sizeof(SQLTCHAR));
 
 #ifdef UNICODE
-    sts = SQLGetData (hstmt, idx, SQL_C_WCHAR, fetchBuffer,
-            NUMTCHAR (fetchBuffer), &colIndicator);
+    sts = SQLGetData (hstmt, idx, SQL_C_WCHAR, &value_[0],
+            value_.size(), &colIndicator);
 #else
-    sts = SQLGetData (hstmt, idx, SQL_C_CHAR, fetchBuffer,
-            NUMTCHAR (fetchBuffer), &colIndicator);
+    sts = SQLGetData (hstmt, idx, SQL_C_CHAR, &value_[0],
+            value_.size(), &colIndicator);
 #endif
     if (sts != SQL_SUCCESS_WITH_INFO && sts != SQL_SUCCESS) {
         std::cerr << "ERROR FETCHING DATA!" << std::endl;
     }
 
-    return ((const char *) fetchBuffer);
+    return ((const char *) &value_[0]);
 }
 
 int
@@ -268,8 +312,35 @@ ODBC_ResultSet::operator delete (void *ptr)
 
 #include <string.h>
 
-SQLTCHAR outdsn[4096];
+#if (ODBCVER >= 0x0300)
+static std::mutex sharedEnvLock;
+static HENV sharedEnv = 0;
 
+/*
+ * The environment every pooling connection is opened in. It is never
+ * freed; the driver manager's pool of connections lives in it, and
+ * must outlast the ODBC_Connections coming and going.
+ */
+static HENV
+sharedEnvironment(void)
+{
+    std::lock_guard<std::mutex> lock(sharedEnvLock);
+    if (sharedEnv) return (sharedEnv);
+
+    // process wide, so it has to come before the environment
+    SQLSetEnvAttr (SQL_NULL_HENV, SQL_ATTR_CONNECTION_POOLING, (SQLPOINTER) SQL_CP_ONE_PER_HENV,
+            SQL_IS_UINTEGER);
+
+    HENV env = 0;
+    if (SQLAllocHandle (SQL_HANDLE_ENV, SQL_NULL_HANDLE, &env) != SQL_SUCCESS) {
+        return (0);
+    }
+    SQLSetEnvAttr (env, SQL_ATTR_ODBC_VERSION, (SQLPOINTER) SQL_OV_ODBC3,
+            SQL_IS_UINTEGER);
+    sharedEnv = env;
+    return (sharedEnv);
+}
+#endif
 
 int
 ODBC_Connection::ODBC_Errors (char *where) const
@@ -279,14 +350,15 @@ ODBC_Connection::ODBC_Errors (char *where) const
   SQLINTEGER native_error = 0;
   int force_exit = 0;
   SQLRETURN sts;
+  HSTMT stmt = diagnostics();
 
 #if (ODBCVER < 0x0300)
   /*
    *  Get statement errors
    */
-  while (hstmt)
+  while (stmt)
     {
-      sts = SQLError (henv, hdbc, hstmt, sqlstate, &native_error,
+      sts = SQLError (henv, hdbc, stmt, sqlstate, &native_error,
       buf, NUMTCHAR (buf), NULL);
       if (!SQL_SUCCEEDED (sts))
     break;
@@ -365,9 +437,9 @@ ODBC_Connection::ODBC_Errors (char *where) const
    *  Get statement errors
    */
   i = 0;
-  while (hstmt && i < 5)
+  while (stmt && i < 5)
     {
-      sts = SQLGetDiagRec (SQL_HANDLE_STMT, hstmt, ++i,
+      sts = SQLGetDiagRec (SQL_HANDLE_STMT, stmt, ++i,
       sqlstate, &native_error, buf, NUMTCHAR (buf), NULL);
       if (!SQL_SUCCEEDED (sts))
     break;
@@ -455,16 +527,37 @@ ODBC_Connection::ODBC_Errors (char *where) const
 
 bool
 ODBC_Connection::open(const char *database, const char *host, const int port, const char *user, const char *pass)
+{
+    return (open(ConnectionOptions(database, host, port, user, pass)));
+}
+
+/* connection attributes taking a number */
+static const struct {
+    const char *name;
+    SQLINTEGER attribute;
+} attributeOptions[] = {
+    { "login_timeout", SQL_ATTR_LOGIN_TIMEOUT },
+    { "connection_timeout", SQL_ATTR_CONNECTION_TIMEOUT },
+    { "packet_size", SQL_ATTR_PACKET_SIZE }
+};
+static const char *const connectionOptions[] = { "login_timeout", "connection_timeout", "packet_size", "pooling", NULL };
+
+bool
+ODBC_Connection::open(const ConnectionOptions &options)
 {
     short buflen;
     SQLCHAR dataSource[1024];
+    // each connection has its own, so they may connect in parallel
+    SQLTCHAR outdsn[4096];
     int status;
 #ifdef UNICODE
     SQLWCHAR wdataSource[1024];
 #endif
+    const char *database = options.get("database");
 
-    strcpy((char *) dataSource, database);
-
+    reportUnknown(options);
+    ConnectTrace trace(observer_, this, database, options.get("host"), (int) options.getLong("port", 0));
+    snprintf((char *) dataSource, sizeof(dataSource), "%s", database ? database : "");
 #if (ODBCVER < 0x0300)
     if (SQLAllocEnv (&henv) != SQL_SUCCESS)
         return (false);
@@ -472,12 +565,19 @@ ODBC_Connection::open(const char *database, const char *host, const int port, co
     if (SQLAllocConnect (henv, &hdbc) != SQL_SUCCESS)
         return (false);
 #else
-    if (SQLAllocHandle (SQL_HANDLE_ENV, NULL, &henv) != SQL_SUCCESS) {
-        return (false);
-    }
+    if (options.getBool("pooling", true)) {
+        if ((henv = sharedEnvironment()) == 0) {
+            return (false);
+        }
+        sharedEnv_ = true;
+    } else {
+        if (SQLAllocHandle (SQL_HANDLE_ENV, NULL, &henv) != SQL_SUCCESS) {
+            return (false);
+        }
 
-    SQLSetEnvAttr (henv, SQL_ATTR_ODBC_VERSION, (SQLPOINTER) SQL_OV_ODBC3,
-            SQL_IS_UINTEGER);
+        SQLSetEnvAttr (henv, SQL_ATTR_ODBC_VERSION, (SQLPOINTER) SQL_OV_ODBC3,
+                SQL_IS_UINTEGER);
+    }
 
     if (SQLAllocHandle (SQL_HANDLE_DBC, henv, &hdbc) != SQL_SUCCESS) {
         return (false);
@@ -488,6 +588,14 @@ ODBC_Connection::open(const char *database, const char *host, const int port, co
     SQLSetConnectOption (hdbc, SQL_APPLICATION_NAME, (SQLULEN) TEXT ("dbabstract"));
 #endif
 
+#if (ODBCVER >= 0x0300)
+    // these must be set before connecting
+    for (size_t i=0; i<sizeof(attributeOptions) / sizeof(attributeOptions[0]); i++) {
+        if (!options.has(attributeOptions[i].name)) continue;
+        SQLUINTEGER value = (SQLUINTEGER) options.getLong(attributeOptions[i].name, 0);
+        SQLSetConnectAttr (hdbc, attributeOptions[i].attribute, (SQLPOINTER) (SQLULEN) value, SQL_IS_UINTEGER);
+    }
+#endif
 #ifdef UNICODE
     strcpy_A2W (wdataSource, (char *) dataSource);
     status = SQLDriverConnectW (hdbc, 0, (SQLWCHAR *) wdataSource, SQL_NTS,
@@ -511,12 +619,31 @@ ODBC_Connection::open(const char *database, const char *host, const int port, co
     if (SQLAllocHandle (SQL_HANDLE_STMT, hdbc, &hstmt) != SQL_SUCCESS)
         return (false);
 #endif
-    return (true);
+    return (trace.finish(true));
+}
+
+std::vector<std::string>
+ODBC_Connection::unknownOptions(const ConnectionOptions &options) const
+{
+    return (options.unknown(connectionOptions));
 }
 
 bool
 ODBC_Connection::close(void)
 {
+    bool wasConnected = (connected != 0);
+
+    settle();
+    for (size_t i=0; i<idle_.size(); i++) {
+        dispose(idle_[i]);
+    }
+    idle_.clear();
+    for (std::map<std::string, Prepared>::iterator it = prepared_.begin(); it != prepared_.end(); ++it) {
+        dispose(it->second.stmt);
+    }
+    prepared_.clear();
+    seen_.clear();
+
 #if (ODBCVER < 0x0300)
     if (hstmt) {
         SQLFreeStmt (hstmt, SQL_DROP);
@@ -549,30 +676,165 @@ ODBC_Connection::close(void)
         hdbc = NULL;
     }
     if (henv) {
-        SQLFreeHandle (SQL_HANDLE_ENV, henv);
+        if (!sharedEnv_) SQLFreeHandle (SQL_HANDLE_ENV, henv);
         henv = NULL;
+        sharedEnv_ = false;
     }
 #endif
+    if (wasConnected && observer_) observer_->onDisconnect(this);
     return (true);
 }
 
 bool
 ODBC_Connection::isConnected(void)
 {
-    return (true);
+    SQLUINTEGER dead = SQL_CD_FALSE;
+
+    if (!connected) return (false);
+    // answered from the driver's own state, without a round trip;
+    // drivers which do not know are taken to be connected
+    if (SQLGetConnectAttr (hdbc, SQL_ATTR_CONNECTION_DEAD, &dead, SQL_IS_UINTEGER, NULL) != SQL_SUCCESS)
+        return (true);
+    return (dead != SQL_CD_TRUE);
+}
+
+/* handles kept for reuse, beyond those prepared */
+static const size_t idleStatements = 8;
+/* statements kept prepared */
+static const size_t preparedStatements = 32;
+/* statements remembered to spot the second run */
+static const size_t seenStatements = 256;
+
+HSTMT
+ODBC_Connection::allocate(void)
+{
+    HSTMT stmt = 0;
+
+#if (ODBCVER < 0x0300)
+    if (SQLAllocStmt (hdbc, &stmt) != SQL_SUCCESS)
+        return (0);
+#else
+    if (SQLAllocHandle (SQL_HANDLE_STMT, hdbc, &stmt) != SQL_SUCCESS)
+        return (0);
+#endif
+    return (stmt);
+}
+
+void
+ODBC_Connection::dispose(HSTMT stmt)
+{
+#if (ODBCVER < 0x0300)
+    SQLFreeStmt (stmt, SQL_DROP);
+#else
+    SQLFreeHandle (SQL_HANDLE_STMT, stmt);
+#endif
+}
+
+/**
+ * Returns an unused statement handle, for a single run.
+ */
+HSTMT
+ODBC_Connection::checkout(void)
+{
+    if (idle_.empty()) return (allocate());
+
+    HSTMT stmt = idle_.back();
+    idle_.pop_back();
+    return (stmt);
+}
+
+/**
+ * Returns a statement handle to run sql on. The second time sql is
+ * seen it is prepared on a handle kept for it, and prepared is set;
+ * only SQLExecute() is left to do then.
+ */
+HSTMT
+ODBC_Connection::checkout(const char *sql, bool &prepared)
+{
+    prepared = false;
+
+    std::map<std::string, Prepared>::iterator it = prepared_.find(sql);
+    if (it != prepared_.end()) {
+        // already open further up; run this one on its own
+        if (it->second.busy) return (checkout());
+        it->second.busy = true;
+        prepared = true;
+        return (it->second.stmt);
+    }
+
+    if (prepared_.size() < preparedStatements && !seen_.insert(sql).second) {
+        seen_.erase(sql);
+        HSTMT stmt = checkout();
+        if (!stmt) return (0);
+        if (SQLPrepare (stmt, (SQLTCHAR *) sql, SQL_NTS) == SQL_SUCCESS) {
+            Prepared p = { stmt, true };
+            prepared_[sql] = p;
+            prepared = true;
+            return (stmt);
+        }
+        // left to SQLExecDirect(), which reports the error
+        return (stmt);
+    }
+    if (seen_.size() > seenStatements) {
+        seen_.clear();
+    }
+    return (checkout());
+}
+
+/**
+ * Takes back a handle from checkout(), closing its cursor. Prepared
+ * statements stay prepared.
+ */
+void
+ODBC_Connection::checkin(HSTMT stmt)
+{
+    SQLFreeStmt (stmt, SQL_CLOSE);
+
+    for (std::map<std::string, Prepared>::iterator it = prepared_.begin(); it != prepared_.end(); ++it) {
+        if (it->second.stmt == stmt) {
+            it->second.busy = false;
+            return;
+        }
+    }
+    if (idle_.size() < idleStatements) {
+        idle_.push_back(stmt);
+    } else {
+        dispose(stmt);
+    }
+}
+
+/**
+ * Takes back the handle kept for errormsg() after a failed query,
+ * once another statement is about to run.
+ */
+void
+ODBC_Connection::settle(void)
+{
+    if (!diag_) return;
+    checkin(diag_);
+    diag_ = 0;
 }
 
 bool
 ODBC_Connection::execute(const char *sql)
+{
+    QueryTrace trace(observer_, this, sql);
+    return (trace.finish(exec(sql)));
+}
+
+bool
+ODBC_Connection::exec(const char *sql)
 {
     int sts;
 
     if (!connected) return (false);
+    settle();
 
-    if (SQLPrepare (hstmt, (SQLTCHAR *) sql, SQL_NTS) != SQL_SUCCESS)
-        return (false);
-
-    if ((sts=SQLExecute (hstmt)) != SQL_SUCCESS && sts != SQL_SUCCESS_WITH_INFO)
+    // nothing is read back, so the statement is run directly and any
+    // cursor it opened closed again right away
+    sts = SQLExecDirect (hstmt, (SQLTCHAR *) sql, SQL_NTS);
+    SQLFreeStmt (hstmt, SQL_CLOSE);
+    if (sts != SQL_SUCCESS && sts != SQL_SUCCESS_WITH_INFO && sts != SQL_NO_DATA_FOUND)
         return (false);
 
     /*
@@ -595,15 +857,24 @@ ODBC_Connection::executeQuery(const char *sql)
 {
     if (!connected) return (NULL);
 
-    if (SQLPrepare (hstmt, (SQLTCHAR *) sql, SQL_NTS) != SQL_SUCCESS)
+    QueryTrace trace(observer_, this, sql);
+    settle();
+
+    bool prepared;
+    HSTMT stmt = checkout(sql, prepared);
+    if (!stmt)
         return (NULL);
 
-    if (SQLExecute (hstmt) != SQL_SUCCESS)
+    int sts = (prepared ? SQLExecute (stmt) : SQLExecDirect (stmt, (SQLTCHAR *) sql, SQL_NTS));
+    if (sts != SQL_SUCCESS && sts != SQL_SUCCESS_WITH_INFO) {
+        // kept until the next statement, for errormsg()
+        diag_ = stmt;
         return (NULL);
+    }
 
-    dbabstract::ResultSet *c = 0;
-    c = new dbabstract::ODBC_ResultSet(hstmt);
-    return (c);
+    dbabstract::ODBC_ResultSet *c = new dbabstract::ODBC_ResultSet(stmt, this);
+    c->fetch_.attach(observer_, this);
+    return (trace.finish(c));
 }
 
 char *
@@ -647,33 +918,31 @@ ODBC_Connection::insertId(void)
 }
 
 bool
-ODBC_Connection::beginTrans(void)
+ODBC_Connection::transaction(const char *sql, enum ConnectionObserver::TRANS_EVENT event)
 {
     if (!connected) return (false);
-    if (execute("BEGIN") == true) {
-        return (true);
-    }
-    return (false);
+
+    // reported as a transaction only, not as a statement
+    TransactionTrace trace(observer_, this, event);
+    return (trace.finish(exec(sql)));
+}
+
+bool
+ODBC_Connection::beginTrans(void)
+{
+    return (transaction("BEGIN", ConnectionObserver::BEGIN));
 }
 
 bool
 ODBC_Connection::commitTrans(void)
 {
-    if (!connected) return (false);
-    if (execute("COMMIT") == true) {
-        return (true);
-    }
-    return (false);
+    return (transaction("COMMIT", ConnectionObserver::COMMIT));
 }
 
 bool
 ODBC_Connection::rollbackTrans(void)
 {
-    if (!connected) return (false);
-    if (execute("ROLLBACK") == true) {
-        return (true);
-    }
-    return (false);
+    return (transaction("ROLLBACK", ConnectionObserver::ROLLBACK));
 }
 
 bool
@@ -707,12 +976,12 @@ ODBC_Connection::errorno(void) const
     SQLRETURN sts;
 
 #if (ODBCVER < 0x0300)
-    sts = SQLError (henv, hdbc, hstmt, sqlstate, &native_error,
+    sts = SQLError (henv, hdbc, diagnostics(), sqlstate, &native_error,
             buf, NUMTCHAR (buf), NULL);
     if (!SQL_SUCCEEDED (sts))
         return (0);
 #else
-    sts = SQLGetDiagRec (SQL_HANDLE_STMT, hstmt, 0, sqlstate, &native_error,
+    sts = SQLGetDiagRec (SQL_HANDLE_STMT, diagnostics(), 0, sqlstate, &native_error,
             buf, NUMTCHAR (buf), NULL);
     if (!SQL_SUCCEEDED (sts))
         return (0);
@@ -723,7 +992,6 @@ ODBC_Connection::errorno(void) const
 const char *
 ODBC_Connection::errormsg(void) const
 {
-    static SQLTCHAR buf[512];
     SQLTCHAR sqlstate[15];
     SQLINTEGER native_error = 0;
     SQLRETURN sts;
@@ -731,17 +999,17 @@ ODBC_Connection::errormsg(void) const
     ODBC_Errors ("errormsg");
 
 #if (ODBCVER < 0x0300)
-    sts = SQLError (henv, hdbc, hstmt, sqlstate, &native_error,
-            buf, NUMTCHAR (buf), NULL);
+    sts = SQLError (henv, hdbc, diagnostics(), sqlstate, &native_error,
+            error_, NUMTCHAR (error_), NULL);
     if (!SQL_SUCCEEDED (sts))
         return (0);
 #else
-    sts = SQLGetDiagRec (SQL_HANDLE_STMT, hstmt, 0, sqlstate, &native_error,
-            buf, NUMTCHAR (buf), NULL);
+    sts = SQLGetDiagRec (SQL_HANDLE_STMT, diagnostics(), 0, sqlstate, &native_error,
+            error_, NUMTCHAR (error_), NULL);
     if (!SQL_SUCCEEDED (sts))
         return (0);
 #endif
-    return ((const char *) buf);
+    return ((const char *) error_);
 }
 
 const char *
@@ -772,6 +1040,7 @@ ODBC_Connection::tables(void) const
         }
         vTables.push_back((char *) fetchBuffer);
     }
+    SQLFreeStmt (hstmt, SQL_CLOSE);
     return vTables;
 }
 
@@ -19,6 +19,8 @@
  */
 #include <fstream>
 #include <iomanip>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -36,7 +38,7 @@ namespace dbabstract
     {
         friend class ODBC_Connection;
     protected:
-        ODBC_ResultSet(HSTMT stmt) : hstmt(stmt), record(0) {};
+        ODBC_ResultSet(HSTMT stmt, ODBC_Connection *conn = NULL) : hstmt(stmt), record(0), conn_(conn), column_(-1) {};
         ~ODBC_ResultSet();
     private:
         ODBC_ResultSet() {};
@@ -51,6 +53,8 @@ namespace dbabstract
 
         unsigned long recordCount(void) const;
         unsigned int findColumn(const char *field) const;
+        unsigned int columnCount(void) const;
+        const char *columnName(const unsigned int idx) const;
 
         const char *getString(const int idx) const;
         int getInteger(const int idx) const;
@@ -68,10 +72,26 @@ namespace dbabstract
         void operator delete (void *ptr);
 
     private:
+        bool step(void);
+
         HSTMT hstmt;
         int record;
+        ODBC_Connection *conn_; /** takes hstmt back when closed */
+        mutable SQLTCHAR colName_[256];
+        mutable std::vector<SQLTCHAR> value_;
+        mutable int column_; /** the column held in value_ */
+        FetchTrace fetch_;
     };
 
+    /**
+     * Each executeQuery() runs on a statement handle of its own, so
+     * several ResultSets may be open at once, and tables() leaves them
+     * alone. Handles go back to the connection when their ResultSet is
+     * closed, which must happen before the connection is closed.
+     *
+     * A statement seen once is run with SQLExecDirect(). From its
+     * second time on, it is prepared on a handle kept for it.
+     */
     class ODBC_Connection : public Connection
     {
     private:
@@ -83,12 +103,29 @@ namespace dbabstract
             : henv(0)
             , hdbc(0)
             , hstmt(0)
-            , connected(0) {}
+            , connected(0)
+            , diag_(0)
+            , sharedEnv_(false) {}
         ~ODBC_Connection() { close(); }
 
         void *handle(void) { return hstmt; }
         std::vector<std::string> tables(void) const;
         bool open(const char *database, const char *host, const int port, const char *user, const char *pass);
+
+        /**
+         * Also takes "login_timeout" and "connection_timeout" in
+         * seconds, and "packet_size" in bytes.
+         *
+         * Connections share one environment, on which the driver
+         * manager pools them (SQL_CP_ONE_PER_HENV): close() hands the
+         * connection back to the pool, and a later open() with the
+         * same connection string takes it again without logging in.
+         * Session settings may come along with it. "pooling" set to
+         * false gives the connection an environment of its own, and a
+         * real disconnect.
+         */
+        bool open(const ConnectionOptions &options);
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const;
         bool close(void);
         bool isConnected(void);
         bool execute(const char *sql);
@@ -115,9 +152,34 @@ namespace dbabstract
         int ODBC_Errors (char *where) const;
 
     private:
+        friend class ODBC_ResultSet;
+
+        /** a statement prepared on a handle of its own */
+        struct Prepared {
+            HSTMT stmt;
+            bool busy; /** its ResultSet is open */
+        };
+
+        HSTMT allocate(void);
+        void dispose(HSTMT stmt);
+        HSTMT checkout(void);
+        HSTMT checkout(const char *sql, bool &prepared);
+        void checkin(HSTMT stmt);
+        void settle(void);
+        HSTMT diagnostics(void) const { return (diag_ ? diag_ : hstmt); }
+
+        bool exec(const char *sql);
+        bool transaction(const char *sql, enum ConnectionObserver::TRANS_EVENT event);
+
         HENV henv;
         HDBC hdbc;
         HSTMT hstmt;
         int connected;
+        std::vector<HSTMT> idle_;
+        std::map<std::string, Prepared> prepared_;
+        std::set<std::string> seen_; /** statements run once so far */
+        HSTMT diag_; /** the handle of the last failed query */
+        bool sharedEnv_; /** henv is the shared one; not freed */
+        mutable SQLTCHAR error_[512];
     };
 }
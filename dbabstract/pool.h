@@ -0,0 +1,262 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "dbabstract/db.h"
+
+namespace dbabstract
+{
+    /**
+     * A bounded set of open Connection objects shared between
+     * threads. A Connection is handed to one user at a time, which
+     * keeps the one-Connection-per-thread rule of the drivers.
+     *
+     * Connections are created on demand by the factory function,
+     * which must return an opened Connection or NULL. The pool owns
+     * the Connection objects and release()s them when it is deleted;
+     * every acquired Connection must be given back first.
+     */
+    class ConnectionPool
+    {
+    private:
+        ConnectionPool(const ConnectionPool &old);
+        const ConnectionPool &operator=(const ConnectionPool &old);
+
+    public:
+        typedef std::function<Connection *(void)> Factory;
+        typedef std::function<void (Connection *)> Waiter;
+
+        /**
+         * @param factory Creates and opens a new Connection.
+         * @param maxSize Upper bound on open Connection objects.
+         */
+        ConnectionPool(const Factory &factory, size_t maxSize)
+            : factory_(factory)
+            , maxSize_(maxSize ? maxSize : 1)
+            , total_(0)
+            , nextWaiter_(0) {}
+
+        ~ConnectionPool()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i=0; i<idle_.size(); i++) {
+                idle_[i]->release();
+            }
+            idle_.clear();
+        }
+
+        /**
+         * Takes a Connection, waiting up to timeoutMs milliseconds
+         * (-1 forever) for one to be released when the pool is full.
+         *
+         * @return Connection* NULL on timeout, or if the factory failed.
+         */
+        Connection *acquire(long timeoutMs = -1)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            Connection *conn = takeIdle();
+            if (conn) return (conn);
+            if (total_ < maxSize_) {
+                total_++;
+                lock.unlock();
+                return (create());
+            }
+
+            std::shared_ptr<Handoff> handoff(new Handoff);
+            unsigned long id = ++nextWaiter_;
+            waiters_.push_back(Pending(id, [this, handoff](Connection *c) {
+                std::lock_guard<std::mutex> guard(mutex_);
+                handoff->conn = c;
+                handoff->done = true;
+                cond_.notify_all();
+            }));
+
+            if (timeoutMs >= 0) {
+                cond_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&handoff]() { return handoff->done; });
+                if (!handoff->done) {
+                    for (std::list<Pending>::iterator i = waiters_.begin(); i != waiters_.end(); ++i) {
+                        if (i->first == id) {
+                            waiters_.erase(i);
+                            return (NULL);
+                        }
+                    }
+                    // a release() already picked us; take what it hands over
+                }
+            }
+            cond_.wait(lock, [&handoff]() { return handoff->done; });
+            return (handoff->conn);
+        }
+
+        /**
+         * Takes a Connection without waiting.
+         *
+         * @return Connection* NULL if the pool is exhausted.
+         */
+        Connection *tryAcquire(void)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            Connection *conn = takeIdle();
+            if (conn) return (conn);
+            if (total_ < maxSize_) {
+                total_++;
+                lock.unlock();
+                return (create());
+            }
+            return (NULL);
+        }
+
+        /**
+         * Hands a Connection to fn as soon as one is available. fn is
+         * called either right away on this thread, or on the thread
+         * which releases a Connection. It receives NULL if the factory
+         * failed.
+         */
+        void acquireAsync(const Waiter &fn)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            Connection *conn = takeIdle();
+            if (!conn && total_ >= maxSize_) {
+                waiters_.push_back(Pending(++nextWaiter_, fn));
+                return;
+            }
+            if (!conn) {
+                total_++;
+                lock.unlock();
+                conn = create();
+            } else {
+                lock.unlock();
+            }
+            fn(conn);
+        }
+
+        /**
+         * Gives a Connection back to the pool.
+         */
+        void release(Connection *conn)
+        {
+            if (!conn) return;
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (waiters_.empty()) {
+                idle_.push_back(conn);
+                return;
+            }
+            Waiter fn = waiters_.front().second;
+            waiters_.pop_front();
+            lock.unlock();
+            fn(conn);
+        }
+
+        /**
+         * Closes a Connection which turned out to be broken, instead
+         * of giving it back. A waiter, if any, gets a new one.
+         */
+        void discard(Connection *conn)
+        {
+            if (!conn) return;
+            conn->release();
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (waiters_.empty()) {
+                total_--;
+                return;
+            }
+            Waiter fn = waiters_.front().second;
+            waiters_.pop_front();
+            lock.unlock();
+            fn(create());
+        }
+
+        size_t size(void) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return (total_);
+        }
+
+        size_t idle(void) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return (idle_.size());
+        }
+
+        size_t maxSize(void) const { return (maxSize_); }
+
+    private:
+        struct Handoff
+        {
+            Handoff() : conn(NULL), done(false) {}
+            Connection *conn;
+            bool done;
+        };
+        typedef std::pair<unsigned long, Waiter> Pending;
+
+        Connection *takeIdle(void)
+        {
+            if (idle_.empty()) return (NULL);
+            // most recently used first; it is the least likely to
+            // have been dropped by the server
+            Connection *conn = idle_.back();
+            idle_.pop_back();
+            return (conn);
+        }
+
+        Connection *create(void)
+        {
+            Connection *conn = factory_();
+            if (conn) return (conn);
+
+            // the slot is free again; a waiter queued meanwhile would
+            // otherwise wait for a release() which may never come
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (waiters_.empty()) {
+                total_--;
+                return (NULL);
+            }
+            Waiter fn = waiters_.front().second;
+            waiters_.pop_front();
+            lock.unlock();
+            fn(create());
+            return (NULL);
+        }
+
+        Factory factory_;
+        size_t maxSize_;
+        size_t total_;
+        unsigned long nextWaiter_;
+        std::vector<Connection *> idle_;
+        std::list<Pending> waiters_;
+        mutable std::mutex mutex_;
+        std::condition_variable cond_;
+    };
+}; /* namespace */
+
+#endif
@@ -23,6 +23,7 @@
 #include <iostream>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <string>
 #include <vector>
 
@@ -84,6 +85,18 @@ PQ_ResultSet::findColumn(const char *fld) const
     return (i);
 }
 
+unsigned int
+PQ_ResultSet::columnCount(void) const
+{
+    return ((unsigned int) PQnfields(res_));
+}
+
+const char *
+PQ_ResultSet::columnName(const unsigned int idx) const
+{
+    return (PQfname(res_, idx));
+}
+
 const char *
 PQ_ResultSet::getString(const int idx) const
 {
@@ -197,23 +210,64 @@ PQ_ResultSet::operator delete (void *ptr)
 bool
 PQ_Connection::open(const char *database, const char *host, const int port, const char *user, const char *pass)
 {
-    pgconn_ = PQconnectdb(database);
-    database_ = database;
+    return (open(ConnectionOptions(database, host, port, user, pass)));
+}
+
+/* options passed to libpq as they are */
+static const char *const connectionOptions[] = {
+    "connect_timeout", "keepalives", "keepalives_idle", "keepalives_interval", "keepalives_count",
+    "tcp_user_timeout", "target_session_attrs", "sslmode", "application_name", "options", NULL
+};
+
+bool
+PQ_Connection::open(const ConnectionOptions &options)
+{
+    // the database may be a whole conninfo string or URI, as for
+    // open(); the other options override what it says
+    std::vector<const char *> keys, values;
+    static const char *const common[][2] = { { "database", "dbname" }, { "host", "host" }, { "port", "port" }, { "user", "user" }, { "password", "password" } };
+    for (size_t i=0; i<sizeof(common) / sizeof(common[0]); i++) {
+        if (!options.get(common[i][0])) continue;
+        keys.push_back(common[i][1]);
+        values.push_back(options.get(common[i][0]));
+    }
+    for (size_t i=0; connectionOptions[i]; i++) {
+        if (!options.get(connectionOptions[i])) continue;
+        keys.push_back(connectionOptions[i]);
+        values.push_back(options.get(connectionOptions[i]));
+    }
+    keys.push_back(NULL);
+    values.push_back(NULL);
+
+    reportUnknown(options);
+    ConnectTrace trace(observer_, this, options.get("database"), options.get("host"), (int) options.getLong("port", 0));
+    pgconn_ = PQconnectdbParams(&keys[0], &values[0], 1);
     if (PQstatus(pgconn_) != CONNECTION_OK) {
         if (pgconn_)
-            PQfinish(pgconn_);    
-        pgconn_ = false;
+            PQfinish(pgconn_);
+        pgconn_ = NULL;
         return (false);
     }
-    return (true);
+    return (trace.finish(true));
+}
+
+std::vector<std::string>
+PQ_Connection::unknownOptions(const ConnectionOptions &options) const
+{
+    return (options.unknown(connectionOptions));
 }
 
 bool
 PQ_Connection::close(void)
 {
     if (!pgconn_) return (false);
+    if (pending_) {
+        PQclear(pending_);
+        pending_ = NULL;
+    }
     PQfinish(pgconn_);
     pgconn_ = NULL;
+    if (observer_) observer_->onDisconnect(this);
     return (true);
 }
 
@@ -221,17 +275,29 @@ bool
 PQ_Connection::isConnected(void)
 {
     if (!pgconn_) return (false);
-    return ((PQping(database_.c_str()) == PQPING_OK ? true : false));
+    if (PQstatus(pgconn_) != CONNECTION_OK) return (false);
+
+    // an idle connection has nothing to read, unless the server sent a
+    // notice or closed it; reading notices EOF without a round trip
+    struct pollfd pfd;
+    pfd.fd = PQsocket(pgconn_);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (pfd.fd >= 0 && ::poll(&pfd, 1, 0) > 0) {
+        if (!PQconsumeInput(pgconn_)) return (false);
+    }
+    return (PQstatus(pgconn_) == CONNECTION_OK);
 }
 
 bool
 PQ_Connection::execute(const char *sql)
 {
     if (!pgconn_) return (false);
+    QueryTrace trace(observer_, this, sql);
     PGresult *res = PQexec(pgconn_, sql);
     if (PQresultStatus(res) == PGRES_COMMAND_OK) {
         PQclear(res);
-        return (true);
+        return (trace.finish(true));
     }
     std::cerr << "Error issuing command: " << PQerrorMessage(pgconn_) << std::endl;
     PQclear(res);
@@ -243,10 +309,20 @@ PQ_Connection::executeQuery(const char *sql)
 {
     if (!pgconn_) return (NULL);
 
+    QueryTrace trace(observer_, this, sql);
     PGresult *res = PQexec(pgconn_, sql);
-    if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-        return (0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        // no rows to hand out: a command, or a failure the caller
+        // must not mistake (or cache) as an empty result
+        trace.finish(PQresultStatus(res) == PGRES_COMMAND_OK);
+        PQclear(res);
+        return (NULL);
     }
+    // every row arrived with the result
+    if (trace.finish(true) && observer_) {
+        observer_->onFetchBatch(this, (unsigned long) PQntuples(res), 0);
+    }
+
     dbabstract::ResultSet *c = 0;
     c = new dbabstract::PQ_ResultSet(res);
     return (c);
@@ -286,42 +362,35 @@ PQ_Connection::insertId(void)
 }
 
 bool
-PQ_Connection::beginTrans(void)
+PQ_Connection::command(const char *sql, enum ConnectionObserver::TRANS_EVENT event)
 {
     if (!pgconn_) return (false);
-    PGresult *res = PQexec(pgconn_, "BEGIN");
+    TransactionTrace trace(observer_, this, event);
+    PGresult *res = PQexec(pgconn_, sql);
     if (PQresultStatus(res) == PGRES_COMMAND_OK) {
         PQclear(res);
-        return (true);
+        return (trace.finish(true));
     }
     PQclear(res);
     return (false);
 }
 
+bool
+PQ_Connection::beginTrans(void)
+{
+    return (command("BEGIN", ConnectionObserver::BEGIN));
+}
+
 bool
 PQ_Connection::commitTrans(void)
 {
-    if (!pgconn_) return (false);
-    PGresult *res = PQexec(pgconn_, "END");
-    if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-        PQclear(res);
-        return (true);
-    }
-    PQclear(res);
-    return (false);
+    return (command("END", ConnectionObserver::COMMIT));
 }
 
 bool
 PQ_Connection::rollbackTrans(void)
 {
-    if (!pgconn_) return (false);
-    PGresult *res = PQexec(pgconn_, "ROLLBACK");
-    if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-        PQclear(res);
-        return (true);
-    }
-    PQclear(res);
-    return (false);
+    return (command("ROLLBACK", ConnectionObserver::ROLLBACK));
 }
 
 bool
@@ -384,6 +453,128 @@ PQ_Connection::tables(void) const
     return vTables;
 }
 
+int
+PQ_Connection::socket(void)
+{
+    if (!pgconn_) return (-1);
+    return (PQsocket(pgconn_));
+}
+
+Connection::ASYNC_STATUS
+PQ_Connection::startQuery(const char *sql)
+{
+    if (!pgconn_) return (ASYNC_FAILED);
+    if (pending_) {
+        PQclear(pending_);
+        pending_ = NULL;
+    }
+    async_.start(observer_, this, sql);
+    // PQexec and friends ignore this, so it is safe to leave it on
+    PQsetnonblocking(pgconn_, 1);
+    if (!PQsendQuery(pgconn_, sql)) {
+        async_.finish(false);
+        return (ASYNC_FAILED);
+    }
+    flushing_ = true;
+    return (continueQuery());
+}
+
+Connection::ASYNC_STATUS
+PQ_Connection::continueQuery(void)
+{
+    enum ASYNC_STATUS status = poll();
+    if (status == ASYNC_DONE || status == ASYNC_FAILED) {
+        async_.finish(status == ASYNC_DONE);
+    }
+    return (status);
+}
+
+Connection::ASYNC_STATUS
+PQ_Connection::poll(void)
+{
+    if (!pgconn_) return (ASYNC_FAILED);
+
+    if (flushing_) {
+        int rc = PQflush(pgconn_);
+        if (rc < 0) return (ASYNC_FAILED);
+        if (rc > 0) return (ASYNC_WANT_WRITE);
+        flushing_ = false;
+        return (ASYNC_WANT_READ);
+    }
+
+    if (!PQconsumeInput(pgconn_)) {
+        return (ASYNC_FAILED);
+    }
+    if (PQisBusy(pgconn_)) {
+        return (ASYNC_WANT_READ);
+    }
+
+    // keep the last result of a multi-statement string, like PQexec;
+    // the later statements may still be running, so only take what
+    // has arrived
+    PGresult *res;
+    while ((res = PQgetResult(pgconn_)) != NULL) {
+        if (pending_) PQclear(pending_);
+        pending_ = res;
+        if (PQisBusy(pgconn_)) {
+            return (ASYNC_WANT_READ);
+        }
+    }
+    if (!pending_) return (ASYNC_FAILED);
+
+    ExecStatusType st = PQresultStatus(pending_);
+    if (st == PGRES_COMMAND_OK || st == PGRES_TUPLES_OK) {
+        return (ASYNC_DONE);
+    }
+    return (ASYNC_FAILED);
+}
+
+dbabstract::ResultSet *
+PQ_Connection::finishQuery(void)
+{
+    PGresult *res = pending_;
+    pending_ = NULL;
+
+    if (!res) return (NULL);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        return (NULL);
+    }
+    if (observer_) observer_->onFetchBatch(this, (unsigned long) PQntuples(res), 0);
+    dbabstract::ResultSet *c = 0;
+    c = new dbabstract::PQ_ResultSet(res);
+    return (c);
+}
+
+bool
+PQ_Connection::cancelQuery(void)
+{
+    char errbuf[256];
+
+    if (!pgconn_) return (false);
+
+    PGcancel *cancel = PQgetCancel(pgconn_);
+    if (cancel) {
+        PQcancel(cancel, errbuf, sizeof(errbuf));
+        PQfreeCancel(cancel);
+    }
+
+    // the server answers a cancel with an error result; drain it so
+    // the connection is usable again
+    PQsetnonblocking(pgconn_, 0);
+    PGresult *res;
+    while ((res = PQgetResult(pgconn_)) != NULL) {
+        PQclear(res);
+    }
+    if (pending_) {
+        PQclear(pending_);
+        pending_ = NULL;
+    }
+    flushing_ = false;
+    async_.finish(false);
+    return (true);
+}
+
 void *
 PQ_Connection::operator new (size_t bytes)
 {
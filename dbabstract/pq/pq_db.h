@@ -49,6 +49,8 @@ class PQ_ResultSet : public ResultSet
 
         unsigned long recordCount(void) const;
         unsigned int findColumn(const char *field) const;
+        unsigned int columnCount(void) const;
+        const char *columnName(const unsigned int idx) const;
 
         const char *getString(const int idx) const;
         int getInteger(const int idx) const;
@@ -77,11 +79,21 @@ class PQ_ResultSet : public ResultSet
         const PQ_Connection &operator=(const PQ_Connection &old);
 
     public:
-        PQ_Connection() : pgconn_(NULL) {};
+        PQ_Connection() : pgconn_(NULL), pending_(NULL), flushing_(false) {};
         ~PQ_Connection() { close(); }
 
         void * handle(void) { return pgconn_; }
         bool open(const char *database, const char *host, const int port, const char *user, const char *pass);
+
+        /**
+         * Also takes the libpq settings "connect_timeout",
+         * "keepalives", "keepalives_idle", "keepalives_interval",
+         * "keepalives_count", "tcp_user_timeout",
+         * "target_session_attrs", "sslmode", "application_name" and
+         * "options".
+         */
+        bool open(const ConnectionOptions &options);
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const;
         bool close(void);
         bool isConnected(void);
         bool execute(const char *sql);
@@ -102,6 +114,12 @@ class PQ_ResultSet : public ResultSet
 
         std::vector<std::string> tables(void) const;
 
+        int socket(void);
+        enum ASYNC_STATUS startQuery(const char *sql);
+        enum ASYNC_STATUS continueQuery(void);
+        ResultSet *finishQuery(void);
+        bool cancelQuery(void);
+
         // Overload the new/delete opertors so the object will be
         // created/deleted using the memory allocator associated with the
         // DLL/SO.
@@ -109,7 +127,12 @@ class PQ_ResultSet : public ResultSet
         void operator delete (void *ptr);
 
     private:
+        bool command(const char *sql, enum ConnectionObserver::TRANS_EVENT event);
+        enum ASYNC_STATUS poll(void);
+
         PGconn *pgconn_;
-        std::string database_;
+        PGresult *pending_;
+        bool flushing_;
+        AsyncQueryTrace async_;
     };
 }
@@ -0,0 +1,655 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/workerpool.h"
+
+namespace dbabstract
+{
+    /**
+     * A Reactor multiplexes statements on many Connection objects
+     * from a single thread, using epoll(7).
+     *
+     * Drivers which expose a socket and a non-blocking path through
+     * Connection::startQuery() (PostgreSQL, and MySQL when built
+     * against the MariaDB client library) are driven directly by the
+     * event loop. Every other driver is offloaded to a small pool of
+     * worker threads, and the result is handed back to the loop.
+     *
+     * All completions, timers and keepalive callbacks run on the
+     * thread calling run() or runOnce(). Apart from post() and stop(),
+     * the Reactor must only be used from that thread.
+     *
+     * The Reactor does not own the Connection objects; each must
+     * stay alive until it is detach()ed or the Reactor is deleted.
+     * Statements on a single Connection run one at a time, in the
+     * order they were submitted.
+     */
+    class Reactor
+    {
+    private:
+        Reactor(const Reactor &old);
+        const Reactor &operator=(const Reactor &old);
+
+    public:
+        /**
+         * Receives the outcome of a statement. For a query which
+         * succeeded, rs holds the row data and MUST be closed by the
+         * callback; otherwise rs is NULL.
+         */
+        typedef std::function<void (ResultSet *rs, bool ok)> Completion;
+        typedef std::function<void (Connection *conn)> LostCallback;
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * @param offloadThreads Worker threads used for drivers
+         *                       without a non-blocking path.
+         */
+        explicit Reactor(unsigned int offloadThreads = 2)
+            : epfd_(::epoll_create1(EPOLL_CLOEXEC))
+            , wakefd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+            , stopped_(false)
+            , nextTimer_(0)
+            , offload_(new WorkerPool(offloadThreads))
+        {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            ::epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev);
+        }
+
+        ~Reactor()
+        {
+            // workers may still post completions; let them finish
+            // before the descriptors go away
+            offload_.reset();
+            // results nobody is left to pick up
+            for (size_t i=0; i<finished_.size(); i++) {
+                if (finished_[i].rs) finished_[i].rs->close();
+            }
+            for (std::map<Connection *, Conn *>::iterator i = conns_.begin(); i != conns_.end(); ++i) {
+                delete i->second;
+            }
+            ::close(wakefd_);
+            ::close(epfd_);
+        }
+
+        /**
+         * Queues a statement which returns row data.
+         *
+         * @param conn
+         * @param sql
+         * @param done Called with the ResultSet, or NULL on failure.
+         * @param timeoutMs Fail the statement if it has not completed
+         *                  within this many milliseconds; 0 waits
+         *                  forever.
+         *
+         * @return bool False if the Reactor could not be set up.
+         */
+        bool query(Connection *conn, const std::string &sql, const Completion &done, long timeoutMs = 0)
+        {
+            return (submit(conn, sql, true, done, timeoutMs));
+        }
+
+        /**
+         * Queues a statement whose row data (if any) is discarded,
+         * the asynchronous counterpart to Connection::execute().
+         */
+        bool execute(Connection *conn, const std::string &sql, const Completion &done, long timeoutMs = 0)
+        {
+            return (submit(conn, sql, false, done, timeoutMs));
+        }
+
+        /**
+         * Runs fn on the loop thread after delayMs milliseconds.
+         *
+         * @return unsigned long Timer id, usable with cancelTimer().
+         */
+        unsigned long schedule(long delayMs, const std::function<void ()> &fn)
+        {
+            Timer t;
+            t.due = Clock::now() + std::chrono::milliseconds(delayMs);
+            t.id = ++nextTimer_;
+            t.fn = fn;
+            timers_.push(t);
+            live_[t.id] = true;
+            return (t.id);
+        }
+
+        bool cancelTimer(unsigned long id)
+        {
+            return (live_.erase(id) > 0);
+        }
+
+        /**
+         * Issues sql on conn whenever it has been idle for intervalMs
+         * milliseconds, keeping server and middlebox timeouts from
+         * closing it. When the keepalive statement fails, lost is
+         * called and keepalives stop for that Connection.
+         */
+        void keepalive(Connection *conn, long intervalMs, const LostCallback &lost = LostCallback(), const char *sql = "SELECT 1")
+        {
+            Conn *c = lookup(conn);
+            if (c->keepaliveTimer) cancelTimer(c->keepaliveTimer);
+            c->keepaliveMs = intervalMs;
+            c->keepaliveSql = sql;
+            c->lost = lost;
+            armKeepalive(c);
+        }
+
+        /**
+         * Forgets conn. Queued statements which have not started are
+         * failed. Must not be called while a statement is in flight.
+         */
+        void detach(Connection *conn)
+        {
+            std::map<Connection *, Conn *>::iterator i = conns_.find(conn);
+            if (i == conns_.end()) return;
+            Conn *c = i->second;
+            if (c->busy) return;
+            unwatch(c);
+            if (c->keepaliveTimer) cancelTimer(c->keepaliveTimer);
+            conns_.erase(i);
+            while (!c->ops.empty()) {
+                Completion done = c->ops.front().done;
+                c->ops.pop_front();
+                if (done) done(NULL, false);
+            }
+            delete c;
+        }
+
+        /**
+         * Whether the statements on conn run on the offload pool, as
+         * its driver had no non-blocking path for the last one. The
+         * rows of such a ResultSet may block when stepped through.
+         */
+        bool offloads(Connection *conn) const
+        {
+            std::map<Connection *, Conn *>::const_iterator i = conns_.find(conn);
+            return (i != conns_.end() && i->second->blocking);
+        }
+
+        /**
+         * Runs fn on the loop thread. Safe to call from any thread.
+         */
+        void post(const std::function<void ()> &fn)
+        {
+            {
+                std::lock_guard<std::mutex> lock(postMutex_);
+                posted_.push_back(fn);
+            }
+            wake();
+        }
+
+        /**
+         * Runs work on the offload pool. Safe to call from any thread.
+         */
+        void offload(const std::function<void ()> &work)
+        {
+            offload_->submit(work);
+        }
+
+        /**
+         * Waits up to timeoutMs milliseconds (-1 forever) for socket
+         * events, posted functions and timers, and dispatches them.
+         *
+         * @return int Number of events dispatched, or -1 on error.
+         */
+        int runOnce(long timeoutMs = -1)
+        {
+            struct epoll_event events[64];
+            long wait = timeoutMs;
+
+            if (!timers_.empty()) {
+                // round up, or we would wake just before the deadline
+                long due = std::chrono::duration_cast<std::chrono::microseconds>(timers_.top().due - Clock::now()).count();
+                due = (due < 0 ? 0 : (due + 999) / 1000);
+                if (wait < 0 || due < wait) wait = due;
+            }
+
+            int n = ::epoll_wait(epfd_, events, 64, (int) wait);
+            if (n < 0) {
+                if (errno != EINTR) return (-1);
+                n = 0;
+            }
+
+            int handled = 0;
+            for (int i=0; i<n; i++) {
+                if (events[i].data.ptr == NULL) {
+                    handled += runPosted();
+                } else {
+                    ready(static_cast<Conn *>(events[i].data.ptr));
+                    handled++;
+                }
+            }
+            handled += runTimers();
+            return (handled);
+        }
+
+        /**
+         * Dispatches events until stop() is called.
+         */
+        void run(void)
+        {
+            stopped_ = false;
+            while (!stopped_) {
+                if (runOnce(-1) < 0) break;
+            }
+        }
+
+        /**
+         * Makes run() return. Safe to call from any thread.
+         */
+        void stop(void)
+        {
+            stopped_ = true;
+            post(std::function<void ()>());
+        }
+
+        /**
+         * Returns the number of statements queued or in flight.
+         */
+        size_t pending(void) const
+        {
+            size_t count = 0;
+            for (std::map<Connection *, Conn *>::const_iterator i = conns_.begin(); i != conns_.end(); ++i) {
+                count += i->second->ops.size();
+            }
+            return (count);
+        }
+
+    private:
+        struct Op
+        {
+            std::string sql;
+            bool rows;
+            Completion done;
+            long timeoutMs;
+            bool keepalive;
+        };
+
+        struct Conn
+        {
+            Conn(Connection *c)
+                : conn(c), fd(-1), busy(false), offloaded(false), blocking(false), timedOut(false)
+                , generation(0), timeoutTimer(0), keepaliveTimer(0), keepaliveMs(0)
+                , idleSince(Clock::now()) {}
+
+            Connection *conn;
+            int fd;
+            bool busy;
+            bool offloaded;
+            bool blocking; /** the last statement had to be offloaded */
+            bool timedOut;
+            unsigned long generation;
+            unsigned long timeoutTimer;
+            unsigned long keepaliveTimer;
+            long keepaliveMs;
+            std::string keepaliveSql;
+            LostCallback lost;
+            Clock::time_point idleSince;
+            std::deque<Op> ops;
+        };
+
+        /** the outcome of an offloaded statement or cancel */
+        struct Finished
+        {
+            Conn *c;
+            unsigned long generation;
+            ResultSet *rs;
+            bool ok;
+        };
+
+        struct Timer
+        {
+            Clock::time_point due;
+            unsigned long id;
+            std::function<void ()> fn;
+
+            bool operator<(const Timer &other) const
+            {
+                // std::priority_queue is a max-heap
+                return (due > other.due);
+            }
+        };
+
+        Conn *lookup(Connection *conn)
+        {
+            std::map<Connection *, Conn *>::iterator i = conns_.find(conn);
+            if (i != conns_.end()) return (i->second);
+            Conn *c = new Conn(conn);
+            conns_[conn] = c;
+            return (c);
+        }
+
+        bool submit(Connection *conn, const std::string &sql, bool rows, const Completion &done, long timeoutMs, bool keepalive = false)
+        {
+            if (epfd_ < 0 || wakefd_ < 0 || !conn) return (false);
+
+            Conn *c = lookup(conn);
+            Op op;
+            op.sql = sql;
+            op.rows = rows;
+            op.done = done;
+            op.timeoutMs = timeoutMs;
+            op.keepalive = keepalive;
+            c->ops.push_back(op);
+            if (!c->busy) start(c);
+            return (true);
+        }
+
+        void start(Conn *c)
+        {
+            if (c->ops.empty()) return;
+
+            Op &op = c->ops.front();
+            c->busy = true;
+            c->timedOut = false;
+            c->generation++;
+            if (op.timeoutMs > 0) {
+                unsigned long gen = c->generation;
+                c->timeoutTimer = schedule(op.timeoutMs, [this, c, gen]() { timeout(c, gen); });
+            }
+
+            Connection::ASYNC_STATUS st = Connection::ASYNC_UNSUPPORTED;
+            if (c->conn->socket() >= 0) {
+                st = c->conn->startQuery(op.sql.c_str());
+            }
+            c->blocking = (st == Connection::ASYNC_UNSUPPORTED);
+            if (c->blocking) {
+                startOffload(c);
+                return;
+            }
+            progress(c, st);
+        }
+
+        void startOffload(Conn *c)
+        {
+            Connection *conn = c->conn;
+            std::string sql = c->ops.front().sql;
+            bool rows = c->ops.front().rows;
+            unsigned long gen = c->generation;
+
+            c->offloaded = true;
+            offload_->submit([this, c, conn, sql, rows, gen]() {
+                ResultSet *rs = NULL;
+                bool ok;
+                if (rows) {
+                    rs = conn->executeQuery(sql.c_str());
+                    ok = (rs != NULL);
+                } else {
+                    ok = conn->execute(sql.c_str());
+                }
+                finished(c, gen, rs, ok);
+            });
+        }
+
+        /**
+         * Hands the outcome of offloaded work back to the loop. Kept
+         * apart from post(), so that a ResultSet left over when the
+         * Reactor is deleted can still be closed.
+         */
+        void finished(Conn *c, unsigned long gen, ResultSet *rs, bool ok)
+        {
+            Finished f;
+            f.c = c;
+            f.generation = gen;
+            f.rs = rs;
+            f.ok = ok;
+            {
+                std::lock_guard<std::mutex> lock(postMutex_);
+                finished_.push_back(f);
+            }
+            wake();
+        }
+
+        void wake(void)
+        {
+            uint64_t one = 1;
+            ssize_t n = ::write(wakefd_, &one, sizeof(one));
+            (void) n;
+        }
+
+        void finishOffload(Conn *c, unsigned long gen, ResultSet *rs, bool ok)
+        {
+            c->offloaded = false;
+            if (c->timedOut || gen != c->generation) {
+                // the caller already saw a timeout
+                if (rs) rs->close();
+                done(c);
+                return;
+            }
+            complete(c, rs, ok);
+        }
+
+        void progress(Conn *c, Connection::ASYNC_STATUS st)
+        {
+            switch (st) {
+            case Connection::ASYNC_WANT_READ:
+                watch(c, EPOLLIN);
+                break;
+            case Connection::ASYNC_WANT_WRITE:
+                watch(c, EPOLLOUT);
+                break;
+            case Connection::ASYNC_DONE:
+                unwatch(c);
+                complete(c, c->conn->finishQuery(), true);
+                break;
+            default:
+                unwatch(c);
+                complete(c, NULL, false);
+                break;
+            }
+        }
+
+        void ready(Conn *c)
+        {
+            if (!c->busy || c->offloaded) return;
+            progress(c, c->conn->continueQuery());
+        }
+
+        void timeout(Conn *c, unsigned long gen)
+        {
+            if (!c->busy || c->timedOut || gen != c->generation) return;
+
+            c->timeoutTimer = 0;
+            abandon(c);
+        }
+
+        /**
+         * Fails the statement in flight on c. Cancelling it may block
+         * (PQcancel() connects to the server), so that is left to the
+         * offload pool; c takes its next statement afterwards.
+         */
+        void abandon(Conn *c)
+        {
+            if (c->timeoutTimer) {
+                cancelTimer(c->timeoutTimer);
+                c->timeoutTimer = 0;
+            }
+            c->timedOut = true;
+            Completion fn = c->ops.front().done;
+            if (!c->offloaded) {
+                unwatch(c);
+                c->offloaded = true;
+                Connection *conn = c->conn;
+                unsigned long gen = c->generation;
+                offload_->submit([this, c, conn, gen]() {
+                    conn->cancelQuery();
+                    finished(c, gen, NULL, false);
+                });
+            }
+            if (fn) fn(NULL, false);
+            if (c->ops.front().keepalive && c->lost) {
+                c->keepaliveMs = 0;
+                c->lost(c->conn);
+            }
+        }
+
+        void complete(Conn *c, ResultSet *rs, bool ok)
+        {
+            if (c->timeoutTimer) {
+                cancelTimer(c->timeoutTimer);
+                c->timeoutTimer = 0;
+            }
+            Op op = c->ops.front();
+            if (!op.rows && rs) {
+                rs->close();
+                rs = NULL;
+            }
+            if (op.done) {
+                op.done(rs, ok);
+            } else if (rs) {
+                rs->close();
+            }
+            if (op.keepalive && !ok && c->lost) {
+                c->keepaliveMs = 0;
+                c->lost(c->conn);
+            }
+            done(c);
+        }
+
+        void done(Conn *c)
+        {
+            c->ops.pop_front();
+            c->busy = false;
+            c->idleSince = Clock::now();
+            if (!c->ops.empty()) start(c);
+        }
+
+        void armKeepalive(Conn *c)
+        {
+            c->keepaliveTimer = 0;
+            if (c->keepaliveMs <= 0) return;
+            c->keepaliveTimer = schedule(c->keepaliveMs, [this, c]() {
+                c->keepaliveTimer = 0;
+                long idle = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - c->idleSince).count();
+                if (!c->busy && c->ops.empty() && idle >= c->keepaliveMs) {
+                    submit(c->conn, c->keepaliveSql, false, Completion(), c->keepaliveMs, true);
+                }
+                armKeepalive(c);
+            });
+        }
+
+        void watch(Conn *c, uint32_t events)
+        {
+            struct epoll_event ev;
+            ev.events = events;
+            ev.data.ptr = c;
+
+            int fd = c->conn->socket();
+            if (fd != c->fd) {
+                // the driver may have reconnected on a new descriptor
+                unwatch(c);
+                if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == 0) {
+                    c->fd = fd;
+                    return;
+                }
+            } else if (::epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == 0) {
+                return;
+            }
+            // nothing would ever wake the statement up
+            abandon(c);
+        }
+
+        void unwatch(Conn *c)
+        {
+            if (c->fd < 0) return;
+            ::epoll_ctl(epfd_, EPOLL_CTL_DEL, c->fd, NULL);
+            c->fd = -1;
+        }
+
+        int runPosted(void)
+        {
+            uint64_t count;
+            ssize_t n = ::read(wakefd_, &count, sizeof(count));
+            (void) n;
+
+            std::deque<Finished> results;
+            std::deque<std::function<void ()> > work;
+            {
+                std::lock_guard<std::mutex> lock(postMutex_);
+                results.swap(finished_);
+                work.swap(posted_);
+            }
+            int handled = 0;
+            while (!results.empty()) {
+                Finished f = results.front();
+                results.pop_front();
+                finishOffload(f.c, f.generation, f.rs, f.ok);
+                handled++;
+            }
+            while (!work.empty()) {
+                if (work.front()) {
+                    work.front()();
+                    handled++;
+                }
+                work.pop_front();
+            }
+            return (handled);
+        }
+
+        int runTimers(void)
+        {
+            int handled = 0;
+            Clock::time_point now = Clock::now();
+            while (!timers_.empty() && timers_.top().due <= now) {
+                Timer t = timers_.top();
+                timers_.pop();
+                if (live_.erase(t.id) == 0) continue;
+                t.fn();
+                handled++;
+            }
+            return (handled);
+        }
+
+        int epfd_;
+        int wakefd_;
+        std::atomic<bool> stopped_;
+        unsigned long nextTimer_;
+        std::map<Connection *, Conn *> conns_;
+        std::priority_queue<Timer> timers_;
+        std::map<unsigned long, bool> live_;
+        std::mutex postMutex_;
+        std::deque<std::function<void ()> > posted_;
+        std::deque<Finished> finished_;
+        std::unique_ptr<WorkerPool> offload_;
+    };
+}; /* namespace */
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _RECONNECT_H
+#define _RECONNECT_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/sqlscan.h"
+
+namespace dbabstract
+{
+    struct ReconnectPolicy
+    {
+        ReconnectPolicy()
+            : attempts(5)
+            , initialDelay(50)
+            , maxDelay(5000)
+            , retryWrites(false) {}
+
+        unsigned int attempts; /** opens tried per lost connection */
+        std::chrono::milliseconds initialDelay; /** before the second open; doubled after each */
+        std::chrono::milliseconds maxDelay;
+        bool retryWrites; /** also repeat a write that failed with the connection, which may have applied it */
+        std::function<bool (Connection *)> setup; /** run after every open, e.g. to set session options or prepare statements again */
+    };
+
+    /**
+     * A Connection that opens its wrapped Connection again when it
+     * has been lost, waiting longer between failed attempts.
+     *
+     * Before each statement outside a transaction it asks the driver's
+     * isConnected(), which answers from local state, and reconnects if
+     * needed. A statement that fails because the connection was lost
+     * is repeated once on the new connection when it only reads, or
+     * when the policy allows writes. A transaction cannot survive the
+     * loss: its remaining statements and its commit fail, and the
+     * next beginTrans() starts over on the new connection.
+     *
+     * It owns the wrapped Connection and release()s it when it is
+     * deleted. Like the drivers, it is used from one thread at a time.
+     */
+    class ReconnectingConnection : public Connection
+    {
+    private:
+        ReconnectingConnection(const ReconnectingConnection &old);
+        const ReconnectingConnection &operator=(const ReconnectingConnection &old);
+
+    public:
+        /**
+         * @param conn The Connection to wrap; it is opened through
+         *             this object, which keeps the options.
+         */
+        ReconnectingConnection(Connection *conn, const ReconnectPolicy &policy = ReconnectPolicy())
+            : conn_(conn)
+            , policy_(policy)
+            , opened_(false)
+            , inTrans_(false)
+            , transLost_(false)
+            , hasMode_(false)
+            , mode_(READ_COMMITTED)
+            , reconnects_(0)
+            , random_((unsigned int) std::chrono::steady_clock::now().time_since_epoch().count()) {}
+
+        ~ReconnectingConnection()
+        {
+            conn_->release();
+        }
+
+        Connection *connection(void) const { return (conn_); }
+
+        /**
+         * Returns how many times the connection was opened again.
+         */
+        unsigned long reconnects(void) const { return (reconnects_); }
+
+        std::vector<std::string> tables(void) const { return (conn_->tables()); }
+        void *handle(void) { return (conn_->handle()); }
+
+        bool open(const char *database, const char *host, const int port, const char *user, const char *pass)
+        {
+            return (open(ConnectionOptions(database, host, port, user, pass)));
+        }
+
+        bool open(const ConnectionOptions &options)
+        {
+            options_ = options;
+            opened_ = true;
+            return (reopen());
+        }
+
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const { return (conn_->unknownOptions(options)); }
+
+        bool close(void)
+        {
+            opened_ = false;
+            inTrans_ = transLost_ = false;
+            return (conn_->close());
+        }
+
+        bool isConnected(void) { return (conn_->isConnected()); }
+
+        /**
+         * Closes the connection and opens it again, trying as often as
+         * the policy allows.
+         */
+        bool reconnect(void)
+        {
+            if (!opened_) return (false);
+            if (inTrans_) transLost_ = true;
+            conn_->close();
+
+            std::chrono::milliseconds delay = policy_.initialDelay;
+            for (unsigned int i=0; i<policy_.attempts; i++) {
+                if (i) {
+                    // between half and all of the delay, so that many
+                    // clients do not come back at the same moment
+                    std::uniform_int_distribution<long> jitter(delay.count() / 2, delay.count());
+                    std::this_thread::sleep_for(std::chrono::milliseconds(jitter(random_)));
+                    delay = std::min(delay * 2, policy_.maxDelay);
+                }
+                if (reopen()) {
+                    reconnects_++;
+                    return (true);
+                }
+                conn_->close();
+            }
+            return (false);
+        }
+
+        bool execute(const char *sql)
+        {
+            if (!ready()) return (false);
+            if (conn_->execute(sql)) return (true);
+            if (!lost()) return (false);
+            bool retry = (!inTrans_ && (policy_.retryWrites || sqlscan::isReadOnly(sql)));
+            if (!reconnect() || !retry) return (false);
+            return (conn_->execute(sql));
+        }
+
+        ResultSet *executeQuery(const char *sql)
+        {
+            if (!ready()) return (NULL);
+            ResultSet *rs = conn_->executeQuery(sql);
+            if (rs || !lost()) return (rs);
+            bool retry = (!inTrans_ && (policy_.retryWrites || sqlscan::isReadOnly(sql)));
+            if (!reconnect() || !retry) return (NULL);
+            return (conn_->executeQuery(sql));
+        }
+
+        ResultSet *executeBatch(const char *sql)
+        {
+            if (!ready()) return (NULL);
+            ResultSet *rs = conn_->executeBatch(sql);
+            if (rs || !lost()) return (rs);
+            bool retry = (!inTrans_ && (policy_.retryWrites || sqlscan::isReadOnly(sql)));
+            if (!reconnect() || !retry) return (NULL);
+            return (conn_->executeBatch(sql));
+        }
+
+        char *escape(const char *str) { return (conn_->escape(str)); }
+        const char *unixtimeToSql(const time_t t) { return (conn_->unixtimeToSql(t)); }
+        unsigned long insertId(void) { return (conn_->insertId()); }
+
+        bool beginTrans(void)
+        {
+            inTrans_ = transLost_ = false;
+            if (!ready()) return (false);
+            // nothing has happened yet, so trying again is safe
+            if (!conn_->beginTrans() && (!lost() || !reconnect() || !conn_->beginTrans())) return (false);
+            inTrans_ = true;
+            return (true);
+        }
+
+        bool commitTrans(void)
+        {
+            bool lostTrans = transLost_;
+            inTrans_ = transLost_ = false;
+            if (lostTrans) return (false);
+            if (conn_->commitTrans()) return (true);
+            if (lost()) reconnect();
+            return (false);
+        }
+
+        bool rollbackTrans(void)
+        {
+            bool lostTrans = transLost_;
+            inTrans_ = transLost_ = false;
+            // rolled back by the server when it lost the connection
+            if (lostTrans) return (true);
+            if (conn_->rollbackTrans()) return (true);
+            if (lost()) return (reconnect());
+            return (false);
+        }
+
+        bool setTransactionMode(const enum TRANS_MODE mode)
+        {
+            hasMode_ = true;
+            mode_ = mode;
+            return (conn_->setTransactionMode(mode));
+        }
+
+        unsigned int errorno(void) const { return (conn_->errorno()); }
+        const char *errormsg(void) const { return (conn_->errormsg()); }
+        const char *version(void) const { return (conn_->version()); }
+
+        int socket(void) { return (conn_->socket()); }
+
+        /**
+         * Asynchronous statements are not repeated; a lost connection
+         * is opened again before the next one.
+         */
+        enum ASYNC_STATUS startQuery(const char *sql)
+        {
+            if (!ready()) return (ASYNC_FAILED);
+            return (conn_->startQuery(sql));
+        }
+
+        enum ASYNC_STATUS continueQuery(void) { return (conn_->continueQuery()); }
+        ResultSet *finishQuery(void) { return (conn_->finishQuery()); }
+        bool cancelQuery(void) { return (conn_->cancelQuery()); }
+
+        void setObserver(ConnectionObserver *observer)
+        {
+            observer_ = observer;
+            conn_->setObserver(observer);
+        }
+
+    private:
+        bool reopen(void)
+        {
+            if (!conn_->open(options_)) return (false);
+            if (hasMode_ && !conn_->setTransactionMode(mode_)) return (false);
+            return (!policy_.setup || policy_.setup(conn_));
+        }
+
+        /**
+         * Whether a statement may be sent; reconnects first when the
+         * connection is gone outside a transaction.
+         */
+        bool ready(void)
+        {
+            if (inTrans_) return (!transLost_);
+            if (!opened_ || conn_->isConnected()) return (true);
+            return (reconnect());
+        }
+
+        bool lost(void) { return (opened_ && !conn_->isConnected()); }
+
+        Connection *conn_;
+        ReconnectPolicy policy_;
+        ConnectionOptions options_;
+        bool opened_;
+        bool inTrans_;
+        bool transLost_; /** the connection was lost in the current transaction */
+        bool hasMode_;
+        enum TRANS_MODE mode_;
+        unsigned long reconnects_;
+        std::minstd_rand random_;
+    };
+}; /* namespace */
+
+#endif
@@ -0,0 +1,392 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _REPLICATED_H
+#define _REPLICATED_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/sqlscan.h"
+
+namespace dbabstract
+{
+    /**
+     * Passes every call through to a ResultSet of a replica, and
+     * lowers the replica's count of outstanding reads when closed.
+     */
+    class TrackedResultSet : public ResultSet
+    {
+    public:
+        TrackedResultSet(ResultSet *rs, const std::shared_ptr<long> &outstanding)
+            : rs_(rs)
+            , outstanding_(outstanding)
+        {
+            ++*outstanding_;
+        }
+
+        ~TrackedResultSet()
+        {
+            rs_->close();
+            --*outstanding_;
+        }
+
+        void *handle(void) { return (rs_->handle()); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void) { return (rs_->next()); }
+        bool nextResult(void) { return (rs_->nextResult()); }
+        unsigned int findColumn(const char *field) const { return (rs_->findColumn(field)); }
+        unsigned long recordCount(void) const { return (rs_->recordCount()); }
+        unsigned int columnCount(void) const { return (rs_->columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (rs_->columnName(idx)); }
+        const char *getString(const int idx) const { return (rs_->getString(idx)); }
+        int getInteger(const int idx) const { return (rs_->getInteger(idx)); }
+        bool getBool(const int idx) const { return (rs_->getBool(idx)); }
+        time_t getUnixTime(const int idx) const { return (rs_->getUnixTime(idx)); }
+        double getDouble(const int idx) const { return (rs_->getDouble(idx)); }
+        float getFloat(const int idx) const { return (rs_->getFloat(idx)); }
+        long getLong(const int idx) const { return (rs_->getLong(idx)); }
+        short getShort(const int idx) const { return (rs_->getShort(idx)); }
+
+    private:
+        ResultSet *rs_;
+        std::shared_ptr<long> outstanding_;
+    };
+
+    /**
+     * A Connection splitting reads from writes over a primary and its
+     * replicas, each an opened Connection.
+     *
+     * execute(), statements which are not read-only, and everything
+     * between beginTrans() and commitTrans()/rollbackTrans() go to
+     * the primary. Read-only executeQuery() calls go to the healthy
+     * replica with the fewest open ResultSets, taking turns on ties.
+     * When no replica is healthy, or the chosen one fails the
+     * statement, the read is run on the primary instead.
+     *
+     * Replicas are checked at most once per checkInterval, on the
+     * thread using the ReplicatedConnection: a replica is ejected when
+     * it is not connected, its lag cannot be measured, or its lag is
+     * over maxLag. An ejected replica is taken back once a later check
+     * passes. The default lag probe understands PostgreSQL
+     * (pg_last_xact_replay_timestamp) and MySQL (SHOW REPLICA STATUS,
+     * then SHOW SLAVE STATUS); other drivers report no lag.
+     *
+     * Like the drivers, a ReplicatedConnection is used from one thread
+     * at a time. It owns the Connection objects and release()s them
+     * when it is deleted.
+     */
+    class ReplicatedConnection : public Connection
+    {
+    private:
+        ReplicatedConnection(const ReplicatedConnection &old);
+        const ReplicatedConnection &operator=(const ReplicatedConnection &old);
+
+    public:
+        /**
+         * Measures how many seconds conn lags behind its primary.
+         * Returns false when the lag could not be determined.
+         */
+        typedef std::function<bool (Connection *conn, double &lag)> LagProbe;
+
+        /**
+         * @param primary Opened Connection receiving all writes.
+         * @param replicas Opened Connection objects for reads.
+         * @param maxLag Seconds of lag after which a replica is ejected.
+         * @param checkInterval Milliseconds between replica checks.
+         */
+        ReplicatedConnection(Connection *primary, const std::vector<Connection *> &replicas, double maxLag = 10.0, long checkInterval = 1000)
+            : primary_(primary)
+            , last_(primary)
+            , maxLag_(maxLag)
+            , checkInterval_(checkInterval)
+            , probe_(defaultLagProbe)
+            , inTrans_(false)
+            , turn_(0)
+            , checked_(false)
+        {
+            for (size_t i=0; i<replicas.size(); i++) {
+                Replica r;
+                r.conn = replicas[i];
+                r.outstanding.reset(new long(0));
+                r.healthy = true;
+                r.lag = 0;
+                replicas_.push_back(r);
+            }
+        }
+
+        ~ReplicatedConnection()
+        {
+            for (size_t i=0; i<replicas_.size(); i++) {
+                replicas_[i].conn->release();
+            }
+            primary_->release();
+        }
+
+        /**
+         * Replaces the lag probe; the next read re-checks the replicas.
+         */
+        void setLagProbe(const LagProbe &probe)
+        {
+            probe_ = probe;
+            checked_ = false;
+        }
+
+        Connection *primary(void) const { return (primary_); }
+        size_t replicaCount(void) const { return (replicas_.size()); }
+        Connection *replica(size_t idx) const { return (replicas_[idx].conn); }
+        bool healthy(size_t idx) const { return (replicas_[idx].healthy); }
+        double lag(size_t idx) const { return (replicas_[idx].lag); }
+
+        /**
+         * Returns the number of open ResultSets read from a replica.
+         */
+        long outstanding(size_t idx) const { return (*replicas_[idx].outstanding); }
+
+        /**
+         * Checks every replica now, instead of waiting for the
+         * interval to pass.
+         */
+        void checkReplicas(void)
+        {
+            for (size_t i=0; i<replicas_.size(); i++) {
+                Replica &r = replicas_[i];
+                double lag = 0;
+                r.healthy = (r.conn->isConnected() && probe_(r.conn, lag) && lag <= maxLag_);
+                r.lag = lag;
+            }
+            checked_ = true;
+            lastCheck_ = std::chrono::steady_clock::now();
+        }
+
+        /**
+         * Measures lag with the replication status of PostgreSQL or
+         * MySQL, chosen from the driver's version(); reports zero lag
+         * for any other driver.
+         */
+        static bool defaultLagProbe(Connection *conn, double &lag)
+        {
+            const char *version = conn->version();
+            lag = 0;
+
+            if (strncmp(version, "PostgreSQL", 10) == 0) {
+                // NULL on a primary, or a replica which replayed nothing yet;
+                // a replica which replayed all it received is not behind,
+                // however long ago the primary last committed
+                ResultSet *rs = conn->executeQuery("SELECT CASE WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+                                                   "ELSE EXTRACT(EPOCH FROM (now() - pg_last_xact_replay_timestamp())) END");
+                if (!rs) return (false);
+                if (rs->next() && rs->getString(0)) lag = rs->getDouble(0);
+                rs->close();
+                return (true);
+            }
+
+            if (strncmp(version, "MySQL", 5) == 0) {
+                const char *column = "Seconds_Behind_Source";
+                ResultSet *rs = conn->executeQuery("SHOW REPLICA STATUS");
+                if (!rs) {
+                    column = "Seconds_Behind_Master";
+                    rs = conn->executeQuery("SHOW SLAVE STATUS");
+                }
+                if (!rs) return (false);
+
+                bool ok = true;
+                if (rs->next()) {
+                    unsigned int idx = rs->findColumn(column);
+                    // NULL while the replication threads are stopped
+                    if (idx >= rs->columnCount() || !rs->getString(idx)) ok = false;
+                    else lag = rs->getDouble(idx);
+                }
+                rs->close();
+                return (ok);
+            }
+
+            return (true);
+        }
+
+        std::vector<std::string> tables(void) const { return (primary_->tables()); }
+
+        void *handle(void) { return (NULL); }
+
+        /**
+         * The connections are opened by the caller; this always fails.
+         */
+        bool open(const char *, const char *, const int, const char *, const char *)
+        {
+            return (false);
+        }
+
+        bool close(void)
+        {
+            bool ok = primary_->close();
+            for (size_t i=0; i<replicas_.size(); i++) {
+                if (!replicas_[i].conn->close()) ok = false;
+            }
+            return (ok);
+        }
+
+        bool isConnected(void) { return (primary_->isConnected()); }
+
+        bool execute(const char *sql)
+        {
+            last_ = primary_;
+            return (primary_->execute(sql));
+        }
+
+        ResultSet *executeBatch(const char *sql)
+        {
+            last_ = primary_;
+            return (primary_->executeBatch(sql));
+        }
+
+        ResultSet *executeQuery(const char *sql)
+        {
+            if (!inTrans_ && !replicas_.empty() && sqlscan::isReadOnly(sql)) {
+                long idx = pick();
+                if (idx >= 0) {
+                    Replica &r = replicas_[idx];
+                    ResultSet *rs = r.conn->executeQuery(sql);
+                    if (rs) {
+                        last_ = r.conn;
+                        return (new TrackedResultSet(rs, r.outstanding));
+                    }
+                    r.healthy = false;
+                }
+            }
+            last_ = primary_;
+            return (primary_->executeQuery(sql));
+        }
+
+        char *escape(const char *str) { return (primary_->escape(str)); }
+        const char *unixtimeToSql(const time_t t) { return (primary_->unixtimeToSql(t)); }
+        unsigned long insertId(void) { return (primary_->insertId()); }
+
+        bool beginTrans(void)
+        {
+            last_ = primary_;
+            inTrans_ = primary_->beginTrans();
+            return (inTrans_);
+        }
+
+        bool commitTrans(void)
+        {
+            last_ = primary_;
+            inTrans_ = false;
+            return (primary_->commitTrans());
+        }
+
+        bool rollbackTrans(void)
+        {
+            last_ = primary_;
+            inTrans_ = false;
+            return (primary_->rollbackTrans());
+        }
+
+        bool setTransactionMode(const enum TRANS_MODE mode)
+        {
+            bool ok = primary_->setTransactionMode(mode);
+            for (size_t i=0; i<replicas_.size(); i++) {
+                replicas_[i].conn->setTransactionMode(mode);
+            }
+            last_ = primary_;
+            return (ok);
+        }
+
+        /**
+         * The error of the Connection used by the last call.
+         */
+        unsigned int errorno(void) const { return (last_->errorno()); }
+        const char *errormsg(void) const { return (last_->errormsg()); }
+
+        const char *version(void) const
+        {
+            static char ret[256];
+            snprintf(ret, 256, "Replicated Driver v0.1");
+            return (ret);
+        }
+
+        void setObserver(ConnectionObserver *observer)
+        {
+            observer_ = observer;
+            primary_->setObserver(observer);
+            for (size_t i=0; i<replicas_.size(); i++) {
+                replicas_[i].conn->setObserver(observer);
+            }
+        }
+
+    private:
+        struct Replica
+        {
+            Connection *conn;
+            std::shared_ptr<long> outstanding;
+            bool healthy;
+            double lag;
+        };
+
+        /**
+         * Returns the healthy replica with the fewest open ResultSets,
+         * or -1 when there is none.
+         */
+        long pick(void)
+        {
+            if (!checked_ || std::chrono::steady_clock::now() - lastCheck_ >= std::chrono::milliseconds(checkInterval_)) {
+                checkReplicas();
+            }
+
+            long best = -1;
+            size_t n = replicas_.size();
+            for (size_t k=0; k<n; k++) {
+                size_t i = (turn_ + k) % n;
+                if (!replicas_[i].healthy) continue;
+                if (best < 0 || *replicas_[i].outstanding < *replicas_[best].outstanding) {
+                    best = (long) i;
+                }
+            }
+            turn_ = (turn_ + 1) % n;
+            return (best);
+        }
+
+        Connection *primary_;
+        Connection *last_;
+        std::vector<Replica> replicas_;
+        double maxLag_;
+        long checkInterval_;
+        LagProbe probe_;
+        bool inTrans_;
+        size_t turn_;
+        bool checked_;
+        std::chrono::steady_clock::time_point lastCheck_;
+    };
+}; /* namespace */
+
+#endif
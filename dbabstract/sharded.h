@@ -0,0 +1,701 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _SHARDED_H
+#define _SHARDED_H
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/materialized.h"
+#include "dbabstract/sqlscan.h"
+#include "dbabstract/workerpool.h"
+
+namespace dbabstract
+{
+    /**
+     * A ResultSet reading the rows of one statement run on several
+     * shards. The rows are either concatenated shard by shard, or,
+     * when sort columns are given, merged into one ordered stream
+     * reading a row at a time from each shard. An optional limit
+     * stops the merged stream after that many rows.
+     *
+     * The ResultSet owns the shard ResultSets and closes them.
+     */
+    class ShardedResultSet : public ResultSet
+    {
+    public:
+        struct SortKey
+        {
+            SortKey(unsigned int c, bool d) : column(c), descending(d) {}
+
+            unsigned int column;
+            bool descending;
+        };
+
+        ShardedResultSet(const std::vector<ResultSet *> &parts, const std::vector<SortKey> &keys, long limit)
+            : parts_(parts)
+            , keys_(keys)
+            , limit_(limit)
+            , returned_(0)
+            , current_(-1)
+            , primed_(false) {}
+
+        ~ShardedResultSet()
+        {
+            for (size_t i=0; i<parts_.size(); i++) {
+                parts_[i]->close();
+            }
+        }
+
+        void *handle(void) { return (NULL); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void)
+        {
+            if (limit_ >= 0 && returned_ >= limit_) {
+                current_ = -1;
+                return (false);
+            }
+            bool more = (keys_.empty() ? nextConcat() : nextMerged());
+            if (more) returned_++;
+            return (more);
+        }
+
+        unsigned int findColumn(const char *field) const { return (parts_[0]->findColumn(field)); }
+
+        unsigned long recordCount(void) const
+        {
+            unsigned long count = 0;
+            for (size_t i=0; i<parts_.size(); i++) {
+                count += parts_[i]->recordCount();
+            }
+            if (limit_ >= 0 && count > (unsigned long) limit_) count = limit_;
+            return (count);
+        }
+
+        unsigned int columnCount(void) const { return (parts_[0]->columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (parts_[0]->columnName(idx)); }
+
+        const char *getString(const int idx) const { return (current_ < 0 ? NULL : parts_[current_]->getString(idx)); }
+        int getInteger(const int idx) const { return (current_ < 0 ? 0 : parts_[current_]->getInteger(idx)); }
+        bool getBool(const int idx) const { return (current_ < 0 ? false : parts_[current_]->getBool(idx)); }
+        time_t getUnixTime(const int idx) const { return (current_ < 0 ? 0 : parts_[current_]->getUnixTime(idx)); }
+        double getDouble(const int idx) const { return (current_ < 0 ? 0 : parts_[current_]->getDouble(idx)); }
+        float getFloat(const int idx) const { return (current_ < 0 ? 0 : parts_[current_]->getFloat(idx)); }
+        long getLong(const int idx) const { return (current_ < 0 ? 0 : parts_[current_]->getLong(idx)); }
+        short getShort(const int idx) const { return (current_ < 0 ? 0 : parts_[current_]->getShort(idx)); }
+
+        /**
+         * Compares two column values the way the merge orders them:
+         * numerically when both are numbers, otherwise as strings.
+         * SQL NULL sorts before any value.
+         */
+        static int compareValues(const char *a, const char *b)
+        {
+            if (!a || !b) return ((a ? 1 : 0) - (b ? 1 : 0));
+
+            char *enda;
+            char *endb;
+            double da = strtod(a, &enda);
+            double db = strtod(b, &endb);
+            if (enda != a && *enda == '\0' && endb != b && *endb == '\0') {
+                return ((da > db) - (da < db));
+            }
+            return (strcmp(a, b));
+        }
+
+    private:
+        bool nextConcat(void)
+        {
+            if (current_ < 0) {
+                if (primed_) return (false);
+                primed_ = true;
+                current_ = 0;
+            }
+            while ((size_t) current_ < parts_.size()) {
+                if (parts_[current_]->next()) return (true);
+                current_++;
+            }
+            current_ = -1;
+            return (false);
+        }
+
+        bool nextMerged(void)
+        {
+            std::function<bool (size_t, size_t)> after = [this](size_t a, size_t b) { return (less(b, a)); };
+
+            if (!primed_) {
+                primed_ = true;
+                for (size_t i=0; i<parts_.size(); i++) {
+                    if (parts_[i]->next()) heap_.push_back(i);
+                }
+                std::make_heap(heap_.begin(), heap_.end(), after);
+            } else if (current_ >= 0 && parts_[current_]->next()) {
+                heap_.push_back(current_);
+                std::push_heap(heap_.begin(), heap_.end(), after);
+            }
+
+            if (heap_.empty()) {
+                current_ = -1;
+                return (false);
+            }
+            std::pop_heap(heap_.begin(), heap_.end(), after);
+            current_ = (long) heap_.back();
+            heap_.pop_back();
+            return (true);
+        }
+
+        /**
+         * True when the current row of shard a sorts before the
+         * current row of shard b. Ties keep shard order, so the merge
+         * is stable.
+         */
+        bool less(size_t a, size_t b) const
+        {
+            for (size_t k=0; k<keys_.size(); k++) {
+                int c = compareValues(parts_[a]->getString(keys_[k].column), parts_[b]->getString(keys_[k].column));
+                if (c != 0) return (keys_[k].descending ? c > 0 : c < 0);
+            }
+            return (a < b);
+        }
+
+        std::vector<ResultSet *> parts_;
+        std::vector<SortKey> keys_;
+        std::vector<size_t> heap_;
+        long limit_;
+        long returned_;
+        long current_;
+        bool primed_;
+    };
+
+    /**
+     * A Connection spreading data over several shards, each an
+     * opened Connection to its own database.
+     *
+     * Keyed statements, run with execute(key, sql) and
+     * executeQuery(key, sql), go to the single shard owning the key
+     * on a consistent hash ring, so adding a shard moves only about
+     * 1/N of the keys. The position of a shard in the vector given to
+     * the constructor is its identity on the ring and must not change.
+     *
+     * Statements without a key run on every shard at once, each shard
+     * on its own thread, and the results are combined:
+     *
+     *  - a SELECT whose select list consists only of COUNT, SUM, MIN
+     *    and MAX, without GROUP BY or HAVING, returns a single row of
+     *    the combined aggregates (COUNT(DISTINCT ...) and AVG are not
+     *    combined; their per-shard rows are concatenated);
+     *  - a top-level ORDER BY on result columns (by name, alias or
+     *    position) is kept by merging the shards' sorted rows;
+     *  - a top-level LIMIT n is applied to the merged rows; OFFSET is
+     *    not, and is run on each shard as written;
+     *  - anything else returns each shard's rows in turn.
+     *
+     * Transactions are started, committed and rolled back on every
+     * shard, one after the other. This is not a two-phase commit: a
+     * failure part way through commitTrans() leaves some shards
+     * committed.
+     *
+     * The ShardedConnection owns the shards and release()s them when
+     * it is deleted.
+     */
+    class ShardedConnection : public Connection
+    {
+    private:
+        ShardedConnection(const ShardedConnection &old);
+        const ShardedConnection &operator=(const ShardedConnection &old);
+
+    public:
+        /**
+         * @param shards Opened Connection objects, one per shard.
+         * @param points Positions each shard takes on the hash ring;
+         *               more points spread keys more evenly.
+         */
+        ShardedConnection(const std::vector<Connection *> &shards, unsigned int points = 64)
+            : shards_(shards)
+            , errorno_(0)
+            , lastShard_(0)
+        {
+            if (points == 0) points = 1;
+            for (size_t i=0; i<shards_.size(); i++) {
+                workers_.push_back(std::shared_ptr<WorkerPool>(new WorkerPool(1)));
+                for (unsigned int p=0; p<points; p++) {
+                    char name[64];
+                    snprintf(name, sizeof(name), "shard-%lu-%u", (unsigned long) i, p);
+                    ring_[hash(name, strlen(name))] = i;
+                }
+            }
+        }
+
+        ~ShardedConnection()
+        {
+            workers_.clear();
+            for (size_t i=0; i<shards_.size(); i++) {
+                shards_[i]->release();
+            }
+        }
+
+        size_t shardCount(void) const { return (shards_.size()); }
+        Connection *shard(size_t idx) const { return (shards_[idx]); }
+
+        /**
+         * Returns the index of the shard owning key.
+         */
+        size_t shardFor(const std::string &key) const
+        {
+            std::map<uint64_t, size_t>::const_iterator it = ring_.lower_bound(hash(key.data(), key.size()));
+            if (it == ring_.end()) it = ring_.begin();
+            return (it->second);
+        }
+
+        /**
+         * Runs sql on the shard owning key, discarding any result data.
+         */
+        bool execute(const std::string &key, const char *sql)
+        {
+            lastShard_ = shardFor(key);
+            Connection *conn = shards_[lastShard_];
+            if (!conn->execute(sql)) {
+                fail(conn);
+                return (false);
+            }
+            return (true);
+        }
+
+        /**
+         * Runs sql on the shard owning key and returns its rows.
+         */
+        ResultSet *executeQuery(const std::string &key, const char *sql)
+        {
+            lastShard_ = shardFor(key);
+            Connection *conn = shards_[lastShard_];
+            ResultSet *rs = conn->executeQuery(sql);
+            if (!rs) fail(conn);
+            return (rs);
+        }
+
+        std::vector<std::string> tables(void) const { return (shards_[0]->tables()); }
+
+        void *handle(void) { return (NULL); }
+
+        /**
+         * The shards are opened by the caller; this always fails.
+         */
+        bool open(const char *, const char *, const int, const char *, const char *)
+        {
+            errorno_ = 0;
+            errormsg_ = "ShardedConnection is built from opened shards";
+            return (false);
+        }
+
+        bool close(void)
+        {
+            bool ok = true;
+            for (size_t i=0; i<shards_.size(); i++) {
+                if (!shards_[i]->close()) ok = false;
+            }
+            return (ok);
+        }
+
+        bool isConnected(void)
+        {
+            for (size_t i=0; i<shards_.size(); i++) {
+                if (!shards_[i]->isConnected()) return (false);
+            }
+            return (!shards_.empty());
+        }
+
+        /**
+         * Runs sql on every shard.
+         */
+        bool execute(const char *sql)
+        {
+            std::string s(sql);
+            return (everywhere([s](Connection *c) { return (c->execute(s.c_str())); }));
+        }
+
+        /**
+         * Runs sql on every shard in parallel and combines the rows.
+         * If any shard fails, NULL is returned and errormsg() tells
+         * why.
+         */
+        ResultSet *executeQuery(const char *sql)
+        {
+            std::string s(sql);
+            std::vector<ResultSet *> parts;
+            scatter<ResultSet *>([s](Connection *c) { return (c->executeQuery(s.c_str())); }, parts);
+
+            bool ok = true;
+            for (size_t i=0; i<parts.size(); i++) {
+                if (!parts[i]) {
+                    fail(shards_[i]);
+                    ok = false;
+                }
+            }
+            if (!ok || parts.empty()) {
+                for (size_t i=0; i<parts.size(); i++) {
+                    if (parts[i]) parts[i]->close();
+                }
+                return (NULL);
+            }
+
+            ResultSet *combined = aggregate(s, parts);
+            if (combined) return (combined);
+
+            std::vector<ShardedResultSet::SortKey> keys;
+            if (!sortKeys(s, parts[0], keys)) keys.clear();
+            return (new ShardedResultSet(parts, keys, limitOf(s)));
+        }
+
+        char *escape(const char *str) { return (shards_[0]->escape(str)); }
+        const char *unixtimeToSql(const time_t t) { return (shards_[0]->unixtimeToSql(t)); }
+
+        /**
+         * Returns the insert id of the shard used by the last keyed
+         * statement.
+         */
+        unsigned long insertId(void)
+        {
+            return (shards_.empty() ? 0 : shards_[lastShard_]->insertId());
+        }
+
+        bool beginTrans(void) { return (everywhere([](Connection *c) { return (c->beginTrans()); })); }
+        bool commitTrans(void) { return (everywhere([](Connection *c) { return (c->commitTrans()); })); }
+        bool rollbackTrans(void) { return (everywhere([](Connection *c) { return (c->rollbackTrans()); })); }
+
+        bool setTransactionMode(const enum TRANS_MODE mode)
+        {
+            return (everywhere([mode](Connection *c) { return (c->setTransactionMode(mode)); }));
+        }
+
+        unsigned int errorno(void) const { return (errorno_); }
+        const char *errormsg(void) const { return (errormsg_.c_str()); }
+
+        const char *version(void) const
+        {
+            static char ret[256];
+            snprintf(ret, 256, "Sharded Driver v0.1");
+            return (ret);
+        }
+
+        void setObserver(ConnectionObserver *observer)
+        {
+            observer_ = observer;
+            for (size_t i=0; i<shards_.size(); i++) {
+                shards_[i]->setObserver(observer);
+            }
+        }
+
+    private:
+        /**
+         * FNV-1a, finished with a 64-bit mix so that similar names
+         * land far apart on the ring.
+         */
+        static uint64_t hash(const char *data, size_t len)
+        {
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i=0; i<len; i++) {
+                h ^= (unsigned char) data[i];
+                h *= 1099511628211ULL;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return (h);
+        }
+
+        void fail(Connection *conn)
+        {
+            errorno_ = conn->errorno();
+            errormsg_ = (conn->errormsg() ? conn->errormsg() : "");
+        }
+
+        /**
+         * Calls fn with every shard, each on the shard's own thread,
+         * and collects the return values in shard order.
+         */
+        template <typename T>
+        void scatter(const std::function<T (Connection *)> &fn, std::vector<T> &out)
+        {
+            std::vector<std::future<T> > futures;
+            for (size_t i=0; i<shards_.size(); i++) {
+                std::shared_ptr<std::promise<T> > promise(new std::promise<T>);
+                futures.push_back(promise->get_future());
+                Connection *conn = shards_[i];
+                workers_[i]->submit([promise, conn, fn]() { promise->set_value(fn(conn)); });
+            }
+            out.clear();
+            for (size_t i=0; i<futures.size(); i++) {
+                out.push_back(futures[i].get());
+            }
+        }
+
+        bool everywhere(const std::function<bool (Connection *)> &fn)
+        {
+            std::vector<bool> results;
+            scatter<bool>(fn, results);
+
+            bool ok = true;
+            for (size_t i=0; i<results.size(); i++) {
+                if (!results[i]) {
+                    fail(shards_[i]);
+                    ok = false;
+                }
+            }
+            return (ok);
+        }
+
+        enum AGGREGATE { AGG_NONE, AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX };
+
+        /**
+         * Recognizes a select list item which is a single COUNT, SUM,
+         * MIN or MAX call, optionally followed by an alias.
+         */
+        static enum AGGREGATE aggregateOf(const std::string &item)
+        {
+            static const char *names[] = { "COUNT", "SUM", "MIN", "MAX" };
+            static const enum AGGREGATE kinds[] = { AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX };
+
+            for (size_t n=0; n<4; n++) {
+                size_t len = strlen(names[n]);
+                if (strncasecmp(item.c_str(), names[n], len) != 0) continue;
+
+                size_t open = len;
+                while (open < item.size() && isspace((unsigned char) item[open])) open++;
+                if (open >= item.size() || item[open] != '(') return (AGG_NONE);
+
+                int depth = 0;
+                size_t i = open;
+                for (; i<item.size(); i++) {
+                    size_t skip = sqlscan::skipQuoted(item, i);
+                    if (skip != i) {
+                        i = skip - 1;
+                        continue;
+                    }
+                    if (item[i] == '(') depth++;
+                    else if (item[i] == ')' && --depth == 0) break;
+                }
+                if (i >= item.size()) return (AGG_NONE);
+
+                std::string args = item.substr(open + 1, i - open - 1);
+                std::string upper(args);
+                for (size_t c=0; c<upper.size(); c++) upper[c] = toupper((unsigned char) upper[c]);
+                if (sqlscan::findKeyword(upper, "DISTINCT") != std::string::npos) return (AGG_NONE);
+
+                // only an alias may follow the call
+                std::string rest = sqlscan::trim(item.substr(i + 1));
+                for (size_t c=0; c<rest.size(); c++) {
+                    char ch = rest[c];
+                    if (!sqlscan::isWordChar(ch) && !isspace((unsigned char) ch) && ch != '"' && ch != '`' && ch != '\'') {
+                        return (AGG_NONE);
+                    }
+                }
+                return (kinds[n]);
+            }
+            return (AGG_NONE);
+        }
+
+        /**
+         * Combines the single rows of an aggregate-only SELECT into
+         * one. Returns NULL when sql is not such a statement; parts
+         * are then left untouched.
+         */
+        static ResultSet *aggregate(const std::string &sql, std::vector<ResultSet *> &parts)
+        {
+            if (sqlscan::firstKeyword(sql) != "SELECT") return (NULL);
+            size_t select = sqlscan::findKeyword(sql, "SELECT");
+            size_t from = sqlscan::findKeyword(sql, "FROM", select);
+            if (sqlscan::findKeyword(sql, "GROUP BY") != std::string::npos ||
+                sqlscan::findKeyword(sql, "HAVING") != std::string::npos ||
+                sqlscan::findKeyword(sql, "UNION") != std::string::npos) {
+                return (NULL);
+            }
+
+            std::string list = sql.substr(select + 6, from == std::string::npos ? std::string::npos : from - select - 6);
+            std::vector<std::string> items = sqlscan::splitTopLevel(list, ',');
+            std::vector<enum AGGREGATE> kinds;
+            for (size_t i=0; i<items.size(); i++) {
+                enum AGGREGATE kind = aggregateOf(items[i]);
+                if (kind == AGG_NONE) return (NULL);
+                kinds.push_back(kind);
+            }
+            if (kinds.empty() || parts[0]->columnCount() != kinds.size()) return (NULL);
+
+            std::vector<std::string> columns;
+            for (size_t c=0; c<kinds.size(); c++) {
+                const char *name = parts[0]->columnName(c);
+                columns.push_back(name ? name : "");
+            }
+
+            std::vector<std::string> values(kinds.size());
+            std::vector<bool> isNull(kinds.size(), true);
+            std::vector<bool> integral(kinds.size(), true);
+            std::vector<long long> sums(kinds.size(), 0);
+            std::vector<double> dsums(kinds.size(), 0);
+
+            for (size_t p=0; p<parts.size(); p++) {
+                if (!parts[p]->next()) continue;
+                for (size_t c=0; c<kinds.size(); c++) {
+                    const char *v = parts[p]->getString(c);
+                    if (!v) continue;
+                    if (kinds[c] == AGG_COUNT || kinds[c] == AGG_SUM) {
+                        char *end;
+                        long long l = strtoll(v, &end, 10);
+                        if (*end != '\0') integral[c] = false;
+                        sums[c] += l;
+                        dsums[c] += strtod(v, NULL);
+                    } else if (isNull[c] || (kinds[c] == AGG_MIN ? ShardedResultSet::compareValues(v, values[c].c_str()) < 0
+                                                                 : ShardedResultSet::compareValues(v, values[c].c_str()) > 0)) {
+                        values[c] = v;
+                    }
+                    isNull[c] = false;
+                }
+            }
+            for (size_t p=0; p<parts.size(); p++) {
+                parts[p]->close();
+            }
+            parts.clear();
+
+            std::vector<const char *> row;
+            for (size_t c=0; c<kinds.size(); c++) {
+                if (kinds[c] == AGG_COUNT || kinds[c] == AGG_SUM) {
+                    char buf[64];
+                    if (integral[c]) snprintf(buf, sizeof(buf), "%lld", sums[c]);
+                    else snprintf(buf, sizeof(buf), "%.17g", dsums[c]);
+                    values[c] = buf;
+                    if (kinds[c] == AGG_COUNT) isNull[c] = false;
+                }
+                row.push_back(isNull[c] ? NULL : values[c].c_str());
+            }
+
+            MaterializedResult::Builder builder(columns);
+            builder.addRow(&row[0]);
+            return (builder.build().cursor());
+        }
+
+        /**
+         * Resolves the top-level ORDER BY of sql to result columns.
+         * Returns false if there is none, or a term is an expression
+         * which is not one of the columns.
+         */
+        static bool sortKeys(const std::string &sql, ResultSet *rs, std::vector<ShardedResultSet::SortKey> &keys)
+        {
+            size_t order = sqlscan::findKeyword(sql, "ORDER BY");
+            if (order == std::string::npos) return (false);
+            order += 5;
+            while (isspace((unsigned char) sql[order])) order++;
+            order += 2;
+
+            size_t end = std::string::npos;
+            const char *stops[] = { "LIMIT", "OFFSET", "FETCH", "FOR" };
+            for (size_t i=0; i<4; i++) {
+                end = std::min(end, sqlscan::findKeyword(sql, stops[i], order));
+            }
+
+            std::vector<std::string> terms = sqlscan::splitTopLevel(sql.substr(order, end == std::string::npos ? end : end - order), ',');
+            for (size_t t=0; t<terms.size(); t++) {
+                std::string term = terms[t];
+                bool descending = false;
+
+                size_t nulls = sqlscan::findKeyword(term, "NULLS");
+                if (nulls != std::string::npos) term = sqlscan::trim(term.substr(0, nulls));
+                size_t dir = sqlscan::findKeyword(term, "DESC");
+                if (dir != std::string::npos) {
+                    descending = true;
+                    term = sqlscan::trim(term.substr(0, dir));
+                } else if ((dir = sqlscan::findKeyword(term, "ASC")) != std::string::npos) {
+                    term = sqlscan::trim(term.substr(0, dir));
+                }
+                if (term.empty()) return (false);
+
+                char *endp;
+                long ordinal = strtol(term.c_str(), &endp, 10);
+                if (*endp == '\0') {
+                    if (ordinal < 1 || (unsigned long) ordinal > rs->columnCount()) return (false);
+                    keys.push_back(ShardedResultSet::SortKey(ordinal - 1, descending));
+                    continue;
+                }
+
+                // a qualified name matches the bare result column
+                size_t dot = term.rfind('.');
+                if (dot != std::string::npos) term = term.substr(dot + 1);
+                if (term.size() >= 2 && (term[0] == '"' || term[0] == '`') && term[term.size()-1] == term[0]) {
+                    term = term.substr(1, term.size() - 2);
+                }
+
+                unsigned int c;
+                for (c=0; c<rs->columnCount(); c++) {
+                    const char *name = rs->columnName(c);
+                    if (name && strcasecmp(name, term.c_str()) == 0) break;
+                }
+                if (c >= rs->columnCount()) return (false);
+                keys.push_back(ShardedResultSet::SortKey(c, descending));
+            }
+            return (!keys.empty());
+        }
+
+        /**
+         * Returns the top-level LIMIT of sql, or -1 when there is none
+         * or it comes with an offset.
+         */
+        static long limitOf(const std::string &sql)
+        {
+            size_t limit = sqlscan::findKeyword(sql, "LIMIT");
+            if (limit == std::string::npos || sqlscan::findKeyword(sql, "OFFSET") != std::string::npos) {
+                return (-1);
+            }
+            const char *p = sql.c_str() + limit + 5;
+            char *end;
+            long n = strtol(p, &end, 10);
+            if (end == p) return (-1);
+            while (isspace((unsigned char) *end)) end++;
+            if (*end == ',') return (-1);
+            return (n);
+        }
+
+        std::vector<Connection *> shards_;
+        std::vector<std::shared_ptr<WorkerPool> > workers_;
+        std::map<uint64_t, size_t> ring_;
+        unsigned int errorno_;
+        std::string errormsg_;
+        size_t lastShard_;
+    };
+}; /* namespace */
+
+#endif
@@ -0,0 +1,600 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _SLOWQUERY_H
+#define _SLOWQUERY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/fingerprint.h"
+#include "dbabstract/json.h"
+#include "dbabstract/sqlscan.h"
+
+namespace dbabstract
+{
+    /**
+     * Collects statements which took longer than a threshold, and
+     * hands them to a sink together with the plan the database chose
+     * for them at the time.
+     *
+     * Statements are reported by SlowQueryConnection. Reporting only
+     * copies the statement into a bounded queue; fingerprinting, plan
+     * capture and the sink run on the log's own thread, so the caller
+     * is not held up by them. When the queue is full, reports are
+     * dropped and counted.
+     *
+     * Plans are captured on a side Connection made by the factory,
+     * on the log's thread, by the statement prefixed with:
+     *
+     *   Sqlite3     EXPLAIN QUERY PLAN
+     *   PostgreSQL  EXPLAIN (FORMAT JSON)
+     *   MySQL       EXPLAIN FORMAT=JSON
+     *
+     * chosen by the version() of the side Connection; other drivers
+     * log no plan. The statement is only explained, never run again.
+     * The side Connection must see the same database, so an in-memory
+     * Sqlite3 database cannot be explained.
+     *
+     * Plan capture is rate limited twice: by a token bucket of
+     * plansPerMinute, and to one plan per fingerprint per
+     * planIntervalSec. Statements over either limit are still logged,
+     * without a plan.
+     */
+    class SlowQueryLog
+    {
+    private:
+        SlowQueryLog(const SlowQueryLog &old);
+        const SlowQueryLog &operator=(const SlowQueryLog &old);
+
+    public:
+        enum PLAN {
+            PLAN_CAPTURED, /** plan holds the plan */
+            PLAN_NONE, /** not a statement which can be explained */
+            PLAN_RATE_LIMITED, /** a plan was captured too recently */
+            PLAN_FAILED /** plan holds the error of the side Connection */
+        };
+
+        struct Entry
+        {
+            std::string sql;
+            std::string fingerprint;
+            uint64_t hash;
+            uint64_t ns; /** statement and fetch time */
+            unsigned long rows;
+            bool failed;
+            time_t when;
+            enum PLAN planStatus;
+            std::string plan;
+
+            /**
+             * Returns the entry as one line of JSON, without the line
+             * feed.
+             */
+            std::string json(void) const
+            {
+                static const char *statuses[] = { "captured", "none", "rate_limited", "failed" };
+                char buf[160];
+                struct tm tm;
+                gmtime_r(&when, &tm);
+                strftime(buf, sizeof(buf), "{\"time\":\"%Y-%m-%dT%H:%M:%SZ\"", &tm);
+                std::string out(buf);
+                snprintf(buf, sizeof(buf), ",\"duration_us\":%llu,\"rows\":%lu,\"failed\":%s,\"hash\":\"%016llx\",\"fingerprint\":",
+                         (unsigned long long) (ns / 1000), rows, (failed ? "true" : "false"), (unsigned long long) hash);
+                out += buf;
+                json::appendString(out, fingerprint.c_str());
+                out += ",\"sql\":";
+                json::appendString(out, sql.c_str());
+                out += ",\"plan_status\":\"";
+                out += statuses[planStatus];
+                out += "\"";
+                if (!plan.empty()) {
+                    out += ",\"plan\":";
+                    json::appendString(out, plan.c_str());
+                }
+                out += "}";
+                return (out);
+            }
+        };
+
+        typedef std::function<Connection *(void)> Factory;
+        typedef std::function<void (const Entry &entry)> Sink;
+
+        /**
+         * @param thresholdUs Statements taking at least this long, in
+         *                    microseconds, are logged.
+         * @param sink Receives every entry, on the log's thread.
+         * @param factory Creates and opens the side Connection for
+         *                plans, when first needed; none when empty.
+         * @param plansPerMinute Plans captured at most, on average.
+         * @param planIntervalSec Seconds before the same fingerprint
+         *                        is explained again.
+         * @param capacity Reports waiting for the log's thread at most.
+         */
+        SlowQueryLog(uint64_t thresholdUs, const Sink &sink, const Factory &factory = Factory(),
+                     double plansPerMinute = 6, long planIntervalSec = 300, size_t capacity = 256)
+            : thresholdNs_(thresholdUs * 1000)
+            , sink_(sink)
+            , factory_(factory)
+            , side_(NULL)
+            , plansPerMinute_(plansPerMinute)
+            , planInterval_(std::chrono::seconds(planIntervalSec))
+            , capacity_(capacity ? capacity : 1)
+            , tokens_(plansPerMinute < 1 ? 1 : plansPerMinute)
+            , refilled_(std::chrono::steady_clock::now())
+            , stopping_(false)
+            , busy_(false)
+            , logged_(0)
+            , dropped_(0)
+            , plans_(0)
+            , rateLimited_(0)
+        {
+            thread_ = std::thread(&SlowQueryLog::run, this);
+        }
+
+        /**
+         * Logs every statement already reported, then closes the side
+         * Connection.
+         */
+        ~SlowQueryLog()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            ready_.notify_one();
+            thread_.join();
+        }
+
+        void setThreshold(uint64_t thresholdUs) { thresholdNs_.store(thresholdUs * 1000, std::memory_order_relaxed); }
+        uint64_t threshold(void) const { return (thresholdNs_.load(std::memory_order_relaxed) / 1000); }
+
+        bool exceeds(uint64_t ns) const { return (ns >= thresholdNs_.load(std::memory_order_relaxed)); }
+
+        /**
+         * Queues a statement which took ns, if that exceeds the
+         * threshold.
+         *
+         * @return bool True if it was queued.
+         */
+        bool report(const char *sql, uint64_t ns, unsigned long rows, bool failed)
+        {
+            if (!exceeds(ns)) return (false);
+
+            Entry entry;
+            entry.sql = sql;
+            entry.hash = 0;
+            entry.ns = ns;
+            entry.rows = rows;
+            entry.failed = failed;
+            entry.when = time(NULL);
+            entry.planStatus = PLAN_NONE;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stopping_ || queue_.size() >= capacity_) {
+                    dropped_++;
+                    return (false);
+                }
+                queue_.push_back(entry);
+            }
+            ready_.notify_one();
+            return (true);
+        }
+
+        /**
+         * Waits until every statement reported before the call has
+         * been handed to the sink.
+         */
+        void flush(void)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this]() { return (queue_.empty() && !busy_); });
+        }
+
+        unsigned long logged(void) const { return (logged_); }
+        unsigned long dropped(void) const { return (dropped_); }
+        unsigned long plans(void) const { return (plans_); }
+        unsigned long rateLimited(void) const { return (rateLimited_); }
+
+        /**
+         * Returns the statement which explains sql on the database of
+         * a Connection with the given version(), or an empty string
+         * when sql cannot be explained there: it is not a single
+         * SELECT, INSERT, UPDATE, DELETE, REPLACE or WITH statement,
+         * or the driver is unknown.
+         */
+        static std::string planQuery(const char *version, const std::string &sql)
+        {
+            std::string kw = sqlscan::firstKeyword(sql);
+            if (kw != "SELECT" && kw != "INSERT" && kw != "UPDATE" && kw != "DELETE" && kw != "REPLACE" && kw != "WITH") {
+                return (std::string());
+            }
+            std::vector<std::string> parts = sqlscan::splitTopLevel(sql, ';');
+            if (parts.size() > 2 || (parts.size() == 2 && !parts[1].empty())) {
+                return (std::string());
+            }
+            const std::string &stmt = (parts.empty() ? sql : parts[0]);
+
+            if (strncmp(version, "Sqlite3", 7) == 0) return ("EXPLAIN QUERY PLAN " + stmt);
+            if (strncmp(version, "PostgreSQL", 10) == 0) return ("EXPLAIN (FORMAT JSON) " + stmt);
+            if (strncmp(version, "MySQL", 5) == 0) return ("EXPLAIN FORMAT=JSON " + stmt);
+            return (std::string());
+        }
+
+        /**
+         * Returns a Sink writing each entry as a line of JSON to out,
+         * which must outlive the log.
+         */
+        static Sink lines(std::ostream &out)
+        {
+            return ([&out](const Entry &entry) { out << entry.json() << std::endl; });
+        }
+
+    private:
+        void run(void)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;) {
+                ready_.wait(lock, [this]() { return (stopping_ || !queue_.empty()); });
+                if (queue_.empty()) break;
+
+                Entry entry = queue_.front();
+                queue_.pop_front();
+                busy_ = true;
+                lock.unlock();
+
+                entry.hash = sqlscan::fingerprint(entry.sql.c_str(), entry.fingerprint);
+                if (!entry.failed) explain(entry);
+                if (sink_) sink_(entry);
+                logged_++;
+
+                lock.lock();
+                busy_ = false;
+                done_.notify_all();
+            }
+            if (side_) side_->release();
+            side_ = NULL;
+        }
+
+        /**
+         * Takes a token for a plan of fingerprint hash, if the rate
+         * limits allow it.
+         */
+        bool allowPlan(uint64_t hash)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            double burst = (plansPerMinute_ < 1 ? 1 : plansPerMinute_);
+            tokens_ += std::chrono::duration<double>(now - refilled_).count() * plansPerMinute_ / 60;
+            if (tokens_ > burst) tokens_ = burst;
+            refilled_ = now;
+
+            std::map<uint64_t, std::chrono::steady_clock::time_point>::iterator it = planned_.find(hash);
+            if (it != planned_.end() && now - it->second < planInterval_) return (false);
+            if (tokens_ < 1) return (false);
+
+            tokens_ -= 1;
+            if (planned_.size() >= 4096) {
+                for (it = planned_.begin(); it != planned_.end(); ) {
+                    if (now - it->second >= planInterval_) planned_.erase(it++);
+                    else ++it;
+                }
+            }
+            planned_[hash] = now;
+            return (true);
+        }
+
+        void explain(Entry &entry)
+        {
+            if (!factory_) return;
+            if (!side_) {
+                side_ = factory_();
+                if (!side_) {
+                    entry.planStatus = PLAN_FAILED;
+                    entry.plan = "unable to open the side connection";
+                    return;
+                }
+            }
+
+            std::string sql = planQuery(side_->version(), entry.sql);
+            if (sql.empty()) return;
+            if (!allowPlan(entry.hash)) {
+                entry.planStatus = PLAN_RATE_LIMITED;
+                rateLimited_++;
+                return;
+            }
+
+            ResultSet *rs = side_->executeQuery(sql.c_str());
+            if (!rs) {
+                entry.planStatus = PLAN_FAILED;
+                entry.plan = (side_->errormsg() ? side_->errormsg() : "");
+                return;
+            }
+            // one row per plan step; JSON plans are a single value
+            unsigned int columns = rs->columnCount();
+            while (rs->next()) {
+                if (!entry.plan.empty()) entry.plan += '\n';
+                for (unsigned int i=0; i<columns; i++) {
+                    const char *v = rs->getString(i);
+                    if (i) entry.plan += " | ";
+                    entry.plan += (v ? v : "NULL");
+                }
+            }
+            rs->close();
+            entry.planStatus = PLAN_CAPTURED;
+            plans_++;
+        }
+
+        std::atomic<uint64_t> thresholdNs_;
+        Sink sink_;
+        Factory factory_;
+        Connection *side_;
+        double plansPerMinute_;
+        std::chrono::steady_clock::duration planInterval_;
+        size_t capacity_;
+        double tokens_;
+        std::chrono::steady_clock::time_point refilled_;
+        std::map<uint64_t, std::chrono::steady_clock::time_point> planned_;
+
+        std::deque<Entry> queue_;
+        bool stopping_;
+        bool busy_;
+        std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable done_;
+        std::thread thread_;
+
+        std::atomic<unsigned long> logged_;
+        std::atomic<unsigned long> dropped_;
+        std::atomic<unsigned long> plans_;
+        std::atomic<unsigned long> rateLimited_;
+    };
+
+    /**
+     * Passes every call through to the ResultSet of the wrapped
+     * Connection, timing next() and counting rows; the statement is
+     * reported when it is closed.
+     */
+    class SlowQueryResultSet : public ResultSet
+    {
+    public:
+        SlowQueryResultSet(ResultSet *rs, SlowQueryLog *log, const char *sql, uint64_t ns)
+            : rs_(rs)
+            , log_(log)
+            , sql_(sql)
+            , ns_(ns)
+            , rows_(0) {}
+
+        ~SlowQueryResultSet()
+        {
+            rs_->close();
+            log_->report(sql_.c_str(), ns_, rows_, false);
+        }
+
+        void *handle(void) { return (rs_->handle()); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = rs_->next();
+            ns_ += elapsedNs(begin);
+            if (ok) rows_++;
+            return (ok);
+        }
+
+        bool nextResult(void)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = rs_->nextResult();
+            ns_ += elapsedNs(begin);
+            return (ok);
+        }
+
+        unsigned int findColumn(const char *field) const { return (rs_->findColumn(field)); }
+        unsigned long recordCount(void) const { return (rs_->recordCount()); }
+        unsigned int columnCount(void) const { return (rs_->columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (rs_->columnName(idx)); }
+        const char *getString(const int idx) const { return (rs_->getString(idx)); }
+        int getInteger(const int idx) const { return (rs_->getInteger(idx)); }
+        bool getBool(const int idx) const { return (rs_->getBool(idx)); }
+        time_t getUnixTime(const int idx) const { return (rs_->getUnixTime(idx)); }
+        double getDouble(const int idx) const { return (rs_->getDouble(idx)); }
+        float getFloat(const int idx) const { return (rs_->getFloat(idx)); }
+        long getLong(const int idx) const { return (rs_->getLong(idx)); }
+        short getShort(const int idx) const { return (rs_->getShort(idx)); }
+
+    private:
+        ResultSet *rs_;
+        SlowQueryLog *log_;
+        std::string sql_;
+        uint64_t ns_;
+        unsigned long rows_;
+    };
+
+    /**
+     * A Connection which passes every call through to another one and
+     * reports statements exceeding the threshold of a SlowQueryLog.
+     * A query counts the time spent in executeQuery() and next(), not
+     * the caller's time between rows, and is reported when its
+     * ResultSet is closed. COMMIT and ROLLBACK are reported as
+     * statements too.
+     *
+     * It owns the wrapped Connection and release()s it when it is
+     * deleted; the log is shared, and must outlive it. Like the
+     * drivers, it is used from one thread at a time.
+     */
+    class SlowQueryConnection : public Connection
+    {
+    private:
+        SlowQueryConnection(const SlowQueryConnection &old);
+        const SlowQueryConnection &operator=(const SlowQueryConnection &old);
+
+    public:
+        SlowQueryConnection(Connection *conn, SlowQueryLog *log)
+            : conn_(conn)
+            , log_(log) {}
+
+        ~SlowQueryConnection()
+        {
+            conn_->release();
+        }
+
+        Connection *connection(void) const { return (conn_); }
+
+        std::vector<std::string> tables(void) const { return (conn_->tables()); }
+        void *handle(void) { return (conn_->handle()); }
+        bool open(const char *database, const char *host, const int port, const char *user, const char *pass)
+        {
+            return (conn_->open(database, host, port, user, pass));
+        }
+
+        bool open(const ConnectionOptions &options) { return (conn_->open(options)); }
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const { return (conn_->unknownOptions(options)); }
+        bool close(void) { return (conn_->close()); }
+        bool isConnected(void) { return (conn_->isConnected()); }
+
+        bool execute(const char *sql)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = conn_->execute(sql);
+            log_->report(sql, elapsedNs(begin), 0, !ok);
+            return (ok);
+        }
+
+        ResultSet *executeQuery(const char *sql)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            ResultSet *rs = conn_->executeQuery(sql);
+            uint64_t ns = elapsedNs(begin);
+            if (!rs) {
+                log_->report(sql, ns, 0, true);
+                return (NULL);
+            }
+            return (new SlowQueryResultSet(rs, log_, sql, ns));
+        }
+
+        ResultSet *executeBatch(const char *sql)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            ResultSet *rs = conn_->executeBatch(sql);
+            uint64_t ns = elapsedNs(begin);
+            if (!rs) {
+                log_->report(sql, ns, 0, true);
+                return (NULL);
+            }
+            return (new SlowQueryResultSet(rs, log_, sql, ns));
+        }
+
+        char *escape(const char *str) { return (conn_->escape(str)); }
+        const char *unixtimeToSql(const time_t t) { return (conn_->unixtimeToSql(t)); }
+        unsigned long insertId(void) { return (conn_->insertId()); }
+
+        bool beginTrans(void) { return (conn_->beginTrans()); }
+
+        bool commitTrans(void)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = conn_->commitTrans();
+            log_->report("COMMIT", elapsedNs(begin), 0, !ok);
+            return (ok);
+        }
+
+        bool rollbackTrans(void)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok = conn_->rollbackTrans();
+            log_->report("ROLLBACK", elapsedNs(begin), 0, !ok);
+            return (ok);
+        }
+
+        bool setTransactionMode(const enum TRANS_MODE mode) { return (conn_->setTransactionMode(mode)); }
+        unsigned int errorno(void) const { return (conn_->errorno()); }
+        const char *errormsg(void) const { return (conn_->errormsg()); }
+        const char *version(void) const { return (conn_->version()); }
+
+        int socket(void) { return (conn_->socket()); }
+
+        /**
+         * An asynchronous query is timed from startQuery() to
+         * finishQuery().
+         */
+        enum ASYNC_STATUS startQuery(const char *sql)
+        {
+            asyncStarted_ = std::chrono::steady_clock::now();
+            asyncSql_ = sql;
+            enum ASYNC_STATUS status = conn_->startQuery(sql);
+            if (status == ASYNC_FAILED) log_->report(sql, elapsedNs(asyncStarted_), 0, true);
+            return (status);
+        }
+
+        enum ASYNC_STATUS continueQuery(void)
+        {
+            enum ASYNC_STATUS status = conn_->continueQuery();
+            if (status == ASYNC_FAILED) log_->report(asyncSql_.c_str(), elapsedNs(asyncStarted_), 0, true);
+            return (status);
+        }
+
+        ResultSet *finishQuery(void)
+        {
+            ResultSet *rs = conn_->finishQuery();
+            uint64_t ns = elapsedNs(asyncStarted_);
+            if (!rs) {
+                log_->report(asyncSql_.c_str(), ns, 0, true);
+                return (NULL);
+            }
+            return (new SlowQueryResultSet(rs, log_, asyncSql_.c_str(), ns));
+        }
+
+        bool cancelQuery(void) { return (conn_->cancelQuery()); }
+
+        void setObserver(ConnectionObserver *observer)
+        {
+            observer_ = observer;
+            conn_->setObserver(observer);
+        }
+
+    private:
+        Connection *conn_;
+        SlowQueryLog *log_;
+        std::chrono::steady_clock::time_point asyncStarted_;
+        std::string asyncSql_;
+    };
+}; /* namespace */
+
+#endif
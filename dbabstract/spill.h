@@ -0,0 +1,582 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _SPILL_H
+#define _SPILL_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/materialized.h"
+
+namespace dbabstract
+{
+    /**
+     * Compression in the LZ4 block format: a greedy single pass with
+     * a small hash table, which is fast rather than thorough. Blocks
+     * are independent of each other.
+     */
+    namespace lz4block
+    {
+        /**
+         * Compresses n bytes of src into out, replacing its contents.
+         *
+         * @return size_t The size of out.
+         */
+        inline size_t compress(const char *src, size_t n, std::vector<char> &out)
+        {
+            static const size_t MINMATCH = 4;
+            static const size_t LASTLITERALS = 5; /** the format ends in literals */
+            static const size_t MFLIMIT = 12; /** no match starts later than n - MFLIMIT */
+            const uint8_t *in = (const uint8_t *) src;
+            std::vector<uint32_t> table(4096, 0); /** position + 1 of a 4 byte sequence */
+            size_t anchor = 0;
+            size_t i = 0;
+
+            out.clear();
+            out.reserve(n + n / 255 + 16);
+
+            auto length = [&out](size_t len) {
+                for (; len >= 255; len -= 255) out.push_back((char) 255);
+                out.push_back((char) len);
+            };
+            auto literals = [&out, &length, in](size_t from, size_t to, size_t matchLen) {
+                size_t lit = to - from;
+                size_t ml = (matchLen ? matchLen - MINMATCH : 0);
+                out.push_back((char) (((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15)));
+                if (lit >= 15) length(lit - 15);
+                out.insert(out.end(), in + from, in + to);
+            };
+
+            if (n >= MFLIMIT + 1) {
+                while (i <= n - MFLIMIT) {
+                    uint32_t seq;
+                    memcpy(&seq, in + i, 4);
+                    uint32_t h = (seq * 2654435761U) >> 20;
+                    size_t candidate = table[h];
+                    table[h] = (uint32_t) (i + 1);
+                    if (!candidate || i - (candidate - 1) > 65535 || memcmp(in + candidate - 1, in + i, 4) != 0) {
+                        i++;
+                        continue;
+                    }
+                    size_t ref = candidate - 1;
+                    size_t len = MINMATCH;
+                    size_t maxLen = n - LASTLITERALS - i;
+                    while (len < maxLen && in[ref + len] == in[i + len]) len++;
+
+                    literals(anchor, i, len);
+                    size_t offset = i - ref;
+                    out.push_back((char) (offset & 0xff));
+                    out.push_back((char) (offset >> 8));
+                    if (len - MINMATCH >= 15) length(len - MINMATCH - 15);
+                    i += len;
+                    anchor = i;
+                }
+            }
+            literals(anchor, n, 0);
+            return (out.size());
+        }
+
+        /**
+         * Decompresses n bytes of src into exactly size bytes at dst.
+         *
+         * @return bool False if src is malformed or does not produce
+         *              size bytes.
+         */
+        inline bool decompress(const char *src, size_t n, char *dst, size_t size)
+        {
+            const uint8_t *ip = (const uint8_t *) src;
+            const uint8_t *iend = ip + n;
+            uint8_t *op = (uint8_t *) dst;
+            uint8_t *oend = op + size;
+
+            while (ip < iend) {
+                unsigned int token = *ip++;
+                size_t lit = token >> 4;
+                if (lit == 15) {
+                    uint8_t b;
+                    do {
+                        if (ip >= iend) return (false);
+                        b = *ip++;
+                        lit += b;
+                    } while (b == 255);
+                }
+                if ((size_t) (iend - ip) < lit || (size_t) (oend - op) < lit) return (false);
+                if (lit) memcpy(op, ip, lit);
+                op += lit;
+                ip += lit;
+                if (ip >= iend) break; // the last sequence has no match
+
+                if (iend - ip < 2) return (false);
+                size_t offset = ip[0] | (ip[1] << 8);
+                ip += 2;
+                if (!offset || offset > (size_t) (op - (uint8_t *) dst)) return (false);
+                size_t len = token & 15;
+                if (len == 15) {
+                    uint8_t b;
+                    do {
+                        if (ip >= iend) return (false);
+                        b = *ip++;
+                        len += b;
+                    } while (b == 255);
+                }
+                len += 4;
+                if ((size_t) (oend - op) < len) return (false);
+                // byte by byte, as the match may overlap its output
+                const uint8_t *ref = op - offset;
+                for (size_t k=0; k<len; k++) op[k] = ref[k];
+                op += len;
+            }
+            return (op == oend);
+        }
+    }; /* namespace */
+
+    struct SpillOptions
+    {
+        SpillOptions()
+            : compress(false)
+            , blockBytes(64 * 1024) {}
+
+        std::string directory; /** where the file goes; $TMPDIR or /tmp when empty */
+        bool compress; /** compress the blocks which get smaller */
+        size_t blockBytes; /** rows are stored and read in blocks of about this size */
+    };
+
+    /**
+     * The rows of a result, written to a file on local disk and read
+     * back through a memory mapping, so a job may query once, release
+     * its Connection and go over the rows many times without keeping
+     * them on the heap. The pages of the file are part of the page
+     * cache, which the kernel may drop and read again as needed.
+     *
+     * The rows are kept in blocks of SpillOptions::blockBytes, with
+     * the row layout of MaterializedResult: a NULL bitmap and value
+     * offsets, then the values. With SpillOptions::compress, a block
+     * is stored in the LZ4 block format when that makes it smaller,
+     * and a cursor decompresses the block it is in. The file is
+     * deleted as soon as it is created, and goes away with the last
+     * copy of the SpilledResult and the cursors over it.
+     */
+    class SpilledResult
+    {
+    private:
+        struct Data;
+
+    public:
+        SpilledResult() {}
+
+        /**
+         * Writes all remaining rows of rs to a new file. The ResultSet
+         * is left open.
+         *
+         * @return SpilledResult Check ok(), which is false if the file
+         *                       could not be written.
+         */
+        static SpilledResult fromResultSet(ResultSet *rs, const SpillOptions &options = SpillOptions())
+        {
+            std::vector<std::string> columns;
+            unsigned int cols = rs->columnCount();
+            for (unsigned int i=0; i<cols; i++) {
+                const char *name = rs->columnName(i);
+                columns.push_back(name ? name : "");
+            }
+            Writer writer(columns, options);
+            std::vector<const char *> values(cols);
+            while (writer.ok() && rs->next()) {
+                for (unsigned int i=0; i<cols; i++) values[i] = rs->getString(i);
+                writer.addRow(values.empty() ? NULL : &values[0]);
+            }
+            return (writer.finish());
+        }
+
+        /**
+         * Reads all remaining rows of rs into memory, or to a file once
+         * they take more than memoryLimit bytes.
+         *
+         * @return RandomAccessResultSet* NULL if the file could not be
+         *                                written. It MUST be closed.
+         */
+        static RandomAccessResultSet *materialize(ResultSet *rs, size_t memoryLimit, const SpillOptions &options = SpillOptions())
+        {
+            std::vector<std::string> columns;
+            unsigned int cols = rs->columnCount();
+            for (unsigned int i=0; i<cols; i++) {
+                const char *name = rs->columnName(i);
+                columns.push_back(name ? name : "");
+            }
+            MaterializedResult::Builder builder(columns);
+            std::vector<const char *> values(cols);
+            size_t bytes = 0;
+            while (rs->next()) {
+                for (unsigned int i=0; i<cols; i++) {
+                    values[i] = rs->getString(i);
+                    bytes += sizeof(uint32_t) + (values[i] ? strlen(values[i]) + 1 : 0);
+                }
+                if (bytes <= memoryLimit) {
+                    builder.addRow(values.empty() ? NULL : &values[0]);
+                    continue;
+                }
+
+                // too large: move what was read to a file, and go on there
+                MaterializedResult head = builder.build();
+                Writer writer(columns, options);
+                std::vector<const char *> stored(cols);
+                for (unsigned long r=0; writer.ok() && r<head.rowCount(); r++) {
+                    for (unsigned int i=0; i<cols; i++) stored[i] = head.value(r, i);
+                    writer.addRow(stored.empty() ? NULL : &stored[0]);
+                }
+                do {
+                    for (unsigned int i=0; i<cols; i++) values[i] = rs->getString(i);
+                    writer.addRow(values.empty() ? NULL : &values[0]);
+                } while (writer.ok() && rs->next());
+                SpilledResult spilled = writer.finish();
+                return (spilled.ok() ? spilled.cursor() : NULL);
+            }
+            return (builder.build().cursor());
+        }
+
+        bool ok(void) const { return (data_ && data_->error.empty()); }
+
+        const char *errormsg(void) const { return (data_ ? data_->error.c_str() : "not written"); }
+
+        unsigned int columnCount(void) const
+        {
+            return (data_ ? (unsigned int) data_->columns.size() : 0);
+        }
+
+        const char *columnName(const unsigned int idx) const
+        {
+            if (!data_ || idx >= data_->columns.size()) return (NULL);
+            return (data_->columns[idx].c_str());
+        }
+
+        unsigned int findColumn(const char *field) const
+        {
+            unsigned int i;
+            for (i=0; i<columnCount(); i++) {
+                if (data_->columns[i] == field) return (i);
+            }
+            return (i);
+        }
+
+        unsigned long rowCount(void) const { return (ok() ? data_->rows : 0); }
+
+        /**
+         * Returns the size of the file, and of the rows before
+         * compression.
+         */
+        size_t fileBytes(void) const { return (data_ ? data_->size : 0); }
+        size_t rawBytes(void) const { return (data_ ? data_->rawBytes : 0); }
+
+        size_t blockCount(void) const { return (data_ ? data_->blocks.size() : 0); }
+
+        /**
+         * Returns a new ResultSet positioned before the first row.
+         * It MUST be closed when done, like any other ResultSet.
+         */
+        RandomAccessResultSet *cursor(void) const;
+
+    private:
+        friend class SpilledResultSet;
+
+        struct Block
+        {
+            size_t offset; /** in the file */
+            size_t stored;
+            size_t raw;
+            unsigned long firstRow;
+            bool compressed;
+        };
+
+        struct Data
+        {
+            Data() : fd(-1), map(NULL), size(0), rawBytes(0), rows(0), bitmapBytes(0) {}
+
+            ~Data()
+            {
+                if (map) munmap(map, size);
+                if (fd >= 0) ::close(fd);
+            }
+
+            std::vector<std::string> columns;
+            std::vector<Block> blocks;
+            std::string error;
+            int fd;
+            char *map;
+            size_t size;
+            size_t rawBytes;
+            unsigned long rows;
+            size_t bitmapBytes;
+        };
+
+        /**
+         * Appends rows to a new file, a block at a time. A block is a
+         * row count and the offset of each row, followed by the rows.
+         */
+        class Writer
+        {
+        public:
+            Writer(const std::vector<std::string> &columns, const SpillOptions &options)
+                : data_(new Data)
+                , options_(options)
+                , rowsInBlock_(0)
+            {
+                data_->columns = columns;
+                data_->bitmapBytes = (columns.size() + 7) / 8;
+
+                std::string dir(options.directory);
+                if (dir.empty()) dir = (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+                std::string path(dir + "/dbabstract-spill-XXXXXX");
+                std::vector<char> name(path.begin(), path.end());
+                name.push_back('\0');
+                data_->fd = mkstemp(&name[0]);
+                if (data_->fd < 0) {
+                    fail("cannot create a file in " + dir);
+                } else {
+                    unlink(&name[0]);
+                }
+            }
+
+            bool ok(void) const { return (data_->error.empty()); }
+
+            void addRow(const char * const *values)
+            {
+                size_t cols = data_->columns.size();
+                offsets_.push_back((uint32_t) rows_.size());
+                size_t row = rows_.size();
+                size_t header = data_->bitmapBytes + cols * sizeof(uint32_t);
+                rows_.resize(row + header, 0);
+
+                uint32_t at = 0;
+                for (size_t i=0; i<cols; i++) {
+                    memcpy(&rows_[row + data_->bitmapBytes + i * sizeof(uint32_t)], &at, sizeof(at));
+                    if (!values[i]) {
+                        rows_[row + i / 8] |= (char) (1 << (i % 8));
+                        continue;
+                    }
+                    size_t len = strlen(values[i]) + 1;
+                    rows_.insert(rows_.end(), values[i], values[i] + len);
+                    at += (uint32_t) len;
+                }
+                rowsInBlock_++;
+                data_->rows++;
+                if (rows_.size() + offsets_.size() * sizeof(uint32_t) >= options_.blockBytes) flush();
+            }
+
+            SpilledResult finish(void)
+            {
+                flush();
+                if (ok() && data_->size) {
+                    void *map = mmap(NULL, data_->size, PROT_READ, MAP_PRIVATE, data_->fd, 0);
+                    if (map == MAP_FAILED) fail("cannot map the file");
+                    else data_->map = (char *) map;
+                }
+                if (data_->fd >= 0) {
+                    ::close(data_->fd);
+                    data_->fd = -1;
+                }
+                SpilledResult r;
+                r.data_ = data_;
+                return (r);
+            }
+
+        private:
+            void flush(void)
+            {
+                if (!rowsInBlock_ || !ok()) return;
+
+                raw_.resize(sizeof(uint32_t) * (1 + offsets_.size()));
+                uint32_t count = (uint32_t) rowsInBlock_;
+                memcpy(&raw_[0], &count, sizeof(count));
+                for (size_t i=0; i<offsets_.size(); i++) {
+                    uint32_t off = (uint32_t) (raw_.size() + offsets_[i]);
+                    memcpy(&raw_[sizeof(uint32_t) * (1 + i)], &off, sizeof(off));
+                }
+                raw_.insert(raw_.end(), rows_.begin(), rows_.end());
+
+                Block b;
+                b.offset = data_->size;
+                b.raw = raw_.size();
+                b.firstRow = data_->rows - rowsInBlock_;
+                b.compressed = (options_.compress && lz4block::compress(&raw_[0], raw_.size(), packed_) < raw_.size());
+                const std::vector<char> &out = (b.compressed ? packed_ : raw_);
+                b.stored = out.size();
+
+                for (size_t done=0; done<out.size(); ) {
+                    ssize_t n = write(data_->fd, &out[done], out.size() - done);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) {
+                        fail("cannot write the file");
+                        return;
+                    }
+                    done += (size_t) n;
+                }
+                data_->blocks.push_back(b);
+                data_->size += b.stored;
+                data_->rawBytes += b.raw;
+                rows_.clear();
+                offsets_.clear();
+                rowsInBlock_ = 0;
+            }
+
+            void fail(const std::string &what)
+            {
+                if (data_->error.empty()) data_->error = what + ": " + strerror(errno);
+            }
+
+            std::shared_ptr<Data> data_;
+            SpillOptions options_;
+            std::vector<char> rows_;
+            std::vector<uint32_t> offsets_;
+            unsigned long rowsInBlock_;
+            std::vector<char> raw_;
+            std::vector<char> packed_;
+        };
+
+        std::shared_ptr<const Data> data_;
+    };
+
+    /**
+     * A RandomAccessResultSet over the rows of a SpilledResult. Each
+     * has the block it is in decompressed on its own.
+     */
+    class SpilledResultSet : public RandomAccessResultSet
+    {
+    public:
+        SpilledResultSet(const SpilledResult &result)
+            : result_(result)
+            , row_(-1)
+            , block_((size_t) -1)
+            , base_(NULL)
+            , current_(NULL) {}
+
+        void *handle(void) { return (NULL); }
+
+        bool close(void)
+        {
+            delete this;
+            return (true);
+        }
+
+        bool next(void)
+        {
+            if (row_ + 1 >= (long) result_.rowCount()) {
+                row_ = (long) result_.rowCount();
+                current_ = NULL;
+                return (false);
+            }
+            return (position(row_ + 1));
+        }
+
+        void rewind(void)
+        {
+            row_ = -1;
+            current_ = NULL;
+        }
+
+        bool seek(unsigned long row)
+        {
+            if (row >= result_.rowCount()) {
+                row_ = (long) result_.rowCount();
+                current_ = NULL;
+                return (false);
+            }
+            return (position((long) row));
+        }
+
+        long row(void) const { return (row_); }
+
+        SpilledResultSet *share(void) const { return (new SpilledResultSet(result_)); }
+
+        const SpilledResult &result(void) const { return (result_); }
+
+        unsigned int findColumn(const char *field) const { return (result_.findColumn(field)); }
+        unsigned long recordCount(void) const { return (result_.rowCount()); }
+        unsigned int columnCount(void) const { return (result_.columnCount()); }
+        const char *columnName(const unsigned int idx) const { return (result_.columnName(idx)); }
+
+        const char *getString(const int idx) const
+        {
+            if (!current_ || idx < 0 || (unsigned int) idx >= result_.columnCount()) return (NULL);
+            const SpilledResult::Data &d = *result_.data_;
+            if (current_[idx / 8] & (1 << (idx % 8))) return (NULL);
+            uint32_t at;
+            memcpy(&at, current_ + d.bitmapBytes + idx * sizeof(uint32_t), sizeof(at));
+            return (current_ + d.bitmapBytes + d.columns.size() * sizeof(uint32_t) + at);
+        }
+
+    private:
+        /**
+         * Makes row current, bringing in its block when needed.
+         */
+        bool position(long row)
+        {
+            const SpilledResult::Data &d = *result_.data_;
+            if (block_ >= d.blocks.size() || (unsigned long) row < d.blocks[block_].firstRow ||
+                (block_ + 1 < d.blocks.size() && (unsigned long) row >= d.blocks[block_ + 1].firstRow)) {
+                size_t b = (size_t) (std::upper_bound(d.blocks.begin(), d.blocks.end(), (unsigned long) row,
+                                                      [](unsigned long r, const SpilledResult::Block &blk) { return (r < blk.firstRow); })
+                                     - d.blocks.begin()) - 1;
+                const SpilledResult::Block &blk = d.blocks[b];
+                if (blk.compressed) {
+                    scratch_.resize(blk.raw);
+                    if (!lz4block::decompress(d.map + blk.offset, blk.stored, &scratch_[0], blk.raw)) {
+                        block_ = (size_t) -1;
+                        current_ = NULL;
+                        row_ = (long) result_.rowCount();
+                        return (false);
+                    }
+                    base_ = &scratch_[0];
+                } else {
+                    base_ = d.map + blk.offset;
+                }
+                block_ = b;
+            }
+            uint32_t at;
+            memcpy(&at, base_ + sizeof(uint32_t) * (1 + row - d.blocks[block_].firstRow), sizeof(at));
+            current_ = base_ + at;
+            row_ = row;
+            return (true);
+        }
+
+        SpilledResult result_;
+        long row_;
+        size_t block_;
+        const char *base_; /** the raw rows of block_ */
+        const char *current_; /** the current row */
+        std::vector<char> scratch_;
+    };
+
+    inline RandomAccessResultSet *SpilledResult::cursor(void) const
+    {
+        return (new SpilledResultSet(*this));
+    }
+}; /* namespace */
+
+#endif
@@ -17,9 +17,11 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <ctype.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +29,7 @@
 #include <vector>
 
 #include "sqlite3_db.h"
+#include "dbabstract/sqlscan.h"
 
 #include "sqlite3.h"
 
@@ -47,11 +50,15 @@ Sqlite3_ResultSet::close(void)
     // eat remaining rows, if there are some
     do {
         rc = sqlite3_step(res_);
-    } while (rc != SQLITE_DONE && rc != SQLITE_ERROR && rc != SQLITE_MISUSE);
+    } while (rc == SQLITE_ROW);
 
     sqlite3_finalize(res_);
     res_ = NULL;
+    fetch_.finish();
+
+    std::function<void ()> onClose(onClose_);
     delete this;
+    if (onClose) onClose();
 
     return (true);
 }
@@ -59,19 +66,12 @@ Sqlite3_ResultSet::close(void)
 bool
 Sqlite3_ResultSet::next(void)
 {
-    int rc;
+    // lock waits happen in the connection's busy handler; SQLITE_BUSY
+    // here means its deadline passed
+    if (!fetch_.active()) return (sqlite3_step(res_) == SQLITE_ROW);
 
-    do {
-        rc = sqlite3_step(res_);
-        if (rc == SQLITE_BUSY) {
-            sleep(1);
-            continue;
-        }
-        if (rc == SQLITE_ROW) {
-            return (true);
-        }
-    } while (rc != SQLITE_DONE && rc != SQLITE_ERROR && rc != SQLITE_MISUSE);
-    return (false);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    return (fetch_.add(sqlite3_step(res_) == SQLITE_ROW, begin));
 }
 
 unsigned long
@@ -97,6 +97,18 @@ Sqlite3_ResultSet::findColumn(const char *fld) const
     return (i);
 }
 
+unsigned int
+Sqlite3_ResultSet::columnCount(void) const
+{
+    return ((unsigned int) sqlite3_column_count(res_));
+}
+
+const char *
+Sqlite3_ResultSet::columnName(const unsigned int idx) const
+{
+    return (sqlite3_column_name(res_, idx));
+}
+
 const char *
 Sqlite3_ResultSet::getString(const int idx) const
 {
@@ -204,13 +216,134 @@ Sqlite3_ResultSet::operator delete (void *ptr)
 bool
 Sqlite3_Connection::open(const char *database, const char *host, const int port, const char *user, const char *pass)
 {
-    if (sqlite3_open(database, &db_) != SQLITE_OK) {
+    ConnectTrace trace(observer_, this, database, host, port);
+    // URIs are honoured whatever the library was built with
+    if (sqlite3_open_v2(database, &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
+        sqlite3_close(db_);
         db_ = NULL;
         return (false);
     }
+    sqlite3_busy_handler(db_, busyHandler, this);
+    return (trace.finish(true));
+}
+
+/* options of Sqlite3_Connection; the group takes them but the first three */
+static const char *const connectionOptions[] = { "mode", "mutex", "journal_mode", "cache", "uri", "busy_timeout", "synchronous", "mmap_size", "cache_size", NULL };
+/* options set by a PRAGMA, journal_mode first */
+static const char *const pragmaOptions[] = { "journal_mode", "synchronous", "mmap_size", "cache_size", NULL };
+
+bool
+Sqlite3_Connection::open(const ConnectionOptions &options)
+{
+    const char *mode = options.get("mode");
+    const char *mutex = options.get("mutex");
+    const char *cache = options.get("cache");
+    const char *database = (options.get("database") ? options.get("database") : "");
+    int flags = 0;
+
+    reportUnknown(options);
+    if (!mode || strcmp(mode, "rwc") == 0) flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    else if (strcmp(mode, "rw") == 0) flags = SQLITE_OPEN_READWRITE;
+    else if (strcmp(mode, "ro") == 0) flags = SQLITE_OPEN_READONLY;
+    else if (strcmp(mode, "memory") == 0) flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MEMORY;
+    else {
+        std::cerr << "Unknown SQLite open mode: " << mode << std::endl;
+        return (false);
+    }
+    if (mutex && strcmp(mutex, "none") == 0) flags |= SQLITE_OPEN_NOMUTEX;
+    else if (mutex && strcmp(mutex, "full") == 0) flags |= SQLITE_OPEN_FULLMUTEX;
+    else if (mutex) {
+        std::cerr << "Unknown SQLite mutex mode: " << mutex << std::endl;
+        return (false);
+    }
+    if (cache && strcmp(cache, "shared") == 0) flags |= SQLITE_OPEN_SHAREDCACHE;
+    else if (cache && strcmp(cache, "private") == 0) flags |= SQLITE_OPEN_PRIVATECACHE;
+    else if (cache) {
+        std::cerr << "Unknown SQLite cache mode: " << cache << std::endl;
+        return (false);
+    }
+    // file::memory:?cache=shared and friends only work as URIs
+    if (options.getBool("uri", false) || strncmp(database, "file:", 5) == 0) flags |= SQLITE_OPEN_URI;
+
+    if (!openWithFlags(database, flags)) return (false);
+    if (!configure(options, true)) {
+        close();
+        return (false);
+    }
+    return (true);
+}
+
+std::vector<std::string>
+Sqlite3_Connection::unknownOptions(const ConnectionOptions &options) const
+{
+    return (options.unknown(connectionOptions));
+}
+
+bool
+Sqlite3_Connection::configure(const ConnectionOptions &options, bool journal)
+{
+    if (options.has("busy_timeout")) setBusyStrategy(busyInitialUs_, busyMaxUs_, options.getLong("busy_timeout", busyDeadlineMs_));
+
+    for (size_t i=(journal ? 0 : 1); pragmaOptions[i]; i++) {
+        const char *name = pragmaOptions[i];
+        const char *value = options.get(name);
+        if (!value) continue;
+        // pragma values cannot be bound, so only plain words pass
+        for (const char *p = value; *p; p++) {
+            if (!isalnum((unsigned char) *p) && *p != '_' && *p != '-') {
+                std::cerr << "Bad value for SQLite option " << name << ": " << value << std::endl;
+                return (false);
+            }
+        }
+        std::string sql = std::string("PRAGMA ") + name + " = " + value;
+        if (!exec(sql.c_str())) return (false);
+    }
     return (true);
 }
 
+bool
+Sqlite3_Connection::openWithFlags(const char *database, int flags)
+{
+    ConnectTrace trace(observer_, this, database, NULL, 0);
+    if (sqlite3_open_v2(database, &db_, flags, NULL) != SQLITE_OK) {
+        sqlite3_close(db_);
+        db_ = NULL;
+        return (false);
+    }
+    sqlite3_busy_handler(db_, busyHandler, this);
+    return (trace.finish(true));
+}
+
+void
+Sqlite3_Connection::setBusyStrategy(long initialUs, long maxUs, long deadlineMs)
+{
+    busyInitialUs_ = (initialUs > 0 ? initialUs : 1);
+    busyMaxUs_ = (maxUs > busyInitialUs_ ? maxUs : busyInitialUs_);
+    busyDeadlineMs_ = (deadlineMs > 0 ? deadlineMs : 0);
+}
+
+int
+Sqlite3_Connection::busyHandler(void *self, int count)
+{
+    Sqlite3_Connection *conn = (Sqlite3_Connection *) self;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    // count restarts at zero for every new wait on a lock
+    if (count == 0) conn->busyStart_ = now;
+    long long waited = std::chrono::duration_cast<std::chrono::microseconds>(now - conn->busyStart_).count();
+    long long left = conn->busyDeadlineMs_ * 1000LL - waited;
+    if (left <= 0) return (0);
+
+    long long delay = conn->busyMaxUs_;
+    if (count < 30) delay = std::min(delay, (long long) conn->busyInitialUs_ << count);
+    if (delay > left) delay = left;
+
+    usleep((useconds_t) delay);
+    conn->busyWaits_++;
+    conn->busyUs_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+    return (1);
+}
+
 bool
 Sqlite3_Connection::close(void)
 {
@@ -219,7 +352,131 @@ Sqlite3_Connection::close(void)
         return (false);
     }
     db_ = NULL;
+    if (observer_) observer_->onDisconnect(this);
+    return (true);
+}
+
+/**
+ * Copies the main database of from into that of to; see backup().
+ */
+bool
+Sqlite3_Connection::copy(sqlite3 *from, sqlite3 *to, int pagesPerStep, long pauseMs, const BackupProgress &progress)
+{
+    sqlite3_backup *backup = sqlite3_backup_init(to, "main", from, "main");
+    if (!backup) return (false);
+
+    std::chrono::steady_clock::time_point blocked;
+    bool waiting = false;
+    bool stopped = false;
+    int rc;
+    while ((rc = sqlite3_backup_step(backup, pagesPerStep)) != SQLITE_DONE) {
+        if (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) break;
+        if (rc == SQLITE_OK) {
+            waiting = false;
+        } else if (!waiting) {
+            waiting = true;
+            blocked = std::chrono::steady_clock::now();
+        } else if (std::chrono::steady_clock::now() - blocked >= std::chrono::milliseconds(busyDeadlineMs_)) {
+            break;
+        }
+        if (progress && !progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup))) {
+            stopped = true;
+            break;
+        }
+        // a lock may clear up without a pause, but not in no time
+        if (pauseMs > 0 || waiting) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs > 0 ? pauseMs : 1));
+        }
+    }
+    if (rc == SQLITE_DONE && progress) progress(0, sqlite3_backup_pagecount(backup));
+    // leaves the error, if any, on to
+    sqlite3_backup_finish(backup);
+    return (rc == SQLITE_DONE && !stopped);
+}
+
+bool
+Sqlite3_Connection::backup(Sqlite3_Connection &dest, int pagesPerStep, long pauseMs, const BackupProgress &progress)
+{
+    if (!db_ || !dest.db_) return (false);
+    return (copy(db_, dest.db_, pagesPerStep, pauseMs, progress));
+}
+
+bool
+Sqlite3_Connection::backupTo(const char *path, int pagesPerStep, long pauseMs, const BackupProgress &progress)
+{
+    sqlite3 *file = NULL;
+
+    if (!db_) return (false);
+    if (sqlite3_open_v2(path, &file, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+        std::cerr << "Unable to open SQLite backup " << path << ": " << sqlite3_errmsg(file) << std::endl;
+        sqlite3_close(file);
+        return (false);
+    }
+    bool ok = copy(db_, file, pagesPerStep, pauseMs, progress);
+    if (!ok) std::cerr << "SQLite backup to " << path << " failed: " << sqlite3_errmsg(file) << std::endl;
+    sqlite3_close(file);
+    return (ok);
+}
+
+bool
+Sqlite3_Connection::restoreFrom(const char *path, int pagesPerStep, long pauseMs, const BackupProgress &progress)
+{
+    sqlite3 *file = NULL;
+
+    if (!db_) return (false);
+    if (sqlite3_open_v2(path, &file, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        std::cerr << "Unable to open SQLite backup " << path << ": " << sqlite3_errmsg(file) << std::endl;
+        sqlite3_close(file);
+        return (false);
+    }
+    bool ok = copy(file, db_, pagesPerStep, pauseMs, progress);
+    if (!ok) std::cerr << "SQLite restore from " << path << " failed: " << sqlite3_errmsg(db_) << std::endl;
+    sqlite3_close(file);
+    return (ok);
+}
+
+bool
+Sqlite3_Connection::serialize(std::vector<unsigned char> &out, const char *schema)
+{
+    if (!db_) return (false);
+#ifdef SQLITE_ENABLE_DESERIALIZE
+    sqlite3_int64 size = 0;
+    // a deserialized database hands out its own memory
+    unsigned char *data = sqlite3_serialize(db_, schema, &size, SQLITE_SERIALIZE_NOCOPY);
+    if (data) {
+        out.assign(data, data + size);
+        return (true);
+    }
+    if ((data = sqlite3_serialize(db_, schema, &size, 0)) == NULL) {
+        // an empty database has no pages to copy
+        out.clear();
+        return (size == 0 && sqlite3_errcode(db_) == SQLITE_OK);
+    }
+    out.assign(data, data + size);
+    sqlite3_free(data);
     return (true);
+#else
+    std::cerr << "SQLite was built without sqlite3_serialize()" << std::endl;
+    return (false);
+#endif
+}
+
+bool
+Sqlite3_Connection::deserialize(const void *data, size_t size, bool readOnly, const char *schema)
+{
+    if (!db_) return (false);
+#ifdef SQLITE_ENABLE_DESERIALIZE
+    // SQLite owns the copy, and frees it with the database
+    unsigned char *copy = (unsigned char *) sqlite3_malloc64(size ? size : 1);
+    if (!copy) return (false);
+    if (size) memcpy(copy, data, size);
+    unsigned int flags = SQLITE_DESERIALIZE_FREEONCLOSE |
+        (readOnly ? SQLITE_DESERIALIZE_READONLY : SQLITE_DESERIALIZE_RESIZEABLE);
+    return (sqlite3_deserialize(db_, schema, copy, size, size, flags) == SQLITE_OK);
+#else
+    std::cerr << "SQLite was built without sqlite3_deserialize()" << std::endl;
+    return (false);
+#endif
 }
 
 bool
@@ -231,6 +488,13 @@ Sqlite3_Connection::isConnected(void)
 
 bool
 Sqlite3_Connection::execute(const char *sql)
+{
+    QueryTrace trace(observer_, this, sql);
+    return (trace.finish(exec(sql)));
+}
+
+bool
+Sqlite3_Connection::exec(const char *sql)
 {
     bool ret = false;
     char *err = NULL;
@@ -254,13 +518,14 @@ Sqlite3_Connection::executeQuery(const char *sql)
 
     if (!db_) return (NULL);
 
+    QueryTrace trace(observer_, this, sql);
     if (sqlite3_prepare(db_, sql, -1, &vm, &tail) != SQLITE_OK) {
         return (0);
     }
 
-    dbabstract::ResultSet *c = 0;
-    c = new dbabstract::Sqlite3_ResultSet(vm);
-    return (c);
+    dbabstract::Sqlite3_ResultSet *c = new dbabstract::Sqlite3_ResultSet(vm);
+    c->fetch_.attach(observer_, this);
+    return (trace.finish(c));
 }
 
 char *
@@ -297,24 +562,31 @@ Sqlite3_Connection::insertId(void)
 }
 
 bool
-Sqlite3_Connection::beginTrans(void)
+Sqlite3_Connection::transaction(const char *sql, enum ConnectionObserver::TRANS_EVENT event)
 {
     if (!db_) return (false);
-    return (execute("BEGIN TRANSACTION"));
+
+    // reported as a transaction only, not as a statement
+    TransactionTrace trace(observer_, this, event);
+    return (trace.finish(exec(sql)));
+}
+
+bool
+Sqlite3_Connection::beginTrans(void)
+{
+    return (transaction(immediate_ ? "BEGIN IMMEDIATE TRANSACTION" : "BEGIN TRANSACTION", ConnectionObserver::BEGIN));
 }
 
 bool
 Sqlite3_Connection::commitTrans(void)
 {
-    if (!db_) return (false);
-    return (execute("COMMIT TRANSACTION"));
+    return (transaction("COMMIT TRANSACTION", ConnectionObserver::COMMIT));
 }
 
 bool
 Sqlite3_Connection::rollbackTrans(void)
 {
-    if (!db_) return (false);
-    return (execute("ROLLBACK TRANSACTION"));
+    return (transaction("ROLLBACK TRANSACTION", ConnectionObserver::ROLLBACK));
 }
 
 bool
@@ -383,6 +655,454 @@ Sqlite3_Connection::operator delete (void *ptr)
   delete [] static_cast <char *> (ptr);
 }
 
+Sqlite3_ConnectionGroup::Sqlite3_ConnectionGroup(unsigned int readers)
+    : maxReaders_(readers ? readers : 1)
+    , writer_(NULL)
+    , inTrans_(false)
+    , snapshot_(NULL)
+{
+}
+
+Sqlite3_ConnectionGroup::~Sqlite3_ConnectionGroup()
+{
+    close();
+}
+
+void *
+Sqlite3_ConnectionGroup::handle(void)
+{
+    return (writer_ ? writer_->handle() : NULL);
+}
+
+bool
+Sqlite3_ConnectionGroup::open(const char *database, const char *host, const int port, const char *user, const char *pass)
+{
+    return (open(ConnectionOptions(database, host, port, user, pass)));
+}
+
+std::vector<std::string>
+Sqlite3_ConnectionGroup::unknownOptions(const ConnectionOptions &options) const
+{
+    // skips "mode", "mutex", "journal_mode" and "cache": a shared
+    // cache would put the readers behind the writer's table locks
+    return (options.unknown(connectionOptions + 4));
+}
+
+bool
+Sqlite3_ConnectionGroup::open(const ConnectionOptions &options)
+{
+    const char *database = (options.get("database") ? options.get("database") : "");
+    int uri = (options.getBool("uri", false) ? SQLITE_OPEN_URI : 0);
+
+    reportUnknown(options);
+    close();
+
+    writer_ = new Sqlite3_Connection;
+    writer_->setObserver(observer_);
+    if (!writer_->openWithFlags(database, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX | uri)) {
+        setError(SQLITE_CANTOPEN, "unable to open database file");
+        writer_->release();
+        writer_ = NULL;
+        return (false);
+    }
+
+    bool wal = false;
+    ResultSet *rs = writer_->executeQuery("PRAGMA journal_mode=WAL");
+    if (rs) {
+        wal = (rs->next() && rs->getString(0) && strcmp(rs->getString(0), "wal") == 0);
+        rs->close();
+    }
+    if (!wal) {
+        setError(SQLITE_ERROR, "unable to switch the database to WAL journaling");
+        writer_->release();
+        writer_ = NULL;
+        return (false);
+    }
+    if (!writer_->configure(options, false)) {
+        setError(writer_->errorno(), writer_->errormsg());
+        writer_->release();
+        writer_ = NULL;
+        return (false);
+    }
+
+    database_ = database;
+    options_ = options;
+    return (true);
+}
+
+bool
+Sqlite3_ConnectionGroup::close(void)
+{
+    if (!writer_) return (false);
+
+    unpinSnapshot();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i=0; i<readers_.size(); i++) {
+        readers_[i]->release();
+    }
+    readers_.clear();
+    idle_.clear();
+    leases_.clear();
+    writer_->release();
+    writer_ = NULL;
+    inTrans_ = false;
+    return (true);
+}
+
+bool
+Sqlite3_ConnectionGroup::isConnected(void)
+{
+    return (writer_ != NULL);
+}
+
+bool
+Sqlite3_ConnectionGroup::execute(const char *sql)
+{
+    if (!writer_) return (false);
+
+    std::lock_guard<std::recursive_mutex> lock(writerMutex_);
+    if (!writer_->execute(sql)) {
+        setError(writer_->errorno(), writer_->errormsg());
+        return (false);
+    }
+    return (true);
+}
+
+dbabstract::ResultSet *
+Sqlite3_ConnectionGroup::executeQuery(const char *sql)
+{
+    if (!writer_) return (NULL);
+
+    bool owner;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        owner = (inTrans_ && txnOwner_ == std::this_thread::get_id());
+    }
+
+    if (owner || !sqlscan::isReadOnly(sql)) {
+        // the writer stays with this thread until the ResultSet is closed
+        writerMutex_.lock();
+        ResultSet *rs = writer_->executeQuery(sql);
+        if (!rs) {
+            setError(writer_->errorno(), writer_->errormsg());
+            writerMutex_.unlock();
+            return (NULL);
+        }
+        return (leased(rs, [this]() { writerMutex_.unlock(); }));
+    }
+
+    Sqlite3_Connection *reader = leaseReader();
+    if (!reader) return (NULL);
+    ResultSet *rs = reader->executeQuery(sql);
+    if (!rs) {
+        setError(reader->errorno(), reader->errormsg());
+        returnReader();
+        return (NULL);
+    }
+    return (leased(rs, [this]() { returnReader(); }));
+}
+
+dbabstract::ResultSet *
+Sqlite3_ConnectionGroup::leased(ResultSet *rs, const std::function<void ()> &onClose)
+{
+    static_cast<Sqlite3_ResultSet *>(rs)->onClose_ = onClose;
+    return (rs);
+}
+
+Sqlite3_Connection *
+Sqlite3_ConnectionGroup::leaseReader(void)
+{
+    std::thread::id self = std::this_thread::get_id();
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    Lease &lease = leases_[self];
+    if (lease.count > 0) {
+        lease.count++;
+        return (lease.conn);
+    }
+
+    while (idle_.empty() && readers_.size() >= maxReaders_) {
+        released_.wait(lock);
+    }
+
+    Sqlite3_Connection *conn = NULL;
+    if (!idle_.empty()) {
+        // prefer the reader this thread used last
+        std::vector<Sqlite3_Connection *>::iterator it = std::find(idle_.begin(), idle_.end(), lease.conn);
+        if (it == idle_.end()) it = idle_.end() - 1;
+        conn = *it;
+        idle_.erase(it);
+        conn->setObserver(observer_);
+    } else {
+        conn = new Sqlite3_Connection;
+        conn->setObserver(observer_);
+        int uri = (options_.getBool("uri", false) ? SQLITE_OPEN_URI : 0);
+        if (!conn->openWithFlags(database_.c_str(), SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | uri) || !conn->configure(options_, false)) {
+            errors_[self] = std::make_pair((unsigned int) SQLITE_CANTOPEN, std::string("unable to open database file"));
+            conn->release();
+            return (NULL);
+        }
+        // lets sqlite3_snapshot_open() know the file is in WAL mode
+        conn->execute("PRAGMA application_id");
+        readers_.push_back(conn);
+    }
+
+    lease.conn = conn;
+    lease.pinned = false;
+    if (snapshot_) {
+        if (!beginSnapshot(conn)) {
+            errors_[self] = std::make_pair(conn->errorno(), std::string(conn->errormsg()));
+            idle_.push_back(conn);
+            released_.notify_one();
+            return (NULL);
+        }
+        lease.pinned = true;
+    }
+    lease.count = 1;
+    return (conn);
+}
+
+void
+Sqlite3_ConnectionGroup::returnReader(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Lease &lease = leases_[std::this_thread::get_id()];
+    if (--lease.count > 0) return;
+    if (lease.pinned) {
+        lease.conn->execute("COMMIT");
+        lease.pinned = false;
+    }
+    idle_.push_back(lease.conn);
+    released_.notify_one();
+}
+
+bool
+Sqlite3_ConnectionGroup::beginSnapshot(Sqlite3_Connection *conn)
+{
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (!conn->execute("BEGIN")) return (false);
+    if (sqlite3_snapshot_open((sqlite3 *) conn->handle(), "main", (sqlite3_snapshot *) snapshot_) != SQLITE_OK) {
+        conn->execute("ROLLBACK");
+        return (false);
+    }
+    return (true);
+#else
+    (void) conn;
+    return (false);
+#endif
+}
+
+bool
+Sqlite3_ConnectionGroup::pinSnapshot(void)
+{
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (!writer_) return (false);
+
+    unpinSnapshot();
+    Sqlite3_Connection *conn = leaseReader();
+    if (!conn) return (false);
+
+    sqlite3_snapshot *snap = NULL;
+    bool ok = conn->execute("BEGIN");
+    if (ok && sqlite3_snapshot_get((sqlite3 *) conn->handle(), "main", &snap) != SQLITE_OK) {
+        setError(conn->errorno(), conn->errormsg());
+        ok = false;
+    }
+    conn->execute("COMMIT");
+    returnReader();
+
+    if (ok) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshot_ = snap;
+    }
+    return (ok);
+#else
+    setError(SQLITE_ERROR, "SQLite was built without SQLITE_ENABLE_SNAPSHOT");
+    return (false);
+#endif
+}
+
+void
+Sqlite3_ConnectionGroup::unpinSnapshot(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (snapshot_) sqlite3_snapshot_free((sqlite3_snapshot *) snapshot_);
+#endif
+    snapshot_ = NULL;
+}
+
+size_t
+Sqlite3_ConnectionGroup::readers(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (readers_.size());
+}
+
+void
+Sqlite3_ConnectionGroup::setObserver(ConnectionObserver *observer)
+{
+    // readers in use by other threads are left alone; leaseReader()
+    // hands the observer on when they are next leased
+    std::lock_guard<std::recursive_mutex> writerLock(writerMutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    observer_ = observer;
+    if (writer_) writer_->setObserver(observer);
+    for (size_t i=0; i<idle_.size(); i++) {
+        idle_[i]->setObserver(observer);
+    }
+}
+
+char *
+Sqlite3_ConnectionGroup::escape(const char *str)
+{
+    return (writer_->escape(str));
+}
+
+const char *
+Sqlite3_ConnectionGroup::unixtimeToSql(const time_t val)
+{
+    return (writer_->unixtimeToSql(val));
+}
+
+unsigned long
+Sqlite3_ConnectionGroup::insertId(void)
+{
+    std::lock_guard<std::recursive_mutex> lock(writerMutex_);
+    return (writer_->insertId());
+}
+
+bool
+Sqlite3_ConnectionGroup::beginTrans(void)
+{
+    if (!writer_) return (false);
+
+    // held until commitTrans() or rollbackTrans()
+    writerMutex_.lock();
+    if (!writer_->beginTrans()) {
+        setError(writer_->errorno(), writer_->errormsg());
+        writerMutex_.unlock();
+        return (false);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    inTrans_ = true;
+    txnOwner_ = std::this_thread::get_id();
+    return (true);
+}
+
+bool
+Sqlite3_ConnectionGroup::commitTrans(void)
+{
+    if (!writer_) return (false);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!inTrans_ || txnOwner_ != std::this_thread::get_id()) {
+            errors_[std::this_thread::get_id()] = std::make_pair((unsigned int) SQLITE_ERROR, std::string("no transaction is active on this thread"));
+            return (false);
+        }
+    }
+    // a failed COMMIT leaves the transaction open
+    if (!writer_->commitTrans()) {
+        setError(writer_->errorno(), writer_->errormsg());
+        return (false);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inTrans_ = false;
+    }
+    writerMutex_.unlock();
+    return (true);
+}
+
+bool
+Sqlite3_ConnectionGroup::rollbackTrans(void)
+{
+    if (!writer_) return (false);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!inTrans_ || txnOwner_ != std::this_thread::get_id()) {
+            errors_[std::this_thread::get_id()] = std::make_pair((unsigned int) SQLITE_ERROR, std::string("no transaction is active on this thread"));
+            return (false);
+        }
+    }
+    bool ok = writer_->rollbackTrans();
+    if (!ok) setError(writer_->errorno(), writer_->errormsg());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inTrans_ = false;
+    }
+    writerMutex_.unlock();
+    return (ok);
+}
+
+bool
+Sqlite3_ConnectionGroup::setTransactionMode(const enum TRANS_MODE mode)
+{
+    if (!writer_) return (false);
+
+    std::lock_guard<std::recursive_mutex> lock(writerMutex_);
+    return (writer_->setTransactionMode(mode));
+}
+
+void
+Sqlite3_ConnectionGroup::setError(unsigned int code, const char *msg)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    errors_[std::this_thread::get_id()] = std::make_pair(code, std::string(msg ? msg : ""));
+}
+
+unsigned int
+Sqlite3_ConnectionGroup::errorno(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::thread::id, std::pair<unsigned int, std::string> >::const_iterator it = errors_.find(std::this_thread::get_id());
+    return (it == errors_.end() ? 0 : it->second.first);
+}
+
+const char *
+Sqlite3_ConnectionGroup::errormsg(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::thread::id, std::pair<unsigned int, std::string> >::const_iterator it = errors_.find(std::this_thread::get_id());
+    return (it == errors_.end() ? "" : it->second.second.c_str());
+}
+
+std::vector<std::string>
+Sqlite3_ConnectionGroup::tables(void) const
+{
+    std::vector<std::string> vTables;
+    ResultSet *rs = ((Connection*)this)->executeQuery("SELECT name FROM sqlite_master WHERE type='table'");
+    if (rs) {
+        while (rs->next()) {
+            vTables.push_back(rs->getString(0));
+        }
+        rs->close();
+    }
+    return vTables;
+}
+
+const char *
+Sqlite3_ConnectionGroup::version(void) const
+{
+    static char ret[256];
+    snprintf(ret, 256, "Sqlite3 Driver v0.2 using %s", sqlite3_libversion());
+    return ((const char *) ret);
+}
+
+void *
+Sqlite3_ConnectionGroup::operator new (size_t bytes)
+{
+  return (::new char[bytes]);
+}
+
+void
+Sqlite3_ConnectionGroup::operator delete (void *ptr)
+{
+  delete [] static_cast <char *> (ptr);
+}
+
 // Returns the Newsweek class pointer.
 // The ACE_BUILD_SVC_DLL and ACE_Svc_Export directives are necessary to
 // take care of exporting the function for Win32 platforms.
@@ -17,9 +17,16 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <string>
 
@@ -30,10 +37,12 @@
 namespace dbabstract
 {
     class Sqlite3_Connection;
+    class Sqlite3_ConnectionGroup;
 
     class Sqlite3_ResultSet : public ResultSet
     {
         friend class Sqlite3_Connection;
+        friend class Sqlite3_ConnectionGroup;
     protected:
         Sqlite3_ResultSet(sqlite3_stmt *res) : res_(res) {};
         ~Sqlite3_ResultSet();
@@ -49,6 +58,8 @@ namespace dbabstract
 
         unsigned long recordCount(void) const;
         unsigned int findColumn(const char *field) const;
+        unsigned int columnCount(void) const;
+        const char *columnName(const unsigned int idx) const;
 
         const char *getString(const int idx) const;
         int getInteger(const int idx) const;
@@ -67,6 +78,8 @@ namespace dbabstract
 
     private:
         sqlite3_stmt *res_;
+        std::function<void ()> onClose_;
+        FetchTrace fetch_;
     };
 
     class Sqlite3_Connection : public Connection
@@ -76,11 +89,47 @@ namespace dbabstract
         const Sqlite3_Connection &operator=(const Sqlite3_Connection &old);
 
     public:
-        Sqlite3_Connection() : db_(NULL) {};
+        Sqlite3_Connection()
+            : db_(NULL)
+            , busyInitialUs_(50)
+            , busyMaxUs_(20000)
+            , busyDeadlineMs_(5000)
+            , immediate_(false)
+            , busyWaits_(0)
+            , busyUs_(0) {};
         ~Sqlite3_Connection() { close(); }
 
         void * handle(void) { return db_; }
         bool open(const char *database, const char *host, const int port, const char *user, const char *pass);
+
+        /**
+         * Also takes "mode" (ro, rw, rwc or memory), "mutex" (none or
+         * full), "cache" (shared or private), "uri", "busy_timeout" in
+         * milliseconds, and the pragmas "journal_mode", "synchronous",
+         * "mmap_size" and "cache_size".
+         *
+         * A database named ":memory:" lives in memory and is private
+         * to the connection. Names starting with "file:" are always
+         * taken as URIs, so connections opening the same
+         * "file:name?mode=memory&cache=shared" share one in-memory
+         * database, which lasts until the last of them is closed.
+         * Their locks are per table and fail with SQLITE_LOCKED
+         * rather than waiting.
+         */
+        bool open(const ConnectionOptions &options);
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const;
+
+        /**
+         * Opens database with sqlite3_open_v2() and the given
+         * SQLITE_OPEN_* flags.
+         */
+        bool openWithFlags(const char *database, int flags);
+
+        /**
+         * Applies the "busy_timeout" and pragma options, but for
+         * "journal_mode" unless journal.
+         */
+        bool configure(const ConnectionOptions &options, bool journal);
         bool close(void);
         bool isConnected(void);
         bool execute(const char *sql);
@@ -101,6 +150,81 @@ namespace dbabstract
 
         std::vector<std::string> tables(void) const;
 
+        /**
+         * Sets how a statement waits for a lock held by another
+         * connection: first for initialUs microseconds, doubling on
+         * each retry up to maxUs, until deadlineMs milliseconds have
+         * passed and the statement fails with SQLITE_BUSY. A deadline
+         * of 0 fails at once. Defaults to 50us, 20ms and 5s.
+         */
+        void setBusyStrategy(long initialUs, long maxUs, long deadlineMs);
+
+        /**
+         * Makes beginTrans() take the write lock up front (BEGIN
+         * IMMEDIATE), so a writer waits at the start of its
+         * transaction instead of failing part way through it.
+         */
+        void setImmediateTransactions(bool immediate) { immediate_ = immediate; }
+
+        /**
+         * Returns how many times a statement waited for a lock, and
+         * the total time spent waiting, in microseconds.
+         */
+        unsigned long busyWaits(void) const { return (busyWaits_); }
+        unsigned long long busyMicroseconds(void) const { return (busyUs_); }
+
+        /**
+         * Called after each step of a backup with the pages left to
+         * copy and the total; returning false stops the backup.
+         */
+        typedef std::function<bool (int remaining, int total)> BackupProgress;
+
+        /**
+         * Copies the database into dest's, replacing it, while both
+         * stay in use. pagesPerStep pages are copied at a time (all of
+         * them if negative), sleeping pauseMs milliseconds between
+         * steps so that other connections get at the database. Locks
+         * held elsewhere are waited for, up to the busy deadline (see
+         * setBusyStrategy()). A write by another connection starts the
+         * copy over; writes through this one are carried along.
+         *
+         * @return bool False if it failed or was stopped; dest's
+         *              errormsg() tells why.
+         */
+        bool backup(Sqlite3_Connection &dest, int pagesPerStep = -1, long pauseMs = 0,
+                    const BackupProgress &progress = BackupProgress());
+
+        /**
+         * Copies the database into the file at path, as backup() does,
+         * replacing what the file held. Used to checkpoint an
+         * in-memory database.
+         */
+        bool backupTo(const char *path, int pagesPerStep = -1, long pauseMs = 0,
+                      const BackupProgress &progress = BackupProgress());
+
+        /**
+         * Replaces the database with a copy of the one in the file at
+         * path. Used to warm up an in-memory database.
+         */
+        bool restoreFrom(const char *path, int pagesPerStep = -1, long pauseMs = 0,
+                         const BackupProgress &progress = BackupProgress());
+
+        /**
+         * Copies schema ("main", or an attached one) into out, as the
+         * bytes of its database file. A database loaded by
+         * deserialize() is copied straight from its memory.
+         *
+         * Needs an SQLite with sqlite3_serialize(), as do deserialize().
+         */
+        bool serialize(std::vector<unsigned char> &out, const char *schema = "main");
+
+        /**
+         * Replaces schema with an in-memory database holding a copy of
+         * size bytes at data, as written by serialize(). Unless
+         * readOnly, it may be written and grow.
+         */
+        bool deserialize(const void *data, size_t size, bool readOnly = false, const char *schema = "main");
+
         // Overload the new/delete opertors so the object will be
         // created/deleted using the memory allocator associated with the
         // DLL/SO.
@@ -108,8 +232,139 @@ namespace dbabstract
         void operator delete (void *ptr);
 
     private:
+        static int busyHandler(void *self, int count);
+        bool copy(sqlite3 *from, sqlite3 *to, int pagesPerStep, long pauseMs, const BackupProgress &progress);
+        bool exec(const char *sql);
+        bool transaction(const char *sql, enum ConnectionObserver::TRANS_EVENT event);
+
         sqlite3 *db_;
         int errorno_;
         std::string errormsg_;
+
+        long busyInitialUs_;
+        long busyMaxUs_;
+        long busyDeadlineMs_;
+        bool immediate_;
+        std::chrono::steady_clock::time_point busyStart_;
+        std::atomic<unsigned long> busyWaits_;
+        std::atomic<unsigned long long> busyUs_;
+    };
+    /**
+     * One writer and up to N reader connections to the same SQLite
+     * database file, shared by many threads.
+     *
+     * The connections are opened with SQLITE_OPEN_NOMUTEX and the
+     * database is switched to WAL journaling, so readers do not block
+     * the writer or each other. execute(), statements which are not
+     * read-only and everything inside a transaction run on the writer,
+     * one thread at a time. Read-only executeQuery() calls run on a
+     * reader owned by the calling thread until its last ResultSet is
+     * closed; when all readers are owned, the thread waits for one.
+     *
+     * pinSnapshot() makes every later read see the database as it was
+     * at that moment, until unpinSnapshot(). It needs an SQLite built
+     * with SQLITE_ENABLE_SNAPSHOT, and a snapshot may be lost to a
+     * checkpoint of the WAL file.
+     *
+     * ResultSets must be closed on the thread which created them. An
+     * in-memory database cannot be shared between connections; use a
+     * file.
+     */
+    class Sqlite3_ConnectionGroup : public Connection
+    {
+    private:
+        Sqlite3_ConnectionGroup(const Sqlite3_ConnectionGroup &old);
+        const Sqlite3_ConnectionGroup &operator=(const Sqlite3_ConnectionGroup &old);
+
+    public:
+        Sqlite3_ConnectionGroup(unsigned int readers = 4);
+        ~Sqlite3_ConnectionGroup();
+
+        void * handle(void);
+        bool open(const char *database, const char *host, const int port, const char *user, const char *pass);
+
+        /**
+         * Takes the options of Sqlite3_Connection but "mode", "mutex",
+         * "journal_mode" and "cache"; the others apply to every
+         * connection.
+         */
+        bool open(const ConnectionOptions &options);
+        std::vector<std::string> unknownOptions(const ConnectionOptions &options) const;
+        bool close(void);
+        bool isConnected(void);
+        bool execute(const char *sql);
+        ResultSet *executeQuery(const char *sql);
+        char *escape(const char *);
+        const char *unixtimeToSql(const time_t);
+        unsigned long insertId(void);
+
+        bool beginTrans(void);
+        bool commitTrans(void);
+        bool rollbackTrans(void);
+        bool setTransactionMode(const enum TRANS_MODE mode);
+
+        unsigned int errorno(void) const;
+        const char *errormsg(void) const;
+
+        const char *version(void) const;
+
+        std::vector<std::string> tables(void) const;
+
+        /**
+         * Pins reads to the current state of the database.
+         *
+         * @return bool False if snapshots are unavailable.
+         */
+        bool pinSnapshot(void);
+        void unpinSnapshot(void);
+
+        /**
+         * Returns the number of reader connections opened so far.
+         */
+        size_t readers(void) const;
+
+        /**
+         * Attaches observer to the writer and every reader, which
+         * report their work as themselves. It waits for the writer to
+         * be free; a reader in use by another thread keeps reporting
+         * to the old observer until it is next leased. It must not be
+         * called with a ResultSet of the group open.
+         */
+        void setObserver(ConnectionObserver *observer);
+
+        void *operator new (size_t bytes);
+        void operator delete (void *ptr);
+
+    private:
+        struct Lease
+        {
+            Lease() : conn(NULL), count(0), pinned(false) {}
+
+            Sqlite3_Connection *conn; /** also kept while idle, as a hint */
+            int count;
+            bool pinned;
+        };
+
+        Sqlite3_Connection *leaseReader(void);
+        void returnReader(void);
+        bool beginSnapshot(Sqlite3_Connection *conn);
+        ResultSet *leased(ResultSet *rs, const std::function<void ()> &onClose);
+        void setError(unsigned int code, const char *msg);
+
+        std::string database_;
+        ConnectionOptions options_;
+        unsigned int maxReaders_;
+        Sqlite3_Connection *writer_;
+        std::recursive_mutex writerMutex_;
+        std::thread::id txnOwner_;
+        bool inTrans_;
+
+        std::vector<Sqlite3_Connection *> readers_;
+        std::vector<Sqlite3_Connection *> idle_;
+        std::map<std::thread::id, Lease> leases_;
+        std::map<std::thread::id, std::pair<unsigned int, std::string> > errors_;
+        void *snapshot_;
+        mutable std::mutex mutex_;
+        std::condition_variable released_;
     };
 }
@@ -0,0 +1,364 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _SQLSCAN_H
+#define _SQLSCAN_H
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace dbabstract
+{
+    /**
+     * Light-weight helpers for looking at SQL text on the client,
+     * e.g. to route a statement. They are not a parser: they only
+     * know about quoting, comments and parenthesis nesting, which is
+     * enough to find keywords at the top level of a statement.
+     */
+    namespace sqlscan
+    {
+        inline bool isWordChar(char c)
+        {
+            return (isalnum((unsigned char) c) || c == '_' || c == '$');
+        }
+
+        /**
+         * Steps over the quoted string, identifier or comment starting
+         * at sql[i], returning the index just past it; returns i when
+         * there is none.
+         */
+        inline size_t skipQuoted(const std::string &sql, size_t i)
+        {
+            char c = sql[i];
+            if (c == '\'' || c == '"' || c == '`') {
+                for (size_t j=i+1; j<sql.size(); j++) {
+                    if (sql[j] == c) {
+                        // doubled quote is an escaped quote
+                        if (j + 1 < sql.size() && sql[j+1] == c) {
+                            j++;
+                            continue;
+                        }
+                        return (j + 1);
+                    }
+                    if (sql[j] == '\\' && c != '"') j++;
+                }
+                return (sql.size());
+            }
+            if (c == '-' && i + 1 < sql.size() && sql[i+1] == '-') {
+                size_t end = sql.find('\n', i);
+                return (end == std::string::npos ? sql.size() : end + 1);
+            }
+            if (c == '/' && i + 1 < sql.size() && sql[i+1] == '*') {
+                size_t end = sql.find("*/", i + 2);
+                return (end == std::string::npos ? sql.size() : end + 2);
+            }
+            return (i);
+        }
+
+        /**
+         * Returns the position of the first occurrence of keyword kw
+         * (case-insensitive, whole words only) at parenthesis depth
+         * zero, or at any depth if nested, at or after from;
+         * std::string::npos if there is none. kw may contain single
+         * spaces, which match any whitespace.
+         */
+        inline size_t findKeyword(const std::string &sql, const char *kw, size_t from = 0, bool nested = false)
+        {
+            int depth = 0;
+            size_t i = from;
+
+            while (i < sql.size()) {
+                size_t skip = skipQuoted(sql, i);
+                if (skip != i) {
+                    i = skip;
+                    continue;
+                }
+                char c = sql[i];
+                if (c == '(') depth++;
+                else if (c == ')') depth--;
+                else if ((depth == 0 || nested) && (i == 0 || !isWordChar(sql[i-1]))) {
+                    size_t j = i;
+                    const char *k = kw;
+                    while (*k && j < sql.size()) {
+                        if (*k == ' ') {
+                            if (!isspace((unsigned char) sql[j])) break;
+                            while (j < sql.size() && isspace((unsigned char) sql[j])) j++;
+                            k++;
+                        } else if (toupper((unsigned char) sql[j]) == toupper((unsigned char) *k)) {
+                            j++;
+                            k++;
+                        } else {
+                            break;
+                        }
+                    }
+                    if (!*k && (j >= sql.size() || !isWordChar(sql[j]))) {
+                        return (i);
+                    }
+                }
+                i++;
+            }
+            return (std::string::npos);
+        }
+
+        /**
+         * Returns the first word of the statement in upper case,
+         * skipping whitespace, comments and opening parenthesis.
+         */
+        inline std::string firstKeyword(const std::string &sql)
+        {
+            size_t i = 0;
+            while (i < sql.size()) {
+                size_t skip = skipQuoted(sql, i);
+                if (skip != i && sql[i] != '\'' && sql[i] != '"' && sql[i] != '`') {
+                    i = skip;
+                } else if (isspace((unsigned char) sql[i]) || sql[i] == '(') {
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            std::string word;
+            while (i < sql.size() && isWordChar(sql[i])) {
+                word += (char) toupper((unsigned char) sql[i++]);
+            }
+            return (word);
+        }
+
+        inline std::string trim(const std::string &s)
+        {
+            size_t b = 0;
+            size_t e = s.size();
+            while (b < e && isspace((unsigned char) s[b])) b++;
+            while (e > b && (isspace((unsigned char) s[e-1]) || s[e-1] == ';')) e--;
+            return (s.substr(b, e - b));
+        }
+
+        /**
+         * Splits s on sep characters found at parenthesis depth zero
+         * and outside quotes. The pieces are trimmed.
+         */
+        inline std::vector<std::string> splitTopLevel(const std::string &s, char sep)
+        {
+            std::vector<std::string> out;
+            int depth = 0;
+            size_t start = 0;
+            size_t i = 0;
+
+            while (i < s.size()) {
+                size_t skip = skipQuoted(s, i);
+                if (skip != i) {
+                    i = skip;
+                    continue;
+                }
+                if (s[i] == '(') depth++;
+                else if (s[i] == ')') depth--;
+                else if (s[i] == sep && depth == 0) {
+                    out.push_back(trim(s.substr(start, i - start)));
+                    start = i + 1;
+                }
+                i++;
+            }
+            std::string last = trim(s.substr(start));
+            if (!last.empty() || !out.empty()) out.push_back(last);
+            return (out);
+        }
+
+        /**
+         * True for statements which only read: SELECT (without
+         * FOR UPDATE / FOR SHARE / INTO), SHOW, EXPLAIN, DESCRIBE and
+         * read-only WITH queries. A statement followed by another
+         * one is not.
+         */
+        inline bool isReadOnly(const std::string &sql)
+        {
+            std::string kw = firstKeyword(sql);
+            if (kw == "SHOW" || kw == "EXPLAIN" || kw == "DESCRIBE" || kw == "DESC") {
+                return (true);
+            }
+            if (kw != "SELECT" && kw != "WITH" && kw != "VALUES") {
+                return (false);
+            }
+            if (findKeyword(sql, "FOR UPDATE") != std::string::npos ||
+                findKeyword(sql, "FOR SHARE") != std::string::npos ||
+                findKeyword(sql, "LOCK IN SHARE MODE") != std::string::npos ||
+                findKeyword(sql, "INTO") != std::string::npos) {
+                return (false);
+            }
+            if (kw == "WITH") {
+                // the statements of a CTE sit inside its parentheses
+                const char *writes[] = { "INSERT", "UPDATE", "DELETE", "MERGE", "INTO" };
+                for (size_t i=0; i<5; i++) {
+                    if (findKeyword(sql, writes[i], 0, true) != std::string::npos) return (false);
+                }
+            }
+            if (sql.find(';') != std::string::npos) {
+                std::vector<std::string> parts = splitTopLevel(sql, ';');
+                if (parts.size() > 2 || (parts.size() == 2 && !parts[1].empty())) return (false);
+            }
+            return (true);
+        }
+
+        /**
+         * Returns sql with comments removed and each run of whitespace
+         * outside quotes turned into a single space, without leading
+         * and trailing whitespace or semicolons. Statements which only
+         * differ in their layout normalize to the same text.
+         */
+        inline std::string normalize(const std::string &sql)
+        {
+            std::string out;
+            size_t i = 0;
+            bool space = false;
+
+            while (i < sql.size()) {
+                size_t skip = skipQuoted(sql, i);
+                if (skip != i && sql[i] != '\'' && sql[i] != '"' && sql[i] != '`') {
+                    space = true;
+                    i = skip;
+                } else if (skip != i) {
+                    if (space && !out.empty()) out += ' ';
+                    space = false;
+                    out.append(sql, i, skip - i);
+                    i = skip;
+                } else if (isspace((unsigned char) sql[i])) {
+                    space = true;
+                    i++;
+                } else {
+                    if (space && !out.empty()) out += ' ';
+                    space = false;
+                    out += sql[i++];
+                }
+            }
+            return (trim(out));
+        }
+
+        /**
+         * Returns the names of the tables a statement refers to: the
+         * names following FROM (and the comma separated ones after
+         * it), JOIN, INTO, UPDATE, TABLE and TRUNCATE, at any depth.
+         * They are unquoted, lower case and without their schema, and
+         * each is listed once. Names it cannot see, e.g. those used by
+         * views or functions, are missing; a few it returns may not be
+         * tables at all, e.g. common table expressions.
+         */
+        inline std::vector<std::string> tableNames(const std::string &sql)
+        {
+            static const char *introducers[] = { "FROM", "JOIN", "INTO", "UPDATE", "TABLE", "TRUNCATE" };
+            static const char *skipped[] = { "IF", "NOT", "EXISTS", "ONLY", "LATERAL", "TABLE" };
+            static const char *notNames[] = { "SELECT", "SET", "OF", "NOWAIT", "SKIP", "VALUES", "WITH", "DEFAULT" };
+            std::vector<std::string> out;
+            size_t i = 0;
+
+            // reads a possibly quoted, possibly qualified name at sql[i]
+            auto readName = [&sql](size_t &i) -> std::string {
+                std::string name;
+                for (;;) {
+                    name.clear();
+                    char c = (i < sql.size() ? sql[i] : 0);
+                    if (c == '"' || c == '`' || c == '[') {
+                        char close = (c == '[' ? ']' : c);
+                        size_t end = sql.find(close, i + 1);
+                        if (end == std::string::npos) end = sql.size();
+                        for (size_t j=i+1; j<end; j++) name += (char) tolower((unsigned char) sql[j]);
+                        i = (end < sql.size() ? end + 1 : end);
+                    } else {
+                        while (i < sql.size() && isWordChar(sql[i])) {
+                            name += (char) tolower((unsigned char) sql[i++]);
+                        }
+                    }
+                    if (name.empty() || i >= sql.size() || sql[i] != '.') break;
+                    i++;
+                }
+                return (name);
+            };
+            auto skipSpace = [&sql](size_t &i) {
+                while (i < sql.size()) {
+                    size_t skip = skipQuoted(sql, i);
+                    if (skip != i && sql[i] != '\'' && sql[i] != '"' && sql[i] != '`') i = skip;
+                    else if (isspace((unsigned char) sql[i])) i++;
+                    else break;
+                }
+            };
+            auto isWord = [](const std::string &word, const char * const *list, size_t n) {
+                for (size_t k=0; k<n; k++) {
+                    if (strcasecmp(word.c_str(), list[k]) == 0) return (true);
+                }
+                return (false);
+            };
+
+            while (i < sql.size()) {
+                size_t skip = skipQuoted(sql, i);
+                if (skip != i) {
+                    i = skip;
+                    continue;
+                }
+                if (!isWordChar(sql[i])) {
+                    i++;
+                    continue;
+                }
+                size_t start = i;
+                while (i < sql.size() && isWordChar(sql[i])) i++;
+                std::string word = sql.substr(start, i - start);
+                if (!isWord(word, introducers, 6)) continue;
+
+                bool from = (strcasecmp(word.c_str(), "FROM") == 0);
+                for (;;) {
+                    skipSpace(i);
+                    size_t at = i;
+                    std::string name = readName(i);
+                    while (!name.empty() && isWord(name, skipped, 6)) {
+                        skipSpace(i);
+                        at = i;
+                        name = readName(i);
+                    }
+                    if (name.empty() || isWord(name, notNames, 8) || (at < sql.size() && isdigit((unsigned char) sql[at]))) {
+                        i = at;
+                        break;
+                    }
+                    if (std::find(out.begin(), out.end(), name) == out.end()) out.push_back(name);
+                    if (!from) break;
+
+                    // FROM a [AS] x, b ...: step over an alias to a comma
+                    skipSpace(i);
+                    size_t after = i;
+                    std::string alias = readName(i);
+                    if (strcasecmp(alias.c_str(), "AS") == 0) {
+                        skipSpace(i);
+                        after = i;
+                        alias = readName(i);
+                    }
+                    skipSpace(i);
+                    if (i < sql.size() && sql[i] == ',') {
+                        i++;
+                    } else {
+                        i = after;
+                        break;
+                    }
+                }
+            }
+            return (out);
+        }
+    }
+}; /* namespace */
+
+#endif
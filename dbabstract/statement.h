@@ -0,0 +1,184 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _STATEMENT_H
+#define _STATEMENT_H
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dbabstract/db.h"
+
+namespace dbabstract
+{
+    /**
+     * A statement with '?' placeholders and the values bound to
+     * them. The values are escaped for a particular Connection with
+     * the qstr and unixtime manipulators when toSql() is called, so a
+     * Statement may be built once and run against any driver.
+     *
+     * Placeholders inside quoted strings or identifiers are left
+     * alone.
+     */
+    class Statement
+    {
+    public:
+        Statement(const char *sql) : sql_(sql ? sql : "") {}
+        Statement(const std::string &sql) : sql_(sql) {}
+
+        /**
+         * Binds the next placeholder to a string; a NULL pointer
+         * binds SQL NULL.
+         */
+        Statement &bind(const char *val)
+        {
+            if (!val) return (bindNull());
+            params_.push_back(Param(Param::TEXT, val));
+            return (*this);
+        }
+
+        Statement &bind(const std::string &val)
+        {
+            params_.push_back(Param(Param::TEXT, val));
+            return (*this);
+        }
+
+        Statement &bind(int val) { return (bind((long) val)); }
+
+        Statement &bind(long val)
+        {
+            std::ostringstream ss;
+            ss << val;
+            params_.push_back(Param(Param::NUMBER, ss.str()));
+            return (*this);
+        }
+
+        Statement &bind(double val)
+        {
+            std::ostringstream ss;
+            ss << std::setprecision(17) << val;
+            params_.push_back(Param(Param::NUMBER, ss.str()));
+            return (*this);
+        }
+
+        Statement &bindTime(time_t val)
+        {
+            Param p(Param::TIME, "");
+            p.time = val;
+            params_.push_back(p);
+            return (*this);
+        }
+
+        Statement &bindNull(void)
+        {
+            params_.push_back(Param(Param::NUL, "NULL"));
+            return (*this);
+        }
+
+        /**
+         * Drops the bound values, keeping the SQL.
+         */
+        void clear(void) { params_.clear(); }
+
+        const std::string &sql(void) const { return (sql_); }
+        size_t paramCount(void) const { return (params_.size()); }
+
+        /**
+         * Produces the SQL text with every placeholder replaced by its
+         * value, escaped for conn.
+         *
+         * @return bool False if fewer values than placeholders were bound.
+         */
+        bool toSql(Connection &conn, std::string &out) const
+        {
+            std::ostringstream ss;
+            size_t next = 0;
+            char quote = 0;
+
+            for (size_t i=0; i<sql_.size(); i++) {
+                char c = sql_[i];
+                if (quote) {
+                    if (c == quote) quote = 0;
+                    ss << c;
+                } else if (c == '\'' || c == '"' || c == '`') {
+                    quote = c;
+                    ss << c;
+                } else if (c == '?') {
+                    if (next >= params_.size()) return (false);
+                    const Param &p = params_[next++];
+                    switch (p.type) {
+                    case Param::TEXT:
+                        ss << qstr(conn, p.text);
+                        break;
+                    case Param::TIME:
+                        ss << unixtime(conn, p.time);
+                        break;
+                    default:
+                        ss << p.text;
+                        break;
+                    }
+                } else {
+                    ss << c;
+                }
+            }
+            out = ss.str();
+            return (true);
+        }
+
+        /**
+         * Returns a string identifying the SQL and the bound values,
+         * independent of any Connection; two Statements with equal
+         * keys produce the same query.
+         */
+        std::string key(void) const
+        {
+            std::string k(sql_);
+            for (size_t i=0; i<params_.size(); i++) {
+                k += '\0';
+                k += (char) ('0' + params_[i].type);
+                if (params_[i].type == Param::TIME) {
+                    std::ostringstream ss;
+                    ss << (long) params_[i].time;
+                    k += ss.str();
+                } else {
+                    k += params_[i].text;
+                }
+            }
+            return (k);
+        }
+
+    private:
+        struct Param
+        {
+            enum Type { NUL, TEXT, NUMBER, TIME };
+
+            Param(Type t, const std::string &v) : type(t), text(v), time(0) {}
+
+            Type type;
+            std::string text;
+            time_t time;
+        };
+
+        std::string sql_;
+        std::vector<Param> params_;
+    };
+}; /* namespace */
+
+#endif
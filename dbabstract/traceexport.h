@@ -0,0 +1,382 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _TRACEEXPORT_H
+#define _TRACEEXPORT_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/json.h"
+
+namespace dbabstract
+{
+    /**
+     * Writes the work observed on Connections to a file as spans, to
+     * be loaded next to the traces of the requests which caused it.
+     *
+     * CHROME writes a JSON array of trace events ("ph":"X"), which
+     * chrome://tracing and Perfetto open. OTLP writes one OpenTelemetry
+     * ExportTraceServiceRequest per line (the JSON encoding of OTLP),
+     * as read by the OpenTelemetry Collector's file receiver.
+     *
+     *   TraceFileExporter exporter("db.trace.json");
+     *   Connection::setDefaultObserver(&exporter);
+     *
+     * Every statement, batch of rows fetched, open() and transaction
+     * becomes a span; statements inside a transaction are children of
+     * its span. Spans take the trace and parent span given to
+     * setTraceContext() on the calling thread, so they join the trace
+     * of the request being served.
+     *
+     * Times are wall clock times; a span is placed by its end and its
+     * duration. Streamed rows are reported when their ResultSet is
+     * closed, so a fetch span covers the time spent fetching, ending
+     * at close(). The exporter must outlive the Connections using it.
+     */
+    class TraceFileExporter : public ConnectionObserver
+    {
+    private:
+        TraceFileExporter(const TraceFileExporter &old);
+        const TraceFileExporter &operator=(const TraceFileExporter &old);
+
+    public:
+        enum FORMAT {
+            CHROME, /** Chrome trace event JSON array */
+            OTLP /** OpenTelemetry JSON, one request per line */
+        };
+
+        /**
+         * @param path File to write, replaced if it exists.
+         * @param format
+         * @param service service.name of the OTLP resource.
+         * @param system db.system of every span, e.g. "postgresql".
+         */
+        TraceFileExporter(const char *path, enum FORMAT format = CHROME, const char *service = "dbabstract", const char *system = "other_sql")
+            : format_(format)
+            , service_(service)
+            , system_(system)
+            , events_(0)
+            , random_(std::random_device()())
+        {
+            file_ = fopen(path, "w");
+            if (file_ && format_ == CHROME) fputs("[", file_);
+        }
+
+        ~TraceFileExporter()
+        {
+            if (!file_) return;
+            if (format_ == CHROME) fputs("\n]\n", file_);
+            fclose(file_);
+        }
+
+        bool isOpen(void) const { return (file_ != NULL); }
+
+        /**
+         * Returns the number of spans written.
+         */
+        unsigned long events(void) const { return (events_); }
+
+        void flush(void)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (file_) fflush(file_);
+        }
+
+        /**
+         * Makes the spans of the calling thread part of a trace, until
+         * called again; NULL makes each of them start its own trace.
+         *
+         * @param traceId 32 hex digits, e.g. from a traceparent header.
+         * @param parentSpanId 16 hex digits, or NULL.
+         */
+        static void setTraceContext(const char *traceId, const char *parentSpanId)
+        {
+            context().traceId = (traceId ? traceId : "");
+            context().parentSpanId = (parentSpanId ? parentSpanId : "");
+        }
+
+        void onConnect(Connection *conn, const char *database, const char *host, int port, bool ok, uint64_t ns)
+        {
+            std::string attrs;
+            if (database) attribute(attrs, "db.name", database);
+            if (host) attribute(attrs, "server.address", host);
+            if (port) attribute(attrs, "server.port", (uint64_t) port);
+            span(conn, "connect", attrs, ok, ns);
+        }
+
+        void onDisconnect(Connection *conn)
+        {
+            // an open transaction ends with its connection, and the
+            // next Connection at this address must not inherit it
+            std::lock_guard<std::mutex> lock(mutex_);
+            transactions_.erase(conn);
+        }
+
+        void onQueryEnd(Connection *conn, const char *sql, bool ok, uint64_t ns)
+        {
+            std::string attrs;
+            attribute(attrs, "db.statement", sql);
+            span(conn, operation(sql).c_str(), attrs, ok, ns);
+        }
+
+        void onFetchBatch(Connection *conn, unsigned long rows, uint64_t ns)
+        {
+            std::string attrs;
+            attribute(attrs, "db.response.returned_rows", (uint64_t) rows);
+            span(conn, "fetch", attrs, true, ns);
+        }
+
+        void onTransaction(Connection *conn, enum TRANS_EVENT event, bool ok, uint64_t ns)
+        {
+            uint64_t now = unixNs();
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            if (event == BEGIN) {
+                if (!ok) {
+                    lock.unlock();
+                    std::string attrs;
+                    span(conn, "BEGIN", attrs, false, ns);
+                    return;
+                }
+                Transaction &txn = transactions_[conn];
+                txn.start = now - ns;
+                ids(txn.traceId, txn.parentSpanId);
+                txn.spanId = hex(random_(), 16);
+                return;
+            }
+
+            // without a BEGIN seen, or when a failed COMMIT leaves the
+            // transaction open, the call is a span of its own
+            std::map<Connection *, Transaction>::iterator it = transactions_.find(conn);
+            if (it == transactions_.end() || (!ok && event == COMMIT)) {
+                lock.unlock();
+                std::string attrs;
+                span(conn, (event == COMMIT ? "COMMIT" : "ROLLBACK"), attrs, ok, ns);
+                return;
+            }
+
+            Transaction txn = it->second;
+            transactions_.erase(it);
+            std::string attrs;
+            attribute(attrs, "db.transaction.outcome", (event == COMMIT ? "commit" : "rollback"));
+            write("transaction", txn.traceId, txn.spanId, txn.parentSpanId, txn.start, now, attrs, ok);
+        }
+
+    private:
+        struct Context
+        {
+            std::string traceId;
+            std::string parentSpanId;
+        };
+
+        struct Transaction
+        {
+            uint64_t start;
+            std::string traceId;
+            std::string spanId;
+            std::string parentSpanId;
+        };
+
+        static Context &context(void)
+        {
+            static thread_local Context ctx;
+            return (ctx);
+        }
+
+        static uint64_t unixNs(void)
+        {
+            return ((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+
+        /**
+         * A small number per thread, for the "tid" of trace events.
+         */
+        static unsigned long threadNumber(void)
+        {
+            static std::atomic<unsigned long> next(1);
+            static thread_local unsigned long number = next++;
+            return (number);
+        }
+
+        static std::string hex(uint64_t value, int digits)
+        {
+            static const char *digit = "0123456789abcdef";
+            std::string out(digits, '0');
+            for (int i=digits-1; i>=0 && value; i--, value >>= 4) {
+                out[i] = digit[value & 15];
+            }
+            return (out);
+        }
+
+        /**
+         * The first word of sql, in upper case, names its span.
+         */
+        static std::string operation(const char *sql)
+        {
+            std::string op;
+            while (*sql == ' ' || *sql == '\t' || *sql == '\n' || *sql == '\r' || *sql == '(') sql++;
+            for (; op.size() < 32 && ((*sql >= 'a' && *sql <= 'z') || (*sql >= 'A' && *sql <= 'Z')); sql++) {
+                op += (char) (*sql >= 'a' ? *sql - 'a' + 'A' : *sql);
+            }
+            return (op.empty() ? std::string("query") : op);
+        }
+
+        /**
+         * Attributes are kept as "key", value pairs, and laid out in
+         * write() according to the format.
+         */
+        static void attribute(std::string &attrs, const char *key, const char *value)
+        {
+            attrs += 's';
+            json::appendString(attrs, key);
+            attrs += '\0';
+            json::appendString(attrs, value);
+            attrs += '\0';
+        }
+
+        static void attribute(std::string &attrs, const char *key, uint64_t value)
+        {
+            char buf[24];
+            snprintf(buf, sizeof(buf), "%llu", (unsigned long long) value);
+            attrs += 'i';
+            json::appendString(attrs, key);
+            attrs += '\0';
+            attrs += buf;
+            attrs += '\0';
+        }
+
+        /**
+         * Takes the trace and parent of a new span from the calling
+         * thread, or starts a trace; called with mutex_ held.
+         */
+        void ids(std::string &traceId, std::string &parentSpanId)
+        {
+            const Context &ctx = context();
+            if (ctx.traceId.empty()) {
+                traceId = hex(random_(), 16) + hex(random_(), 16);
+                parentSpanId.clear();
+            } else {
+                traceId = ctx.traceId;
+                parentSpanId = ctx.parentSpanId;
+            }
+        }
+
+        void span(Connection *conn, const char *name, const std::string &attrs, bool ok, uint64_t ns)
+        {
+            uint64_t end = unixNs();
+            std::string all(attrs);
+            if (!ok && conn->errormsg()) attribute(all, "error.message", conn->errormsg());
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::string traceId, parentSpanId;
+            std::map<Connection *, Transaction>::const_iterator txn = transactions_.find(conn);
+            if (txn != transactions_.end()) {
+                traceId = txn->second.traceId;
+                parentSpanId = txn->second.spanId;
+            } else {
+                ids(traceId, parentSpanId);
+            }
+            write(name, traceId, hex(random_(), 16), parentSpanId, end - ns, end, all, ok);
+        }
+
+        /**
+         * Writes one span; called with mutex_ held.
+         */
+        void write(const char *name, const std::string &traceId, const std::string &spanId, const std::string &parentSpanId,
+                   uint64_t start, uint64_t end, const std::string &attrs, bool ok)
+        {
+            if (!file_) return;
+
+            std::string out;
+            char buf[128];
+            if (format_ == CHROME) {
+                out += (events_ ? ",\n" : "\n");
+                out += "{\"name\":";
+                json::appendString(out, name);
+                snprintf(buf, sizeof(buf), ",\"cat\":\"db\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%lu,\"args\":{",
+                         start / 1000.0, (end - start) / 1000.0, (int) getpid(), threadNumber());
+                out += buf;
+                out += "\"trace_id\":\"" + traceId + "\",\"span_id\":\"" + spanId + "\"";
+                if (!ok) out += ",\"error\":true";
+                for (size_t i=0; i<attrs.size(); ) {
+                    size_t key = attrs.find('\0', i + 1);
+                    size_t value = attrs.find('\0', key + 1);
+                    out += ',';
+                    out.append(attrs, i + 1, key - i - 1);
+                    out += ':';
+                    out.append(attrs, key + 1, value - key - 1);
+                    i = value + 1;
+                }
+                out += "}}";
+            } else {
+                out += "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":";
+                json::appendString(out, service_.c_str());
+                out += "}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"dbabstract\"},\"spans\":[{";
+                out += "\"traceId\":\"" + traceId + "\",\"spanId\":\"" + spanId + "\"";
+                if (!parentSpanId.empty()) out += ",\"parentSpanId\":\"" + parentSpanId + "\"";
+                out += ",\"name\":";
+                json::appendString(out, name);
+                snprintf(buf, sizeof(buf), ",\"kind\":3,\"startTimeUnixNano\":\"%llu\",\"endTimeUnixNano\":\"%llu\"",
+                         (unsigned long long) start, (unsigned long long) end);
+                out += buf;
+                out += ",\"attributes\":[{\"key\":\"db.system\",\"value\":{\"stringValue\":";
+                json::appendString(out, system_.c_str());
+                out += "}}";
+                for (size_t i=0; i<attrs.size(); ) {
+                    size_t key = attrs.find('\0', i + 1);
+                    size_t value = attrs.find('\0', key + 1);
+                    out += ",{\"key\":";
+                    out.append(attrs, i + 1, key - i - 1);
+                    // OTLP JSON carries 64-bit integers as strings
+                    out += (attrs[i] == 's' ? ",\"value\":{\"stringValue\":" : ",\"value\":{\"intValue\":\"");
+                    out.append(attrs, key + 1, value - key - 1);
+                    out += (attrs[i] == 's' ? "}}" : "\"}}");
+                    i = value + 1;
+                }
+                out += "],\"status\":{\"code\":";
+                out += (ok ? "1" : "2");
+                out += "}}]}]}]}\n";
+            }
+            fwrite(out.data(), 1, out.size(), file_);
+            events_++;
+        }
+
+        FILE *file_;
+        enum FORMAT format_;
+        std::string service_;
+        std::string system_;
+        std::atomic<unsigned long> events_;
+        std::mt19937_64 random_;
+        std::map<Connection *, Transaction> transactions_;
+        std::mutex mutex_;
+    };
+}; /* namespace */
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _WORKERPOOL_H
+#define _WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dbabstract
+{
+    /**
+     * A fixed set of threads running submitted jobs in FIFO order.
+     * It is used to run statements on drivers which can only block,
+     * such as Sqlite3 and ODBC, and to fan statements out to many
+     * Connection objects at once.
+     */
+    class WorkerPool
+    {
+    private:
+        WorkerPool(const WorkerPool &old);
+        const WorkerPool &operator=(const WorkerPool &old);
+
+    public:
+        explicit WorkerPool(unsigned int threads) : stopping_(false)
+        {
+            if (threads == 0) threads = 1;
+            for (unsigned int i=0; i<threads; i++) {
+                threads_.push_back(std::thread(&WorkerPool::run, this));
+            }
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            cond_.notify_all();
+            for (size_t i=0; i<threads_.size(); i++) {
+                threads_[i].join();
+            }
+        }
+
+        void submit(const std::function<void ()> &job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back(job);
+            }
+            cond_.notify_one();
+        }
+
+        size_t size(void) const { return threads_.size(); }
+
+    private:
+        void run(void)
+        {
+            for (;;) {
+                std::function<void ()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    while (!stopping_ && jobs_.empty()) {
+                        cond_.wait(lock);
+                    }
+                    // drain what was queued before shutting down
+                    if (jobs_.empty()) return;
+                    job = jobs_.front();
+                    jobs_.pop_front();
+                }
+                job();
+            }
+        }
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        std::deque<std::function<void ()> > jobs_;
+        std::vector<std::thread> threads_;
+        bool stopping_;
+    };
+}; /* namespace */
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _WORKLOAD_H
+#define _WORKLOAD_H
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/statement.h"
+
+namespace dbabstract
+{
+    /**
+     * One call of a recorded workload.
+     *
+     * A workload file starts with the line "# dbabstract workload 1"
+     * and has one event per line, its fields separated by tabs:
+     *
+     *   offset_us  connection  kind  [sql  [param ...]]
+     *
+     * offset_us is the time of the call in microseconds from the start
+     * of the recording, and connection numbers the Connection it was
+     * made on. kind is S for a statement, P for a statement with '?'
+     * placeholders followed by its parameters, and B, C or R for
+     * beginTrans(), commitTrans() and rollbackTrans(). A parameter is
+     * N for NULL, or i:, d: or s: followed by an integer, a double or
+     * a string. Backslash, tab and line feed are written \\, \t and
+     * \n inside the SQL and the parameters. Lines starting with # are
+     * comments.
+     */
+    struct WorkloadEvent
+    {
+        enum KIND {
+            STATEMENT = 'S',
+            PREPARED = 'P',
+            BEGIN = 'B',
+            COMMIT = 'C',
+            ROLLBACK = 'R'
+        };
+
+        WorkloadEvent() : offsetUs(0), connection(0), kind(STATEMENT) {}
+
+        uint64_t offsetUs;
+        unsigned long connection;
+        enum KIND kind;
+        std::string sql;
+        std::vector<std::string> params; /** as written in the file */
+
+        /**
+         * Returns the event as a line of a workload file, without the
+         * line feed.
+         */
+        std::string format(void) const
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%llu\t%lu\t%c", (unsigned long long) offsetUs, connection, (char) kind);
+            std::string out(buf);
+            if (kind == STATEMENT || kind == PREPARED) {
+                out += '\t';
+                escape(out, sql);
+                for (size_t i=0; i<params.size(); i++) {
+                    out += '\t';
+                    escape(out, params[i]);
+                }
+            }
+            return (out);
+        }
+
+        /**
+         * Reads a line of a workload file.
+         *
+         * @return bool False if the line is not an event.
+         */
+        bool parse(const std::string &line)
+        {
+            std::vector<std::string> fields;
+            std::string field;
+            for (size_t i=0; i<=line.size(); i++) {
+                if (i == line.size() || line[i] == '\t') {
+                    fields.push_back(field);
+                    field.clear();
+                } else if (line[i] == '\\' && i + 1 < line.size()) {
+                    char c = line[++i];
+                    field += (c == 't' ? '\t' : c == 'n' ? '\n' : c);
+                } else if (line[i] != '\r') {
+                    field += line[i];
+                }
+            }
+            if (fields.size() < 3 || fields[2].size() != 1) return (false);
+
+            char *end;
+            offsetUs = strtoull(fields[0].c_str(), &end, 10);
+            if (*end || fields[0].empty()) return (false);
+            connection = strtoul(fields[1].c_str(), &end, 10);
+            if (*end || fields[1].empty()) return (false);
+
+            switch (fields[2][0]) {
+            case STATEMENT:
+            case PREPARED:
+                if (fields.size() < 4) return (false);
+                kind = (enum KIND) fields[2][0];
+                sql = fields[3];
+                params.assign(fields.begin() + 4, fields.end());
+                return (kind == PREPARED || params.empty());
+            case BEGIN:
+            case COMMIT:
+            case ROLLBACK:
+                kind = (enum KIND) fields[2][0];
+                sql.clear();
+                params.clear();
+                return (fields.size() == 3);
+            }
+            return (false);
+        }
+
+        /**
+         * Binds params to a Statement of sql.
+         *
+         * @return bool False if a parameter is malformed.
+         */
+        bool bind(Statement &stmt) const
+        {
+            for (size_t i=0; i<params.size(); i++) {
+                const std::string &p = params[i];
+                if (p == "N") {
+                    stmt.bindNull();
+                } else if (p.compare(0, 2, "i:") == 0) {
+                    stmt.bind(atol(p.c_str() + 2));
+                } else if (p.compare(0, 2, "d:") == 0) {
+                    stmt.bind(atof(p.c_str() + 2));
+                } else if (p.compare(0, 2, "s:") == 0) {
+                    stmt.bind(p.substr(2));
+                } else {
+                    return (false);
+                }
+            }
+            return (true);
+        }
+
+        static void escape(std::string &out, const std::string &s)
+        {
+            for (size_t i=0; i<s.size(); i++) {
+                if (s[i] == '\\') out += "\\\\";
+                else if (s[i] == '\t') out += "\\t";
+                else if (s[i] == '\n') out += "\\n";
+                else out += s[i];
+            }
+        }
+    };
+
+    /**
+     * Reads a workload file into events, ordered by their offset.
+     *
+     * @param bad Receives the number of the first malformed line, if
+     *            any; it is 0 otherwise.
+     *
+     * @return bool False if the file cannot be read or a line is
+     *              malformed.
+     */
+    inline bool loadWorkload(const char *path, std::vector<WorkloadEvent> &events, unsigned long *bad = NULL)
+    {
+        std::ifstream in(path);
+        if (bad) *bad = 0;
+        if (!in) return (false);
+
+        events.clear();
+        std::string line;
+        for (unsigned long n=1; std::getline(in, line); n++) {
+            if (line.empty() || line[0] == '#') continue;
+            WorkloadEvent ev;
+            if (!ev.parse(line)) {
+                if (bad) *bad = n;
+                return (false);
+            }
+            events.push_back(ev);
+        }
+        // calls on one connection keep their order
+        std::stable_sort(events.begin(), events.end(),
+                         [](const WorkloadEvent &a, const WorkloadEvent &b) { return (a.offsetUs < b.offsetUs); });
+        return (true);
+    }
+
+    /**
+     * Records the statements and transactions of the Connections it
+     * observes to a workload file, for dba_loadgen to replay:
+     *
+     *   WorkloadRecorder recorder("app.workload");
+     *   Connection::setDefaultObserver(&recorder);
+     *
+     * Statements are recorded as run, with their values in the SQL.
+     * Each observed Connection gets a number of its own, in the order
+     * they are first seen; one opened again after close() gets a new
+     * number. Writing takes a lock, and the file is
+     * written through a buffer; it is complete once the recorder is
+     * deleted or flush() returns. The recorder must outlive the
+     * Connections using it.
+     */
+    class WorkloadRecorder : public ConnectionObserver
+    {
+    private:
+        WorkloadRecorder(const WorkloadRecorder &old);
+        const WorkloadRecorder &operator=(const WorkloadRecorder &old);
+
+    public:
+        /**
+         * @param path File to write, replaced if it exists.
+         */
+        WorkloadRecorder(const char *path)
+            : started_(std::chrono::steady_clock::now())
+            , lastConnection_(0)
+            , events_(0)
+        {
+            file_ = fopen(path, "w");
+            if (file_) fputs("# dbabstract workload 1\n", file_);
+        }
+
+        ~WorkloadRecorder()
+        {
+            if (file_) fclose(file_);
+        }
+
+        bool isOpen(void) const { return (file_ != NULL); }
+
+        unsigned long events(void) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return (events_);
+        }
+
+        void flush(void)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (file_) fflush(file_);
+        }
+
+        void onQueryStart(Connection *conn, const char *sql)
+        {
+            WorkloadEvent ev;
+            ev.kind = WorkloadEvent::STATEMENT;
+            ev.sql = sql;
+            record(conn, ev, std::chrono::steady_clock::now());
+        }
+
+        void onTransaction(Connection *conn, enum TRANS_EVENT event, bool, uint64_t ns)
+        {
+            WorkloadEvent ev;
+            ev.kind = (event == BEGIN ? WorkloadEvent::BEGIN : event == COMMIT ? WorkloadEvent::COMMIT : WorkloadEvent::ROLLBACK);
+            // reported once done; record when it was called
+            record(conn, ev, std::chrono::steady_clock::now() - std::chrono::nanoseconds(ns));
+        }
+
+        void onDisconnect(Connection *conn)
+        {
+            // its address may be reused by the next Connection
+            std::lock_guard<std::mutex> lock(mutex_);
+            connections_.erase(conn);
+        }
+
+    private:
+        void record(Connection *conn, WorkloadEvent &ev, std::chrono::steady_clock::time_point at)
+        {
+            ev.offsetUs = (at > started_ ? std::chrono::duration_cast<std::chrono::microseconds>(at - started_).count() : 0);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!file_) return;
+            std::map<Connection *, unsigned long>::iterator it = connections_.find(conn);
+            if (it == connections_.end()) {
+                it = connections_.insert(std::make_pair(conn, ++lastConnection_)).first;
+            }
+            ev.connection = it->second;
+            std::string line = ev.format();
+            line += '\n';
+            fwrite(line.data(), 1, line.size(), file_);
+            events_++;
+        }
+
+        FILE *file_;
+        std::chrono::steady_clock::time_point started_;
+        std::map<Connection *, unsigned long> connections_;
+        unsigned long lastConnection_;
+        unsigned long events_;
+        mutable std::mutex mutex_;
+    };
+}; /* namespace */
+
+#endif
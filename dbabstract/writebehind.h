@@ -0,0 +1,356 @@
+/*
+ * A database abstraction layer for C++ and ACE framework
+ *
+ * (C) 2006-2014 Thralling Penguin LLC. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _WRITEBEHIND_H
+#define _WRITEBEHIND_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+#include "dbabstract/db.h"
+
+namespace dbabstract
+{
+    /**
+     * Collects statements from many threads and writes them on a
+     * dedicated Connection in batches, one transaction per batch, so
+     * that many small writes share a single commit.
+     *
+     * A batch is committed when it holds maxBatch statements, or
+     * maxDelayMs after its first statement arrived. If a statement in
+     * the batch fails, the batch is rolled back and its statements are
+     * run again one at a time, so one bad statement does not fail the
+     * others.
+     *
+     * Statements wait in a fixed-size ring. Submitting does not take a
+     * lock; when the ring is full, submit() either waits for space
+     * (BLOCK) or gives up and counts the statement as dropped (DROP).
+     *
+     * The callback given with a statement is called on the writer
+     * thread once the statement is committed (true) or has failed
+     * (false). It must not submit to the same queue while the ring may
+     * be full with the BLOCK policy.
+     */
+    class WriteBehindQueue
+    {
+    private:
+        WriteBehindQueue(const WriteBehindQueue &old);
+        const WriteBehindQueue &operator=(const WriteBehindQueue &old);
+
+    public:
+        typedef std::function<Connection *(void)> Factory;
+        typedef std::function<void (bool durable)> Callback;
+
+        enum POLICY {
+            BLOCK, /** submit() waits for space in the ring */
+            DROP /** submit() fails when the ring is full */
+        };
+
+        /**
+         * @param factory Creates and opens the writer's Connection; it
+         *                is called on the writer thread.
+         * @param capacity Statements the ring holds, rounded up to a
+         *                 power of two.
+         * @param maxBatch Statements committed together at most.
+         * @param maxDelayMs How long a batch waits to fill up.
+         * @param policy What submit() does when the ring is full.
+         */
+        WriteBehindQueue(const Factory &factory, size_t capacity = 4096, size_t maxBatch = 256, long maxDelayMs = 5, enum POLICY policy = BLOCK)
+            : factory_(factory)
+            , maxBatch_(maxBatch ? maxBatch : 1)
+            , maxDelayMs_(maxDelayMs)
+            , policy_(policy)
+            , cells_(ringSize(capacity))
+            , mask_(cells_.size() - 1)
+            , enqueuePos_(0)
+            , dequeuePos_(0)
+            , sleeping_(false)
+            , stopping_(false)
+            , completed_(0)
+            , committed_(0)
+            , failed_(0)
+            , dropped_(0)
+            , batches_(0)
+        {
+            for (size_t i=0; i<cells_.size(); i++) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            thread_ = std::thread(&WriteBehindQueue::run, this);
+        }
+
+        /**
+         * Writes out every statement already submitted, then closes
+         * the Connection.
+         */
+        ~WriteBehindQueue()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            ready_.notify_one();
+            space_.notify_all();
+            thread_.join();
+        }
+
+        /**
+         * Queues sql to be written.
+         *
+         * @return bool False if the statement was dropped, or the
+         *              queue is being destroyed.
+         */
+        bool submit(const std::string &sql, const Callback &done = Callback())
+        {
+            if (stopping_) {
+                dropped_++;
+                return (false);
+            }
+            while (!tryPush(sql, done)) {
+                if (policy_ == DROP || stopping_) {
+                    dropped_++;
+                    return (false);
+                }
+                std::unique_lock<std::mutex> lock(mutex_);
+                space_.wait_for(lock, std::chrono::milliseconds(1));
+            }
+            // pairs with the fence in waitForItems()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ready_.notify_one();
+            }
+            return (true);
+        }
+
+        /**
+         * Waits until every statement submitted before the call has
+         * been committed or has failed.
+         */
+        void flush(void)
+        {
+            uint64_t ticket = enqueuePos_.load();
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.notify_one();
+            done_.wait(lock, [this, ticket]() { return (completed_ >= ticket); });
+        }
+
+        unsigned long committed(void) const { return (committed_); }
+        unsigned long failed(void) const { return (failed_); }
+        unsigned long dropped(void) const { return (dropped_); }
+        unsigned long batches(void) const { return (batches_); }
+
+        /**
+         * Returns the number of statements waiting in the ring.
+         */
+        size_t pending(void) const
+        {
+            return ((size_t) (enqueuePos_.load() - completed_.load()));
+        }
+
+    private:
+        struct Item
+        {
+            std::string sql;
+            Callback done;
+        };
+
+        struct Cell
+        {
+            Cell() : sequence(0) {}
+
+            std::atomic<uint64_t> sequence;
+            Item item;
+        };
+
+        static size_t ringSize(size_t capacity)
+        {
+            size_t size = 2;
+            while (size < capacity) size <<= 1;
+            return (size);
+        }
+
+        /**
+         * Claims the next slot of the ring (Vyukov's bounded queue).
+         * A slot is free for position pos when its sequence equals
+         * pos, and holds an item for the consumer at pos + 1.
+         */
+        bool tryPush(const std::string &sql, const Callback &done)
+        {
+            uint64_t pos = enqueuePos_.load(std::memory_order_relaxed);
+            Cell *cell;
+            for (;;) {
+                cell = &cells_[pos & mask_];
+                uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+                int64_t diff = (int64_t) seq - (int64_t) pos;
+                if (diff == 0) {
+                    if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else if (diff < 0) {
+                    return (false);
+                } else {
+                    pos = enqueuePos_.load(std::memory_order_relaxed);
+                }
+            }
+            cell->item.sql = sql;
+            cell->item.done = done;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return (true);
+        }
+
+        bool tryPop(Item &item)
+        {
+            Cell *cell = &cells_[dequeuePos_ & mask_];
+            if (cell->sequence.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+                return (false);
+            }
+            item.sql.swap(cell->item.sql);
+            item.done.swap(cell->item.done);
+            cell->item.done = Callback();
+            cell->sequence.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+            dequeuePos_++;
+            return (true);
+        }
+
+        /**
+         * Sleeps until an item arrives, the deadline passes or the
+         * queue stops. Producers only take the lock to wake us while
+         * sleeping_ is set.
+         */
+        void waitForItems(const std::chrono::steady_clock::time_point *deadline)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (cells_[dequeuePos_ & mask_].sequence.load(std::memory_order_acquire) != dequeuePos_ + 1 && !stopping_) {
+                if (deadline) ready_.wait_until(lock, *deadline);
+                else ready_.wait(lock);
+            }
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+
+        void run(void)
+        {
+            Connection *conn = NULL;
+            std::vector<Item> batch;
+
+            for (;;) {
+                Item item;
+                if (!tryPop(item)) {
+                    if (stopping_ && enqueuePos_.load() == dequeuePos_) break;
+                    waitForItems(NULL);
+                    continue;
+                }
+
+                batch.push_back(Item());
+                batch.back().sql.swap(item.sql);
+                batch.back().done.swap(item.done);
+                std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(maxDelayMs_);
+
+                while (batch.size() < maxBatch_) {
+                    if (tryPop(item)) {
+                        batch.push_back(Item());
+                        batch.back().sql.swap(item.sql);
+                        batch.back().done.swap(item.done);
+                        continue;
+                    }
+                    // a claimed but unpublished slot, or an empty ring
+                    if (stopping_ && enqueuePos_.load() == dequeuePos_) break;
+                    if (std::chrono::steady_clock::now() >= deadline) break;
+                    waitForItems(&deadline);
+                }
+                space_.notify_all();
+
+                if (!conn) conn = factory_();
+                write(conn, batch);
+                batch.clear();
+            }
+
+            if (conn) conn->release();
+        }
+
+        void write(Connection *conn, std::vector<Item> &batch)
+        {
+            std::vector<bool> results(batch.size(), false);
+
+            if (conn) {
+                bool ok = conn->beginTrans();
+                for (size_t i=0; ok && i<batch.size(); i++) {
+                    ok = conn->execute(batch[i].sql.c_str());
+                }
+                if (ok) ok = conn->commitTrans();
+
+                if (ok) {
+                    results.assign(batch.size(), true);
+                } else {
+                    conn->rollbackTrans();
+                    // find the bad statements, committing the others one by one
+                    for (size_t i=0; i<batch.size(); i++) {
+                        results[i] = conn->execute(batch[i].sql.c_str());
+                    }
+                }
+            }
+            batches_++;
+
+            for (size_t i=0; i<batch.size(); i++) {
+                if (results[i]) committed_++;
+                else failed_++;
+                if (batch[i].done) batch[i].done(results[i]);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                completed_ += batch.size();
+            }
+            done_.notify_all();
+        }
+
+        Factory factory_;
+        size_t maxBatch_;
+        long maxDelayMs_;
+        enum POLICY policy_;
+
+        std::vector<Cell> cells_;
+        uint64_t mask_;
+        std::atomic<uint64_t> enqueuePos_;
+        uint64_t dequeuePos_;
+
+        std::atomic<bool> sleeping_;
+        std::atomic<bool> stopping_;
+        std::atomic<uint64_t> completed_;
+        std::atomic<unsigned long> committed_;
+        std::atomic<unsigned long> failed_;
+        std::atomic<unsigned long> dropped_;
+        std::atomic<unsigned long> batches_;
+
+        std::thread thread_;
+        std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+        std::condition_variable done_;
+    };
+}; /* namespace */
+
+#endif
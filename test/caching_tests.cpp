@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/caching.h"
+
+static std::vector<std::string> names(const char *a, const char *b = NULL, const char *c = NULL) {
+    std::vector<std::string> v;
+    if (a) v.push_back(a);
+    if (b) v.push_back(b);
+    if (c) v.push_back(c);
+    return (v);
+}
+
+static dbabstract::MaterializedResult result(const char *value) {
+    dbabstract::MaterializedResult::Builder builder(names("v"));
+    builder.addRow(&value);
+    return (builder.build());
+}
+
+TEST(QueryCacheTest, FindsTableNames) {
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("SELECT * FROM config WHERE k = 'from x'"), names("config"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("select a.v from public.\"Config\" a, rates AS r JOIN `zones` z ON z.id = r.zone"), names("config", "rates", "zones"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("SELECT v FROM t WHERE id IN (SELECT id FROM u)"), names("t", "u"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("INSERT INTO t (a) SELECT a FROM u"), names("t", "u"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("UPDATE t SET a = 1"), names("t"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("DELETE FROM t WHERE a = 1"), names("t"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("CREATE TABLE IF NOT EXISTS t (a INT)"), names("t"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("TRUNCATE TABLE t"), names("t"));
+    EXPECT_EQ(dbabstract::sqlscan::tableNames("SELECT 1"), names(NULL));
+
+    EXPECT_EQ(dbabstract::sqlscan::normalize("  SELECT  *\n FROM t -- note\n WHERE a = 'x  y' ;"), "SELECT * FROM t WHERE a = 'x  y'");
+    EXPECT_EQ(dbabstract::QueryCache::key(dbabstract::Statement("SELECT  ?").bind(1)),
+              dbabstract::QueryCache::key(dbabstract::Statement("SELECT ?").bind(1)));
+    EXPECT_NE(dbabstract::QueryCache::key(dbabstract::Statement("SELECT ?").bind(1)),
+              dbabstract::QueryCache::key(dbabstract::Statement("SELECT ?").bind(2)));
+    EXPECT_EQ(dbabstract::QueryCache::key(dbabstract::Statement("SELECT 1 ")), dbabstract::QueryCache::key("SELECT 1"));
+}
+
+TEST(QueryCacheTest, EvictsExpiresAndInvalidates) {
+    dbabstract::QueryCache cache(4096, std::chrono::milliseconds(60000), 1);
+    dbabstract::MaterializedResult r;
+
+    uint64_t since = cache.clock();
+    for (int i=0; i<64; i++) {
+        EXPECT_EQ(cache.put("k" + std::to_string(i), names("t"), result("value"), since), true);
+    }
+    EXPECT_EQ(cache.get("k0", r), false);
+    EXPECT_EQ(cache.get("k63", r), true);
+    EXPECT_STREQ(r.value(0, 0), "value");
+    dbabstract::QueryCache::Stats s = cache.stats();
+    EXPECT_GT(s.evictions, 0u);
+    EXPECT_LE(s.bytes, 4096u);
+    EXPECT_EQ(s.entries + s.evictions, 64u);
+
+    EXPECT_EQ(cache.put("other", names("u"), result("x"), since), true);
+    cache.invalidate("Public.T");
+    EXPECT_EQ(cache.get("k63", r), false);
+    EXPECT_EQ(cache.get("other", r), true);
+    EXPECT_EQ(cache.stats().entries, 1u);
+
+    // read before the invalidation: refused
+    EXPECT_EQ(cache.put("k1", names("t"), result("old"), since), false);
+    EXPECT_EQ(cache.put("k1", names("t"), result("new"), cache.clock()), true);
+
+    EXPECT_EQ(cache.put("short", names(NULL), result("x"), cache.clock(), std::chrono::milliseconds(1)), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_EQ(cache.get("short", r), false);
+    EXPECT_EQ(cache.stats().expirations, 1u);
+
+    cache.invalidateAll();
+    EXPECT_EQ(cache.stats().entries, 0u);
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class CachingTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            remove(path);
+            direct = create_sqlite3_connection();
+            EXPECT_EQ(direct->open(path, NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(direct->execute("CREATE TABLE config (k VARCHAR(16) PRIMARY KEY, v VARCHAR(16), n INT)"), true);
+            EXPECT_EQ(direct->execute("INSERT INTO config VALUES ('a', '1', 10)"), true);
+            EXPECT_EQ(direct->execute("INSERT INTO config VALUES ('b', 'true', NULL)"), true);
+
+            dbabstract::Connection *conn = create_sqlite3_connection();
+            EXPECT_EQ(conn->open(path, NULL, 0, NULL, NULL), true);
+            caching = new dbabstract::CachingConnection(conn, &cache);
+        }
+
+        virtual void TearDown() {
+            caching->release();
+            direct->release();
+            remove(path);
+        }
+
+        static std::string value(dbabstract::Connection *conn, const char *sql) {
+            dbabstract::ResultSet *rs = conn->executeQuery(sql);
+            if (!rs) return ("(failed)");
+            std::string v = (rs->next() ? rs->getString(0) : "(none)");
+            while (rs->next()) {}
+            rs->close();
+            return (v);
+        }
+
+        static const char *path;
+        dbabstract::QueryCache cache;
+        dbabstract::Connection *direct;
+        dbabstract::CachingConnection *caching;
+};
+
+const char *CachingTest::path = "caching_tests.db";
+
+TEST_F(CachingTest, HitsReplayTheResult) {
+    const char *sql = "SELECT k, v, n FROM config ORDER BY k";
+    dbabstract::ResultSet *rs = caching->executeQuery(sql);
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    while (rs->next()) {}
+    rs->close();
+    EXPECT_EQ(cache.stats().fills, 1u);
+
+    // changed behind its back: the cached copy is returned
+    EXPECT_EQ(direct->execute("UPDATE config SET v = '2' WHERE k = 'a'"), true);
+    rs = caching->executeQuery("SELECT  k, v, n\nFROM config ORDER BY k");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    EXPECT_EQ(cache.stats().hits, 1u);
+    EXPECT_EQ(rs->columnCount(), 3u);
+    EXPECT_EQ(rs->recordCount(), 2u);
+    EXPECT_STREQ(rs->columnName(1), "v");
+    EXPECT_EQ(rs->findColumn("n"), 2u);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->getString(1), "1");
+    EXPECT_EQ(rs->getInteger(2), 10);
+    EXPECT_EQ(rs->getLong(2), 10L);
+    EXPECT_EQ(rs->getDouble(2), 10.0);
+    EXPECT_EQ(rs->getBool(1), true);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_EQ(rs->getString(2), (const char *) NULL);
+    EXPECT_EQ(rs->getInteger(2), 0);
+    EXPECT_EQ(rs->getBool(1), true);
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+
+    // a write through the cache invalidates the table
+    EXPECT_EQ(caching->execute("UPDATE config SET n = 11 WHERE k = 'a'"), true);
+    EXPECT_EQ(value(caching, sql), "a");
+    EXPECT_EQ(cache.stats().invalidations, 1u);
+    rs = caching->executeQuery(sql);
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->getString(1), "2");
+    rs->close();
+}
+
+TEST_F(CachingTest, StatementsAreKeyedByTheirValues) {
+    dbabstract::Statement stmt("SELECT v FROM config WHERE k = ?");
+    dbabstract::ResultSet *rs = caching->executeQuery(dbabstract::Statement(stmt).bind("a"));
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->getString(0), "1");
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+
+    rs = caching->executeQuery(dbabstract::Statement(stmt).bind("b"));
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->getString(0), "true");
+    rs->close(); // closed early: not stored
+
+    rs = caching->executeQuery(dbabstract::Statement(stmt).bind("a"));
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    rs->close();
+    dbabstract::QueryCache::Stats s = cache.stats();
+    EXPECT_EQ(s.hits, 1u);
+    EXPECT_EQ(s.misses, 2u);
+    EXPECT_EQ(s.entries, 1u);
+}
+
+TEST_F(CachingTest, TransactionsBypassTheCache) {
+    EXPECT_EQ(value(caching, "SELECT v FROM config WHERE k = 'a'"), "1");
+
+    EXPECT_EQ(caching->beginTrans(), true);
+    EXPECT_EQ(caching->execute("UPDATE config SET v = '3' WHERE k = 'a'"), true);
+    EXPECT_EQ(value(caching, "SELECT v FROM config WHERE k = 'a'"), "3");
+    EXPECT_EQ(caching->commitTrans(), true);
+    EXPECT_EQ(cache.stats().hits, 0u);
+
+    EXPECT_EQ(value(caching, "SELECT v FROM config WHERE k = 'a'"), "3");
+    EXPECT_EQ(value(caching, "SELECT v FROM config WHERE k = 'a'"), "3");
+    EXPECT_EQ(cache.stats().hits, 1u);
+
+    EXPECT_EQ(value(caching, "SELECT 1"), "1");
+    EXPECT_EQ(cache.stats().entries, 2u);
+    EXPECT_EQ(caching->execute("INSERT INTO config VALUES ('c', '4', 0)"), true);
+    EXPECT_EQ(cache.stats().entries, 1u);
+
+    // writes it cannot attribute to tables drop everything
+    EXPECT_EQ(caching->execute("REINDEX config"), true);
+    EXPECT_EQ(cache.stats().entries, 0u);
+}
+
+TEST_F(CachingTest, FailuresAreNotCached) {
+    EXPECT_EQ(value(caching, "SELECT v FROM later"), "(failed)");
+    EXPECT_EQ(cache.stats().entries, 0u);
+
+    // created behind its back: nothing stale stands in the way
+    EXPECT_EQ(direct->execute("CREATE TABLE later (v VARCHAR(16))"), true);
+    EXPECT_EQ(direct->execute("INSERT INTO later VALUES ('5')"), true);
+    EXPECT_EQ(value(caching, "SELECT v FROM later"), "5");
+    dbabstract::QueryCache::Stats s = cache.stats();
+    EXPECT_EQ(s.hits, 0u);
+    EXPECT_EQ(s.misses, 2u);
+    EXPECT_EQ(s.fills, 1u);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/catalog.h"
+
+TEST(CatalogTest, ClassifiesDeclaredTypes) {
+    typedef dbabstract::CatalogColumn C;
+    EXPECT_EQ(C::typeOf("INTEGER"), C::INTEGER);
+    EXPECT_EQ(C::typeOf("bigint"), C::INTEGER);
+    EXPECT_EQ(C::typeOf("int(11) unsigned"), C::INTEGER);
+    EXPECT_EQ(C::typeOf("character varying"), C::TEXT);
+    EXPECT_EQ(C::typeOf("VARCHAR(32)"), C::TEXT);
+    EXPECT_EQ(C::typeOf("bytea"), C::BLOB);
+    EXPECT_EQ(C::typeOf("double precision"), C::REAL);
+    EXPECT_EQ(C::typeOf("numeric(10,2)"), C::NUMERIC);
+    EXPECT_EQ(C::typeOf("boolean"), C::BOOLEAN);
+    EXPECT_EQ(C::typeOf("tinyint(1)"), C::BOOLEAN);
+    EXPECT_EQ(C::typeOf("timestamp without time zone"), C::DATETIME);
+    EXPECT_EQ(C::typeOf("interval"), C::OTHER);
+    EXPECT_EQ(C::typeOf("point"), C::OTHER);
+    EXPECT_EQ(C::typeOf(""), C::OTHER);
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class CatalogDbTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            connection = create_sqlite3_connection();
+            EXPECT_EQ(connection->open(":memory:", NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(connection->execute("CREATE TABLE users (id INTEGER PRIMARY KEY, email VARCHAR(64) NOT NULL UNIQUE, born DATETIME, score REAL)"), true);
+            EXPECT_EQ(connection->execute("CREATE TABLE grants (user_id INTEGER NOT NULL, role TEXT NOT NULL, granted BOOLEAN, PRIMARY KEY (role, user_id))"), true);
+            EXPECT_EQ(connection->execute("CREATE INDEX grants_by_user ON grants (user_id, granted)"), true);
+            connection->setObserver(&catalog);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+        }
+
+        dbabstract::Catalog catalog;
+        dbabstract::Connection *connection;
+};
+
+TEST_F(CatalogDbTest, ReadsColumnsKeysAndIndexes) {
+    std::shared_ptr<const dbabstract::CatalogTable> users = catalog.table(*connection, "Users");
+    ASSERT_TRUE(users.get() != NULL);
+    EXPECT_EQ(users->name, "users");
+    ASSERT_EQ(users->columns.size(), 4u);
+    EXPECT_EQ(users->columns[0].name, "id");
+    EXPECT_EQ(users->columns[0].type, dbabstract::CatalogColumn::INTEGER);
+    EXPECT_EQ(users->columns[0].primaryKey, 1u);
+    EXPECT_EQ(users->columns[1].declared, "VARCHAR(64)");
+    EXPECT_EQ(users->columns[1].type, dbabstract::CatalogColumn::TEXT);
+    EXPECT_EQ(users->columns[1].nullable, false);
+    EXPECT_EQ(users->column("BORN")->type, dbabstract::CatalogColumn::DATETIME);
+    EXPECT_EQ(users->column("born")->nullable, true);
+    EXPECT_EQ(users->column("score")->type, dbabstract::CatalogColumn::REAL);
+    EXPECT_EQ(users->column("missing"), (const dbabstract::CatalogColumn *) NULL);
+    EXPECT_EQ(users->primaryKey, std::vector<std::string>(1, "id"));
+    ASSERT_EQ(users->indexes.size(), 1u);
+    EXPECT_EQ(users->indexes[0].unique, true);
+    EXPECT_EQ(users->indexes[0].columns, std::vector<std::string>(1, "email"));
+
+    std::shared_ptr<const dbabstract::CatalogTable> grants = catalog.table(*connection, "grants");
+    ASSERT_TRUE(grants.get() != NULL);
+    std::vector<std::string> pk;
+    pk.push_back("role");
+    pk.push_back("user_id");
+    EXPECT_EQ(grants->primaryKey, pk);
+    EXPECT_EQ(grants->column("user_id")->primaryKey, 2u);
+    EXPECT_EQ(grants->column("granted")->type, dbabstract::CatalogColumn::BOOLEAN);
+    ASSERT_EQ(grants->indexes.size(), 2u);
+    for (size_t i=0; i<grants->indexes.size(); i++) {
+        const dbabstract::CatalogIndex &index = grants->indexes[i];
+        if (index.name == "grants_by_user") {
+            EXPECT_EQ(index.unique, false);
+            EXPECT_EQ(index.primary, false);
+            ASSERT_EQ(index.columns.size(), 2u);
+            EXPECT_EQ(index.columns[1], "granted");
+        } else {
+            EXPECT_EQ(index.primary, true);
+            EXPECT_EQ(index.columns, pk);
+        }
+    }
+
+    EXPECT_EQ(catalog.table(*connection, "extras").get(), (const dbabstract::CatalogTable *) NULL);
+}
+
+TEST_F(CatalogDbTest, CachesUntilTheSchemaChanges) {
+    std::vector<std::string> tables = catalog.tables(*connection);
+    ASSERT_EQ(tables.size(), 2u);
+    EXPECT_EQ(tables[0], "grants");
+    EXPECT_EQ(tables[1], "users");
+
+    unsigned long queries = catalog.queries();
+    EXPECT_EQ(catalog.tables(*connection).size(), 2u);
+    std::shared_ptr<const dbabstract::CatalogTable> users = catalog.table(*connection, "users");
+    EXPECT_EQ(catalog.table(*connection, "extras").get(), (const dbabstract::CatalogTable *) NULL);
+    EXPECT_EQ(catalog.queries(), queries);
+
+    // plain statements leave it alone
+    EXPECT_EQ(connection->execute("INSERT INTO users (email) VALUES ('a@b')"), true);
+    EXPECT_EQ(catalog.table(*connection, "users"), users);
+
+    EXPECT_EQ(connection->execute("ALTER TABLE users ADD COLUMN nick VARCHAR(16)"), true);
+    EXPECT_EQ(catalog.table(*connection, "grants")->columns.size(), 3u);
+    EXPECT_EQ(catalog.queries(), queries); // only users was forgotten
+    std::shared_ptr<const dbabstract::CatalogTable> altered = catalog.table(*connection, "users");
+    ASSERT_TRUE(altered.get() != NULL);
+    EXPECT_NE(altered, users);
+    EXPECT_EQ(altered->columns.size(), 5u);
+    EXPECT_EQ(users->columns.size(), 4u); // still usable by those holding it
+    EXPECT_GT(catalog.queries(), queries);
+
+    EXPECT_EQ(connection->execute("CREATE TABLE extras (a INT)"), true);
+    ASSERT_TRUE(catalog.table(*connection, "extras").get() != NULL);
+    EXPECT_EQ(catalog.tables(*connection).size(), 3u);
+
+    EXPECT_EQ(connection->execute("CREATE INDEX extras_a ON extras (a)"), true);
+    EXPECT_EQ(catalog.table(*connection, "extras")->indexes.size(), 1u);
+
+    EXPECT_EQ(connection->execute("DROP TABLE extras"), true);
+    EXPECT_EQ(catalog.table(*connection, "extras").get(), (const dbabstract::CatalogTable *) NULL);
+
+    // changes made elsewhere need an explicit invalidation
+    EXPECT_EQ(catalog.table(*connection, "grants")->columns.size(), 3u);
+    connection->setObserver(NULL);
+    EXPECT_EQ(connection->execute("ALTER TABLE grants ADD COLUMN note TEXT"), true);
+    EXPECT_EQ(catalog.table(*connection, "grants")->columns.size(), 3u);
+    catalog.invalidate("GRANTS");
+    EXPECT_EQ(catalog.table(*connection, "grants")->columns.size(), 4u);
+    catalog.invalidateAll();
+    EXPECT_EQ(catalog.tables(*connection).size(), 2u);
+}
+
+#endif
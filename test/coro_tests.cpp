@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/coro.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+static dbabstract::Connection *
+open_memory(void)
+{
+    dbabstract::Connection *c = create_sqlite3_connection();
+    if (!c->open(":memory:", NULL, 0, NULL, NULL)) {
+        c->release();
+        return (NULL);
+    }
+    return (c);
+}
+
+class CoroutineTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            connection = open_memory();
+        }
+
+        virtual void TearDown() {
+            connection->release();
+        }
+
+        dbabstract::Executor executor;
+        dbabstract::Connection * connection;
+};
+
+static dbabstract::Task<int>
+sum_rows(dbabstract::Executor &ex, dbabstract::Connection *c)
+{
+    dbabstract::AsyncConnection conn(ex, c);
+
+    if (!co_await conn.execute("CREATE TABLE testing (num INTEGER)")) co_return -1;
+    for (int i=1; i<=4; i++) {
+        if (!co_await conn.execute("INSERT INTO testing VALUES (" + std::to_string(i) + ")")) co_return -1;
+    }
+
+    dbabstract::AsyncResultSet rs = co_await conn.query("SELECT num FROM testing ORDER BY num");
+    if (!rs) co_return -1;
+
+    int sum = 0;
+    while (co_await rs.next()) {
+        sum += rs.getInteger(0);
+    }
+    rs.close();
+    co_return sum;
+}
+
+TEST_F(CoroutineTest, QueryAndIterate) {
+    EXPECT_EQ(executor.syncWait(sum_rows(executor, connection)), 10);
+}
+
+static dbabstract::Task<bool>
+bad_query(dbabstract::Executor &ex, dbabstract::Connection *c)
+{
+    dbabstract::AsyncConnection conn(ex, c);
+    dbabstract::AsyncResultSet rs = co_await conn.query("SELECT sjot frm fs");
+    co_return (bool) rs;
+}
+
+TEST_F(CoroutineTest, FailedQueryIsEmpty) {
+    EXPECT_EQ(executor.syncWait(bad_query(executor, connection)), false);
+}
+
+static dbabstract::Task<void>
+sleeper(dbabstract::Executor &ex, std::vector<int> &order, int id, long ms)
+{
+    co_await ex.sleep(ms);
+    order.push_back(id);
+}
+
+static dbabstract::Task<void>
+two_sleepers(dbabstract::Executor &ex, std::vector<int> &order)
+{
+    ex.spawn(sleeper(ex, order, 2, 30));
+    co_await sleeper(ex, order, 1, 5);
+    co_await ex.sleep(60);
+}
+
+TEST_F(CoroutineTest, SleepInterleaves) {
+    std::vector<int> order;
+    executor.syncWait(two_sleepers(executor, order));
+    ASSERT_EQ(order.size(), 2u);
+    EXPECT_EQ(order[0], 1);
+    EXPECT_EQ(order[1], 2);
+}
+
+static dbabstract::Task<void>
+borrow(dbabstract::Executor &ex, dbabstract::AsyncPool &pool, std::vector<int> &order, int id)
+{
+    dbabstract::Connection *c = co_await pool.acquire();
+    order.push_back(id);
+    co_await ex.sleep(10);
+    order.push_back(id);
+    pool.release(c);
+}
+
+static dbabstract::Task<void>
+contend(dbabstract::Executor &ex, dbabstract::AsyncPool &pool, std::vector<int> &order)
+{
+    ex.spawn(borrow(ex, pool, order, 1));
+    co_await borrow(ex, pool, order, 2);
+    co_await ex.sleep(20);
+}
+
+TEST_F(CoroutineTest, PoolAcquireWaitsForRelease) {
+    dbabstract::ConnectionPool pool(open_memory, 1);
+    dbabstract::AsyncPool apool(executor, pool);
+    std::vector<int> order;
+
+    executor.syncWait(contend(executor, apool, order));
+    // with a single Connection the two borrowers cannot overlap
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order[0], order[1]);
+    EXPECT_EQ(order[2], order[3]);
+    EXPECT_EQ(pool.size(), 1u);
+    EXPECT_EQ(pool.idle(), 1u);
+}
+
+TEST_F(CoroutineTest, PoolFailedCreateServesWaiter) {
+    std::atomic<int> calls(0);
+    std::atomic<bool> waiting(false);
+    dbabstract::ConnectionPool pool([&]() -> dbabstract::Connection * {
+        if (calls++ == 0) {
+            // fail once the other thread is queued behind this one
+            while (!waiting) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return (NULL);
+        }
+        return (open_memory());
+    }, 1);
+
+    dbabstract::Connection *waited = NULL;
+    std::thread other([&]() {
+        while (calls == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        waiting = true;
+        waited = pool.acquire(2000);
+    });
+    EXPECT_EQ(pool.acquire(), (dbabstract::Connection *) NULL);
+    other.join();
+    ASSERT_NE(waited, (dbabstract::Connection *) NULL);
+    EXPECT_EQ(calls, 2);
+    pool.release(waited);
+    EXPECT_EQ(pool.size(), 1u);
+}
+
+#endif
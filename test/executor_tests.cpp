@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <future>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/executor.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+static dbabstract::Connection *
+open_file(void)
+{
+    dbabstract::Connection *c = create_sqlite3_connection();
+    if (!c->open("executor.db", NULL, 0, NULL, NULL)) {
+        c->release();
+        return (NULL);
+    }
+    return (c);
+}
+
+class ExecutorTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            unlink("executor.db");
+            connection = open_file();
+            EXPECT_EQ(connection->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY AUTOINCREMENT, text VARCHAR(128), num INTEGER)"), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+            unlink("executor.db");
+        }
+
+        dbabstract::Connection * connection;
+};
+
+TEST_F(ExecutorTest, StatementBindsAndEscapes) {
+    dbabstract::Statement stmt("SELECT ? , '?', ?, ?");
+    stmt.bind("be'nden").bind(42L).bindNull();
+    std::string sql;
+    EXPECT_EQ(stmt.toSql(*connection, sql), true);
+    EXPECT_EQ(sql, "SELECT 'be''nden' , '?', 42, NULL");
+
+    dbabstract::Statement missing("SELECT ?, ?");
+    missing.bind(1);
+    EXPECT_EQ(missing.toSql(*connection, sql), false);
+}
+
+TEST_F(ExecutorTest, QueryReturnsMaterializedRows) {
+    dbabstract::QueryExecutor ex(open_file, 2);
+
+    EXPECT_EQ(ex.execute(dbabstract::Statement("INSERT INTO testing (text, num) VALUES (?, ?)").bind("benden").bind(42)).get().ok(), true);
+    EXPECT_EQ(ex.execute("INSERT INTO testing (num) VALUES (7)").get().ok(), true);
+
+    dbabstract::MaterializedResult r = ex.query("SELECT text, num FROM testing ORDER BY id").get();
+    ASSERT_EQ(r.ok(), true);
+    EXPECT_EQ(r.columnCount(), 2u);
+    EXPECT_STREQ(r.columnName(1), "num");
+    ASSERT_EQ(r.rowCount(), 2u);
+    EXPECT_STREQ(r.value(0, 0), "benden");
+    EXPECT_EQ(r.value(1, 0), (const char *) NULL);
+
+    dbabstract::ResultSet *rs = r.cursor();
+    EXPECT_EQ(rs->next(), true);
+    EXPECT_EQ(rs->getInteger(1), 42);
+    EXPECT_EQ(rs->next(), true);
+    EXPECT_EQ(rs->getString(0), (const char *) NULL);
+    EXPECT_EQ(rs->getInteger(0), 0);
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+}
+
+TEST_F(ExecutorTest, FailureCarriesError) {
+    dbabstract::QueryExecutor ex(open_file, 1);
+    dbabstract::MaterializedResult r = ex.query("SELECT sjot frm fs").get();
+    EXPECT_EQ(r.ok(), false);
+}
+
+class Gate {
+    public:
+        dbabstract::Connection *open(void) {
+            opened.set_value();
+            release.get_future().wait();
+            return (open_file());
+        }
+
+        std::promise<void> opened;
+        std::promise<void> release;
+};
+
+TEST_F(ExecutorTest, HigherPriorityRunsFirst) {
+    Gate gate;
+    std::future<void> opened = gate.opened.get_future();
+    dbabstract::QueryExecutor ex([&gate]() { return gate.open(); }, 1);
+
+    // the worker takes this job, then blocks opening its Connection
+    std::future<dbabstract::MaterializedResult> first = ex.execute("INSERT INTO testing (text) VALUES ('first')");
+    opened.wait();
+
+    std::future<dbabstract::MaterializedResult> low = ex.execute("INSERT INTO testing (text) VALUES ('low')", 0);
+    std::future<dbabstract::MaterializedResult> high = ex.execute("INSERT INTO testing (text) VALUES ('high')", 10);
+    gate.release.set_value();
+    low.get();
+
+    dbabstract::MaterializedResult r = ex.query("SELECT text FROM testing ORDER BY id").get();
+    ASSERT_EQ(r.rowCount(), 3u);
+    EXPECT_STREQ(r.value(0, 0), "first");
+    EXPECT_STREQ(r.value(1, 0), "high");
+    EXPECT_STREQ(r.value(2, 0), "low");
+}
+
+TEST_F(ExecutorTest, BoundedQueueRejects) {
+    Gate gate;
+    std::future<void> opened = gate.opened.get_future();
+    dbabstract::QueryExecutor ex([&gate]() { return gate.open(); }, 1, 1);
+
+    std::future<dbabstract::MaterializedResult> f1 = ex.execute("SELECT 1");
+    opened.wait();
+
+    std::future<dbabstract::MaterializedResult> f2, f3;
+    EXPECT_EQ(ex.tryExecute("SELECT 2", f2), true);
+    EXPECT_EQ(ex.tryExecute("SELECT 3", f3), false);
+    EXPECT_EQ(ex.queued(), 1u);
+
+    gate.release.set_value();
+    EXPECT_EQ(f2.get().ok(), true);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "dbabstract/fingerprint.h"
+
+static std::string
+fp(const char *sql)
+{
+    std::string out;
+    dbabstract::sqlscan::fingerprint(sql, out);
+    return (out);
+}
+
+TEST(FingerprintTest, ReplacesLiterals) {
+    EXPECT_EQ(fp("SELECT * FROM t WHERE id = 42 AND name = 'it''s'"), "select * from t where id = ? and name = ?");
+    EXPECT_EQ(fp("UPDATE t SET a = -1.5e-3, b = x'0F', c = E'\\'' WHERE d = $1"), "update t set a = ?, b = ?, c = ? where d = ?");
+    EXPECT_EQ(fp("SELECT a-1, b >= -.5 FROM t"), "select a - ?, b >= ? from t");
+    EXPECT_EQ(fp("SELECT \"Mixed\".`col` FROM t"), "select \"Mixed\".`col` from t");
+}
+
+TEST(FingerprintTest, IgnoresLayout) {
+    EXPECT_EQ(fp("select  *\n FROM t -- note\n WHERE a=1 /* hint */;"), "select * from t where a = ?");
+    EXPECT_EQ(dbabstract::sqlscan::fingerprint("SELECT * FROM t WHERE a = 1"),
+              dbabstract::sqlscan::fingerprint("select * from T where A=2 ;"));
+    EXPECT_NE(dbabstract::sqlscan::fingerprint("SELECT * FROM t WHERE a = 1"),
+              dbabstract::sqlscan::fingerprint("SELECT * FROM t WHERE b = 1"));
+}
+
+TEST(FingerprintTest, CollapsesLists) {
+    EXPECT_EQ(fp("SELECT * FROM t WHERE id IN (1, 2, 3)"), "select * from t where id in (...)");
+    EXPECT_EQ(fp("SELECT * FROM t WHERE id in ('a')"), "select * from t where id in (...)");
+    EXPECT_EQ(fp("SELECT * FROM t WHERE id IN (SELECT id FROM u)"), "select * from t where id in (select id from u)");
+    EXPECT_EQ(fp("INSERT INTO t (a, b) VALUES (1, 'x'), (2, 'y'), (3, 'z')"), "insert into t (a, b) values (?, ?)");
+    EXPECT_EQ(fp("INSERT INTO t VALUES (1, 2), (3)"), "insert into t values (?, ?), (?)");
+}
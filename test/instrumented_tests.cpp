@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/instrumented.h"
+
+TEST(LatencyHistogramTest, BucketsAreContiguous) {
+    for (size_t i=0; i+1<dbabstract::LatencyHistogram::BUCKETS; i++) {
+        EXPECT_EQ(dbabstract::LatencyHistogram::bucketOf(dbabstract::LatencyHistogram::lowestOf(i)), i);
+        EXPECT_EQ(dbabstract::LatencyHistogram::bucketOf(dbabstract::LatencyHistogram::highestOf(i)), i);
+    }
+    EXPECT_EQ(dbabstract::LatencyHistogram::bucketOf(UINT64_MAX), (size_t) dbabstract::LatencyHistogram::BUCKETS - 1);
+}
+
+TEST(LatencyHistogramTest, PercentilesWithinPrecision) {
+    dbabstract::LatencyHistogram h;
+    for (uint64_t v=1; v<=100000; v++) {
+        h.record(v * 1000);
+    }
+    EXPECT_EQ(h.count(), 100000u);
+    EXPECT_EQ(h.min(), 1000u);
+    EXPECT_EQ(h.max(), 100000000u);
+    EXPECT_NEAR((double) h.percentile(50), 50000000.0, 50000000.0 / 32);
+    EXPECT_NEAR((double) h.percentile(99), 99000000.0, 99000000.0 / 32);
+    EXPECT_NEAR((double) h.percentile(99.9), 99900000.0, 99900000.0 / 32);
+    EXPECT_EQ(h.percentile(100), h.max());
+
+    dbabstract::LatencyHistogram other;
+    other.record(5, 10);
+    h.merge(other);
+    EXPECT_EQ(h.count(), 100010u);
+    EXPECT_EQ(h.min(), 5u);
+    EXPECT_EQ(h.percentile(0), 5u);
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class InstrumentedTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            connection = new dbabstract::InstrumentedConnection(create_sqlite3_connection());
+            EXPECT_EQ(connection->open(":memory:", NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(connection->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY, text VARCHAR(16))"), true);
+            EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (1, 'abc')"), true);
+            EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (22, 'defgh')"), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+        }
+
+        dbabstract::InstrumentedConnection * connection;
+};
+
+TEST_F(InstrumentedTest, CountsRowsAndBytes) {
+    connection->setCountingBytes(true);
+    dbabstract::ResultSet *rs = connection->executeQuery("SELECT id, text FROM testing ORDER BY id");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    while (rs->next()) {}
+    rs->close();
+
+    dbabstract::InstrumentedStats::Snapshot s = connection->snapshot();
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::EXECUTE].count(), 3u);
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::QUERY].count(), 1u);
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::FIRST_ROW].count(), 1u);
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::FETCH].count(), 1u);
+    EXPECT_EQ(s.resultSets, 1u);
+    EXPECT_EQ(s.rows, 2u);
+    EXPECT_EQ(s.bytes, 11u);
+    EXPECT_EQ(s.errorCount(), 0u);
+
+    connection->setCountingBytes(false);
+    rs = connection->executeQuery("SELECT id, text FROM testing ORDER BY id");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    while (rs->next()) {}
+    rs->close();
+    s = connection->snapshot();
+    EXPECT_EQ(s.rows, 4u);
+    EXPECT_EQ(s.bytes, 11u);
+}
+
+TEST_F(InstrumentedTest, CountsErrorsByCode) {
+    EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (1, 'again')"), false);
+    unsigned int code = connection->errorno();
+    EXPECT_EQ(connection->executeQuery("SELECT * FROM missing"), (dbabstract::ResultSet *) NULL);
+
+    dbabstract::InstrumentedStats::Snapshot s = connection->snapshot();
+    EXPECT_EQ(s.errorCount(), 2u);
+    EXPECT_GE(s.errors[code], 1u);
+}
+
+TEST_F(InstrumentedTest, TimesTransactions) {
+    EXPECT_EQ(connection->beginTrans(), true);
+    EXPECT_EQ(connection->execute("DELETE FROM testing"), true);
+    EXPECT_EQ(connection->rollbackTrans(), true);
+    EXPECT_EQ(connection->beginTrans(), true);
+    EXPECT_EQ(connection->commitTrans(), true);
+
+    dbabstract::InstrumentedStats::Snapshot s = connection->snapshot();
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::TRANSACTION].count(), 2u);
+    EXPECT_EQ(s.commits, 1u);
+    EXPECT_EQ(s.rollbacks, 1u);
+}
+
+TEST_F(InstrumentedTest, GroupsByFingerprint) {
+    connection->setFingerprinting(true);
+    for (int i=0; i<3; i++) {
+        std::ostringstream sql;
+        sql << "SELECT text FROM testing WHERE id = " << i;
+        dbabstract::ResultSet *rs = connection->executeQuery(sql.str().c_str());
+        ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+        while (rs->next()) {}
+        rs->close();
+    }
+    EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (1, 'x')"), false);
+
+    dbabstract::InstrumentedStats::Snapshot s = connection->snapshot();
+    ASSERT_EQ(s.statements.size(), 2u);
+    const dbabstract::InstrumentedStats::StatementTotals &select = s.statements[dbabstract::sqlscan::fingerprint("SELECT text FROM testing WHERE id = 7")];
+    EXPECT_EQ(select.text, "select text from testing where id = ?");
+    EXPECT_EQ(select.calls, 3u);
+    EXPECT_EQ(select.rows, 1u);
+    EXPECT_EQ(select.errors, 0u);
+    EXPECT_EQ(s.statements[dbabstract::sqlscan::fingerprint("INSERT INTO testing VALUES (2, 'y')")].errors, 1u);
+}
+
+TEST_F(InstrumentedTest, ThreadsShareStats) {
+    std::shared_ptr<dbabstract::InstrumentedStats> stats(new dbabstract::InstrumentedStats);
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; t++) {
+        threads.push_back(std::thread([stats]() {
+            dbabstract::Connection *conn = new dbabstract::InstrumentedConnection(create_sqlite3_connection(), stats);
+            conn->open(":memory:", NULL, 0, NULL, NULL);
+            for (int i=0; i<100; i++) {
+                conn->execute("SELECT 1");
+            }
+            conn->release();
+        }));
+    }
+    for (size_t t=0; t<threads.size(); t++) {
+        threads[t].join();
+    }
+
+    dbabstract::InstrumentedStats::Snapshot s = stats->snapshot();
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::EXECUTE].count(), 400u);
+
+    s.merge(connection->snapshot());
+    EXPECT_EQ(s.timers[dbabstract::InstrumentedStats::EXECUTE].count(), 403u);
+}
+
+#endif
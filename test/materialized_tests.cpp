@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/materialized.h"
+
+TEST(MaterializedTest, KeepsValuesAndNulls) {
+    std::vector<std::string> columns;
+    for (int i=0; i<10; i++) columns.push_back("c" + std::to_string(i));
+    dbabstract::MaterializedResult::Builder builder(columns);
+    const char *row1[] = { "a", NULL, "", "ccc", NULL, "e", "f", "g", NULL, "j" };
+    const char *row2[] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, "last" };
+    builder.addRow(row1);
+    builder.addRow(row2);
+    dbabstract::MaterializedResult r = builder.build();
+
+    ASSERT_EQ(r.rowCount(), 2u);
+    ASSERT_EQ(r.columnCount(), 10u);
+    for (unsigned int i=0; i<10; i++) {
+        if (row1[i]) EXPECT_STREQ(r.value(0, i), row1[i]);
+        else EXPECT_EQ(r.value(0, i), (const char *) NULL);
+    }
+    EXPECT_EQ(r.value(1, 8), (const char *) NULL);
+    EXPECT_STREQ(r.value(1, 9), "last");
+    EXPECT_GT(r.bytes(), 0u);
+
+    // the builder starts over
+    dbabstract::MaterializedResult empty = builder.build();
+    EXPECT_EQ(empty.rowCount(), 0u);
+    EXPECT_EQ(empty.columnCount(), 10u);
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+TEST(MaterializedTest, MaterializeOutlivesTheConnection) {
+    dbabstract::Connection *conn = create_sqlite3_connection();
+    ASSERT_EQ(conn->open(":memory:", NULL, 0, NULL, NULL), true);
+    EXPECT_EQ(conn->execute("CREATE TABLE t (id INTEGER, name VARCHAR(16), at DATETIME)"), true);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (1, 'one', '2014-01-02 03:04:05')"), true);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (2, NULL, NULL)"), true);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (3, 'three', NULL)"), true);
+
+    dbabstract::ResultSet *rs = conn->executeQuery("SELECT id, name, at FROM t ORDER BY id");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    ASSERT_EQ(rs->next(), true); // already read rows are not included
+    dbabstract::MaterializedResultSet *m = rs->materialize();
+    rs->close();
+    conn->release();
+
+    EXPECT_EQ(m->recordCount(), 2u);
+    EXPECT_EQ(m->columnCount(), 3u);
+    EXPECT_EQ(m->findColumn("name"), 1u);
+    EXPECT_EQ(m->row(), -1);
+    ASSERT_EQ(m->next(), true);
+    EXPECT_EQ(m->getInteger(0), 2);
+    EXPECT_EQ(m->getString(1), (const char *) NULL);
+    ASSERT_EQ(m->next(), true);
+    EXPECT_STREQ(m->getString(1), "three");
+    EXPECT_EQ(m->next(), false);
+    EXPECT_EQ(m->getString(0), (const char *) NULL);
+
+    m->rewind();
+    ASSERT_EQ(m->next(), true);
+    EXPECT_EQ(m->getLong(0), 2L);
+    EXPECT_EQ(m->seek(1), true);
+    EXPECT_EQ(m->row(), 1);
+    EXPECT_EQ(m->getShort(0), 3);
+    EXPECT_EQ(m->seek(2), false);
+    EXPECT_EQ(m->next(), false);
+    EXPECT_EQ(m->seek(0), true);
+    EXPECT_EQ(m->getDouble(0), 2.0);
+
+    // other threads read the same rows through their own cursors
+    std::vector<dbabstract::MaterializedResultSet *> shared;
+    for (int i=0; i<4; i++) shared.push_back(m->share());
+    m->close();
+    std::vector<long> sums(shared.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<shared.size(); i++) {
+        threads.push_back(std::thread([&shared, &sums, i]() {
+            for (int pass=0; pass<100; pass++) {
+                shared[i]->rewind();
+                while (shared[i]->next()) sums[i] += shared[i]->getLong(0);
+            }
+            shared[i]->close();
+        }));
+    }
+    for (size_t i=0; i<threads.size(); i++) threads[i].join();
+    for (size_t i=0; i<sums.size(); i++) EXPECT_EQ(sums[i], 500L);
+}
+
+#endif
@@ -104,6 +104,32 @@ TEST_F(DefaultTest, VersionString) {
     EXPECT_EQ(correct, true);
 }
 
+TEST_F(DefaultTest, RunsBatches) {
+    dbabstract::ResultSet *rs = connection->executeBatch(
+        "CREATE TEMPORARY TABLE batch (n INT); INSERT INTO batch VALUES (1),(2); SELECT n FROM batch ORDER BY n; SELECT COUNT(*) FROM batch");
+    ASSERT_NE(rs, (dbabstract::ResultSet*)NULL);
+    EXPECT_EQ(rs->columnCount(), 0u);
+    EXPECT_EQ(rs->next(), false);
+    ASSERT_EQ(rs->nextResult(), true);
+    EXPECT_EQ(rs->recordCount(), 2u);
+    ASSERT_EQ(rs->nextResult(), true);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_EQ(rs->getInteger(0), 1);
+    // the unread row is skipped
+    ASSERT_EQ(rs->nextResult(), true);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_EQ(rs->getLong(0), 2L);
+    EXPECT_EQ(rs->nextResult(), false);
+    rs->close();
+
+    // closed early; the connection is still in sync
+    rs = connection->executeBatch("SELECT 1; SELECT 2; SELECT 3");
+    ASSERT_NE(rs, (dbabstract::ResultSet*)NULL);
+    rs->close();
+    EXPECT_EQ(connection->execute("SELECT 4; DROP TEMPORARY TABLE batch"), true);
+    EXPECT_EQ(connection->executeBatch("SELEC 1; SELECT 2"), (dbabstract::ResultSet*)NULL);
+}
+
 class TransactionTest : public ::testing::Test {
     protected:
         virtual void SetUp() {
@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/instrumented.h"
+#include "dbabstract/traceexport.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class CountingObserver : public dbabstract::ConnectionObserver
+{
+public:
+    CountingObserver() : connects(0), disconnects(0), starts(0), ends(0), failures(0), batches(0), rows(0), begins(0), commits(0), rollbacks(0) {}
+
+    void onConnect(dbabstract::Connection *, const char *, const char *, int, bool, uint64_t) { connects++; }
+    void onDisconnect(dbabstract::Connection *) { disconnects++; }
+    void onQueryStart(dbabstract::Connection *, const char *) { starts++; }
+    void onQueryEnd(dbabstract::Connection *, const char *sql, bool ok, uint64_t)
+    {
+        ends++;
+        if (!ok) failures++;
+        last = sql;
+    }
+    void onFetchBatch(dbabstract::Connection *, unsigned long count, uint64_t)
+    {
+        batches++;
+        rows += count;
+    }
+    void onTransaction(dbabstract::Connection *, enum TRANS_EVENT event, bool, uint64_t)
+    {
+        if (event == BEGIN) begins++;
+        if (event == COMMIT) commits++;
+        if (event == ROLLBACK) rollbacks++;
+    }
+
+    int connects, disconnects, starts, ends, failures, batches;
+    unsigned long rows;
+    int begins, commits, rollbacks;
+    std::string last;
+};
+
+class ObserverTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            connection = create_sqlite3_connection();
+            EXPECT_EQ(connection->open(":memory:", NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(connection->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY, text VARCHAR(16))"), true);
+            EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (1, 'abc')"), true);
+            EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (22, 'defgh')"), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+        }
+
+        static std::string read(const char *path) {
+            std::ifstream in(path);
+            std::stringstream ss;
+            ss << in.rdbuf();
+            return (ss.str());
+        }
+
+        dbabstract::Connection * connection;
+};
+
+TEST_F(ObserverTest, ReportsStatementsRowsAndTransactions) {
+    CountingObserver observer;
+    EXPECT_EQ(connection->observer(), (dbabstract::ConnectionObserver *) NULL);
+    connection->setObserver(&observer);
+
+    dbabstract::ResultSet *rs = connection->executeQuery("SELECT id, text FROM testing");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    while (rs->next()) {}
+    rs->close();
+    EXPECT_EQ(observer.batches, 1);
+    EXPECT_EQ(observer.rows, 2u);
+
+    EXPECT_EQ(connection->beginTrans(), true);
+    EXPECT_EQ(connection->execute("DELETE FROM testing"), true);
+    EXPECT_EQ(connection->rollbackTrans(), true);
+    EXPECT_EQ(connection->execute("SELECT * FROM missing"), false);
+
+    // BEGIN and ROLLBACK are reported as the transaction only
+    EXPECT_EQ(observer.starts, 3);
+    EXPECT_EQ(observer.ends, 3);
+    EXPECT_EQ(observer.failures, 1);
+    EXPECT_EQ(observer.last, "SELECT * FROM missing");
+    EXPECT_EQ(observer.begins, 1);
+    EXPECT_EQ(observer.rollbacks, 1);
+
+    connection->setObserver(NULL);
+    EXPECT_EQ(connection->execute("SELECT 1"), true);
+    EXPECT_EQ(observer.ends, 3);
+}
+
+TEST_F(ObserverTest, DefaultObserverAndDecorators) {
+    CountingObserver observer;
+    dbabstract::Connection::setDefaultObserver(&observer);
+    dbabstract::Connection *conn = create_sqlite3_connection();
+    dbabstract::Connection::setDefaultObserver(NULL);
+
+    EXPECT_EQ(conn->open(":memory:", NULL, 0, NULL, NULL), true);
+    EXPECT_EQ(conn->execute("SELECT 1"), true);
+    EXPECT_EQ(observer.connects, 1);
+    EXPECT_EQ(observer.ends, 1);
+    conn->release();
+    EXPECT_EQ(observer.disconnects, 1);
+
+    CountingObserver other;
+    dbabstract::InstrumentedConnection *wrapped = new dbabstract::InstrumentedConnection(create_sqlite3_connection());
+    wrapped->setObserver(&other);
+    EXPECT_EQ(wrapped->open(":memory:", NULL, 0, NULL, NULL), true);
+    EXPECT_EQ(wrapped->execute("SELECT 1"), true);
+    EXPECT_EQ(wrapped->connection()->observer(), &other);
+    EXPECT_EQ(other.connects, 1);
+    EXPECT_EQ(other.ends, 1);
+    wrapped->release();
+}
+
+TEST_F(ObserverTest, ExportsChromeTraceEvents) {
+    const char *path = "observer_tests.trace.json";
+    {
+        dbabstract::TraceFileExporter exporter(path);
+        ASSERT_EQ(exporter.isOpen(), true);
+        connection->setObserver(&exporter);
+
+        EXPECT_EQ(connection->beginTrans(), true);
+        EXPECT_EQ(connection->execute("UPDATE testing SET text = 'say \"hi\"' WHERE id = 1"), true);
+        EXPECT_EQ(connection->commitTrans(), true);
+        dbabstract::ResultSet *rs = connection->executeQuery("select * from testing");
+        ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+        while (rs->next()) {}
+        rs->close();
+        connection->setObserver(NULL);
+        EXPECT_EQ(exporter.events(), 4u);
+    }
+
+    std::string trace = read(path);
+    remove(path);
+    EXPECT_EQ(trace.substr(0, 2), "[\n");
+    EXPECT_EQ(trace.substr(trace.size() - 3), "\n]\n");
+    EXPECT_NE(trace.find("\"name\":\"UPDATE\",\"cat\":\"db\",\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(trace.find("\"db.statement\":\"UPDATE testing SET text = 'say \\\"hi\\\"' WHERE id = 1\""), std::string::npos);
+    EXPECT_NE(trace.find("\"name\":\"transaction\""), std::string::npos);
+    EXPECT_NE(trace.find("\"name\":\"SELECT\""), std::string::npos);
+    EXPECT_NE(trace.find("\"db.response.returned_rows\":2"), std::string::npos);
+}
+
+TEST_F(ObserverTest, ExportsOtlpSpansInTraceContext) {
+    const char *path = "observer_tests.otlp.json";
+    const char *traceId = "4bf92f3577b34da6a3ce929d0e0e4736";
+    {
+        dbabstract::TraceFileExporter exporter(path, dbabstract::TraceFileExporter::OTLP, "tests", "sqlite");
+        connection->setObserver(&exporter);
+        dbabstract::TraceFileExporter::setTraceContext(traceId, "00f067aa0ba902b7");
+
+        EXPECT_EQ(connection->beginTrans(), true);
+        EXPECT_EQ(connection->execute("DELETE FROM testing WHERE id = 1"), true);
+        EXPECT_EQ(connection->commitTrans(), true);
+        EXPECT_EQ(connection->execute("SELECT * FROM missing"), false);
+
+        dbabstract::TraceFileExporter::setTraceContext(NULL, NULL);
+        connection->setObserver(NULL);
+    }
+
+    std::vector<std::string> lines;
+    std::istringstream in(read(path));
+    remove(path);
+    for (std::string line; std::getline(in, line); ) {
+        lines.push_back(line);
+        EXPECT_EQ(line.compare(0, 16, "{\"resourceSpans\""), 0);
+        EXPECT_NE(line.find(std::string("\"traceId\":\"") + traceId + "\""), std::string::npos);
+        EXPECT_NE(line.find("{\"key\":\"db.system\",\"value\":{\"stringValue\":\"sqlite\"}}"), std::string::npos);
+    }
+    ASSERT_EQ(lines.size(), 3u);
+
+    // the DELETE is a child of the transaction, which is a child of
+    // the caller's span
+    size_t at = lines[1].find("\"spanId\":\"");
+    ASSERT_NE(at, std::string::npos);
+    std::string txnSpan = lines[1].substr(at + 10, 16);
+    EXPECT_NE(lines[0].find("\"parentSpanId\":\"" + txnSpan + "\""), std::string::npos);
+    EXPECT_NE(lines[1].find("\"parentSpanId\":\"00f067aa0ba902b7\""), std::string::npos);
+    EXPECT_NE(lines[1].find("\"stringValue\":\"commit\""), std::string::npos);
+    EXPECT_NE(lines[2].find("\"status\":{\"code\":2}"), std::string::npos);
+    EXPECT_NE(lines[2].find("\"error.message\""), std::string::npos);
+}
+
+TEST_F(ObserverTest, ClosingEndsTheTraceOfATransaction) {
+    const char *path = "observer_tests.reopen.json";
+    {
+        dbabstract::TraceFileExporter exporter(path, dbabstract::TraceFileExporter::OTLP, "tests", "sqlite");
+        connection->setObserver(&exporter);
+        dbabstract::TraceFileExporter::setTraceContext("4bf92f3577b34da6a3ce929d0e0e4736", "00f067aa0ba902b7");
+
+        EXPECT_EQ(connection->beginTrans(), true);
+        EXPECT_EQ(connection->close(), true);
+        EXPECT_EQ(connection->open(":memory:", NULL, 0, NULL, NULL), true);
+        EXPECT_EQ(connection->execute("SELECT 1"), true);
+
+        dbabstract::TraceFileExporter::setTraceContext(NULL, NULL);
+        connection->setObserver(NULL);
+    }
+
+    std::string trace = read(path);
+    remove(path);
+    size_t select = trace.find("\"name\":\"SELECT\"");
+    ASSERT_NE(select, std::string::npos);
+    size_t line = trace.rfind('\n', select);
+    std::string span = trace.substr(line == std::string::npos ? 0 : line + 1);
+    EXPECT_NE(span.substr(0, span.find('\n')).find("\"parentSpanId\":\"00f067aa0ba902b7\""), std::string::npos);
+}
+
+#endif
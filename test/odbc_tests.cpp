@@ -3,6 +3,8 @@
 #include <iostream>
 #include <string>
 #include <strstream>
+#include <thread>
+#include <vector>
 
 #include "dbabstract/db.h"
 
@@ -63,6 +65,27 @@ TEST_F(ODBCDefaultTest, VersionString) {
     EXPECT_EQ(correct, true);
 }
 
+TEST(ODBCPoolingTest, ConnectsInParallel) {
+    std::vector<std::thread> workers;
+    std::vector<int> opened(4, 0);
+    for (int i=0; i<4; i++) {
+        workers.push_back(std::thread([i, &opened]() {
+            // the second round takes its connection from the pool
+            for (int round=0; round<2; round++) {
+                dbabstract::Connection *c = create_odbc_connection();
+                dbabstract::ConnectionOptions o("DSN=test_db", "127.0.0.1", 3306, "root", "");
+                o.set("pooling", i != 0);
+                if (c->open(o) && c->execute("SELECT 1")) opened[i]++;
+                c->release();
+            }
+        }));
+    }
+    for (size_t i=0; i<workers.size(); i++) {
+        workers[i].join();
+    }
+    EXPECT_EQ(opened, std::vector<int>(4, 2));
+}
+
 class ODBCTransactionTest : public ::testing::Test {
     protected:
         virtual void SetUp() {
@@ -138,6 +161,32 @@ TEST_F(ODBCTransactionTest, DoubleSelect) {
     rs->close();
 }
 
+TEST_F(ODBCTransactionTest, NestedQueries) {
+    EXPECT_EQ(connection->execute("INSERT INTO testing (text,fl) VALUES ('outer',1)"), true);
+    EXPECT_EQ(connection->commitTrans(), true);
+
+    dbabstract::ResultSet *rs = connection->executeQuery("SELECT * FROM testing");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->getString(2), "outer");
+    // tables() and the inner cursors leave the outer one alone; the
+    // second run of the same text is prepared
+    EXPECT_EQ(connection->tables().empty(), false);
+    for (int i=0; i<2; i++) {
+        dbabstract::ResultSet *inner = connection->executeQuery("SELECT COUNT(*) FROM testing");
+        ASSERT_NE(inner, (dbabstract::ResultSet *) NULL);
+        ASSERT_EQ(inner->next(), true);
+        EXPECT_EQ(inner->getLong(1), 1l);
+        inner->close();
+    }
+    EXPECT_STREQ(rs->getString(2), "outer");
+    EXPECT_EQ(rs->getInteger(4), 1);
+    rs->close();
+
+    EXPECT_EQ(connection->executeQuery("SELECT nothing FROM testing"), (dbabstract::ResultSet *) NULL);
+    EXPECT_NE(connection->errormsg(), (const char *) NULL);
+}
+
 TEST_F(ODBCTransactionTest, QueryString) {
     connection->setTransactionMode(dbabstract::Connection::READ_UNCOMMITTED);
     connection->setTransactionMode(dbabstract::Connection::READ_COMMITTED);
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "dbabstract/db.h"
+
+TEST(ConnectionOptionsTest, ParsesUrls) {
+    dbabstract::ConnectionOptions o;
+    std::string error;
+    ASSERT_EQ(dbabstract::ConnectionOptions::parse("pq://app:p%40ss@db.example.com:6432/orders?keepalives=1&target_session_attrs=read-write&sslmode", o, error), true) << error;
+    EXPECT_STREQ(o.get("driver"), "pq");
+    EXPECT_STREQ(o.get("user"), "app");
+    EXPECT_STREQ(o.get("password"), "p@ss");
+    EXPECT_STREQ(o.get("host"), "db.example.com");
+    EXPECT_EQ(o.getLong("port", 0), 6432L);
+    EXPECT_STREQ(o.get("database"), "orders");
+    EXPECT_EQ(o.getBool("keepalives", false), true);
+    EXPECT_STREQ(o.get("target_session_attrs"), "read-write");
+    EXPECT_EQ(o.getBool("sslmode", false), true);
+
+    ASSERT_EQ(dbabstract::ConnectionOptions::parse("sqlite3:////var/lib/app.db?journal_mode=wal", o, error), true) << error;
+    EXPECT_STREQ(o.get("database"), "/var/lib/app.db");
+    EXPECT_EQ(o.get("host"), (const char *) NULL);
+    EXPECT_STREQ(o.get("journal_mode"), "wal");
+
+    ASSERT_EQ(dbabstract::ConnectionOptions::parse("mysql://[::1]:3306/", o, error), true) << error;
+    EXPECT_STREQ(o.get("host"), "::1");
+    EXPECT_EQ(o.has("database"), false);
+
+    EXPECT_EQ(dbabstract::ConnectionOptions::parse("localhost/db", o, error), false);
+    EXPECT_EQ(dbabstract::ConnectionOptions::parse("pq://host:http/db", o, error), false);
+    EXPECT_NE(error.find("http"), std::string::npos);
+    EXPECT_EQ(dbabstract::ConnectionOptions::parse("pq://host/db%4", o, error), false);
+
+    dbabstract::ConnectionOptions args("db", NULL, 0, "u", NULL);
+    EXPECT_EQ(args.values().size(), 2u);
+    args.set("compress", true).set("read_timeout", 5).set("typo", "x");
+    static const char *const known[] = { "compress", "read_timeout", NULL };
+    EXPECT_EQ(args.unknown(known), std::vector<std::string>(1, "typo"));
+    EXPECT_EQ(args.getBool("compress", false), true);
+    EXPECT_EQ(args.getBool("missing", true), true);
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+static std::string pragma(dbabstract::Connection *conn, const char *sql) {
+    dbabstract::ResultSet *rs = conn->executeQuery(sql);
+    if (!rs) return ("(failed)");
+    std::string v = (rs->next() && rs->getString(0) ? rs->getString(0) : "(none)");
+    rs->close();
+    return (v);
+}
+
+TEST(ConnectionOptionsTest, SqliteTakesSettings) {
+    const char *path = "options_tests.db";
+    remove(path);
+
+    dbabstract::ConnectionOptions o;
+    std::string error;
+    ASSERT_EQ(dbabstract::ConnectionOptions::parse(std::string("sqlite3:///") + path +
+                                                   "?journal_mode=wal&synchronous=normal&cache_size=-4000&busy_timeout=250", o, error), true) << error;
+    dbabstract::Connection *conn = create_sqlite3_connection();
+    EXPECT_EQ(conn->unknownOptions(o).size(), 0u);
+    ASSERT_EQ(conn->open(o), true);
+    EXPECT_EQ(pragma(conn, "PRAGMA journal_mode"), "wal");
+    EXPECT_EQ(pragma(conn, "PRAGMA synchronous"), "1");
+    EXPECT_EQ(pragma(conn, "PRAGMA cache_size"), "-4000");
+    EXPECT_EQ(conn->execute("CREATE TABLE t (a INT)"), true);
+    conn->release();
+
+    // read only
+    conn = create_sqlite3_connection();
+    ASSERT_EQ(conn->open(dbabstract::ConnectionOptions(path, NULL, 0, NULL, NULL).set("mode", "ro")), true);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (1)"), false);
+    conn->release();
+
+    conn = create_sqlite3_connection();
+    o = dbabstract::ConnectionOptions(path, NULL, 0, NULL, NULL);
+    o.set("keepalives", 1);
+    EXPECT_EQ(conn->unknownOptions(o), std::vector<std::string>(1, "keepalives"));
+    EXPECT_EQ(conn->open(o), true); // reported, not fatal
+    conn->release();
+
+    conn = create_sqlite3_connection();
+    EXPECT_EQ(conn->open(dbabstract::ConnectionOptions(path, NULL, 0, NULL, NULL).set("synchronous", "off; DROP TABLE t")), false);
+    EXPECT_EQ(conn->open(dbabstract::ConnectionOptions(path, NULL, 0, NULL, NULL).set("mode", "append")), false);
+    conn->release();
+
+    remove(path);
+    remove((std::string(path) + "-wal").c_str());
+    remove((std::string(path) + "-shm").c_str());
+}
+
+#endif
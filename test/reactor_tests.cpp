@@ -0,0 +1,253 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/reactor.h"
+
+/**
+ * A non-blocking connection whose statements complete when a byte
+ * arrives on a pipe.
+ */
+class PipeConnection : public dbabstract::Connection
+{
+public:
+    PipeConnection() : fd(-1), started(0), cancels(0)
+    {
+        if (::pipe(fds) != 0) fds[0] = fds[1] = -1;
+        fd = fds[0];
+        ::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    }
+    ~PipeConnection()
+    {
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    std::vector<std::string> tables(void) const { return (std::vector<std::string>()); }
+    void *handle(void) { return (NULL); }
+    bool open(const char *, const char *, const int, const char *, const char *) { return (true); }
+    bool close(void) { return (true); }
+    bool isConnected(void) { return (true); }
+    bool execute(const char *) { return (false); }
+    dbabstract::ResultSet *executeQuery(const char *) { return (NULL); }
+    char *escape(const char *) { return (NULL); }
+    const char *unixtimeToSql(const time_t) { return (NULL); }
+    unsigned long insertId(void) { return (0); }
+    bool beginTrans(void) { return (false); }
+    bool commitTrans(void) { return (false); }
+    bool rollbackTrans(void) { return (false); }
+    bool setTransactionMode(const enum TRANS_MODE) { return (false); }
+    unsigned int errorno(void) const { return (0); }
+    const char *errormsg(void) const { return (""); }
+    const char *version(void) const { return ("Pipe"); }
+
+    int socket(void) { return (fd); }
+    enum ASYNC_STATUS startQuery(const char *)
+    {
+        started++;
+        return (ASYNC_WANT_READ);
+    }
+    enum ASYNC_STATUS continueQuery(void)
+    {
+        char c;
+        return (::read(fds[0], &c, 1) == 1 ? ASYNC_DONE : ASYNC_WANT_READ);
+    }
+    bool cancelQuery(void)
+    {
+        cancels++;
+        return (true);
+    }
+
+    void answer(void)
+    {
+        ssize_t n = ::write(fds[1], "x", 1);
+        (void) n;
+    }
+
+    int fds[2];
+    int fd; /** what socket() returns */
+    int started;
+    std::atomic<int> cancels;
+};
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class ReactorTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            connection = create_sqlite3_connection();
+            connection->open(":memory:", NULL, 0, NULL, NULL);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+        }
+
+        void runUntil(const bool &flag) {
+            for (int i=0; i<200 && !flag; i++) {
+                reactor.runOnce(50);
+            }
+        }
+
+        dbabstract::Reactor reactor;
+        dbabstract::Connection * connection;
+};
+
+TEST_F(ReactorTest, SqliteHasNoSocket) {
+    EXPECT_EQ(connection->socket(), -1);
+    EXPECT_EQ(connection->startQuery("SELECT 1"), dbabstract::Connection::ASYNC_UNSUPPORTED);
+}
+
+TEST_F(ReactorTest, TimerFires) {
+    bool fired = false;
+    reactor.schedule(10, [&fired]() { fired = true; });
+    runUntil(fired);
+    EXPECT_EQ(fired, true);
+}
+
+TEST_F(ReactorTest, CancelledTimerDoesNotFire) {
+    bool fired = false;
+    bool other = false;
+    unsigned long id = reactor.schedule(10, [&fired]() { fired = true; });
+    reactor.schedule(20, [&other]() { other = true; });
+    EXPECT_EQ(reactor.cancelTimer(id), true);
+    runUntil(other);
+    EXPECT_EQ(fired, false);
+}
+
+TEST_F(ReactorTest, OffloadedQueryCompletes) {
+    bool finished = false;
+    int value = 0;
+    reactor.query(connection, "SELECT 40 + 2", [&](dbabstract::ResultSet *rs, bool ok) {
+        EXPECT_EQ(ok, true);
+        if (rs) {
+            if (rs->next()) value = rs->getInteger(0);
+            rs->close();
+        }
+        finished = true;
+    });
+    runUntil(finished);
+    EXPECT_EQ(finished, true);
+    EXPECT_EQ(value, 42);
+    EXPECT_EQ(reactor.pending(), 0u);
+    EXPECT_EQ(reactor.offloads(connection), true);
+}
+
+TEST_F(ReactorTest, StatementsRunInOrder) {
+    std::vector<int> order;
+    bool finished = false;
+    int count = 0;
+
+    reactor.execute(connection, "CREATE TABLE testing (id INTEGER)", [&](dbabstract::ResultSet *, bool ok) {
+        EXPECT_EQ(ok, true);
+        order.push_back(1);
+    });
+    reactor.execute(connection, "INSERT INTO testing VALUES (1)", [&](dbabstract::ResultSet *, bool ok) {
+        EXPECT_EQ(ok, true);
+        order.push_back(2);
+    });
+    reactor.query(connection, "SELECT COUNT(*) FROM testing", [&](dbabstract::ResultSet *rs, bool) {
+        order.push_back(3);
+        if (rs) {
+            if (rs->next()) count = rs->getInteger(0);
+            rs->close();
+        }
+        finished = true;
+    });
+    runUntil(finished);
+    ASSERT_EQ(order.size(), 3u);
+    EXPECT_EQ(order[0], 1);
+    EXPECT_EQ(order[1], 2);
+    EXPECT_EQ(order[2], 3);
+    EXPECT_EQ(count, 1);
+}
+
+TEST_F(ReactorTest, FailedStatementReportsError) {
+    bool finished = false;
+    bool result = true;
+    reactor.execute(connection, "BYE", [&](dbabstract::ResultSet *, bool ok) {
+        result = ok;
+        finished = true;
+    });
+    runUntil(finished);
+    EXPECT_EQ(result, false);
+}
+
+TEST_F(ReactorTest, TimeoutCancelsAndMovesOn) {
+    PipeConnection pipe;
+    bool first = true;
+    bool second = false;
+    bool finished = false;
+    reactor.query(&pipe, "SELECT slow", [&](dbabstract::ResultSet *, bool ok) {
+        first = ok;
+    }, 20);
+    reactor.execute(&pipe, "SELECT next", [&](dbabstract::ResultSet *, bool ok) {
+        second = ok;
+        finished = true;
+    });
+    // the cancel runs off the loop; the next statement waits for it
+    for (int i=0; i<200 && pipe.started < 2; i++) {
+        reactor.runOnce(50);
+    }
+    EXPECT_EQ(first, false);
+    EXPECT_EQ(pipe.cancels.load(), 1);
+    ASSERT_EQ(pipe.started, 2);
+    pipe.answer();
+    runUntil(finished);
+    EXPECT_EQ(second, true);
+    EXPECT_EQ(reactor.pending(), 0u);
+    EXPECT_EQ(reactor.offloads(&pipe), false);
+    reactor.detach(&pipe);
+}
+
+TEST_F(ReactorTest, UnwatchableSocketFails) {
+    PipeConnection pipe;
+    // regular files cannot be watched by epoll
+    pipe.fd = ::open("/dev/null", O_RDONLY);
+    bool finished = false;
+    bool result = true;
+    reactor.execute(&pipe, "SELECT 1", [&](dbabstract::ResultSet *, bool ok) {
+        result = ok;
+        finished = true;
+    });
+    runUntil(finished);
+    EXPECT_EQ(result, false);
+    for (int i=0; i<200 && reactor.pending(); i++) {
+        reactor.runOnce(50);
+    }
+    EXPECT_EQ(pipe.cancels.load(), 1);
+    reactor.detach(&pipe);
+    ::close(pipe.fd);
+}
+
+TEST_F(ReactorTest, KeepaliveReportsLostConnection) {
+    bool lost = false;
+    dbabstract::Connection *reported = NULL;
+    reactor.keepalive(connection, 10, [&](dbabstract::Connection *conn) {
+        lost = true;
+        reported = conn;
+    }, "BYE");
+    runUntil(lost);
+    EXPECT_EQ(lost, true);
+    EXPECT_EQ(reported, connection);
+    reactor.detach(connection);
+}
+
+TEST_F(ReactorTest, PostRunsOnLoop) {
+    bool ran = false;
+    std::thread t([&]() { reactor.post([&ran]() { ran = true; }); });
+    t.join();
+    runUntil(ran);
+    EXPECT_EQ(ran, true);
+}
+
+#endif
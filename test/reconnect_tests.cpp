@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/reconnect.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+/**
+ * A SQLite connection whose server can go away.
+ */
+class FlakyConnection : public dbabstract::Connection
+{
+public:
+    FlakyConnection() : conn(NULL), alive(false), dieOnNext(false), opens(0), failOpens(0), statements(0) {}
+    ~FlakyConnection() { close(); }
+
+    std::vector<std::string> tables(void) const { return (conn->tables()); }
+    void *handle(void) { return (conn); }
+
+    bool open(const char *database, const char *host, const int port, const char *user, const char *pass)
+    {
+        opens++;
+        if (failOpens) {
+            failOpens--;
+            return (false);
+        }
+        conn = create_sqlite3_connection();
+        alive = conn->open(database, host, port, user, pass);
+        return (alive);
+    }
+
+    bool close(void)
+    {
+        if (conn) conn->release();
+        conn = NULL;
+        alive = false;
+        return (true);
+    }
+
+    bool isConnected(void) { return (alive); }
+    bool execute(const char *sql) { return (sent() && conn->execute(sql)); }
+    dbabstract::ResultSet *executeQuery(const char *sql) { return (sent() ? conn->executeQuery(sql) : NULL); }
+    char *escape(const char *s) { return (conn->escape(s)); }
+    const char *unixtimeToSql(const time_t t) { return (conn->unixtimeToSql(t)); }
+    unsigned long insertId(void) { return (conn->insertId()); }
+    bool beginTrans(void) { return (alive && conn->beginTrans()); }
+    bool commitTrans(void) { return (alive && conn->commitTrans()); }
+    bool rollbackTrans(void) { return (alive && conn->rollbackTrans()); }
+    bool setTransactionMode(const enum TRANS_MODE) { return (true); }
+    unsigned int errorno(void) const { return (0); }
+    const char *errormsg(void) const { return (""); }
+    const char *version(void) const { return ("Flaky"); }
+
+    /** the server goes away; noticed with the next call */
+    void kill(void) { alive = false; }
+
+    bool sent(void)
+    {
+        statements++;
+        if (dieOnNext) alive = dieOnNext = false;
+        return (alive);
+    }
+
+    dbabstract::Connection *conn;
+    bool alive;
+    bool dieOnNext; /** lost while the next statement runs */
+    int opens;
+    int failOpens;
+    int statements;
+};
+
+class ReconnectTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            remove(path);
+            policy.initialDelay = std::chrono::milliseconds(1);
+            policy.maxDelay = std::chrono::milliseconds(4);
+            policy.setup = [this](dbabstract::Connection *c) {
+                setups++;
+                return (c->execute("CREATE TABLE IF NOT EXISTS t (id INTEGER)"));
+            };
+            setups = 0;
+            flaky = new FlakyConnection;
+            conn = new dbabstract::ReconnectingConnection(flaky, policy);
+            EXPECT_EQ(conn->open(path, NULL, 0, NULL, NULL), true);
+        }
+
+        virtual void TearDown() {
+            conn->release();
+            remove(path);
+        }
+
+        long count(void) {
+            dbabstract::ResultSet *rs = conn->executeQuery("SELECT COUNT(*) FROM t");
+            if (!rs) return (-1);
+            long n = (rs->next() ? rs->getLong(0) : -1);
+            rs->close();
+            return (n);
+        }
+
+        static const char *path;
+        dbabstract::ReconnectPolicy policy;
+        int setups;
+        FlakyConnection *flaky;
+        dbabstract::ReconnectingConnection *conn;
+};
+
+const char *ReconnectTest::path = "reconnect_tests.db";
+
+TEST_F(ReconnectTest, ChecksBeforeUseWithoutRoundTrips) {
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (1)"), true);
+    EXPECT_EQ(conn->isConnected(), true);
+    EXPECT_EQ(flaky->statements, 2); // the setup, the insert
+
+    flaky->kill();
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (2)"), true);
+    EXPECT_EQ(conn->reconnects(), 1u);
+    EXPECT_EQ(setups, 2);
+    EXPECT_EQ(count(), 2);
+}
+
+TEST_F(ReconnectTest, RepeatsOnlyReads) {
+    flaky->dieOnNext = true;
+    EXPECT_EQ(count(), 0);
+    EXPECT_EQ(conn->reconnects(), 1u);
+
+    flaky->dieOnNext = true;
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (1)"), false);
+    EXPECT_EQ(conn->reconnects(), 2u);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (1)"), true);
+    EXPECT_EQ(count(), 1);
+}
+
+TEST_F(ReconnectTest, TransactionsDoNotSurvive) {
+    ASSERT_EQ(conn->beginTrans(), true);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (1)"), true);
+    flaky->kill();
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (2)"), false);
+    EXPECT_EQ(conn->reconnects(), 1u);
+    // not run on the new connection outside the transaction
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (3)"), false);
+    EXPECT_EQ(conn->commitTrans(), false);
+    EXPECT_EQ(count(), 0);
+
+    ASSERT_EQ(conn->beginTrans(), true);
+    EXPECT_EQ(conn->execute("INSERT INTO t VALUES (4)"), true);
+    EXPECT_EQ(conn->commitTrans(), true);
+    EXPECT_EQ(count(), 1);
+}
+
+TEST_F(ReconnectTest, BacksOffAndGivesUp) {
+    flaky->kill();
+    flaky->failOpens = 2;
+    int opens = flaky->opens;
+    EXPECT_EQ(count(), 0);
+    EXPECT_EQ(flaky->opens, opens + 3);
+    EXPECT_EQ(conn->reconnects(), 1u);
+
+    flaky->kill();
+    flaky->failOpens = 100;
+    opens = flaky->opens;
+    EXPECT_EQ(count(), -1);
+    EXPECT_EQ(flaky->opens, opens + (int) policy.attempts);
+    EXPECT_EQ(conn->isConnected(), false);
+
+    flaky->failOpens = 0;
+    EXPECT_EQ(count(), 0);
+    EXPECT_EQ(conn->reconnects(), 2u);
+}
+
+#endif
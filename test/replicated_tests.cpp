@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "dbabstract/db.h"
+#include "dbabstract/replicated.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+static dbabstract::Connection *
+open_named(const char *name)
+{
+    dbabstract::Connection *c = create_sqlite3_connection();
+    c->open(":memory:", NULL, 0, NULL, NULL);
+    c->execute("CREATE TABLE whoami (name VARCHAR(32))");
+    std::string sql("INSERT INTO whoami VALUES ('");
+    sql += name;
+    sql += "')";
+    c->execute(sql.c_str());
+    return (c);
+}
+
+class ReplicatedTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            std::vector<dbabstract::Connection *> replicas;
+            replicas.push_back(open_named("replica0"));
+            replicas.push_back(open_named("replica1"));
+            connection = new dbabstract::ReplicatedConnection(open_named("primary"), replicas);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+        }
+
+        std::string who(void) {
+            std::string name;
+            dbabstract::ResultSet *rs = connection->executeQuery("SELECT name FROM whoami");
+            if (rs) {
+                if (rs->next()) name = rs->getString(0);
+                rs->close();
+            }
+            return (name);
+        }
+
+        dbabstract::ReplicatedConnection * connection;
+};
+
+TEST_F(ReplicatedTest, ClassifiesStatements) {
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("  select 1"), true);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("/* hint */ SELECT * FROM t"), true);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("SELECT * FROM t FOR UPDATE"), false);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("SELECT 'for update' FROM t"), true);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("INSERT INTO t SELECT * FROM u"), false);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("WITH x AS (SELECT 1) DELETE FROM t"), false);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("WITH d AS (DELETE FROM t RETURNING *) SELECT * FROM d"), false);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("WITH x AS (SELECT 'delete' FROM t) SELECT * FROM x"), true);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("SELECT 1;"), true);
+    EXPECT_EQ(dbabstract::sqlscan::isReadOnly("SELECT ';' FROM t; DELETE FROM t"), false);
+}
+
+TEST_F(ReplicatedTest, WritesGoToPrimary) {
+    EXPECT_EQ(connection->execute("UPDATE whoami SET name = 'written'"), true);
+    dbabstract::ResultSet *rs = connection->primary()->executeQuery("SELECT name FROM whoami");
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->getString(0), "written");
+    rs->close();
+    EXPECT_EQ(who().substr(0, 7), "replica");
+}
+
+TEST_F(ReplicatedTest, ReadsGoToLeastOutstanding) {
+    dbabstract::ResultSet *first = connection->executeQuery("SELECT name FROM whoami");
+    ASSERT_NE(first, (dbabstract::ResultSet *) NULL);
+    dbabstract::ResultSet *second = connection->executeQuery("SELECT name FROM whoami");
+    ASSERT_NE(second, (dbabstract::ResultSet *) NULL);
+    EXPECT_EQ(connection->outstanding(0), 1);
+    EXPECT_EQ(connection->outstanding(1), 1);
+
+    first->close();
+    EXPECT_EQ(connection->outstanding(0) + connection->outstanding(1), 1);
+    std::string freed = (connection->outstanding(0) == 0 ? "replica0" : "replica1");
+    EXPECT_EQ(who(), freed);
+    second->close();
+}
+
+TEST_F(ReplicatedTest, TransactionsStayOnPrimary) {
+    EXPECT_EQ(connection->beginTrans(), true);
+    EXPECT_EQ(who(), "primary");
+    EXPECT_EQ(connection->commitTrans(), true);
+    EXPECT_EQ(who().substr(0, 7), "replica");
+}
+
+TEST_F(ReplicatedTest, LaggingReplicasAreEjected) {
+    dbabstract::Connection *stale = connection->replica(0);
+    connection->setLagProbe([stale](dbabstract::Connection *c, double &lag) {
+        lag = (c == stale ? 60 : 0);
+        return (true);
+    });
+    for (int i=0; i<4; i++) {
+        EXPECT_EQ(who(), "replica1");
+    }
+    EXPECT_EQ(connection->healthy(0), false);
+
+    connection->setLagProbe([](dbabstract::Connection *, double &lag) {
+        lag = 0;
+        return (false);
+    });
+    EXPECT_EQ(who(), "primary");
+}
+
+TEST_F(ReplicatedTest, FailedReadFallsBackToPrimary) {
+    connection->replica(0)->execute("DROP TABLE whoami");
+    for (int i=0; i<3; i++) {
+        std::string name = who();
+        EXPECT_EQ(name == "primary" || name == "replica1", true);
+    }
+    EXPECT_EQ(connection->healthy(0), false);
+    EXPECT_EQ(who(), "replica1");
+}
+
+TEST_F(ReplicatedTest, FailedReplicasLeaveReadsOnPrimary) {
+    connection->replica(0)->execute("DROP TABLE whoami");
+    connection->replica(1)->execute("DROP TABLE whoami");
+    EXPECT_EQ(who(), "primary");
+    EXPECT_EQ(who(), "primary");
+    EXPECT_EQ(connection->healthy(0), false);
+    EXPECT_EQ(connection->healthy(1), false);
+    EXPECT_EQ(connection->outstanding(0) + connection->outstanding(1), 0);
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/sharded.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+static const int SHARDS = 3;
+
+static std::string
+shard_file(int i)
+{
+    std::ostringstream ss;
+    ss << "shard" << i << ".db";
+    return (ss.str());
+}
+
+class ShardedTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            std::vector<dbabstract::Connection *> shards;
+            for (int i=0; i<SHARDS; i++) {
+                unlink(shard_file(i).c_str());
+                dbabstract::Connection *c = create_sqlite3_connection();
+                c->open(shard_file(i).c_str(), NULL, 0, NULL, NULL);
+                shards.push_back(c);
+            }
+            connection = new dbabstract::ShardedConnection(shards);
+            EXPECT_EQ(connection->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY AUTOINCREMENT, text VARCHAR(128), num INTEGER)"), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+            for (int i=0; i<SHARDS; i++) {
+                unlink(shard_file(i).c_str());
+            }
+        }
+
+        void insert(int num) {
+            std::ostringstream key, sql;
+            key << "user" << num;
+            sql << "INSERT INTO testing (text, num) VALUES ('" << key.str() << "', " << num << ")";
+            EXPECT_EQ(connection->execute(key.str(), sql.str().c_str()), true);
+        }
+
+        dbabstract::ShardedConnection * connection;
+};
+
+TEST_F(ShardedTest, DDLReachesEveryShard) {
+    for (size_t i=0; i<connection->shardCount(); i++) {
+        std::vector<std::string> t = connection->shard(i)->tables();
+        EXPECT_EQ(std::find(t.begin(), t.end(), "testing") != t.end(), true);
+    }
+}
+
+TEST_F(ShardedTest, KeysSpreadAndStayPut) {
+    std::vector<int> hits(SHARDS, 0);
+    for (int i=0; i<300; i++) {
+        std::ostringstream key;
+        key << "user" << i;
+        size_t s = connection->shardFor(key.str());
+        ASSERT_LT(s, (size_t) SHARDS);
+        EXPECT_EQ(connection->shardFor(key.str()), s);
+        hits[s]++;
+    }
+    for (int i=0; i<SHARDS; i++) {
+        EXPECT_GT(hits[i], 30);
+    }
+}
+
+TEST_F(ShardedTest, KeyedQueryHitsOneShard) {
+    insert(7);
+    dbabstract::ResultSet *rs = connection->executeQuery("user7", "SELECT num FROM testing");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    EXPECT_EQ(rs->next(), true);
+    EXPECT_EQ(rs->getInteger(0), 7);
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+    EXPECT_EQ(connection->insertId(), 1u);
+}
+
+TEST_F(ShardedTest, OrderByMergesShards) {
+    for (int i=1; i<=20; i++) insert(i);
+
+    dbabstract::ResultSet *rs = connection->executeQuery("SELECT text, num FROM testing ORDER BY num DESC");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    for (int i=20; i>=1; i--) {
+        ASSERT_EQ(rs->next(), true);
+        EXPECT_EQ(rs->getInteger(1), i);
+    }
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+
+    rs = connection->executeQuery("SELECT num FROM testing t ORDER BY t.num LIMIT 3");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    for (int i=1; i<=3; i++) {
+        ASSERT_EQ(rs->next(), true);
+        EXPECT_EQ(rs->getInteger(0), i);
+    }
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+}
+
+TEST_F(ShardedTest, AggregatesCombine) {
+    for (int i=1; i<=10; i++) insert(i);
+
+    dbabstract::ResultSet *rs = connection->executeQuery("SELECT COUNT(*) AS n, SUM(num), MIN(num), MAX(text) FROM testing");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    ASSERT_EQ(rs->next(), true);
+    EXPECT_STREQ(rs->columnName(0), "n");
+    EXPECT_EQ(rs->getInteger(0), 10);
+    EXPECT_EQ(rs->getInteger(1), 55);
+    EXPECT_EQ(rs->getInteger(2), 1);
+    EXPECT_STREQ(rs->getString(3), "user9");
+    EXPECT_EQ(rs->next(), false);
+    rs->close();
+}
+
+TEST_F(ShardedTest, FailingShardFailsQuery) {
+    EXPECT_EQ(connection->executeQuery("SELECT sjot frm fs"), (dbabstract::ResultSet *) NULL);
+    EXPECT_STRNE(connection->errormsg(), "");
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/slowquery.h"
+
+TEST(SlowQueryLogTest, PlanQueryPerDialect) {
+    EXPECT_EQ(dbabstract::SlowQueryLog::planQuery("Sqlite3 Driver v0.2 using 3.40.1", "SELECT * FROM t"), "EXPLAIN QUERY PLAN SELECT * FROM t");
+    EXPECT_EQ(dbabstract::SlowQueryLog::planQuery("PostgreSQL Driver v0.1", "update t set a = 1;"), "EXPLAIN (FORMAT JSON) update t set a = 1");
+    EXPECT_EQ(dbabstract::SlowQueryLog::planQuery("MySQL Driver v0.2 using MySQL client library v8", " (SELECT 1)"), "EXPLAIN FORMAT=JSON (SELECT 1)");
+    EXPECT_EQ(dbabstract::SlowQueryLog::planQuery("ODBC Driver v0.1", "SELECT 1"), "");
+    EXPECT_EQ(dbabstract::SlowQueryLog::planQuery("Sqlite3 Driver", "CREATE TABLE t (a INT)"), "");
+    EXPECT_EQ(dbabstract::SlowQueryLog::planQuery("Sqlite3 Driver", "SELECT 1; DELETE FROM t"), "");
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class SlowQueryTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            remove(path);
+            connection = create_sqlite3_connection();
+            EXPECT_EQ(connection->open(path, NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(connection->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY, text VARCHAR(16))"), true);
+            EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (1, 'abc')"), true);
+            EXPECT_EQ(connection->execute("INSERT INTO testing VALUES (22, 'defgh')"), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+            remove(path);
+        }
+
+        static dbabstract::Connection *side(void) {
+            dbabstract::Connection *conn = create_sqlite3_connection();
+            if (!conn->open(path, NULL, 0, NULL, NULL)) {
+                conn->release();
+                return (NULL);
+            }
+            return (conn);
+        }
+
+        static void select(dbabstract::Connection *conn, const char *sql) {
+            dbabstract::ResultSet *rs = conn->executeQuery(sql);
+            ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+            while (rs->next()) {}
+            rs->close();
+        }
+
+        static const char *path;
+        dbabstract::Connection * connection;
+};
+
+const char *SlowQueryTest::path = "slowquery_tests.db";
+
+TEST_F(SlowQueryTest, LogsStatementsOverThresholdWithPlan) {
+    std::vector<dbabstract::SlowQueryLog::Entry> entries;
+    dbabstract::SlowQueryLog log(3600 * 1000000ULL, [&entries](const dbabstract::SlowQueryLog::Entry &e) { entries.push_back(e); }, &SlowQueryTest::side);
+    dbabstract::Connection *conn = new dbabstract::SlowQueryConnection(connection, &log);
+    connection->duplicate();
+
+    select(conn, "SELECT * FROM testing WHERE id > 0");
+    log.flush();
+    EXPECT_EQ(entries.size(), 0u);
+
+    log.setThreshold(0);
+    select(conn, "SELECT * FROM testing WHERE id > 0");
+    EXPECT_EQ(conn->execute("CREATE TABLE other (a INT)"), true);
+    EXPECT_EQ(conn->execute("INSERT INTO testing VALUES (1, 'again')"), false);
+    log.flush();
+    conn->release();
+
+    ASSERT_EQ(entries.size(), 3u);
+    EXPECT_EQ(entries[0].fingerprint, "select * from testing where id > ?");
+    EXPECT_EQ(entries[0].rows, 2u);
+    EXPECT_EQ(entries[0].planStatus, dbabstract::SlowQueryLog::PLAN_CAPTURED);
+    EXPECT_NE(entries[0].plan.find("testing"), std::string::npos);
+    EXPECT_EQ(entries[1].planStatus, dbabstract::SlowQueryLog::PLAN_NONE);
+    EXPECT_EQ(entries[2].failed, true);
+    EXPECT_EQ(entries[2].planStatus, dbabstract::SlowQueryLog::PLAN_NONE);
+    EXPECT_EQ(log.logged(), 3u);
+    EXPECT_EQ(log.plans(), 1u);
+
+    std::string json = entries[0].json();
+    EXPECT_NE(json.find("\"rows\":2,\"failed\":false"), std::string::npos);
+    EXPECT_NE(json.find("\"plan_status\":\"captured\""), std::string::npos);
+}
+
+TEST_F(SlowQueryTest, RateLimitsPlans) {
+    std::ostringstream out;
+    dbabstract::SlowQueryLog log(0, dbabstract::SlowQueryLog::lines(out), &SlowQueryTest::side, 2);
+    dbabstract::Connection *conn = new dbabstract::SlowQueryConnection(connection, &log);
+    connection->duplicate();
+
+    select(conn, "SELECT text FROM testing WHERE id = 1");
+    select(conn, "SELECT text FROM testing WHERE id = 22"); // same fingerprint
+    select(conn, "SELECT id FROM testing");
+    select(conn, "SELECT count(*) FROM testing"); // out of tokens
+    log.flush();
+    conn->release();
+
+    EXPECT_EQ(log.logged(), 4u);
+    EXPECT_EQ(log.plans(), 2u);
+    EXPECT_EQ(log.rateLimited(), 2u);
+
+    std::istringstream in(out.str());
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line); ) lines.push_back(line);
+    ASSERT_EQ(lines.size(), 4u);
+    EXPECT_NE(lines[0].find("\"plan_status\":\"captured\""), std::string::npos);
+    EXPECT_NE(lines[1].find("\"plan_status\":\"rate_limited\""), std::string::npos);
+    EXPECT_NE(lines[2].find("\"plan_status\":\"captured\""), std::string::npos);
+    EXPECT_NE(lines[3].find("\"plan_status\":\"rate_limited\""), std::string::npos);
+}
+
+#endif
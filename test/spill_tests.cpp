@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/spill.h"
+
+static void roundTrip(const std::string &raw) {
+    std::vector<char> packed;
+    dbabstract::lz4block::compress(raw.data(), raw.size(), packed);
+    std::vector<char> back(raw.size() + 1);
+    ASSERT_EQ(dbabstract::lz4block::decompress(packed.data(), packed.size(), back.data(), raw.size()), true);
+    EXPECT_EQ(std::string(back.data(), raw.size()), raw);
+    // a size that does not match is an error
+    EXPECT_EQ(dbabstract::lz4block::decompress(packed.data(), packed.size(), back.data(), raw.size() + 1), false);
+}
+
+TEST(SpillTest, CompressesInBlocks) {
+    roundTrip("");
+    roundTrip("abc");
+    roundTrip(std::string(100000, 'x'));
+    std::string text;
+    for (int i=0; i<2000; i++) text += "row " + std::to_string(i % 37) + " of the reference data\n";
+    roundTrip(text);
+    std::string noise;
+    srand(7);
+    for (int i=0; i<70000; i++) noise += (char) (rand() & 0xff);
+    roundTrip(noise);
+
+    std::vector<char> packed;
+    EXPECT_LT(dbabstract::lz4block::compress(text.data(), text.size(), packed), text.size() / 4);
+    std::vector<char> out(text.size());
+    packed[packed.size() / 2] ^= 0x55;
+    dbabstract::lz4block::decompress(packed.data(), packed.size(), out.data(), out.size()); // must not overrun
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+class SpillResultTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            mkdir(dir, 0700);
+            connection = create_sqlite3_connection();
+            EXPECT_EQ(connection->open(":memory:", NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(connection->execute("CREATE TABLE t (id INTEGER, name VARCHAR(32), note VARCHAR(32))"), true);
+            EXPECT_EQ(connection->beginTrans(), true);
+            for (int i=0; i<1000; i++) {
+                std::string sql = "INSERT INTO t VALUES (" + std::to_string(i) + ", 'name " + std::to_string(i) + "', " +
+                                  (i % 3 ? "'some repeated note'" : "NULL") + ")";
+                EXPECT_EQ(connection->execute(sql.c_str()), true);
+            }
+            EXPECT_EQ(connection->commitTrans(), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+            EXPECT_EQ(files(), 0);
+            rmdir(dir);
+        }
+
+        static int files(void) {
+            int n = 0;
+            DIR *d = opendir(dir);
+            if (!d) return (0);
+            while (struct dirent *e = readdir(d)) {
+                if (e->d_name[0] != '.') n++;
+            }
+            closedir(d);
+            return (n);
+        }
+
+        static void check(dbabstract::RandomAccessResultSet *rs) {
+            ASSERT_EQ(rs->recordCount(), 1000u);
+            ASSERT_EQ(rs->columnCount(), 3u);
+            EXPECT_STREQ(rs->columnName(1), "name");
+            long sum = 0;
+            unsigned long rows = 0;
+            while (rs->next()) {
+                sum += rs->getLong(0);
+                EXPECT_EQ(rs->getString(2) == NULL, rs->getInteger(0) % 3 == 0);
+                rows++;
+            }
+            EXPECT_EQ(rows, 1000u);
+            EXPECT_EQ(sum, 999L * 1000 / 2);
+            EXPECT_EQ(rs->getString(0), (const char *) NULL);
+
+            ASSERT_EQ(rs->seek(731), true);
+            EXPECT_EQ(rs->getInteger(0), 731);
+            EXPECT_STREQ(rs->getString(1), "name 731");
+            EXPECT_STREQ(rs->getString(2), "some repeated note");
+            ASSERT_EQ(rs->seek(3), true);
+            EXPECT_EQ(rs->getString(2), (const char *) NULL);
+            ASSERT_EQ(rs->next(), true);
+            EXPECT_EQ(rs->getShort(0), 4);
+            EXPECT_EQ(rs->seek(1000), false);
+            rs->rewind();
+            ASSERT_EQ(rs->next(), true);
+            EXPECT_EQ(rs->getInteger(0), 0);
+        }
+
+        static const char *dir;
+        dbabstract::Connection *connection;
+};
+
+const char *SpillResultTest::dir = "spill_tests.dir";
+
+TEST_F(SpillResultTest, ServesRowsFromTheFile) {
+    for (int compress=0; compress<2; compress++) {
+        dbabstract::SpillOptions options;
+        options.directory = dir;
+        options.blockBytes = 1024;
+        options.compress = (compress != 0);
+
+        dbabstract::ResultSet *rs = connection->executeQuery("SELECT id, name, note FROM t ORDER BY id");
+        ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+        dbabstract::SpilledResult spilled = dbabstract::SpilledResult::fromResultSet(rs, options);
+        rs->close();
+        ASSERT_EQ(spilled.ok(), true) << spilled.errormsg();
+        EXPECT_GT(spilled.blockCount(), 10u);
+        if (compress) EXPECT_LT(spilled.fileBytes(), spilled.rawBytes());
+        else EXPECT_EQ(spilled.fileBytes(), spilled.rawBytes());
+        EXPECT_EQ(files(), 0); // already unlinked
+
+        dbabstract::RandomAccessResultSet *cursor = spilled.cursor();
+        check(cursor);
+        dbabstract::RandomAccessResultSet *other = cursor->share();
+        cursor->close();
+        check(other);
+        other->close();
+    }
+}
+
+TEST_F(SpillResultTest, SpillsPastTheMemoryLimit) {
+    dbabstract::SpillOptions options;
+    options.directory = dir;
+    options.compress = true;
+
+    dbabstract::ResultSet *rs = connection->executeQuery("SELECT id, name, note FROM t ORDER BY id");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    dbabstract::RandomAccessResultSet *small = dbabstract::SpilledResult::materialize(rs, 4096, options);
+    rs->close();
+    ASSERT_NE(small, (dbabstract::RandomAccessResultSet *) NULL);
+    EXPECT_NE(dynamic_cast<dbabstract::SpilledResultSet *>(small), (dbabstract::SpilledResultSet *) NULL);
+    check(small);
+    small->close();
+
+    rs = connection->executeQuery("SELECT id, name, note FROM t ORDER BY id");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    dbabstract::RandomAccessResultSet *large = dbabstract::SpilledResult::materialize(rs, 1024 * 1024, options);
+    rs->close();
+    ASSERT_NE(large, (dbabstract::RandomAccessResultSet *) NULL);
+    EXPECT_NE(dynamic_cast<dbabstract::MaterializedResultSet *>(large), (dbabstract::MaterializedResultSet *) NULL);
+    check(large);
+    large->close();
+
+    options.directory = "spill_tests.missing";
+    rs = connection->executeQuery("SELECT id FROM t");
+    ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+    dbabstract::SpilledResult failed = dbabstract::SpilledResult::fromResultSet(rs, options);
+    rs->close();
+    EXPECT_EQ(failed.ok(), false);
+    EXPECT_NE(std::string(failed.errormsg()).find("spill_tests.missing"), std::string::npos);
+}
+
+#endif
@@ -1,13 +1,19 @@
 #include <gtest/gtest.h>
+#include <chrono>
 #include <exception>
 #include <iostream>
 #include <string>
 #include <strstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
 
 #include "dbabstract/db.h"
 
 #ifdef ENABLE_SQLITE3
 
+#include "dbabstract/sqlite3/sqlite3_db.h"
+
 extern "C" {
     extern dbabstract::Connection *create_sqlite3_connection(void);
 };
@@ -206,5 +212,237 @@ TEST_F(SqliteTransactionTest, QueryNumberTypes) {
 }
 
 
-#endif
+class SqliteGroupTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            unlink("group.db");
+            unlink("group.db-wal");
+            unlink("group.db-shm");
+            group = new dbabstract::Sqlite3_ConnectionGroup(2);
+            ASSERT_EQ(group->open("group.db", NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(group->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY AUTOINCREMENT, num INTEGER)"), true);
+            EXPECT_EQ(group->execute("INSERT INTO testing (num) VALUES (1)"), true);
+        }
+
+        virtual void TearDown() {
+            group->release();
+            unlink("group.db");
+            unlink("group.db-wal");
+            unlink("group.db-shm");
+        }
+
+        int count(void) {
+            int n = -1;
+            dbabstract::ResultSet *rs = group->executeQuery("SELECT COUNT(*) FROM testing");
+            if (rs) {
+                if (rs->next()) n = rs->getInteger(0);
+                rs->close();
+            }
+            return (n);
+        }
+
+        dbabstract::Sqlite3_ConnectionGroup * group;
+};
+
+TEST_F(SqliteGroupTest, InMemoryIsRejected) {
+    dbabstract::Sqlite3_ConnectionGroup *mem = new dbabstract::Sqlite3_ConnectionGroup(1);
+    EXPECT_EQ(mem->open(":memory:", NULL, 0, NULL, NULL), false);
+    EXPECT_STRNE(mem->errormsg(), "");
+    EXPECT_EQ(mem->unknownOptions(dbabstract::ConnectionOptions("group.db", NULL, 0, NULL, NULL).set("cache", "shared")),
+              std::vector<std::string>(1, "cache"));
+    mem->release();
+}
 
+TEST_F(SqliteGroupTest, ReadsUseReaders) {
+    EXPECT_EQ(group->readers(), 0u);
+    EXPECT_EQ(count(), 1);
+    EXPECT_EQ(group->readers(), 1u);
+
+    // a second open ResultSet on the same thread shares its reader
+    dbabstract::ResultSet *a = group->executeQuery("SELECT num FROM testing");
+    dbabstract::ResultSet *b = group->executeQuery("SELECT num FROM testing");
+    EXPECT_EQ(group->readers(), 1u);
+    a->close();
+    b->close();
+}
+
+TEST_F(SqliteGroupTest, ConcurrentReadersAndWriter) {
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+
+    for (int t=0; t<4; t++) {
+        threads.push_back(std::thread([this, t, &failures]() {
+            for (int i=0; i<50; i++) {
+                if (count() < 1) failures[t]++;
+            }
+        }));
+    }
+    for (int i=0; i<50; i++) {
+        EXPECT_EQ(group->execute("INSERT INTO testing (num) VALUES (2)"), true);
+    }
+    for (size_t t=0; t<threads.size(); t++) {
+        threads[t].join();
+        EXPECT_EQ(failures[t], 0);
+    }
+    EXPECT_LE(group->readers(), 2u);
+    EXPECT_EQ(count(), 51);
+}
+
+TEST_F(SqliteGroupTest, TransactionReadsItsOwnWrites) {
+    EXPECT_EQ(group->beginTrans(), true);
+    EXPECT_EQ(group->execute("INSERT INTO testing (num) VALUES (2)"), true);
+    EXPECT_EQ(count(), 2);
+
+    int seen = 0;
+    std::thread other([this, &seen]() { seen = count(); });
+    other.join();
+    EXPECT_EQ(seen, 1);
+
+    EXPECT_EQ(group->commitTrans(), true);
+    EXPECT_EQ(count(), 2);
+}
+
+TEST_F(SqliteGroupTest, SnapshotPinsReads) {
+    if (!group->pinSnapshot()) {
+        EXPECT_STRNE(group->errormsg(), "");
+        return;
+    }
+    EXPECT_EQ(group->execute("INSERT INTO testing (num) VALUES (2)"), true);
+    EXPECT_EQ(count(), 1);
+    group->unpinSnapshot();
+    EXPECT_EQ(count(), 2);
+}
+
+class SqliteBusyTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            unlink("busy.db");
+            holder = new dbabstract::Sqlite3_Connection;
+            waiter = new dbabstract::Sqlite3_Connection;
+            ASSERT_EQ(holder->open("busy.db", NULL, 0, NULL, NULL), true);
+            ASSERT_EQ(waiter->open("busy.db", NULL, 0, NULL, NULL), true);
+            EXPECT_EQ(holder->execute("CREATE TABLE testing (num INTEGER)"), true);
+            holder->setImmediateTransactions(true);
+        }
+
+        virtual void TearDown() {
+            holder->release();
+            waiter->release();
+            unlink("busy.db");
+        }
+
+        dbabstract::Sqlite3_Connection * holder;
+        dbabstract::Sqlite3_Connection * waiter;
+};
+
+TEST_F(SqliteBusyTest, GivesUpAtDeadline) {
+    EXPECT_EQ(holder->beginTrans(), true);
+    waiter->setBusyStrategy(100, 5000, 100);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    EXPECT_EQ(waiter->execute("INSERT INTO testing VALUES (1)"), false);
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    EXPECT_GE(ms, 90);
+    EXPECT_LT(ms, 900);
+    EXPECT_EQ(waiter->errorno(), (unsigned int) SQLITE_BUSY);
+    EXPECT_GT(waiter->busyWaits(), 1u);
+    EXPECT_GE(waiter->busyMicroseconds(), 80000u);
+
+    EXPECT_EQ(holder->rollbackTrans(), true);
+}
+
+TEST_F(SqliteBusyTest, WaitsForLockRelease) {
+    EXPECT_EQ(holder->beginTrans(), true);
+    std::thread release([this]() {
+        usleep(30000);
+        holder->commitTrans();
+    });
+
+    waiter->setImmediateTransactions(true);
+    EXPECT_EQ(waiter->beginTrans(), true);
+    EXPECT_EQ(waiter->execute("INSERT INTO testing VALUES (1)"), true);
+    EXPECT_EQ(waiter->commitTrans(), true);
+    release.join();
+    EXPECT_GT(waiter->busyWaits(), 0u);
+    EXPECT_LT(waiter->busyMicroseconds(), 1000000u);
+}
+
+static long countRows(dbabstract::Connection *conn) {
+    dbabstract::ResultSet *rs = conn->executeQuery("SELECT COUNT(*) FROM testing");
+    if (!rs) return (-1);
+    long n = (rs->next() ? rs->getLong(0) : -1);
+    rs->close();
+    return (n);
+}
+
+TEST(SqliteMemoryTest, SharedCacheAndBackup) {
+    dbabstract::Sqlite3_Connection *a = new dbabstract::Sqlite3_Connection;
+    dbabstract::Sqlite3_Connection *b = new dbabstract::Sqlite3_Connection;
+    ASSERT_EQ(a->open("file:warm?mode=memory&cache=shared", NULL, 0, NULL, NULL), true);
+    ASSERT_EQ(b->open(dbabstract::ConnectionOptions("file:warm?mode=memory", NULL, 0, NULL, NULL).set("cache", "shared")), true);
+    EXPECT_EQ(a->execute("CREATE TABLE testing (num INTEGER, pad TEXT)"), true);
+    EXPECT_EQ(a->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < 500) "
+                         "INSERT INTO testing SELECT i, printf('%0200d', i) FROM n"), true);
+    EXPECT_EQ(countRows(b), 500);
+
+    // checkpoint a few pages at a time, then warm up a fresh database
+    unlink("memory.db");
+    int steps = 0;
+    dbabstract::Sqlite3_Connection::BackupProgress counted = [&steps](int remaining, int total) {
+        steps++;
+        return (remaining <= total);
+    };
+    EXPECT_EQ(a->backupTo("memory.db", 4, 0, counted), true);
+    EXPECT_GT(steps, 2);
+    dbabstract::Sqlite3_Connection *c = new dbabstract::Sqlite3_Connection;
+    ASSERT_EQ(c->open(":memory:", NULL, 0, NULL, NULL), true);
+    EXPECT_EQ(c->restoreFrom("memory.db"), true);
+    EXPECT_EQ(countRows(c), 500);
+
+    // stopped part way, the destination is left alone
+    dbabstract::Sqlite3_Connection *d = new dbabstract::Sqlite3_Connection;
+    ASSERT_EQ(d->open(":memory:", NULL, 0, NULL, NULL), true);
+    dbabstract::Sqlite3_Connection::BackupProgress stop = [](int, int) { return (false); };
+    EXPECT_EQ(c->backup(*d, 1, 0, stop), false);
+    EXPECT_EQ(countRows(d), -1);
+    EXPECT_EQ(c->backup(*d), true);
+    EXPECT_EQ(countRows(d), 500);
+
+    EXPECT_EQ(a->open(dbabstract::ConnectionOptions(":memory:", NULL, 0, NULL, NULL).set("cache", "public")), false);
+    a->release();
+    b->release();
+    c->release();
+    d->release();
+    unlink("memory.db");
+}
+
+TEST(SqliteMemoryTest, SerializeRoundTrip) {
+    dbabstract::Sqlite3_Connection *a = new dbabstract::Sqlite3_Connection;
+    dbabstract::Sqlite3_Connection *b = new dbabstract::Sqlite3_Connection;
+    ASSERT_EQ(a->open(":memory:", NULL, 0, NULL, NULL), true);
+    ASSERT_EQ(b->open(":memory:", NULL, 0, NULL, NULL), true);
+    EXPECT_EQ(a->execute("CREATE TABLE testing (num INTEGER)"), true);
+    EXPECT_EQ(a->execute("INSERT INTO testing VALUES (1), (2), (3)"), true);
+
+    std::vector<unsigned char> image;
+    if (!a->serialize(image)) {
+        // SQLite without sqlite3_serialize()
+        a->release();
+        b->release();
+        return;
+    }
+    EXPECT_GT(image.size(), 0u);
+    ASSERT_EQ(b->deserialize(image.empty() ? NULL : &image[0], image.size()), true);
+    EXPECT_EQ(countRows(b), 3);
+    EXPECT_EQ(b->execute("INSERT INTO testing VALUES (4)"), true);
+
+    std::vector<unsigned char> again;
+    EXPECT_EQ(b->serialize(again), true);
+    EXPECT_EQ(a->deserialize(&again[0], again.size(), true), true);
+    EXPECT_EQ(countRows(a), 4);
+    EXPECT_EQ(a->execute("INSERT INTO testing VALUES (5)"), false);
+    a->release();
+    b->release();
+}
+
+#endif
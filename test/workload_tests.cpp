@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/workload.h"
+
+TEST(WorkloadTest, FormatsAndParsesEvents) {
+    dbabstract::WorkloadEvent ev;
+    ev.offsetUs = 1500;
+    ev.connection = 2;
+    ev.kind = dbabstract::WorkloadEvent::PREPARED;
+    ev.sql = "SELECT *\tFROM t\nWHERE a = ? AND b = '\\'";
+    ev.params.push_back("i:42");
+    ev.params.push_back("s:x\ty");
+    ev.params.push_back("N");
+
+    std::string line = ev.format();
+    EXPECT_EQ(line.find('\n'), std::string::npos);
+    EXPECT_EQ(line.compare(0, 9, "1500\t2\tP\t"), 0);
+
+    dbabstract::WorkloadEvent back;
+    ASSERT_EQ(back.parse(line), true);
+    EXPECT_EQ(back.offsetUs, 1500u);
+    EXPECT_EQ(back.connection, 2u);
+    EXPECT_EQ(back.kind, dbabstract::WorkloadEvent::PREPARED);
+    EXPECT_EQ(back.sql, ev.sql);
+    EXPECT_EQ(back.params, ev.params);
+
+    EXPECT_EQ(back.parse("10\t1\tC"), true);
+    EXPECT_EQ(back.kind, dbabstract::WorkloadEvent::COMMIT);
+    EXPECT_EQ(back.sql, "");
+    EXPECT_EQ(back.parse("10\t1\tC\tSELECT 1"), false);
+    EXPECT_EQ(back.parse("10\t1\tS\tSELECT 1\ti:1"), false);
+    EXPECT_EQ(back.parse("x\t1\tS\tSELECT 1"), false);
+    EXPECT_EQ(back.parse("10\t1\tQ\tSELECT 1"), false);
+}
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+TEST(WorkloadTest, BindsParameters) {
+    dbabstract::Connection *conn = create_sqlite3_connection();
+    ASSERT_EQ(conn->open(":memory:", NULL, 0, NULL, NULL), true);
+
+    dbabstract::WorkloadEvent ev;
+    ASSERT_EQ(ev.parse("0\t1\tP\tINSERT INTO t VALUES (?, ?, ?, ?)\ti:7\td:0.5\ts:it's\tN"), true);
+    dbabstract::Statement stmt(ev.sql);
+    ASSERT_EQ(ev.bind(stmt), true);
+    std::string sql;
+    ASSERT_EQ(stmt.toSql(*conn, sql), true);
+    EXPECT_EQ(sql, "INSERT INTO t VALUES (7, 0.5, 'it''s', NULL)");
+
+    ev.params[0] = "7";
+    dbabstract::Statement bad(ev.sql);
+    EXPECT_EQ(ev.bind(bad), false);
+    conn->release();
+}
+
+TEST(WorkloadTest, RecordsAndLoadsWorkload) {
+    const char *path = "workload_tests.workload";
+    {
+        dbabstract::WorkloadRecorder recorder(path);
+        ASSERT_EQ(recorder.isOpen(), true);
+
+        dbabstract::Connection *a = create_sqlite3_connection();
+        dbabstract::Connection *b = create_sqlite3_connection();
+        a->setObserver(&recorder);
+        b->setObserver(&recorder);
+        ASSERT_EQ(a->open(":memory:", NULL, 0, NULL, NULL), true);
+        ASSERT_EQ(b->open(":memory:", NULL, 0, NULL, NULL), true);
+
+        EXPECT_EQ(a->execute("CREATE TABLE t (a INT, b TEXT)"), true);
+        EXPECT_EQ(a->beginTrans(), true);
+        EXPECT_EQ(a->execute("INSERT INTO t VALUES (1, 'tab\there')"), true);
+        EXPECT_EQ(a->commitTrans(), true);
+        dbabstract::ResultSet *rs = b->executeQuery("SELECT 1");
+        ASSERT_NE(rs, (dbabstract::ResultSet *) NULL);
+        rs->close();
+
+        a->release();
+        b->release();
+        EXPECT_EQ(recorder.events(), 5u);
+    }
+
+    std::vector<dbabstract::WorkloadEvent> events;
+    unsigned long bad = 1;
+    ASSERT_EQ(dbabstract::loadWorkload(path, events, &bad), true);
+    EXPECT_EQ(bad, 0u);
+    ASSERT_EQ(events.size(), 5u);
+    EXPECT_EQ(events[0].connection, 1u);
+    EXPECT_EQ(events[0].sql, "CREATE TABLE t (a INT, b TEXT)");
+    EXPECT_EQ(events[1].kind, dbabstract::WorkloadEvent::BEGIN);
+    EXPECT_EQ(events[2].sql, "INSERT INTO t VALUES (1, 'tab\there')");
+    EXPECT_EQ(events[3].kind, dbabstract::WorkloadEvent::COMMIT);
+    EXPECT_EQ(events[4].connection, 2u);
+    EXPECT_EQ(events[4].kind, dbabstract::WorkloadEvent::STATEMENT);
+    for (size_t i=1; i<events.size(); i++) {
+        EXPECT_LE(events[i - 1].offsetUs, events[i].offsetUs);
+    }
+
+    std::ofstream(path, std::ios::app) << "12\t1\tX\n";
+    EXPECT_EQ(dbabstract::loadWorkload(path, events, &bad), false);
+    EXPECT_EQ(bad, 7u);
+    remove(path);
+}
+
+TEST(WorkloadTest, ReopenedConnectionsGetNewNumbers) {
+    const char *path = "workload_tests.workload";
+    {
+        dbabstract::WorkloadRecorder recorder(path);
+        dbabstract::Connection *a = create_sqlite3_connection();
+        dbabstract::Connection *b = create_sqlite3_connection();
+        a->setObserver(&recorder);
+        b->setObserver(&recorder);
+        ASSERT_EQ(a->open(":memory:", NULL, 0, NULL, NULL), true);
+        ASSERT_EQ(b->open(":memory:", NULL, 0, NULL, NULL), true);
+        EXPECT_EQ(a->execute("SELECT 1"), true);
+        EXPECT_EQ(b->execute("SELECT 2"), true);
+
+        // same address, but another session to replay
+        EXPECT_EQ(a->close(), true);
+        ASSERT_EQ(a->open(":memory:", NULL, 0, NULL, NULL), true);
+        EXPECT_EQ(a->execute("SELECT 3"), true);
+        a->release();
+        b->release();
+    }
+
+    std::vector<dbabstract::WorkloadEvent> events;
+    ASSERT_EQ(dbabstract::loadWorkload(path, events), true);
+    ASSERT_EQ(events.size(), 3u);
+    EXPECT_EQ(events[0].connection, 1u);
+    EXPECT_EQ(events[1].connection, 2u);
+    EXPECT_EQ(events[2].connection, 3u);
+    remove(path);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "dbabstract/db.h"
+#include "dbabstract/writebehind.h"
+
+#ifdef ENABLE_SQLITE3
+
+extern "C" {
+    extern dbabstract::Connection *create_sqlite3_connection(void);
+};
+
+static dbabstract::Connection *
+open_file(void)
+{
+    dbabstract::Connection *c = create_sqlite3_connection();
+    if (!c->open("writebehind.db", NULL, 0, NULL, NULL)) {
+        c->release();
+        return (NULL);
+    }
+    return (c);
+}
+
+class WriteBehindTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            unlink("writebehind.db");
+            connection = open_file();
+            EXPECT_EQ(connection->execute("CREATE TABLE testing (id INTEGER PRIMARY KEY AUTOINCREMENT, num INTEGER UNIQUE)"), true);
+        }
+
+        virtual void TearDown() {
+            connection->release();
+            unlink("writebehind.db");
+        }
+
+        int count(void) {
+            int n = -1;
+            dbabstract::ResultSet *rs = connection->executeQuery("SELECT COUNT(*) FROM testing");
+            if (rs) {
+                if (rs->next()) n = rs->getInteger(0);
+                rs->close();
+            }
+            return (n);
+        }
+
+        static std::string insert(int num) {
+            std::ostringstream ss;
+            ss << "INSERT INTO testing (num) VALUES (" << num << ")";
+            return (ss.str());
+        }
+
+        dbabstract::Connection * connection;
+};
+
+TEST_F(WriteBehindTest, ManyWritersShareCommits) {
+    dbabstract::WriteBehindQueue queue(open_file, 64);
+    std::atomic<int> durable(0);
+    std::vector<std::thread> threads;
+
+    for (int t=0; t<4; t++) {
+        threads.push_back(std::thread([&queue, &durable, t]() {
+            dbabstract::WriteBehindQueue::Callback done = [&durable](bool ok) { if (ok) durable++; };
+            for (int i=0; i<250; i++) {
+                EXPECT_EQ(queue.submit(insert(t * 1000 + i), done), true);
+            }
+        }));
+    }
+    for (size_t t=0; t<threads.size(); t++) {
+        threads[t].join();
+    }
+    queue.flush();
+
+    EXPECT_EQ(durable.load(), 1000);
+    EXPECT_EQ(queue.committed(), 1000u);
+    EXPECT_EQ(queue.pending(), 0u);
+    EXPECT_LT(queue.batches(), 1000u);
+    EXPECT_EQ(count(), 1000);
+}
+
+TEST_F(WriteBehindTest, BadStatementFailsAlone) {
+    dbabstract::WriteBehindQueue queue(open_file, 16, 16, 50);
+    std::vector<int> results(3, -1);
+
+    queue.submit(insert(1), [&results](bool ok) { results[0] = ok; });
+    queue.submit(insert(1), [&results](bool ok) { results[1] = ok; });
+    queue.submit(insert(2), [&results](bool ok) { results[2] = ok; });
+    queue.flush();
+
+    EXPECT_EQ(results[0], 1);
+    EXPECT_EQ(results[1], 0);
+    EXPECT_EQ(results[2], 1);
+    EXPECT_EQ(queue.failed(), 1u);
+    EXPECT_EQ(count(), 2);
+}
+
+TEST_F(WriteBehindTest, DropPolicyRejectsWhenFull) {
+    std::promise<void> opened;
+    std::promise<void> release;
+    std::shared_future<void> released(release.get_future());
+    std::future<void> writing = opened.get_future();
+
+    {
+        dbabstract::WriteBehindQueue queue([&opened, released]() {
+            opened.set_value();
+            released.wait();
+            return (open_file());
+        }, 4, 1, 0, dbabstract::WriteBehindQueue::DROP);
+
+        // the writer takes this one, then blocks opening its Connection
+        EXPECT_EQ(queue.submit(insert(0)), true);
+        writing.wait();
+
+        for (int i=1; i<=4; i++) {
+            EXPECT_EQ(queue.submit(insert(i)), true);
+        }
+        EXPECT_EQ(queue.submit(insert(5)), false);
+        EXPECT_EQ(queue.dropped(), 1u);
+        release.set_value();
+    }
+    EXPECT_EQ(count(), 5);
+}
+
+TEST_F(WriteBehindTest, DestructorWritesPending) {
+    {
+        dbabstract::WriteBehindQueue queue(open_file, 16, 4, 1000);
+        for (int i=0; i<10; i++) {
+            queue.submit(insert(i));
+        }
+    }
+    EXPECT_EQ(count(), 10);
+}
+
+#endif